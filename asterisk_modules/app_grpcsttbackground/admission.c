@@ -0,0 +1,351 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Admission control of STT sessions: per-endpoint concurrency limit with
+ * bounded wait queue, per-endpoint token bucket for session start rate and
+ * per-company concurrency quotas. All state is process-wide and protected by
+ * single mutex: decisions are made once per session start only.
+ *
+ * Queued sessions of endpoint are served in arrival order: session may take
+ * endpoint slot only when no earlier waiter could take it, waiters held back
+ * by their own company quota only do not block later ones. Endpoint entries
+ * are dropped once they have no sessions, no waiters and full token bucket,
+ * since endpoints may come from dialplan.
+ */
+
+#include "admission.h"
+
+#include <asterisk.h>
+#include <asterisk/lock.h>
+#include <asterisk/linkedlists.h>
+#include <asterisk/utils.h>
+
+#include <poll.h>
+#include <time.h>
+
+
+/* Queued sessions re-check terminate event and token bucket with this period */
+#define WAIT_SLICE_MSEC 50
+
+struct admission_waiter {
+	AST_LIST_ENTRY(admission_waiter) list;
+	int company_id;
+};
+struct admission_endpoint {
+	AST_LIST_ENTRY(admission_endpoint) list;
+	int active;
+	int waiting;
+	AST_LIST_HEAD_NOLOCK(, admission_waiter) waiters; /* in arrival order */
+	double tokens;
+	struct timespec refill_time;
+	char name[0];
+};
+struct admission_company {
+	AST_LIST_ENTRY(admission_company) list;
+	int company_id;
+	int active;
+};
+struct grpc_stt_admission_ticket {
+	struct admission_endpoint *endpoint;
+	struct admission_company *company;
+};
+
+static ast_mutex_t admission_mutex;
+static ast_cond_t admission_cond;
+static AST_LIST_HEAD_NOLOCK_STATIC(admission_endpoints, admission_endpoint);
+static AST_LIST_HEAD_NOLOCK_STATIC(admission_companies, admission_company);
+static struct grpc_stt_admission_conf admission_conf;
+static int admission_closed; /* set at unload: no more sessions are admitted */
+
+
+static double monotonic_seconds(const struct timespec *t)
+{
+	return t->tv_sec + t->tv_nsec/1000000000.0;
+}
+static int company_max_sessions(int company_id)
+{
+	int i;
+	for (i = 0; i < admission_conf.company_quota_count; ++i) {
+		if (admission_conf.company_quotas[i].company_id == company_id)
+			return admission_conf.company_quotas[i].max_sessions;
+	}
+	return admission_conf.company_max_sessions;
+}
+static int token_bucket_size(void)
+{
+	return admission_conf.burst > 0 ? admission_conf.burst : 1;
+}
+static struct admission_endpoint *find_endpoint(const char *name)
+{
+	struct admission_endpoint *endpoint;
+	AST_LIST_TRAVERSE(&admission_endpoints, endpoint, list) {
+		if (!strcmp(endpoint->name, name))
+			return endpoint;
+	}
+	endpoint = ast_calloc(1, sizeof(struct admission_endpoint) + strlen(name) + 1);
+	if (!endpoint)
+		return NULL;
+	strcpy(endpoint->name, name);
+	endpoint->tokens = token_bucket_size();
+	clock_gettime(CLOCK_MONOTONIC, &endpoint->refill_time);
+	AST_LIST_INSERT_TAIL(&admission_endpoints, endpoint, list);
+	return endpoint;
+}
+static struct admission_company *find_company(int company_id, int create)
+{
+	struct admission_company *company;
+	AST_LIST_TRAVERSE(&admission_companies, company, list) {
+		if (company->company_id == company_id)
+			return company;
+	}
+	if (!create)
+		return NULL;
+	company = ast_calloc(1, sizeof(struct admission_company));
+	if (!company)
+		return NULL;
+	company->company_id = company_id;
+	AST_LIST_INSERT_TAIL(&admission_companies, company, list);
+	return company;
+}
+static void release_company(struct admission_company *company)
+{
+	if (--company->active)
+		return;
+	AST_LIST_REMOVE(&admission_companies, company, list);
+	ast_free(company);
+}
+static void refill_tokens(struct admission_endpoint *endpoint)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	endpoint->tokens += (monotonic_seconds(&now) - monotonic_seconds(&endpoint->refill_time))*admission_conf.rate;
+	if (endpoint->tokens > token_bucket_size())
+		endpoint->tokens = token_bucket_size();
+	endpoint->refill_time = now;
+}
+static int company_quota_exhausted(int company_id)
+{
+	if (company_id < 0)
+		return 0;
+	int max_sessions = company_max_sessions(company_id);
+	struct admission_company *company = find_company(company_id, 0);
+	return max_sessions > 0 && company && company->active >= max_sessions;
+}
+/* Whether no waiter queued before given one (NULL: before newcomer) may take endpoint slot */
+static int is_next_in_queue(struct admission_endpoint *endpoint, struct admission_waiter *waiter)
+{
+	struct admission_waiter *earlier;
+	AST_LIST_TRAVERSE(&endpoint->waiters, earlier, list) {
+		if (earlier == waiter)
+			return 1;
+		if (!company_quota_exhausted(earlier->company_id))
+			return 0;
+	}
+	return 1;
+}
+/* Drops entries with no sessions and no waiters whose token bucket is full again */
+static void prune_endpoints(void)
+{
+	struct admission_endpoint *endpoint;
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&admission_endpoints, endpoint, list) {
+		if (endpoint->active || endpoint->waiting)
+			continue;
+		if (admission_conf.rate > 0.0) {
+			refill_tokens(endpoint);
+			if (endpoint->tokens < token_bucket_size())
+				continue;
+		}
+		AST_LIST_REMOVE_CURRENT(list);
+		ast_free(endpoint);
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+}
+/* Returns NULL if session is admitted, otherwise reason to be reported if limit persists */
+static const char *try_admit(struct admission_endpoint *endpoint, int company_id, struct grpc_stt_admission_ticket *ticket)
+{
+	struct admission_company *company = NULL;
+	if (company_id >= 0) {
+		int max_sessions = company_max_sessions(company_id);
+		company = find_company(company_id, 0);
+		if (max_sessions > 0 && company && company->active >= max_sessions)
+			return GRPC_STT_ADMISSION_COMPANY_QUOTA;
+	}
+	if (admission_conf.max_sessions > 0 && endpoint->active >= admission_conf.max_sessions)
+		return GRPC_STT_ADMISSION_QUEUE_TIMEOUT;
+	if (admission_conf.rate > 0.0) {
+		refill_tokens(endpoint);
+		if (endpoint->tokens < 1.0)
+			return GRPC_STT_ADMISSION_RATE_LIMITED;
+		endpoint->tokens -= 1.0;
+	}
+	if (company_id >= 0 && !company) {
+		/* Allocation failure just disables tenant accounting for this session */
+		company = find_company(company_id, 1);
+	}
+	if (company)
+		++company->active;
+	++endpoint->active;
+	ticket->endpoint = endpoint;
+	ticket->company = company;
+	return NULL;
+}
+static int is_terminated(int terminate_event_fd)
+{
+	struct pollfd pfd = {
+		.fd = terminate_event_fd,
+		.events = POLLIN,
+		.revents = 0,
+	};
+	return poll(&pfd, 1, 0) > 0;
+}
+
+void grpc_stt_admission_init(void)
+{
+	ast_mutex_init(&admission_mutex);
+	ast_cond_init(&admission_cond, NULL);
+	memset(&admission_conf, 0, sizeof(admission_conf));
+	admission_closed = 0;
+}
+int grpc_stt_admission_close(void)
+{
+	struct admission_endpoint *endpoint;
+	ast_mutex_lock(&admission_mutex);
+	AST_LIST_TRAVERSE(&admission_endpoints, endpoint, list) {
+		if (endpoint->active || endpoint->waiting) {
+			ast_mutex_unlock(&admission_mutex);
+			return -1;
+		}
+	}
+	admission_closed = 1;
+	ast_mutex_unlock(&admission_mutex);
+	return 0;
+}
+void grpc_stt_admission_destroy(void)
+{
+	struct admission_endpoint *endpoint;
+	struct admission_company *company;
+	ast_mutex_lock(&admission_mutex);
+	while ((endpoint = AST_LIST_REMOVE_HEAD(&admission_endpoints, list)))
+		ast_free(endpoint);
+	while ((company = AST_LIST_REMOVE_HEAD(&admission_companies, list)))
+		ast_free(company);
+	ast_free(admission_conf.company_quotas);
+	memset(&admission_conf, 0, sizeof(admission_conf));
+	ast_mutex_unlock(&admission_mutex);
+	ast_cond_destroy(&admission_cond);
+	ast_mutex_destroy(&admission_mutex);
+}
+int grpc_stt_admission_set_conf(const struct grpc_stt_admission_conf *conf)
+{
+	struct grpc_stt_company_quota *company_quotas = NULL;
+	if (conf->company_quota_count) {
+		company_quotas = ast_malloc(sizeof(struct grpc_stt_company_quota)*conf->company_quota_count);
+		if (!company_quotas)
+			return -1;
+		memcpy(company_quotas, conf->company_quotas, sizeof(struct grpc_stt_company_quota)*conf->company_quota_count);
+	}
+	ast_mutex_lock(&admission_mutex);
+	ast_free(admission_conf.company_quotas);
+	admission_conf = *conf;
+	admission_conf.company_quotas = company_quotas;
+	ast_cond_broadcast(&admission_cond);
+	ast_mutex_unlock(&admission_mutex);
+	return 0;
+}
+const char *grpc_stt_admission_acquire(const char *endpoint_name, int company_id, int terminate_event_fd,
+				       struct grpc_stt_admission_ticket **ticket_p)
+{
+	struct grpc_stt_admission_ticket *ticket = ast_calloc(1, sizeof(struct grpc_stt_admission_ticket));
+	if (!ticket)
+		return GRPC_STT_ADMISSION_CANCELLED;
+
+	ast_mutex_lock(&admission_mutex);
+	prune_endpoints();
+	struct admission_endpoint *endpoint = admission_closed ? NULL : find_endpoint(endpoint_name);
+	if (!endpoint) {
+		ast_mutex_unlock(&admission_mutex);
+		ast_free(ticket);
+		return GRPC_STT_ADMISSION_CANCELLED;
+	}
+
+	struct timespec start_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	struct admission_waiter waiter = {
+		.company_id = company_id,
+	};
+	int queued = 0;
+	const char *reason;
+	while (1) {
+		/* Earlier waiters are served first */
+		if (is_next_in_queue(endpoint, queued ? &waiter : NULL)) {
+			if (!(reason = try_admit(endpoint, company_id, ticket)))
+				break;
+		} else {
+			reason = GRPC_STT_ADMISSION_QUEUE_TIMEOUT;
+		}
+		if (!queued) {
+			if (endpoint->waiting >= admission_conf.max_queue) {
+				if (!strcmp(reason, GRPC_STT_ADMISSION_QUEUE_TIMEOUT))
+					reason = GRPC_STT_ADMISSION_QUEUE_FULL;
+				break;
+			}
+			AST_LIST_INSERT_TAIL(&endpoint->waiters, &waiter, list);
+			++endpoint->waiting;
+			queued = 1;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (monotonic_seconds(&now) - monotonic_seconds(&start_time) >= admission_conf.queue_timeout)
+			break;
+		if (is_terminated(terminate_event_fd)) {
+			reason = GRPC_STT_ADMISSION_CANCELLED;
+			break;
+		}
+		struct timespec wakeup_time;
+		clock_gettime(CLOCK_REALTIME, &wakeup_time);
+		wakeup_time.tv_nsec += WAIT_SLICE_MSEC*1000000;
+		if (wakeup_time.tv_nsec >= 1000000000) {
+			wakeup_time.tv_nsec -= 1000000000;
+			++wakeup_time.tv_sec;
+		}
+		ast_cond_timedwait(&admission_cond, &admission_mutex, &wakeup_time);
+	}
+	if (queued) {
+		AST_LIST_REMOVE(&endpoint->waiters, &waiter, list);
+		--endpoint->waiting;
+		/* Next waiter may be eligible now */
+		ast_cond_broadcast(&admission_cond);
+	}
+	ast_mutex_unlock(&admission_mutex);
+
+	if (reason) {
+		ast_free(ticket);
+		return reason;
+	}
+	*ticket_p = ticket;
+	return NULL;
+}
+void grpc_stt_admission_release(struct grpc_stt_admission_ticket *ticket)
+{
+	ast_mutex_lock(&admission_mutex);
+	--ticket->endpoint->active;
+	if (ticket->company)
+		release_company(ticket->company);
+	prune_endpoints();
+	ast_cond_broadcast(&admission_cond);
+	ast_mutex_unlock(&admission_mutex);
+	ast_free(ticket);
+}
@@ -0,0 +1,60 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_ADMISSION_H
+#define GRPC_STT_ADMISSION_H
+
+/* Rejection reasons reported at "SpeechSession" event */
+#define GRPC_STT_ADMISSION_QUEUE_FULL "QUEUE_FULL"
+#define GRPC_STT_ADMISSION_QUEUE_TIMEOUT "QUEUE_TIMEOUT"
+#define GRPC_STT_ADMISSION_RATE_LIMITED "RATE_LIMITED"
+#define GRPC_STT_ADMISSION_COMPANY_QUOTA "COMPANY_QUOTA"
+#define GRPC_STT_ADMISSION_CANCELLED "CANCELLED"
+
+struct grpc_stt_company_quota {
+	int company_id;
+	int max_sessions;
+};
+
+struct grpc_stt_admission_conf {
+	int max_sessions;             /* Per endpoint; 0 - unlimited */
+	int max_queue;                /* Per endpoint waiting sessions; 0 - reject immediately */
+	double queue_timeout;         /* Seconds */
+	double rate;                  /* Session starts per second per endpoint; 0 - unlimited */
+	int burst;                    /* Token bucket size */
+	int company_max_sessions;     /* Per company_id; 0 - unlimited */
+	struct grpc_stt_company_quota *company_quotas; /* Per company_id overrides of company_max_sessions */
+	int company_quota_count;
+};
+
+struct grpc_stt_admission_ticket;
+
+extern void grpc_stt_admission_init(void);
+/* Returns -1 while sessions are admitted or queued; otherwise rejects all further sessions
+   (with CANCELLED reason) and returns 0, so that state may be destroyed */
+extern int grpc_stt_admission_close(void);
+extern void grpc_stt_admission_destroy(void);
+
+/* Replaces active limits; conf is copied. Sessions already admitted are kept. */
+extern int grpc_stt_admission_set_conf(const struct grpc_stt_admission_conf *conf);
+
+/* Blocks until session may start, limits can't be satisfied in time or terminate_event_fd
+   is signaled. Returns NULL and sets *ticket on success, otherwise rejection reason.
+   company_id < 0 means no tenant quota is applied. */
+extern const char *grpc_stt_admission_acquire(const char *endpoint, int company_id, int terminate_event_fd,
+					      struct grpc_stt_admission_ticket **ticket);
+extern void grpc_stt_admission_release(struct grpc_stt_admission_ticket *ticket);
+
+#endif
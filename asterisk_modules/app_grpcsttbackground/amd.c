@@ -0,0 +1,273 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Answering machine pre-classifier: energy-based voice/silence segmentation
+ * of channel read frames with greeting cadence rules (initial silence,
+ * greeting length, word count, silence after greeting). Runs in framehook
+ * with channel locked; decision is read by session threads atomically.
+ */
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include "amd.h"
+
+#include <asterisk.h>
+#include <asterisk/channel.h>
+#include <asterisk/framehook.h>
+#include <asterisk/format_cache.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/alaw.h>
+#include <asterisk/ulaw.h>
+#include <asterisk/json.h>
+#include <asterisk/stasis_channels.h>
+#include <asterisk/utils.h>
+
+#include <stdlib.h>
+
+
+#define SAMPLE_RATE 8000
+
+const struct grpc_stt_amd_conf grpc_stt_amd_dflt_conf = {
+	.initial_silence = 2500,
+	.greeting = 1500,
+	.after_greeting_silence = 800,
+	.total_analysis_time = 5000,
+	.min_word_length = 100,
+	.between_words_silence = 50,
+	.maximum_number_of_words = 3,
+	.silence_threshold = 256,
+};
+
+struct grpc_stt_amd {
+	struct grpc_stt_amd_conf conf;
+	int framehook_id;
+	/* Classifier state: framehook only */
+	int total_ms;
+	int silence_ms;
+	int voice_ms;
+	int greeting_ms; /* since first word; -1 before it */
+	int words;
+	int in_word;
+	/* Decision: written once by framehook, read by session threads */
+	int decision;
+	double confidence;
+};
+
+
+int grpc_stt_frame_average_amplitude(struct ast_frame *f)
+{
+	size_t sample_count = f->samples;
+	if (!sample_count)
+		return 0;
+	int64_t sum = 0;
+	if (f->subclass.format == ast_format_alaw) {
+		uint8_t *sptr = f->data.ptr;
+		for (size_t i = 0; i < sample_count; ++i)
+			sum += abs(AST_ALAW(sptr[i]));
+	} else if (f->subclass.format == ast_format_ulaw) {
+		uint8_t *sptr = f->data.ptr;
+		for (size_t i = 0; i < sample_count; ++i)
+			sum += abs(AST_MULAW(sptr[i]));
+	} else if (f->subclass.format == ast_format_slin) {
+		int16_t *sptr = f->data.ptr;
+		for (size_t i = 0; i < sample_count; ++i)
+			sum += abs(sptr[i]);
+	} else {
+		return -1;
+	}
+	return sum/sample_count;
+}
+
+static void publish_decision(struct ast_channel *chan, struct grpc_stt_amd *amd, const char *reason)
+{
+	char body[256];
+	snprintf(body, sizeof(body), "{\"decision\": \"%s\", \"reason\": \"%s\", \"confidence\": %.2f, \"elapsed\": %d}",
+		 grpc_stt_amd_decision_name(amd->decision), reason, amd->confidence, amd->total_ms);
+	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", "AnsweringMachine", "eventbody", body);
+	if (!blob)
+		return;
+	ast_multi_object_blob_single_channel_publish(chan, ast_multi_user_event_type(), blob);
+	ast_json_unref(blob);
+}
+static void decide(struct ast_channel *chan, struct grpc_stt_amd *amd, enum grpc_stt_amd_decision decision, double confidence, const char *reason)
+{
+	amd->confidence = confidence;
+	__atomic_store_n(&amd->decision, decision, __ATOMIC_RELEASE);
+	publish_decision(chan, amd, reason);
+}
+static void classify_frame(struct ast_channel *chan, struct grpc_stt_amd *amd, struct ast_frame *f)
+{
+	int amplitude = grpc_stt_frame_average_amplitude(f);
+	if (amplitude < 0)
+		return;
+	int duration_ms = f->samples*1000/SAMPLE_RATE;
+	const struct grpc_stt_amd_conf *conf = &amd->conf;
+
+	amd->total_ms += duration_ms;
+	if (amd->greeting_ms >= 0)
+		amd->greeting_ms += duration_ms;
+
+	if (amplitude < conf->silence_threshold) {
+		amd->silence_ms += duration_ms;
+		if (amd->in_word && amd->silence_ms >= conf->between_words_silence) {
+			amd->in_word = 0;
+			amd->voice_ms = 0;
+		}
+		if (amd->greeting_ms < 0 && amd->silence_ms >= conf->initial_silence) {
+			decide(chan, amd, GRPC_STT_AMD_MACHINE, 0.6, "LONGINITIALSILENCE");
+			return;
+		}
+		if (amd->words && amd->silence_ms >= conf->after_greeting_silence) {
+			/* The shorter greeting the more likely it is "Hello?" of a person */
+			double confidence = (amd->greeting_ms - amd->silence_ms) <= conf->greeting/2 ? 0.9 : 0.7;
+			decide(chan, amd, GRPC_STT_AMD_HUMAN, confidence, "HUMAN");
+			return;
+		}
+	} else {
+		amd->silence_ms = 0;
+		amd->voice_ms += duration_ms;
+		if (!amd->in_word && amd->voice_ms >= conf->min_word_length) {
+			amd->in_word = 1;
+			++amd->words;
+			if (amd->greeting_ms < 0)
+				amd->greeting_ms = amd->voice_ms;
+			if (amd->words >= conf->maximum_number_of_words) {
+				decide(chan, amd, GRPC_STT_AMD_MACHINE, 0.85, "MAXWORDS");
+				return;
+			}
+		}
+		if (amd->greeting_ms >= conf->greeting) {
+			decide(chan, amd, GRPC_STT_AMD_MACHINE, 0.9, "LONGGREETING");
+			return;
+		}
+	}
+
+	if (amd->total_ms >= conf->total_analysis_time)
+		decide(chan, amd, GRPC_STT_AMD_NOTSURE, 0.0, "TOOLONG");
+}
+
+static struct ast_frame *framehook_event_callback(struct ast_channel *chan, struct ast_frame *frame, enum ast_framehook_event event, void *data)
+{
+	struct grpc_stt_amd *amd = data;
+	if (frame && event == AST_FRAMEHOOK_EVENT_READ && frame->frametype == AST_FRAME_VOICE &&
+	    __atomic_load_n(&amd->decision, __ATOMIC_RELAXED) == GRPC_STT_AMD_UNDECIDED)
+		classify_frame(chan, amd, frame);
+	return frame;
+}
+static int framehook_consume_callback(void *data, enum ast_frame_type type)
+{
+	return 0;
+}
+static void framehook_destroy_callback(void *data)
+{
+	ao2_ref(data, -1);
+}
+
+static void destroy_amd_datastore(void *data)
+{
+	ao2_ref(data, -1);
+}
+static const struct ast_datastore_info amd_ds_info = {
+	.type = "grpcsttamd",
+	.destroy = destroy_amd_datastore,
+};
+
+static void remove_unlocked(struct ast_channel *chan)
+{
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &amd_ds_info, NULL);
+	if (!datastore)
+		return;
+	struct grpc_stt_amd *amd = datastore->data;
+	if (amd->framehook_id != -1)
+		ast_framehook_detach(chan, amd->framehook_id);
+	ast_channel_datastore_remove(chan, datastore);
+	ast_datastore_free(datastore);
+}
+
+
+int grpc_stt_amd_start(struct ast_channel *chan, const struct grpc_stt_amd_conf *conf)
+{
+	struct grpc_stt_amd *amd = ao2_alloc_options(sizeof(struct grpc_stt_amd), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!amd)
+		return -1;
+	amd->conf = *conf;
+	amd->framehook_id = -1;
+	amd->total_ms = 0;
+	amd->silence_ms = 0;
+	amd->voice_ms = 0;
+	amd->greeting_ms = -1;
+	amd->words = 0;
+	amd->in_word = 0;
+	amd->decision = GRPC_STT_AMD_UNDECIDED;
+	amd->confidence = 0.0;
+
+	struct ast_datastore *datastore = ast_datastore_alloc(&amd_ds_info, NULL);
+	if (!datastore) {
+		ao2_ref(amd, -1);
+		return -1;
+	}
+	datastore->data = amd;
+
+	struct ast_framehook_interface interface = {
+		.version = AST_FRAMEHOOK_INTERFACE_VERSION,
+		.event_cb = framehook_event_callback,
+		.consume_cb = framehook_consume_callback,
+		.destroy_cb = framehook_destroy_callback,
+		.data = ao2_bump(amd),
+	};
+	ast_channel_lock(chan);
+	remove_unlocked(chan);
+	amd->framehook_id = ast_framehook_attach(chan, &interface);
+	if (amd->framehook_id == -1) {
+		ast_channel_unlock(chan);
+		ao2_ref(amd, -1);
+		ast_datastore_free(datastore);
+		return -1;
+	}
+	ast_channel_datastore_add(chan, datastore);
+	ast_channel_unlock(chan);
+	return 0;
+}
+struct grpc_stt_amd *grpc_stt_amd_find(struct ast_channel *chan)
+{
+	struct grpc_stt_amd *amd = NULL;
+	ast_channel_lock(chan);
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &amd_ds_info, NULL);
+	if (datastore)
+		amd = ao2_bump((struct grpc_stt_amd *) datastore->data);
+	ast_channel_unlock(chan);
+	return amd;
+}
+enum grpc_stt_amd_decision grpc_stt_amd_decision(struct grpc_stt_amd *amd, double *confidence)
+{
+	enum grpc_stt_amd_decision decision = __atomic_load_n(&amd->decision, __ATOMIC_ACQUIRE);
+	*confidence = decision == GRPC_STT_AMD_UNDECIDED ? 0.0 : amd->confidence;
+	return decision;
+}
+const char *grpc_stt_amd_decision_name(enum grpc_stt_amd_decision decision)
+{
+	switch (decision) {
+	case GRPC_STT_AMD_HUMAN:
+		return "HUMAN";
+	case GRPC_STT_AMD_MACHINE:
+		return "MACHINE";
+	case GRPC_STT_AMD_NOTSURE:
+		return "NOTSURE";
+	default:
+		return "UNDECIDED";
+	}
+}
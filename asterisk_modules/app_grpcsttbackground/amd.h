@@ -0,0 +1,59 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_AMD_H
+#define GRPC_STT_AMD_H
+
+struct ast_channel;
+struct ast_frame;
+
+enum grpc_stt_amd_decision {
+	GRPC_STT_AMD_UNDECIDED = 0,
+	GRPC_STT_AMD_HUMAN = 1,
+	GRPC_STT_AMD_MACHINE = 2,
+	GRPC_STT_AMD_NOTSURE = 3,
+};
+
+struct grpc_stt_amd_conf {
+	int initial_silence;          /* Milliseconds of silence before any speech: MACHINE */
+	int greeting;                 /* Milliseconds of speech since its start: MACHINE */
+	int after_greeting_silence;   /* Milliseconds of silence after short greeting: HUMAN */
+	int total_analysis_time;      /* Milliseconds without decision: NOTSURE */
+	int min_word_length;          /* Milliseconds of voice counted as word */
+	int between_words_silence;    /* Milliseconds of silence ending word */
+	int maximum_number_of_words;  /* Words in greeting: MACHINE */
+	int silence_threshold;        /* Average absolute SLINEAR amplitude below which frame is silence */
+};
+
+extern const struct grpc_stt_amd_conf grpc_stt_amd_dflt_conf;
+
+/* Returns average absolute SLINEAR amplitude of alaw, ulaw or slin frame, -1 for other formats */
+extern int grpc_stt_frame_average_amplitude(struct ast_frame *f);
+
+struct grpc_stt_amd;
+
+/* Starts classification of channel read audio (replacing one already running).
+   Decision is published as "AnsweringMachine" user event. Returns 0 on success. */
+extern int grpc_stt_amd_start(struct ast_channel *chan, const struct grpc_stt_amd_conf *conf);
+
+/* Returns new reference to classifier running at channel or NULL */
+extern struct grpc_stt_amd *grpc_stt_amd_find(struct ast_channel *chan);
+
+/* Returns current decision and its confidence (0.0 - 1.0) */
+extern enum grpc_stt_amd_decision grpc_stt_amd_decision(struct grpc_stt_amd *amd, double *confidence);
+
+extern const char *grpc_stt_amd_decision_name(enum grpc_stt_amd_decision decision);
+
+#endif
@@ -27,8 +27,11 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 #define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
 
 #include "grpc_stt.h"
-
-#include <grpc/grpc.h>
+#include "admission.h"
+#include "voicekit_grpc.h"
+#include "preroll.h"
+#include "amd.h"
+#include "endpointer.h"
 
 #include <asterisk.h>
 #include <asterisk/pbx.h>
@@ -36,14 +39,17 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 #include <asterisk/module.h>
 #include <asterisk/manager.h>
 #include <asterisk/utils.h>
+#include <asterisk/strings.h>
 #include <asterisk/astobj2.h>
 #include <asterisk/dlinkedlists.h>
 #include <asterisk/format_cache.h>
 #include <asterisk/paths.h>
 #include <asterisk/alaw.h>
+#include <asterisk/cli.h>
 
 #include <sys/eventfd.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <math.h>
 
@@ -55,9 +61,15 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 		<syntax>
 			<parameter name="endpoint" required="true">
 				<para>Specifies service endpoint with HOST:PORT format</para>
+				<para>Endpoint with &quot;unix:PATH&quot; format connects to gRPC service listening at Unix domain socket PATH (usually without TLS, see &quot;s&quot; option)</para>
+				<para>Endpoint with &quot;shm:SOCKET_PATH&quot; format selects shared-memory transport to co-located recognizer listening at Unix socket SOCKET_PATH: audio is passed through per-session shared memory ring and TLS, authorization and gRPC framing are not used</para>
+				<para>Value with &quot;profile=NAME&quot; format selects [profile-NAME] section of grpcstt.conf: its endpoint (or default one) and recognition settings are used</para>
 			</parameter>
 			<parameter name="options">
 				<optionlist>
+					<option name="s">
+						<para>Do not use TLS credentials</para>
+					</option>
 					<option name="S">
 						<para>Use TLS credentials</para>
 					</option>
@@ -67,6 +79,57 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 					<option name="G">
 						<para>Enable gender identification to response</para>
 					</option>
+					<option name="P">
+						<para>Persistent session: session stays open until GRPCSTTBackgroundFinish() or hangup and later GRPCSTTBackground() calls with same endpoint and credentials reuse it</para>
+					</option>
+					<option name="p">
+						<para>Not persistent session: each GRPCSTTBackground() call opens new session</para>
+					</option>
+					<option name="R">
+						<para>Prepend audio buffered by GRPCSTTPreroll() to recognition stream</para>
+					</option>
+					<option name="r">
+						<para>Do not prepend pre-roll audio</para>
+					</option>
+					<option name="M">
+						<para>Wait for GRPCSTTAMD() decision before starting session and skip session if call is answered by machine with confidence of at least [amd] skip_confidence</para>
+					</option>
+					<option name="m">
+						<para>Start session without waiting for answering machine decision</para>
+					</option>
+					<option name="B">
+						<para>Detect voicemail beep tones at captured audio (see [beep] section of grpcstt.conf)</para>
+					</option>
+					<option name="b">
+						<para>Do not detect voicemail beep tones</para>
+					</option>
+					<option name="L">
+						<para>Add per-stage latency timestamps to event bodies</para>
+					</option>
+					<option name="l">
+						<para>Do not add latency timestamps</para>
+					</option>
+					<option name="E">
+						<para>Report stable interim hypotheses as early finals (see [early_final] section of grpcstt.conf)</para>
+					</option>
+					<option name="e">
+						<para>Do not report early finals</para>
+					</option>
+					<option name="U">
+						<argument name="hangover" required="false">
+							<para>Milliseconds of silence ending utterance (overrides [endpointing] hangover)</para>
+						</argument>
+						<para>Client-side endpointing: half-close recognition stream once caller stops talking and finish session after final result; persistent session opens next stream instead (see [endpointing] section of grpcstt.conf)</para>
+					</option>
+					<option name="u">
+						<para>Do not detect end of utterance locally</para>
+					</option>
+					<option name="H">
+						<para>Pause sending audio while PlayBackground() plays at channel or call is on hold</para>
+					</option>
+					<option name="h">
+						<para>Do not pause sending audio automatically</para>
+					</option>
 				</optionlist>
 			</parameter>
 			<parameter name="language_code">
@@ -80,7 +143,8 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 				<para>Specifies maximum number of alternatives</para>
 			</parameter>
 			<parameter name="ca_file">
-				<para>Specifies maximum number of alternatives</para>
+				<para>Specifies CA file relative to configuration directory</para>
+				<para>TLS credentials are built once per CA file and shared by all sessions until the file changes on disk</para>
 			</parameter>
 		</syntax>
 		<description>
@@ -91,6 +155,19 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 			<para><emphasis>At receiving heading metafields of STT session &quot;GRPCSTT_X_REQUEST_ID(X_REQUEST_ID)&quot; event is generated.</emphasis></para>
 			<para><emphasis>At receiving STT recognition hypothesis &quot;GRPCSTTASCII(JSON)&quot; and &quot;GRPCSTTUTF8(JSON)&quot; events are generated.</emphasis></para>
 			<para><emphasis>At session close an &quot;GRPCSTT_SESSION_FINISHED(STATUS,ERROR_CODE,ERROR_MESSAGE)&quot; event is generated.</emphasis></para>
+			<para>Session start is subject to admission control configured at [admission] and [company_quotas] sections of grpcstt.conf: per-endpoint concurrency limit with bounded wait queue, per-endpoint start rate limit and per-company concurrency quotas (company is taken from &quot;company_id&quot; key of &quot;ai_voicemail&quot; channel variable).</para>
+			<para>Persistent session (&quot;P&quot; option or &quot;persistent&quot; setting of grpcstt.conf) lives for the whole call: following GRPCSTTBackground() call keeps session as is if configuration is unchanged and replaces only recognition stream (without gaps in captured audio) if recognition settings differ. Logical parts of the call are marked with GRPCSTTSegment().</para>
+			<para>Voicemail beep detected with &quot;B&quot; option is reported as soon as tone lasts for [beep] min_duration with &quot;VoicemailBeep&quot; event with body {&quot;frequency&quot;: HZ, &quot;start_time&quot;: SECONDS, &quot;detect_time&quot;: SECONDS} where times are UNIX timestamps with millisecond precision.</para>
+			<para>With &quot;L&quot; option (or &quot;latency_timestamps&quot; setting of grpcstt.conf) event bodies get &quot;timestamps&quot; object mapping stage names to {&quot;monotonic&quot;: SECONDS, &quot;realtime&quot;: SECONDS} taken from the same clocks as GET_TIME_NSEC(MONOTONIC) and GET_TIME_NSEC(UTC). &quot;SpeechRecognition&quot; stages are &quot;audio_captured&quot; and &quot;audio_written&quot; (last audio frame contributing to result by its end time), &quot;response_received&quot; and &quot;event_published&quot;. &quot;SpeechSession&quot; stages are &quot;session_started&quot;, &quot;session_finished&quot; and &quot;event_published&quot;. &quot;SpeechRequest&quot; body becomes JSON {&quot;x_request_id&quot;: X_REQUEST_ID, &quot;timestamps&quot;: ...} with &quot;stream_opened&quot;, &quot;config_written&quot;, &quot;request_id_received&quot; and &quot;event_published&quot; stages.</para>
+			<para>With &quot;E&quot; option (or &quot;enable&quot; setting of [early_final] section of grpcstt.conf) interim hypothesis which top transcript stays unchanged (ignoring case and whitespace) for at least [early_final] min_interims consecutive interim results and min_stable_time milliseconds is additionally reported once per utterance with &quot;SpeechEarlyFinal&quot; event with the same body as &quot;SpeechRecognition&quot; one. Real final result follows as usual and its body gets &quot;early_final_differs&quot; boolean telling whether its top transcript differs from early final one. Interim results must be enabled.</para>
+			<para>With &quot;U&quot; option (or &quot;enable&quot; setting of [endpointing] section of grpcstt.conf) end of utterance is detected locally: once at least [endpointing] min_speech milliseconds of voice are followed by hangover milliseconds of silence (audio below silence_threshold or missing audio), recognition stream is half-closed (no more audio or gap-filling silence is sent) and final result is awaited right away. Stream is opened with single_utterance flag set. Session finishes with &quot;SpeechSession&quot; event after its final result, so end-of-speech-to-final latency is bounded by hangover plus round trip instead of server VAD timeout. Persistent session is not finished: after final result of each utterance next recognition stream is opened (audio captured meanwhile is sent to it, endpointing restarts) until session is terminated or call is hung up.</para>
+			<para>Stream setup (connection and service response headers carrying request id) is bounded by [failfast] setup_timeout milliseconds of grpcstt.conf: session failing to set up in time finishes with &quot;DEADLINE_EXCEEDED&quot; error code. With [failfast] breaker enabled, setup failures feed circuit breaker of endpoint shared with other sessions (see &quot;voicekit show breakers&quot; CLI command of res_voicekit_grpc module): while it is open sessions are rejected at once, so dialplan can fall back without waiting.</para>
+			<para>With [capture] dir of grpcstt.conf set, audio frames and segment/pause markers queued to stream writer are recorded with arrival times into file UNIQUEID-MILLISECONDS.sttcap at that directory. Recording is replayed offline through the same writer pacing with &quot;stt_replay&quot; tool (&quot;make stt_replay&quot;) to compare CPU time, request count and inserted silence between versions.</para>
+			<para>Recognition profiles ([profile-NAME] sections of grpcstt.conf) are compiled into streaming configs at configuration load: session started with &quot;profile=NAME&quot; copies compiled config and fills per-call fields (channel exten, company, campaign, application and statistic ids, request UUID) only. Recognition settings overridden by arguments or options (e.g. language code) make session build its config field by field as usual.</para>
+			<para>Sending audio of running session may be paused with GRPCSTTBackgroundPause() and resumed with GRPCSTTBackgroundResume(). With &quot;H&quot; option (or &quot;auto_pause&quot; setting of grpcstt.conf) it is also paused while PlayBackground() layers play at the same channel (and 300 milliseconds after to skip echo tail) and while call is on hold. Paused session keeps its recognition stream and timeline: audio captured while paused is dropped (not gap-filled), and 10 milliseconds of silence are sent once per second to keep the stream alive, so result times include paused intervals.</para>
+			<para>&quot;SpeechSession&quot; event of session that was run carries &quot;usage&quot; object {&quot;cpu_ms&quot;: MS, &quot;cpu_ms_per_second&quot;: MS, &quot;duration&quot;: SECONDS, &quot;peak_queue_bytes&quot;: BYTES}: CPU time used by session threads (gRPC core threads are shared and not included) and peak size of audio captured but not yet written to stream. Running sessions are listed by &quot;voicekit show sessions&quot; CLI command of res_voicekit_grpc module.</para>
+			<para>Session skipped due to answering machine decision (&quot;M&quot; option) is reported with &quot;SpeechSession&quot; event with body {&quot;status&quot;: &quot;SKIPPED&quot;, &quot;reason&quot;: &quot;ANSWERING_MACHINE&quot;}.</para>
+			<para>Session not admitted is reported with &quot;SpeechSession&quot; event with body {&quot;status&quot;: &quot;REJECTED&quot;, &quot;reason&quot;: REASON} where REASON is one of &quot;QUEUE_FULL&quot;, &quot;QUEUE_TIMEOUT&quot;, &quot;RATE_LIMITED&quot;, &quot;COMPANY_QUOTA&quot;, &quot;CIRCUIT_OPEN&quot; (circuit breaker of endpoint is open, see [failfast] section of grpcstt.conf) or &quot;CANCELLED&quot; (session finished while queued). Session rejected by STT service with RESOURCE_EXHAUSTED status is reported the same way with &quot;RESOURCE_EXHAUSTED&quot; reason.</para>
 			<example title="Start streaming to STT at domain.org:300 with TLS and A-Law sample format">
 			 GRPCSTTBackground(domain.org:300,S,,alaw);
 			</example>
@@ -113,6 +190,123 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 			<ref type="application">WaitEvent</ref>
 			<ref type="application">WaitEventInit</ref>
 			<ref type="application">PlayBackground</ref>
+			<ref type="application">GRPCSTTBackgroundPrepare</ref>
+			<ref type="application">GRPCSTTSegment</ref>
+			<ref type="application">GRPCSTTBackgroundPause</ref>
+			<ref type="application">GRPCSTTBackgroundResume</ref>
+			<ref type="application">GRPCSTTPreroll</ref>
+			<ref type="application">GRPCSTTAMD</ref>
+			<ref type="application">GRPCSTTBackgroundFinish</ref>
+		</see-also>
+	</application>
+	<application name="GRPCSTTAMD" language="en_US">
+		<synopsis>
+			Detect answering machine locally.
+		</synopsis>
+		<description>
+			<para>This application starts CPU-cheap classification of incoming channel audio by greeting cadence (initial silence, greeting length, number of words and silence after greeting) configured at [amd] section of grpcstt.conf. It returns immediately; classification runs in background.</para>
+			<para>Decision is reported with &quot;AnsweringMachine&quot; event with body {&quot;decision&quot;: DECISION, &quot;reason&quot;: REASON, &quot;confidence&quot;: CONFIDENCE, &quot;elapsed&quot;: MILLISECONDS} where DECISION is one of &quot;HUMAN&quot;, &quot;MACHINE&quot; or &quot;NOTSURE&quot; and REASON is one of &quot;HUMAN&quot;, &quot;LONGINITIALSILENCE&quot;, &quot;LONGGREETING&quot;, &quot;MAXWORDS&quot; or &quot;TOOLONG&quot;.</para>
+			<para>GRPCSTTBackground() with &quot;M&quot; option waits for decision and does not start recognition for answering machines.</para>
+			<example title="Classify answered call and recognize humans only">
+			 WaitEventInit();
+			 GRPCSTTAMD();
+			 GRPCSTTPreroll(3000);
+			 GRPCSTTBackground(,MR);
+			</example>
+		</description>
+		<see-also>
+			<ref type="application">GRPCSTTBackground</ref>
+			<ref type="application">WaitEvent</ref>
+		</see-also>
+	</application>
+	<application name="GRPCSTTPreroll" language="en_US">
+		<synopsis>
+			Keep recent channel audio for speech recognition sessions.
+		</synopsis>
+		<syntax>
+			<parameter name="duration">
+				<para>Specifies pre-roll duration in milliseconds (default 500, maximum 10000); 0 removes pre-roll buffer</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>This application installs lightweight framehook keeping last <replaceable>duration</replaceable> milliseconds of incoming channel audio in fixed ring buffer. It is intended to be called once per call (e.g. next to WaitEventInit() after answer).</para>
+			<para>Session started by GRPCSTTBackground() with &quot;R&quot; option (or &quot;preroll&quot; setting of grpcstt.conf) sends buffered audio ahead of live audio, so speech started before session start (or during session connection) is not lost.</para>
+		</description>
+		<see-also>
+			<ref type="application">GRPCSTTBackground</ref>
+			<ref type="application">WaitEventInit</ref>
+		</see-also>
+	</application>
+	<application name="GRPCSTTSegment" language="en_US">
+		<synopsis>
+			Mark start of recognition segment.
+		</synopsis>
+		<syntax>
+			<parameter name="name" required="true">
+				<para>Specifies segment name</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>This application marks start of named segment at audio of recognition session running at channel.</para>
+			<para>Recognition results of audio captured after marker (by result start time) get &quot;segment&quot; field with segment name.</para>
+			<example title="Tag answers of IVR questions within single persistent session">
+			 GRPCSTTBackground(,P);
+			 GRPCSTTSegment(question1);
+			 Playback(question1);
+			 GRPCSTTSegment(question2);
+			 Playback(question2);
+			</example>
+		</description>
+		<see-also>
+			<ref type="application">GRPCSTTBackground</ref>
+		</see-also>
+	</application>
+	<application name="GRPCSTTBackgroundPause" language="en_US">
+		<synopsis>
+			Pause sending audio to speech recognition.
+		</synopsis>
+		<description>
+			<para>This application stops sending audio captured after the call to recognition session running at channel (e.g. during prompt or hold) while keeping recognition stream open.</para>
+			<para>Pause called before session start (e.g. for session prepared by GRPCSTTBackgroundPrepare()) is applied once session runs.</para>
+			<example title="Do not recognize caller while prompt is played">
+			 GRPCSTTBackground(,P);
+			 GRPCSTTBackgroundPause();
+			 Playback(greeting);
+			 GRPCSTTBackgroundResume();
+			</example>
+		</description>
+		<see-also>
+			<ref type="application">GRPCSTTBackground</ref>
+			<ref type="application">GRPCSTTBackgroundResume</ref>
+		</see-also>
+	</application>
+	<application name="GRPCSTTBackgroundResume" language="en_US">
+		<synopsis>
+			Resume sending audio to speech recognition.
+		</synopsis>
+		<description>
+			<para>This application resumes sending audio paused by GRPCSTTBackgroundPause() at recognition session running at channel.</para>
+			<para>Automatic pause of &quot;H&quot; option of GRPCSTTBackground() is not affected.</para>
+		</description>
+		<see-also>
+			<ref type="application">GRPCSTTBackground</ref>
+			<ref type="application">GRPCSTTBackgroundPause</ref>
+		</see-also>
+	</application>
+	<application name="GRPCSTTBackgroundPrepare" language="en_US">
+		<synopsis>
+			Open speech recognition session in advance.
+		</synopsis>
+		<syntax>
+			<xi:include xpointer="xpointer(/docs/application[@name='GRPCSTTBackground']/syntax/parameter)" />
+		</syntax>
+		<description>
+			<para>This application takes same arguments as GRPCSTTBackground() and performs admission, connection, authorization and streaming configuration of recognition session (e.g. while channel is still ringing) without sending any audio.</para>
+			<para>Subsequent GRPCSTTBackground() call on same channel starts streaming through prepared session ignoring its own arguments, so first audio frames are not delayed by session setup.</para>
+			<para>Prepared session which is not started within [prepare] max_wait seconds of grpcstt.conf is abandoned and finished with &quot;DEADLINE_EXCEEDED&quot; error code; GRPCSTTBackground() then opens new session.</para>
+		</description>
+		<see-also>
+			<ref type="application">GRPCSTTBackground</ref>
 			<ref type="application">GRPCSTTBackgroundFinish</ref>
 		</see-also>
 	</application>
@@ -130,6 +324,12 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 	</application>
  ***/
 static const char app[] = "GRPCSTTBackground";
+static const char app_prepare[] = "GRPCSTTBackgroundPrepare";
+static const char app_segment[] = "GRPCSTTSegment";
+static const char app_pause[] = "GRPCSTTBackgroundPause";
+static const char app_resume[] = "GRPCSTTBackgroundResume";
+static const char app_preroll[] = "GRPCSTTPreroll";
+static const char app_amd[] = "GRPCSTTAMD";
 static const char app_finish[] = "GRPCSTTBackgroundFinish";
 
 enum grpcsttbackground_flags {
@@ -137,6 +337,28 @@ enum grpcsttbackground_flags {
 	GRPCSTTBACKGROUND_FLAG_SSL_GRPC = (1 << 2),
 	GRPCSTTBACKGROUND_FLAG_GENDER_IDENTIFICATION_GRPC = (1 << 3),
 	GRPCSTTBACKGROUND_FLAG_OFF_GENDER_IDENTIFICATION_GRPC = (1 << 4),
+	GRPCSTTBACKGROUND_FLAG_PERSISTENT = (1 << 5),
+	GRPCSTTBACKGROUND_FLAG_NO_PERSISTENT = (1 << 6),
+	GRPCSTTBACKGROUND_FLAG_PREROLL = (1 << 7),
+	GRPCSTTBACKGROUND_FLAG_NO_PREROLL = (1 << 8),
+	GRPCSTTBACKGROUND_FLAG_AMD_SKIP = (1 << 9),
+	GRPCSTTBACKGROUND_FLAG_NO_AMD_SKIP = (1 << 10),
+	GRPCSTTBACKGROUND_FLAG_BEEP_DETECT = (1 << 11),
+	GRPCSTTBACKGROUND_FLAG_NO_BEEP_DETECT = (1 << 12),
+	GRPCSTTBACKGROUND_FLAG_LATENCY_TIMESTAMPS = (1 << 13),
+	GRPCSTTBACKGROUND_FLAG_NO_LATENCY_TIMESTAMPS = (1 << 14),
+	GRPCSTTBACKGROUND_FLAG_EARLY_FINAL = (1 << 15),
+	GRPCSTTBACKGROUND_FLAG_NO_EARLY_FINAL = (1 << 16),
+	GRPCSTTBACKGROUND_FLAG_ENDPOINTING = (1 << 17),
+	GRPCSTTBACKGROUND_FLAG_NO_ENDPOINTING = (1 << 18),
+	GRPCSTTBACKGROUND_FLAG_AUTO_PAUSE = (1 << 19),
+	GRPCSTTBACKGROUND_FLAG_NO_AUTO_PAUSE = (1 << 20),
+};
+
+enum grpcsttbackground_option_args {
+	GRPCSTTBACKGROUND_OPT_ARG_ENDPOINTING_HANGOVER = 0,
+	/* This must be the last element */
+	GRPCSTTBACKGROUND_OPT_ARG_ARRAY_SIZE,
 };
 
 AST_APP_OPTIONS(grpcsttbackground_opts, {
@@ -144,6 +366,22 @@ AST_APP_OPTIONS(grpcsttbackground_opts, {
 	AST_APP_OPTION('S', GRPCSTTBACKGROUND_FLAG_SSL_GRPC),
 	AST_APP_OPTION('G', GRPCSTTBACKGROUND_FLAG_GENDER_IDENTIFICATION_GRPC),
 	AST_APP_OPTION('g', GRPCSTTBACKGROUND_FLAG_OFF_GENDER_IDENTIFICATION_GRPC),
+	AST_APP_OPTION('P', GRPCSTTBACKGROUND_FLAG_PERSISTENT),
+	AST_APP_OPTION('p', GRPCSTTBACKGROUND_FLAG_NO_PERSISTENT),
+	AST_APP_OPTION('R', GRPCSTTBACKGROUND_FLAG_PREROLL),
+	AST_APP_OPTION('r', GRPCSTTBACKGROUND_FLAG_NO_PREROLL),
+	AST_APP_OPTION('M', GRPCSTTBACKGROUND_FLAG_AMD_SKIP),
+	AST_APP_OPTION('m', GRPCSTTBACKGROUND_FLAG_NO_AMD_SKIP),
+	AST_APP_OPTION('B', GRPCSTTBACKGROUND_FLAG_BEEP_DETECT),
+	AST_APP_OPTION('b', GRPCSTTBACKGROUND_FLAG_NO_BEEP_DETECT),
+	AST_APP_OPTION('L', GRPCSTTBACKGROUND_FLAG_LATENCY_TIMESTAMPS),
+	AST_APP_OPTION('l', GRPCSTTBACKGROUND_FLAG_NO_LATENCY_TIMESTAMPS),
+	AST_APP_OPTION('E', GRPCSTTBACKGROUND_FLAG_EARLY_FINAL),
+	AST_APP_OPTION('e', GRPCSTTBACKGROUND_FLAG_NO_EARLY_FINAL),
+	AST_APP_OPTION_ARG('U', GRPCSTTBACKGROUND_FLAG_ENDPOINTING, GRPCSTTBACKGROUND_OPT_ARG_ENDPOINTING_HANGOVER),
+	AST_APP_OPTION('u', GRPCSTTBACKGROUND_FLAG_NO_ENDPOINTING),
+	AST_APP_OPTION('H', GRPCSTTBACKGROUND_FLAG_AUTO_PAUSE),
+	AST_APP_OPTION('h', GRPCSTTBACKGROUND_FLAG_NO_AUTO_PAUSE),
 });
 
 struct thread_conf {
@@ -156,7 +394,7 @@ struct thread_conf {
 	struct ast_channel *chan;
 	char *endpoint;
 	int ssl_grpc;
-	char *ca_data;
+	char *ca_file; /* relative to configuration directory; NULL for built-in CA */
 	char *language_code; /* optional */
 	int max_alternatives;
 	enum grpc_stt_frame_format frame_format;
@@ -170,9 +408,32 @@ struct thread_conf {
 	double interim_results_max_interval;
 	int interim_results_max_predictions;
 	int enable_gender_identification;
+	int company_id; /* -1 if not specified */
+	int start_event_fd; /* -1 unless session is prepared */
+	int *prepared_state; /* ao2 object with enum grpc_stt_prepared_state; NULL unless session is prepared */
+	double prepare_max_wait;
+	int persistent;
+	int preroll;
+	int beep_detect;
+	struct grpc_stt_beep_conf beep_conf;
+	int latency_timestamps;
+	int early_final;
+	struct grpc_stt_early_final_conf early_final_conf;
+	int endpointing;
+	struct grpc_stt_endpointer_conf endpointer_conf;
+	int auto_pause; /* pause while PlayBackground() plays or call is on hold */
+	struct grpc_stt_profile *profile; /* session thread reference; NULL if no profile selected */
+	int setup_timeout; /* milliseconds; 0 for none */
+	int breaker; /* fail fast while circuit breaker of endpoint is open */
+	struct voicekit_breaker_conf breaker_conf;
+	char *capture_dir; /* NULL unless frames are captured for replay */
+	int amd_skip; /* wait for GRPCSTTAMD() decision and skip session for answering machine */
+	double amd_skip_confidence;
+	struct grpc_stt_amd *amd; /* session thread reference */
+	struct grpc_stt_handle *handle; /* session thread handle */
 };
 
-static struct thread_conf dflt_thread_conf = {
+static const struct thread_conf dflt_thread_conf = {
 	.terminate_event_fd = -1,
 	.authorization_api_key = NULL,
 	.authorization_secret_key = NULL,
@@ -182,7 +443,7 @@ static struct thread_conf dflt_thread_conf = {
 	.chan = NULL,
 	.endpoint = NULL,
 	.ssl_grpc = 0,
-	.ca_data = NULL,
+	.ca_file = NULL,
 	.language_code = NULL,
 	.max_alternatives = 1,
 	.frame_format = GRPC_STT_FRAME_FORMAT_ALAW,
@@ -196,12 +457,59 @@ static struct thread_conf dflt_thread_conf = {
 	.interim_results_max_interval = 0.0,
 	.interim_results_max_predictions = 2,
 	.enable_gender_identification = 0,
+	.company_id = -1,
+	.start_event_fd = -1,
+	.prepared_state = NULL,
+	.prepare_max_wait = 60.0,
+	.persistent = 0,
+	.preroll = 0,
+	.beep_detect = 0,
+	.beep_conf = { .frequency_count = 0 }, /* grpc_stt_beep_dflt_conf at configuration snapshot */
+	.latency_timestamps = 0,
+	.early_final = 0,
+	.early_final_conf = { .min_interims = 0 }, /* grpc_stt_early_final_dflt_conf at configuration snapshot */
+	.endpointing = 0,
+	.endpointer_conf = { .silence_threshold = 0 }, /* grpc_stt_endpointer_dflt_conf at configuration snapshot */
+	.auto_pause = 0,
+	.profile = NULL,
+	.setup_timeout = 10000,
+	.breaker = 0,
+	.breaker_conf = { .failure_threshold = 0 }, /* voicekit_breaker_dflt_conf at configuration snapshot */
+	.capture_dir = NULL,
+	.amd_skip = 0,
+	.amd_skip_confidence = 0.8,
+	.amd = NULL,
+	.handle = NULL,
 };
-static ast_mutex_t dflt_thread_conf_mutex;
 
-#define MAX_INMEMORY_FILE_SIZE (256*1024*1024)
+/* Named recognition profile of [profile-NAME] section */
+struct grpcstt_profile {
+	char *name;
+	char *endpoint; /* NULL unless set by profile */
+	char *language_code; /* NULL unless set by profile */
+	struct thread_conf thread_conf; /* default configuration with profile settings; refers to snapshot strings */
+	struct grpc_stt_profile *compiled;
+};
+
+/* Immutable snapshot of grpcstt.conf: replaced as a whole on reload */
+struct grpcstt_conf_snapshot {
+	struct thread_conf thread_conf;
+	struct grpc_stt_amd_conf amd_conf;
+	struct grpcstt_profile *profiles;
+	int profile_count;
+};
+
+/* Session waiting for answering machine decision re-checks it with this period */
+#define AMD_WAIT_SLICE_MSEC 50
+static AO2_GLOBAL_OBJ_STATIC(grpcstt_conf);
+
+/* Detached session threads running module code (including wait for answering machine decision) */
+static int session_thread_count;
 
 const char* get_voiptime_value_for_key(const char* input, const char* key) {
+    if (!input) {
+        return NULL;
+    }
     const char* token = strstr(input, key);
     if (!token) {
         return NULL;
@@ -221,44 +529,6 @@ const char* get_voiptime_value_for_key(const char* input, const char* key) {
     return value;
 }
 
-static char *load_ca_from_file(const char *relative_fname)
-{
-	char fname[512];
-	snprintf(fname, sizeof(fname), "%s/%s", ast_config_AST_CONFIG_DIR, relative_fname);
-	FILE *fh = fopen(fname, "r");
-	if (!fh) {
-		ast_log(AST_LOG_ERROR, "Failed to open CA file '%s' for reading: %s\n", fname, strerror(errno));
-		return NULL;
-	}
-	struct stat st;
-	if (fstat(fileno(fh), &st)) {
-		ast_log(AST_LOG_ERROR, "Failed to stat CA file '%s' for reading: %s\n", fname, strerror(errno));
-		fclose(fh);
-		return NULL;
-	}
-	size_t size = st.st_size;
-	if (size > MAX_INMEMORY_FILE_SIZE) {
-		ast_log(AST_LOG_ERROR, "Failed to read CA file '%s' into memory: file too big\n", fname);
-		fclose(fh);
-		return NULL;
-	}
-	char *data = (char *) ast_malloc(size + 1);
-	if (!data) {
-		ast_log(AST_LOG_ERROR, "Failed to read CA file '%s' into memory: failed to allocate buffer\n", fname);
-		fclose(fh);
-		return NULL;
-	}
-	if (fread(data, 1, size, fh) != size) {
-		ast_log(AST_LOG_ERROR, "Failed to read CA file '%s' into memory: %s\n", fname, feof(fh) ? "unexpected EOF" : strerror(errno));
-		fclose(fh);
-		ast_free(data);
-		return NULL;
-	}
-	data[size] = '\0';
-	fclose(fh);
-	return data;
-}
-
 static struct thread_conf *make_thread_conf(const struct thread_conf *source)
 {
 	size_t authorization_api_key_len = source->authorization_api_key ? (strlen(source->authorization_api_key) + 1) : 0;
@@ -268,10 +538,11 @@ static struct thread_conf *make_thread_conf(const struct thread_conf *source)
 	size_t authorization_audience_len = source->authorization_audience ? (strlen(source->authorization_audience) + 1) : 0;
 	size_t endpoint_len = strlen(source->endpoint) + 1;
 	size_t language_code_len = source->language_code ? (strlen(source->language_code) + 1) : 0;
-	size_t ca_data_len = source->ca_data ? (strlen(source->ca_data) + 1) : 0;
-	struct thread_conf *conf = ast_malloc(sizeof(struct thread_conf) + authorization_api_key_len + authorization_api_key_len +
+	size_t ca_file_len = source->ca_file ? (strlen(source->ca_file) + 1) : 0;
+	size_t capture_dir_len = source->capture_dir ? (strlen(source->capture_dir) + 1) : 0;
+	struct thread_conf *conf = ast_malloc(sizeof(struct thread_conf) + authorization_api_key_len + authorization_secret_key_len +
 					      authorization_issuer_len + authorization_subject_len + authorization_audience_len +
-					      endpoint_len + ca_data_len + language_code_len);
+					      endpoint_len + ca_file_len + language_code_len + capture_dir_len);
 	if (!conf)
 		return NULL;
 	void *p = conf + 1;
@@ -291,9 +562,11 @@ static struct thread_conf *make_thread_conf(const struct thread_conf *source)
 	conf->endpoint = strcpy(p, source->endpoint);
 	p += endpoint_len;
 	conf->ssl_grpc = source->ssl_grpc;
-	conf->ca_data = source->ca_data ? strcpy(p, source->ca_data) : NULL;
-	p += ca_data_len;
+	conf->ca_file = source->ca_file ? strcpy(p, source->ca_file) : NULL;
+	p += ca_file_len;
 	conf->language_code = source->language_code ? strcpy(p, source->language_code) : NULL;
+	p += language_code_len;
+	conf->capture_dir = source->capture_dir ? strcpy(p, source->capture_dir) : NULL;
 	conf->max_alternatives = source->max_alternatives;
 	conf->frame_format = source->frame_format;
 	conf->vad_disable = source->vad_disable;
@@ -306,68 +579,252 @@ static struct thread_conf *make_thread_conf(const struct thread_conf *source)
 	conf->interim_results_max_interval = source->interim_results_max_interval;
 	conf->interim_results_max_predictions = source->interim_results_max_predictions;
 	conf->enable_gender_identification = source->enable_gender_identification;
+	conf->company_id = source->company_id;
+	conf->start_event_fd = -1;
+	conf->prepared_state = NULL;
+	conf->prepare_max_wait = source->prepare_max_wait;
+	conf->persistent = source->persistent;
+	conf->preroll = source->preroll;
+	conf->beep_detect = source->beep_detect;
+	conf->beep_conf = source->beep_conf;
+	conf->latency_timestamps = source->latency_timestamps;
+	conf->early_final = source->early_final;
+	conf->early_final_conf = source->early_final_conf;
+	conf->endpointing = source->endpointing;
+	conf->endpointer_conf = source->endpointer_conf;
+	conf->auto_pause = source->auto_pause;
+	conf->profile = NULL;
+	conf->setup_timeout = source->setup_timeout;
+	conf->breaker = source->breaker;
+	conf->breaker_conf = source->breaker_conf;
+	conf->amd_skip = source->amd_skip;
+	conf->amd_skip_confidence = source->amd_skip_confidence;
+	conf->amd = NULL;
+	conf->handle = NULL;
 	return conf;
 }
 
 
+/* Returns 1 if session is to be skipped as answered by machine, -1 if session is terminated while waiting */
+static int wait_amd_decision(struct thread_conf *conf)
+{
+	double confidence;
+	enum grpc_stt_amd_decision decision;
+	while ((decision = grpc_stt_amd_decision(conf->amd, &confidence)) == GRPC_STT_AMD_UNDECIDED) {
+		struct pollfd pfd = {
+			.fd = conf->terminate_event_fd,
+			.events = POLLIN,
+			.revents = 0,
+		};
+		if (poll(&pfd, 1, AMD_WAIT_SLICE_MSEC) > 0 || ast_check_hangup_locked(conf->chan))
+			return -1;
+	}
+	return decision == GRPC_STT_AMD_MACHINE && confidence >= conf->amd_skip_confidence;
+}
 static void *thread_start(struct thread_conf *conf)
 {
 	struct ast_channel *chan = conf->chan;
-	grpc_stt_run(conf->terminate_event_fd, conf->endpoint, conf->authorization_api_key, conf->authorization_secret_key,
-		     conf->authorization_issuer, conf->authorization_subject, conf->authorization_audience,
-		     chan, conf->ssl_grpc, conf->ca_data, conf->language_code, conf->max_alternatives, conf->frame_format,
-		     conf->vad_disable, conf->vad_min_speech_duration, conf->vad_max_speech_duration,
-		     conf->vad_silence_duration_threshold, conf->vad_silence_prob_threshold, conf->vad_aggressiveness,
-		     conf->interim_results_enable, conf->interim_results_max_interval, conf->interim_results_max_predictions,
-		     conf->enable_gender_identification);
+	struct grpc_stt_admission_ticket *ticket;
+	const char *skip_reason = NULL;
+	const char *reject_reason = NULL;
+	const char *reject_source = NULL; /* for log only: reasons of event are the same for all sources */
+	int breaker_ticket = VOICEKIT_BREAKER_REJECTED;
+	if (conf->amd) {
+		int amd_result = wait_amd_decision(conf);
+		if (amd_result > 0) {
+			skip_reason = "ANSWERING_MACHINE";
+		} else if (amd_result < 0) {
+			reject_reason = GRPC_STT_ADMISSION_CANCELLED;
+			reject_source = "finish or hangup while waiting for answering machine decision";
+		}
+	}
+	/* Open breaker fails session before it takes admission slot */
+	if (!skip_reason && !reject_reason && conf->breaker) {
+		breaker_ticket = voicekit_breaker_acquire(conf->endpoint, &conf->breaker_conf);
+		if (breaker_ticket == VOICEKIT_BREAKER_REJECTED) {
+			reject_reason = "CIRCUIT_OPEN";
+			reject_source = "circuit breaker";
+		}
+	}
+	if (!skip_reason && !reject_reason) {
+		reject_reason = grpc_stt_admission_acquire(conf->endpoint, conf->company_id, conf->terminate_event_fd, &ticket);
+		reject_source = "admission control";
+	}
+	if (skip_reason || reject_reason) {
+		if (conf->breaker)
+			voicekit_breaker_release(conf->endpoint, &conf->breaker_conf, breaker_ticket, VOICEKIT_BREAKER_CANCELLED);
+		if (conf->prepared_state) {
+			int expected = GRPC_STT_PREPARED_WAITING;
+			__atomic_compare_exchange_n(conf->prepared_state, &expected, GRPC_STT_PREPARED_ABANDONED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		}
+		if (skip_reason) {
+			ast_log(AST_LOG_NOTICE, "%s: Session to '%s' skipped: %s\n", app, conf->endpoint, skip_reason);
+			grpc_stt_skip(chan, skip_reason);
+		} else {
+			ast_log(AST_LOG_WARNING, "%s: Session to '%s' rejected by %s: %s\n", app, conf->endpoint, reject_source, reject_reason);
+			grpc_stt_reject(chan, reject_reason);
+		}
+	} else {
+		grpc_stt_run(conf->handle, conf->terminate_event_fd, conf->endpoint, conf->authorization_api_key, conf->authorization_secret_key,
+			     conf->authorization_issuer, conf->authorization_subject, conf->authorization_audience,
+			     chan, conf->ssl_grpc, conf->ca_file, conf->language_code, conf->max_alternatives, conf->frame_format,
+			     conf->vad_disable, conf->vad_min_speech_duration, conf->vad_max_speech_duration,
+			     conf->vad_silence_duration_threshold, conf->vad_silence_prob_threshold, conf->vad_aggressiveness,
+			     conf->interim_results_enable, conf->interim_results_max_interval, conf->interim_results_max_predictions,
+			     conf->enable_gender_identification, conf->start_event_fd, conf->prepared_state, conf->prepare_max_wait,
+			     conf->preroll, conf->beep_detect ? &conf->beep_conf : NULL, conf->latency_timestamps,
+			     conf->early_final ? &conf->early_final_conf : NULL, conf->endpointing ? &conf->endpointer_conf : NULL,
+			     conf->persistent, conf->auto_pause, conf->profile, conf->setup_timeout, conf->capture_dir,
+			     conf->breaker ? &conf->breaker_conf : NULL, breaker_ticket);
+		grpc_stt_admission_release(ticket);
+	}
 
 	close(conf->terminate_event_fd);
+	if (conf->start_event_fd != -1)
+		close(conf->start_event_fd);
+	ao2_cleanup(conf->prepared_state);
+	ao2_cleanup(conf->amd);
+	grpc_stt_profile_release(conf->profile);
+	grpc_stt_handle_detach(conf->handle);
 	ast_channel_unref(chan);
 	ast_free(conf);
+	__atomic_sub_fetch(&session_thread_count, 1, __ATOMIC_SEQ_CST);
 	return NULL;
 }
 
-static void clear_config(void)
-{
-	ast_free(dflt_thread_conf.authorization_api_key);
-	ast_free(dflt_thread_conf.authorization_secret_key);
-	ast_free(dflt_thread_conf.authorization_issuer);
-	ast_free(dflt_thread_conf.authorization_subject);
-	ast_free(dflt_thread_conf.authorization_audience);
-	ast_free(dflt_thread_conf.endpoint);
-	ast_free(dflt_thread_conf.ca_data);
-	ast_free(dflt_thread_conf.language_code);
-	dflt_thread_conf.authorization_api_key = NULL;
-	dflt_thread_conf.authorization_secret_key = NULL;
-	dflt_thread_conf.authorization_issuer = NULL;
-	dflt_thread_conf.authorization_subject = NULL;
-	dflt_thread_conf.authorization_audience = NULL;
-	dflt_thread_conf.chan = NULL;
-	dflt_thread_conf.endpoint = NULL;
-	dflt_thread_conf.ssl_grpc = 0;
-	dflt_thread_conf.ca_data = NULL;
-	dflt_thread_conf.language_code = NULL;
-	dflt_thread_conf.max_alternatives = 1;
-	dflt_thread_conf.frame_format = GRPC_STT_FRAME_FORMAT_ALAW;
-	dflt_thread_conf.vad_disable = 0;
-	dflt_thread_conf.vad_min_speech_duration = 0.0;
-	dflt_thread_conf.vad_max_speech_duration = 0.0;
-	dflt_thread_conf.vad_silence_duration_threshold = 0.0;
-	dflt_thread_conf.vad_silence_prob_threshold = 0.0;
-	dflt_thread_conf.vad_aggressiveness = 0.0;
-	dflt_thread_conf.interim_results_enable = 0;
-	dflt_thread_conf.interim_results_max_interval = 0.0;
-	dflt_thread_conf.interim_results_max_predictions = 0;
-	dflt_thread_conf.enable_gender_identification = 0;
+static void destroy_grpcstt_conf_snapshot(void *void_s)
+{
+	struct grpcstt_conf_snapshot *s = void_s;
+	ast_free(s->thread_conf.authorization_api_key);
+	ast_free(s->thread_conf.authorization_secret_key);
+	ast_free(s->thread_conf.authorization_issuer);
+	ast_free(s->thread_conf.authorization_subject);
+	ast_free(s->thread_conf.authorization_audience);
+	ast_free(s->thread_conf.endpoint);
+	ast_free(s->thread_conf.ca_file);
+	ast_free(s->thread_conf.language_code);
+	ast_free(s->thread_conf.capture_dir);
+	for (int i = 0; i < s->profile_count; ++i) {
+		ast_free(s->profiles[i].name);
+		ast_free(s->profiles[i].endpoint);
+		ast_free(s->profiles[i].language_code);
+		grpc_stt_profile_release(s->profiles[i].compiled);
+	}
+	ast_free(s->profiles);
+}
+static struct grpcstt_conf_snapshot *make_grpcstt_conf_snapshot(void)
+{
+	struct grpcstt_conf_snapshot *s = ao2_alloc_options(sizeof(struct grpcstt_conf_snapshot), destroy_grpcstt_conf_snapshot,
+							    AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!s)
+		return NULL;
+	s->thread_conf = dflt_thread_conf;
+	s->thread_conf.beep_conf = grpc_stt_beep_dflt_conf;
+	s->thread_conf.early_final_conf = grpc_stt_early_final_dflt_conf;
+	s->thread_conf.endpointer_conf = grpc_stt_endpointer_dflt_conf;
+	s->thread_conf.breaker_conf = voicekit_breaker_dflt_conf;
+	s->amd_conf = grpc_stt_amd_dflt_conf;
+	s->profiles = NULL;
+	s->profile_count = 0;
+	return s;
+}
+static const struct grpcstt_profile *find_profile(const struct grpcstt_conf_snapshot *snapshot, const char *name)
+{
+	for (int i = 0; snapshot && i < snapshot->profile_count; ++i) {
+		if (!strcasecmp(snapshot->profiles[i].name, name))
+			return &snapshot->profiles[i];
+	}
+	return NULL;
+}
+/* Profile section starts from default configuration: it is loaded after all other sections */
+static int load_profile(struct grpcstt_conf_snapshot *snapshot, struct ast_config *cfg, const char *cat)
+{
+	struct grpcstt_profile *profiles = ast_realloc(snapshot->profiles, sizeof(struct grpcstt_profile)*(snapshot->profile_count + 1));
+	if (!profiles)
+		return -1;
+	snapshot->profiles = profiles;
+	struct grpcstt_profile *profile = &profiles[snapshot->profile_count];
+	profile->name = ast_strdup(cat + strlen("profile-"));
+	profile->endpoint = NULL;
+	profile->language_code = NULL;
+	profile->thread_conf = snapshot->thread_conf;
+	profile->compiled = NULL;
+	++snapshot->profile_count;
+	if (!profile->name)
+		return -1;
+	struct thread_conf *conf = &profile->thread_conf;
+
+	struct ast_variable *var = ast_variable_browse(cfg, cat);
+	while (var) {
+		if (!strcasecmp(var->name, "endpoint")) {
+			if (!voicekit_grpc_endpoint_is_valid(var->value, 1)) {
+				ast_log(LOG_ERROR, "Invalid endpoint '%s' (expected \"host:port\", \"unix:path\" or \"shm:path\")\n", var->value);
+				return -1;
+			}
+			ast_free(profile->endpoint);
+			conf->endpoint = profile->endpoint = ast_strdup(var->value);
+		} else if (!strcasecmp(var->name, "language_code")) {
+			ast_free(profile->language_code);
+			conf->language_code = profile->language_code = ast_strdup(var->value);
+		} else if (!strcasecmp(var->name, "max_alternatives")) {
+			conf->max_alternatives = atoi(var->value);
+		} else if (!strcasecmp(var->name, "frame_format")) {
+			if (!strcmp(var->value, "alaw")) {
+				conf->frame_format = GRPC_STT_FRAME_FORMAT_ALAW;
+			} else if (!strcmp(var->value, "ulaw")) {
+				conf->frame_format = GRPC_STT_FRAME_FORMAT_MULAW;
+			} else if (!strcmp(var->value, "slin")) {
+				conf->frame_format = GRPC_STT_FRAME_FORMAT_SLINEAR16;
+			} else {
+				ast_log(LOG_ERROR, "Unsupported frame format '%s'\n", var->value);
+				return -1;
+			}
+		} else if (!strcasecmp(var->name, "vad_disable")) {
+			conf->vad_disable = ast_true(var->value);
+		} else if (!strcasecmp(var->name, "vad_min_speech_duration")) {
+			conf->vad_min_speech_duration = atof(var->value);
+		} else if (!strcasecmp(var->name, "vad_max_speech_duration")) {
+			conf->vad_max_speech_duration = atof(var->value);
+		} else if (!strcasecmp(var->name, "vad_silence_duration_threshold")) {
+			conf->vad_silence_duration_threshold = atof(var->value);
+		} else if (!strcasecmp(var->name, "vad_silence_prob_threshold")) {
+			conf->vad_silence_prob_threshold = atof(var->value);
+		} else if (!strcasecmp(var->name, "vad_aggressiveness")) {
+			conf->vad_aggressiveness = atof(var->value);
+		} else if (!strcasecmp(var->name, "interim_results_enable")) {
+			conf->interim_results_enable = ast_true(var->value);
+		} else if (!strcasecmp(var->name, "interim_results_max_interval")) {
+			conf->interim_results_max_interval = atof(var->value);
+		} else if (!strcasecmp(var->name, "interim_results_max_predictions")) {
+			conf->interim_results_max_predictions = atoi(var->value);
+		} else if (!strcasecmp(var->name, "gender_identification")) {
+			conf->enable_gender_identification = ast_true(var->value);
+		} else {
+			ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+		}
+		var = var->next;
+	}
+
+	profile->compiled = grpc_stt_profile_compile(profile->name, conf->language_code, conf->max_alternatives, conf->frame_format,
+						     conf->vad_disable, conf->vad_min_speech_duration, conf->vad_max_speech_duration,
+						     conf->vad_silence_duration_threshold, conf->vad_silence_prob_threshold, conf->vad_aggressiveness,
+						     conf->interim_results_enable, conf->interim_results_max_interval,
+						     conf->interim_results_max_predictions, conf->enable_gender_identification);
+	return profile->compiled ? 0 : -1;
 }
 static int load_config(int reload)
 {
 	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
 	struct ast_config *cfg = ast_config_load("grpcstt.conf", config_flags);
 	if (!cfg) {
-		ast_mutex_lock(&dflt_thread_conf_mutex);
-		clear_config();
-		ast_mutex_unlock(&dflt_thread_conf_mutex);
+		struct grpcstt_conf_snapshot *snapshot = make_grpcstt_conf_snapshot();
+		if (!snapshot)
+			return -1;
+		ao2_global_obj_replace_unref(grpcstt_conf, snapshot);
+		ao2_ref(snapshot, -1);
+		struct grpc_stt_admission_conf admission_conf = { 0 };
+		grpc_stt_admission_set_conf(&admission_conf);
+		grpc_stt_pool_configure(NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0.0, 0);
 		return 0;
 	}
 	if (cfg == CONFIG_STATUS_FILEUNCHANGED)
@@ -377,9 +834,27 @@ static int load_config(int reload)
 		return -1;
 	}
 
-	ast_mutex_lock(&dflt_thread_conf_mutex);
+	struct grpc_stt_admission_conf admission_conf = {
+		.max_sessions = 0,
+		.max_queue = 0,
+		.queue_timeout = 0.0,
+		.rate = 0.0,
+		.burst = 0,
+		.company_max_sessions = 0,
+		.company_quotas = NULL,
+		.company_quota_count = 0,
+	};
+	RAII_VAR(struct grpc_stt_company_quota *, company_quotas, NULL, ast_free);
+	int pool_size = 0;
+	double pool_max_idle = 30.0;
+	int keepalive_time_ms = 0;
 
-	clear_config();
+	RAII_VAR(struct grpcstt_conf_snapshot *, snapshot, make_grpcstt_conf_snapshot(), ao2_cleanup);
+	if (!snapshot) {
+		ast_config_destroy(cfg);
+		return -1;
+	}
+	struct thread_conf *conf = &snapshot->thread_conf;
 
 	char *cat = ast_category_browse(cfg, NULL);
 	while (cat) {
@@ -387,25 +862,40 @@ static int load_config(int reload)
 			struct ast_variable *var = ast_variable_browse(cfg, cat);
 			while (var) {
 				if (!strcasecmp(var->name, "endpoint")) {
-					dflt_thread_conf.endpoint = ast_strdup(var->value);
+					if (!voicekit_grpc_endpoint_is_valid(var->value, 1)) {
+						ast_log(LOG_ERROR, "Invalid endpoint '%s' (expected \"host:port\", \"unix:path\" or \"shm:path\")\n", var->value);
+						ast_config_destroy(cfg);
+						return -1;
+					}
+					conf->endpoint = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "use_ssl")) {
-					dflt_thread_conf.ssl_grpc = ast_true(var->value);
+					conf->ssl_grpc = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "persistent")) {
+					conf->persistent = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "preroll")) {
+					conf->preroll = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "latency_timestamps")) {
+					conf->latency_timestamps = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "auto_pause")) {
+					conf->auto_pause = ast_true(var->value);
 				} else if (!strcasecmp(var->name, "ca_file")) {
-					dflt_thread_conf.ca_data = load_ca_from_file(var->value);
+					if (!voicekit_grpc_credentials_check(var->value)) {
+						ast_free(conf->ca_file);
+						conf->ca_file = ast_strdup(var->value);
+					}
 				} else if (!strcasecmp(var->name, "language_code")) {
-					dflt_thread_conf.language_code = ast_strdup(var->value);
+					conf->language_code = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "max_alternatives")) {
-					dflt_thread_conf.max_alternatives = atoi(var->value);
+					conf->max_alternatives = atoi(var->value);
 				} else if (!strcasecmp(var->name, "frame_format")) {
 					if (!strcmp(var->value, "alaw")) {
-						dflt_thread_conf.frame_format = GRPC_STT_FRAME_FORMAT_ALAW;
+						conf->frame_format = GRPC_STT_FRAME_FORMAT_ALAW;
 					} else if (!strcmp(var->value, "ulaw")) {
-						dflt_thread_conf.frame_format = GRPC_STT_FRAME_FORMAT_MULAW;
+						conf->frame_format = GRPC_STT_FRAME_FORMAT_MULAW;
 					} else if (!strcmp(var->value, "slin")) {
-						dflt_thread_conf.frame_format = GRPC_STT_FRAME_FORMAT_SLINEAR16;
+						conf->frame_format = GRPC_STT_FRAME_FORMAT_SLINEAR16;
 					} else {
 						ast_log(LOG_ERROR, "Unsupported frame format '%s'\n", var->value);
-						ast_mutex_unlock(&dflt_thread_conf_mutex);
 						ast_config_destroy(cfg);
 						return -1;
 					}
@@ -418,17 +908,17 @@ static int load_config(int reload)
 			struct ast_variable *var = ast_variable_browse(cfg, cat);
 			while (var) {
 				if (!strcasecmp(var->name, "disable")) {
-					dflt_thread_conf.vad_disable = ast_true(var->value);
+					conf->vad_disable = ast_true(var->value);
 				} else if (!strcasecmp(var->name, "min_speech_duration")) {
-					dflt_thread_conf.vad_min_speech_duration = atof(var->value);
+					conf->vad_min_speech_duration = atof(var->value);
 				} else if (!strcasecmp(var->name, "max_speech_duration")) {
-					dflt_thread_conf.vad_max_speech_duration = atof(var->value);
+					conf->vad_max_speech_duration = atof(var->value);
 				} else if (!strcasecmp(var->name, "silence_duration_threshold")) {
-					dflt_thread_conf.vad_silence_duration_threshold = atof(var->value);
+					conf->vad_silence_duration_threshold = atof(var->value);
 				} else if (!strcasecmp(var->name, "silence_prob_threshold")) {
-					dflt_thread_conf.vad_silence_prob_threshold = atof(var->value);
+					conf->vad_silence_prob_threshold = atof(var->value);
 				} else if (!strcasecmp(var->name, "aggressiveness")) {
-					dflt_thread_conf.vad_aggressiveness = atof(var->value);
+					conf->vad_aggressiveness = atof(var->value);
 				} else {
 					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
 				}
@@ -438,11 +928,11 @@ static int load_config(int reload)
 			struct ast_variable *var = ast_variable_browse(cfg, cat);
 			while (var) {
 				if (!strcasecmp(var->name, "enable")) {
-					dflt_thread_conf.interim_results_enable = ast_true(var->value);
+					conf->interim_results_enable = ast_true(var->value);
 				} else if (!strcasecmp(var->name, "max_interval")) {
-					dflt_thread_conf.interim_results_max_interval = atof(var->value);
+					conf->interim_results_max_interval = atof(var->value);
 				} else if (!strcasecmp(var->name, "max_predictions")) {
-					dflt_thread_conf.interim_results_max_predictions = atoi(var->value);
+					conf->interim_results_max_predictions = atoi(var->value);
 				} else {
 					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
 				}
@@ -452,7 +942,191 @@ static int load_config(int reload)
 			struct ast_variable *var = ast_variable_browse(cfg, cat);
 			while (var) {
 				if (!strcasecmp(var->name, "enable")) {
-					dflt_thread_conf.enable_gender_identification = ast_true(var->value);
+					conf->enable_gender_identification = ast_true(var->value);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "admission")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "max_sessions")) {
+					admission_conf.max_sessions = atoi(var->value);
+				} else if (!strcasecmp(var->name, "max_queue")) {
+					admission_conf.max_queue = atoi(var->value);
+				} else if (!strcasecmp(var->name, "queue_timeout")) {
+					admission_conf.queue_timeout = atof(var->value);
+				} else if (!strcasecmp(var->name, "rate")) {
+					admission_conf.rate = atof(var->value);
+				} else if (!strcasecmp(var->name, "burst")) {
+					admission_conf.burst = atoi(var->value);
+				} else if (!strcasecmp(var->name, "company_max_sessions")) {
+					admission_conf.company_max_sessions = atoi(var->value);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "company_quotas")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				char *eptr;
+				long company_id = strtol(var->name, &eptr, 10);
+				if (*eptr || company_id < 0) {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Invalid company_id %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				} else {
+					struct grpc_stt_company_quota *quotas = ast_realloc(company_quotas, sizeof(struct grpc_stt_company_quota)*(admission_conf.company_quota_count + 1));
+					if (quotas) {
+						company_quotas = quotas;
+						company_quotas[admission_conf.company_quota_count].company_id = company_id;
+						company_quotas[admission_conf.company_quota_count].max_sessions = atoi(var->value);
+						++admission_conf.company_quota_count;
+					}
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "beep")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "enable")) {
+					conf->beep_detect = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "frequencies")) {
+					if (grpc_stt_beep_parse_frequencies(&conf->beep_conf, var->value))
+						ast_log(LOG_WARNING, "%s: Cat:%s. Invalid frequency list '%s' at line %d of grpcstt.conf\n", app, cat, var->value, var->lineno);
+				} else if (!strcasecmp(var->name, "min_duration")) {
+					conf->beep_conf.min_duration = atoi(var->value);
+				} else if (!strcasecmp(var->name, "tone_ratio")) {
+					conf->beep_conf.tone_ratio = atof(var->value);
+				} else if (!strcasecmp(var->name, "min_level")) {
+					conf->beep_conf.min_level = atoi(var->value);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "early_final")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "enable")) {
+					conf->early_final = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "min_interims")) {
+					conf->early_final_conf.min_interims = atoi(var->value);
+				} else if (!strcasecmp(var->name, "min_stable_time")) {
+					conf->early_final_conf.min_stable_ms = atoi(var->value);
+				} else if (!strcasecmp(var->name, "max_words")) {
+					conf->early_final_conf.max_words = atoi(var->value);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "endpointing")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "enable")) {
+					conf->endpointing = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "silence_threshold")) {
+					conf->endpointer_conf.silence_threshold = atoi(var->value);
+				} else if (!strcasecmp(var->name, "min_speech")) {
+					conf->endpointer_conf.min_speech = atoi(var->value);
+				} else if (!strcasecmp(var->name, "hangover")) {
+					conf->endpointer_conf.hangover = atoi(var->value);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "capture")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "dir")) {
+					ast_free(conf->capture_dir);
+					conf->capture_dir = *var->value ? ast_strdup(var->value) : NULL;
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "failfast")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "setup_timeout")) {
+					conf->setup_timeout = atoi(var->value);
+				} else if (!strcasecmp(var->name, "breaker")) {
+					conf->breaker = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "failure_threshold")) {
+					conf->breaker_conf.failure_threshold = atoi(var->value);
+				} else if (!strcasecmp(var->name, "error_rate")) {
+					conf->breaker_conf.error_rate = atof(var->value);
+				} else if (!strcasecmp(var->name, "min_calls")) {
+					conf->breaker_conf.min_calls = atoi(var->value);
+				} else if (!strcasecmp(var->name, "window")) {
+					conf->breaker_conf.window = atof(var->value);
+				} else if (!strcasecmp(var->name, "open_time")) {
+					conf->breaker_conf.open_time = atof(var->value);
+				} else if (!strcasecmp(var->name, "half_open_probes")) {
+					conf->breaker_conf.half_open_probes = atoi(var->value);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "amd")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "initial_silence")) {
+					snapshot->amd_conf.initial_silence = atoi(var->value);
+				} else if (!strcasecmp(var->name, "greeting")) {
+					snapshot->amd_conf.greeting = atoi(var->value);
+				} else if (!strcasecmp(var->name, "after_greeting_silence")) {
+					snapshot->amd_conf.after_greeting_silence = atoi(var->value);
+				} else if (!strcasecmp(var->name, "total_analysis_time")) {
+					snapshot->amd_conf.total_analysis_time = atoi(var->value);
+				} else if (!strcasecmp(var->name, "min_word_length")) {
+					snapshot->amd_conf.min_word_length = atoi(var->value);
+				} else if (!strcasecmp(var->name, "between_words_silence")) {
+					snapshot->amd_conf.between_words_silence = atoi(var->value);
+				} else if (!strcasecmp(var->name, "maximum_number_of_words")) {
+					snapshot->amd_conf.maximum_number_of_words = atoi(var->value);
+				} else if (!strcasecmp(var->name, "silence_threshold")) {
+					snapshot->amd_conf.silence_threshold = atoi(var->value);
+				} else if (!strcasecmp(var->name, "skip")) {
+					conf->amd_skip = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "skip_confidence")) {
+					conf->amd_skip_confidence = atof(var->value);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "prepare")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "max_wait")) {
+					double value = atof(var->value);
+					if (value > 0.0)
+						conf->prepare_max_wait = value;
+					else
+						ast_log(LOG_WARNING, "%s: Cat:%s. Invalid max_wait '%s' at line %d of grpcstt.conf (positive seconds expected)\n", app, cat, var->value, var->lineno);
+				} else if (!strcasecmp(var->name, "pool_size")) {
+					int value = atoi(var->value);
+					if (value >= 0)
+						pool_size = value;
+					else
+						ast_log(LOG_WARNING, "%s: Cat:%s. Invalid pool_size '%s' at line %d of grpcstt.conf (non-negative count expected)\n", app, cat, var->value, var->lineno);
+				} else if (!strcasecmp(var->name, "pool_max_idle")) {
+					double value = atof(var->value);
+					if (value > 0.0)
+						pool_max_idle = value;
+					else
+						ast_log(LOG_WARNING, "%s: Cat:%s. Invalid pool_max_idle '%s' at line %d of grpcstt.conf (positive seconds expected)\n", app, cat, var->value, var->lineno);
+				} else if (!strcasecmp(var->name, "keepalive_time")) {
+					double value = atof(var->value);
+					if (value >= 0.0)
+						keepalive_time_ms = (int) (value*1000.0);
+					else
+						ast_log(LOG_WARNING, "%s: Cat:%s. Invalid keepalive_time '%s' at line %d of grpcstt.conf (non-negative seconds expected)\n", app, cat, var->value, var->lineno);
+				} else {
+					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
 				}
 				var = var->next;
 			}
@@ -460,15 +1134,15 @@ static int load_config(int reload)
 			struct ast_variable *var = ast_variable_browse(cfg, cat);
 			while (var) {
 				if (!strcasecmp(var->name, "api_key")) {
-					dflt_thread_conf.authorization_api_key = ast_strdup(var->value);
+					conf->authorization_api_key = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "secret_key")) {
-					dflt_thread_conf.authorization_secret_key = ast_strdup(var->value);
+					conf->authorization_secret_key = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "issuer")) {
-					dflt_thread_conf.authorization_issuer = ast_strdup(var->value);
+					conf->authorization_issuer = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "subject")) {
-					dflt_thread_conf.authorization_subject = ast_strdup(var->value);
+					conf->authorization_subject = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "audience")) {
-					dflt_thread_conf.authorization_audience = ast_strdup(var->value);
+					conf->authorization_audience = ast_strdup(var->value);
 				} else {
 					ast_log(LOG_WARNING, "%s: Cat:%s. Unknown keyword %s at line %d of grpcstt.conf\n", app, cat, var->name, var->lineno);
 				}
@@ -478,20 +1152,51 @@ static int load_config(int reload)
 		cat = ast_category_browse(cfg, cat);
 	}
 
-	ast_mutex_unlock(&dflt_thread_conf_mutex);
+	cat = ast_category_browse(cfg, NULL);
+	while (cat) {
+		if (!strncasecmp(cat, "profile-", strlen("profile-")) && load_profile(snapshot, cfg, cat)) {
+			ast_log(LOG_ERROR, "%s: Failed to load profile section %s of grpcstt.conf\n", app, cat);
+			ast_config_destroy(cfg);
+			return -1;
+		}
+		cat = ast_category_browse(cfg, cat);
+	}
+
 	ast_config_destroy(cfg);
 
+	ao2_global_obj_replace_unref(grpcstt_conf, snapshot);
+
+	admission_conf.company_quotas = company_quotas;
+	if (grpc_stt_admission_set_conf(&admission_conf))
+		return -1;
+
+	/* Shared-memory transport has no connection to warm up */
+	const char *pool_endpoint = (conf->endpoint && strncmp(conf->endpoint, "shm:", 4)) ? conf->endpoint : NULL;
+	grpc_stt_pool_configure(pool_endpoint, conf->ssl_grpc, conf->ca_file,
+				conf->authorization_api_key, conf->authorization_secret_key,
+				conf->authorization_issuer, conf->authorization_subject, conf->authorization_audience,
+				pool_size, pool_max_idle, keepalive_time_ms);
+
 	return 0;
 }
 struct grpcsttbackground_control {
 	int terminate_event_fd;
+	int start_event_fd; /* -1 unless session is prepared */
+	int *prepared_state; /* shared with session thread; NULL unless session is prepared */
+	struct grpc_stt_handle *handle;
+	struct thread_conf *persistent_conf; /* configuration of running persistent session; NULL unless persistent */
 };
-static struct grpcsttbackground_control *make_grpcsttbackground_control(int terminate_event_fd)
+static struct grpcsttbackground_control *make_grpcsttbackground_control(int terminate_event_fd, int start_event_fd, int *prepared_state,
+									struct grpc_stt_handle *handle, struct thread_conf *persistent_conf)
 {
 	struct grpcsttbackground_control *s = ast_calloc(sizeof(struct grpcsttbackground_control), 1);
 	if (!s)
 		return NULL;
 	s->terminate_event_fd = terminate_event_fd;
+	s->start_event_fd = start_event_fd;
+	s->prepared_state = prepared_state;
+	s->handle = handle;
+	s->persistent_conf = persistent_conf;
 	return s;
 }
 static void destroy_grpcsttbackground_control(void *void_s)
@@ -499,6 +1204,11 @@ static void destroy_grpcsttbackground_control(void *void_s)
 	struct grpcsttbackground_control *s = void_s;
 	eventfd_write(s->terminate_event_fd, 1);
 	close(s->terminate_event_fd);
+	if (s->start_event_fd != -1)
+		close(s->start_event_fd);
+	ao2_cleanup(s->prepared_state);
+	grpc_stt_handle_release(s->handle);
+	ast_free(s->persistent_conf);
 	ast_free(s);
 }
 static const struct ast_datastore_info grpcsttbackground_ds_info = {
@@ -519,13 +1229,24 @@ static void clear_channel_control_state(struct ast_channel *chan)
 	clear_channel_control_state_unlocked(chan);
 	ast_channel_unlock(chan);
 }
-static void replace_channel_control_state_unlocked(struct ast_channel *chan, int terminate_event_fd)
+/* Takes ownership of descriptors, prepared_state reference, handle and persistent_conf */
+static void replace_channel_control_state_unlocked(struct ast_channel *chan, int terminate_event_fd, int start_event_fd, int *prepared_state,
+						   struct grpc_stt_handle *handle, struct thread_conf *persistent_conf)
 {
 	clear_channel_control_state_unlocked(chan);
 
-	struct grpcsttbackground_control *control = make_grpcsttbackground_control(terminate_event_fd);
-	if (!control)
+	struct grpcsttbackground_control *control = make_grpcsttbackground_control(terminate_event_fd, start_event_fd, prepared_state,
+										   handle, persistent_conf);
+	if (!control) {
+		eventfd_write(terminate_event_fd, 1);
+		close(terminate_event_fd);
+		if (start_event_fd != -1)
+			close(start_event_fd);
+		ao2_cleanup(prepared_state);
+		grpc_stt_handle_release(handle);
+		ast_free(persistent_conf);
 		return;
+	}
 	struct ast_datastore *datastore = ast_datastore_alloc(&grpcsttbackground_ds_info, NULL);
 	if (!datastore) {
 		destroy_grpcsttbackground_control(control);
@@ -534,11 +1255,84 @@ static void replace_channel_control_state_unlocked(struct ast_channel *chan, int
 	datastore->data = control;
 	ast_channel_datastore_add(chan, datastore);
 }
-static void replace_channel_control_state(struct ast_channel *chan, int terminate_event_fd)
+static void replace_channel_control_state(struct ast_channel *chan, int terminate_event_fd, int start_event_fd, int *prepared_state,
+					  struct grpc_stt_handle *handle, struct thread_conf *persistent_conf)
+{
+	ast_channel_lock(chan);
+	replace_channel_control_state_unlocked(chan, terminate_event_fd, start_event_fd, prepared_state, handle, persistent_conf);
+	ast_channel_unlock(chan);
+}
+static int same_string(const char *a, const char *b)
+{
+	return !strcmp(S_OR(a, ""), S_OR(b, ""));
+}
+static int same_connection_conf(const struct thread_conf *a, const struct thread_conf *b)
+{
+	return same_string(a->endpoint, b->endpoint) && a->ssl_grpc == b->ssl_grpc && same_string(a->ca_file, b->ca_file) &&
+		same_string(a->authorization_api_key, b->authorization_api_key) && same_string(a->authorization_secret_key, b->authorization_secret_key) &&
+		same_string(a->authorization_issuer, b->authorization_issuer) && same_string(a->authorization_subject, b->authorization_subject) &&
+		same_string(a->authorization_audience, b->authorization_audience) && a->company_id == b->company_id;
+}
+static int same_recognition_conf(const struct thread_conf *a, const struct thread_conf *b)
+{
+	return same_string(a->language_code, b->language_code) && a->max_alternatives == b->max_alternatives &&
+		a->frame_format == b->frame_format && a->vad_disable == b->vad_disable &&
+		a->vad_min_speech_duration == b->vad_min_speech_duration && a->vad_max_speech_duration == b->vad_max_speech_duration &&
+		a->vad_silence_duration_threshold == b->vad_silence_duration_threshold &&
+		a->vad_silence_prob_threshold == b->vad_silence_prob_threshold && a->vad_aggressiveness == b->vad_aggressiveness &&
+		a->interim_results_enable == b->interim_results_enable && a->interim_results_max_interval == b->interim_results_max_interval &&
+		a->interim_results_max_predictions == b->interim_results_max_predictions &&
+		a->enable_gender_identification == b->enable_gender_identification;
+}
+/* Returns 1 if running persistent session of channel serves new GRPCSTTBackground() call:
+   stream is replaced only if recognition config differs */
+static int reuse_persistent_session(struct ast_channel *chan, const struct thread_conf *thread_conf)
 {
+	int reused = 0;
 	ast_channel_lock(chan);
-	replace_channel_control_state_unlocked(chan, terminate_event_fd);
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &grpcsttbackground_ds_info, NULL);
+	if (datastore) {
+		struct grpcsttbackground_control *control = datastore->data;
+		if (control->persistent_conf && !grpc_stt_handle_finished(control->handle) &&
+		    same_connection_conf(control->persistent_conf, thread_conf)) {
+			if (same_recognition_conf(control->persistent_conf, thread_conf)) {
+				reused = 1;
+			} else {
+				struct thread_conf *conf = make_thread_conf(thread_conf);
+				if (conf && !grpc_stt_handle_reconfigure(control->handle, conf->language_code, conf->max_alternatives, conf->frame_format,
+									  conf->vad_disable, conf->vad_min_speech_duration, conf->vad_max_speech_duration,
+									  conf->vad_silence_duration_threshold, conf->vad_silence_prob_threshold, conf->vad_aggressiveness,
+									  conf->interim_results_enable, conf->interim_results_max_interval,
+									  conf->interim_results_max_predictions, conf->enable_gender_identification)) {
+					ast_free(control->persistent_conf);
+					control->persistent_conf = conf;
+					reused = 1;
+				} else {
+					ast_free(conf);
+				}
+			}
+		}
+	}
 	ast_channel_unlock(chan);
+	return reused;
+}
+/* Returns 1 if channel has session prepared by GRPCSTTBackgroundPrepare() and it is released for streaming now */
+static int start_prepared_session(struct ast_channel *chan)
+{
+	int started = 0;
+	ast_channel_lock(chan);
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &grpcsttbackground_ds_info, NULL);
+	if (datastore) {
+		struct grpcsttbackground_control *control = datastore->data;
+		int expected = GRPC_STT_PREPARED_WAITING;
+		if (control->prepared_state &&
+		    __atomic_compare_exchange_n(control->prepared_state, &expected, GRPC_STT_PREPARED_STARTED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			eventfd_write(control->start_event_fd, 1);
+			started = 1;
+		}
+	}
+	ast_channel_unlock(chan);
+	return started;
 }
 
 static int make_event_fd_pair(int *parent_fd_p, int *child_fd_p)
@@ -563,10 +1357,10 @@ static int make_event_fd_pair(int *parent_fd_p, int *child_fd_p)
 	return 0;
 }
 
-static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
+static int start_session(struct ast_channel *chan, const char *data, int prepare)
 {
-	ast_mutex_lock(&dflt_thread_conf_mutex);
-	struct thread_conf thread_conf = dflt_thread_conf;
+	RAII_VAR(struct grpcstt_conf_snapshot *, snapshot, ao2_global_obj_ref(grpcstt_conf), ao2_cleanup);
+	struct thread_conf thread_conf = snapshot ? snapshot->thread_conf : dflt_thread_conf;
 	thread_conf.chan = chan;
 
 	char *parse = ast_strdupa(data);
@@ -581,8 +1375,19 @@ static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
 
 	AST_STANDARD_APP_ARGS(args, parse);
 
-	if (args.endpoint && *args.endpoint)
+	struct grpc_stt_profile *profile = NULL;
+	if (args.endpoint && !strncasecmp(args.endpoint, "profile=", strlen("profile="))) {
+		const struct grpcstt_profile *p = find_profile(snapshot, args.endpoint + strlen("profile="));
+		if (!p) {
+			ast_log(LOG_ERROR, "%s: Failed to execute application: unknown profile '%s'\n", app, args.endpoint + strlen("profile="));
+			return -1;
+		}
+		thread_conf = p->thread_conf;
+		thread_conf.chan = chan;
+		profile = p->compiled;
+	} else if (args.endpoint && *args.endpoint) {
 		thread_conf.endpoint = args.endpoint;
+	}
 
     const char *variable_configuration = "ai_voicemail";
     const char *variable_configuration_value = pbx_builtin_getvar_helper(chan, variable_configuration);
@@ -590,6 +1395,15 @@ static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
     const char* host_port_delimiter = ":";
     const char* port_str = get_voiptime_value_for_key(variable_configuration_value, "port");
 
+    const char* company_id_str = get_voiptime_value_for_key(variable_configuration_value, "company_id");
+    if (company_id_str != NULL) {
+        char *eptr;
+        long company_id = strtol(company_id_str, &eptr, 10);
+        if (*company_id_str && !*eptr && company_id >= 0)
+            thread_conf.company_id = company_id;
+        ast_free((char *) company_id_str);
+    }
+
     if (host_str != NULL && port_str != NULL) {
         size_t result_length = strlen(host_str) + strlen(host_port_delimiter) + strlen(port_str) + 1;
         char *result_host_port = (char *)ast_malloc(result_length);
@@ -605,13 +1419,17 @@ static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
 
 	if (!thread_conf.endpoint) {
 		ast_log(LOG_ERROR, "%s: Failed to execute application: no endpoint (host:port) specified\n", app);
-		ast_mutex_unlock(&dflt_thread_conf_mutex);
+		return -1;
+	}
+	if (!voicekit_grpc_endpoint_is_valid(thread_conf.endpoint, 1)) {
+		ast_log(LOG_ERROR, "%s: Failed to execute application: invalid endpoint '%s' (expected \"host:port\", \"unix:path\" or \"shm:path\")\n", app, thread_conf.endpoint);
 		return -1;
 	}
 
 	if (args.options) {
 		struct ast_flags flags = { 0 };
-		ast_app_parse_options(grpcsttbackground_opts, &flags, NULL, args.options);
+		char *opt_args[GRPCSTTBACKGROUND_OPT_ARG_ARRAY_SIZE] = { NULL };
+		ast_app_parse_options(grpcsttbackground_opts, &flags, opt_args, args.options);
 
 		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_SSL_GRPC))
 			thread_conf.ssl_grpc = 0;
@@ -622,17 +1440,66 @@ static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
 			thread_conf.enable_gender_identification = 0;
 		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_GENDER_IDENTIFICATION_GRPC))
 			thread_conf.enable_gender_identification = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_PERSISTENT))
+			thread_conf.persistent = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_PERSISTENT))
+			thread_conf.persistent = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_PREROLL))
+			thread_conf.preroll = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_PREROLL))
+			thread_conf.preroll = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_AMD_SKIP))
+			thread_conf.amd_skip = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_AMD_SKIP))
+			thread_conf.amd_skip = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_BEEP_DETECT))
+			thread_conf.beep_detect = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_BEEP_DETECT))
+			thread_conf.beep_detect = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_LATENCY_TIMESTAMPS))
+			thread_conf.latency_timestamps = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_LATENCY_TIMESTAMPS))
+			thread_conf.latency_timestamps = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_EARLY_FINAL))
+			thread_conf.early_final = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_EARLY_FINAL))
+			thread_conf.early_final = 1;
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_ENDPOINTING))
+			thread_conf.endpointing = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_ENDPOINTING)) {
+			thread_conf.endpointing = 1;
+			const char *hangover = opt_args[GRPCSTTBACKGROUND_OPT_ARG_ENDPOINTING_HANGOVER];
+			if (!ast_strlen_zero(hangover)) {
+				char *eptr;
+				long value = strtol(hangover, &eptr, 10);
+				if (*eptr || value <= 0) {
+					ast_log(LOG_ERROR, "%s: Invalid endpointing hangover '%s'\n", app, hangover);
+					return -1;
+				}
+				thread_conf.endpointer_conf.hangover = value;
+			}
+		}
+
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_NO_AUTO_PAUSE))
+			thread_conf.auto_pause = 0;
+		if (ast_test_flag(&flags, GRPCSTTBACKGROUND_FLAG_AUTO_PAUSE))
+			thread_conf.auto_pause = 1;
 	}
 
 	if (args.language_code && *args.language_code)
 		thread_conf.language_code = args.language_code;
 
-	RAII_VAR (char *, ca_data, NULL, ast_free);
 	if (args.ca_file && *args.ca_file) {
-		if (!(ca_data = load_ca_from_file(args.ca_file)))
+		if (voicekit_grpc_credentials_check(args.ca_file))
 			return -1;
-		ast_free(thread_conf.ca_data);
-		thread_conf.ca_data = ca_data;
+		thread_conf.ca_file = args.ca_file;
 	}
 
 	if (args.frame_format && *args.frame_format) {
@@ -644,7 +1511,6 @@ static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
 			thread_conf.frame_format = GRPC_STT_FRAME_FORMAT_SLINEAR16;
 		} else {
 			ast_log(LOG_ERROR, "Unsupported frame format '%s'\n", args.frame_format);
-			ast_mutex_unlock(&dflt_thread_conf_mutex);
 			return -1;
 		}
 	}
@@ -658,32 +1524,165 @@ static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
 			ast_log(LOG_WARNING, "Invalid max alternatives count %s specified\n", args.max_alternatives);
 	}
 
+	if (thread_conf.persistent && !prepare && reuse_persistent_session(chan, &thread_conf))
+		return 0;
+
 	ast_channel_ref(chan);
 	struct thread_conf *conf = make_thread_conf(&thread_conf);
-	ast_mutex_unlock(&dflt_thread_conf_mutex);
 	if (!conf) {
 		ast_channel_unref(chan);
 		return -1;
 	}
+	if (thread_conf.amd_skip) {
+		conf->amd = grpc_stt_amd_find(chan);
+		if (!conf->amd)
+			ast_log(LOG_WARNING, "%s: No GRPCSTTAMD() classifier running at channel %s: session is started unconditionally\n", app, ast_channel_name(chan));
+	}
+	struct thread_conf *persistent_conf = NULL;
+	struct grpc_stt_handle *handle = grpc_stt_handle_create();
+	conf->handle = handle ? grpc_stt_handle_dup(handle) : NULL;
+	if (thread_conf.persistent)
+		persistent_conf = make_thread_conf(&thread_conf);
+	if (!conf->handle || (thread_conf.persistent && !persistent_conf)) {
+		grpc_stt_handle_release(conf->handle);
+		grpc_stt_handle_release(handle);
+		ast_free(persistent_conf);
+		ast_channel_unref(chan);
+		ast_free(conf);
+		return -1;
+	}
 	int terminate_event_fd, child_terminate_event_fd;
 	if (make_event_fd_pair(&terminate_event_fd, &child_terminate_event_fd)) {
+		grpc_stt_handle_release(conf->handle);
+		grpc_stt_handle_release(handle);
+		ast_free(persistent_conf);
 		ast_channel_unref(chan);
+		ast_free(conf);
 		return -1;
 	}
-	
+	int start_event_fd = -1, child_start_event_fd = -1;
+	int *prepared_state = NULL;
+	if (prepare) {
+		prepared_state = ao2_alloc_options(sizeof(int), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!prepared_state || make_event_fd_pair(&start_event_fd, &child_start_event_fd)) {
+			ao2_cleanup(prepared_state);
+			grpc_stt_handle_release(conf->handle);
+			grpc_stt_handle_release(handle);
+			ast_free(persistent_conf);
+			ast_channel_unref(chan);
+			close(terminate_event_fd);
+			close(child_terminate_event_fd);
+			ast_free(conf);
+			return -1;
+		}
+		*prepared_state = GRPC_STT_PREPARED_WAITING;
+	}
+
 	conf->terminate_event_fd = child_terminate_event_fd;
+	conf->start_event_fd = child_start_event_fd;
+	conf->prepared_state = prepared_state ? ao2_bump(prepared_state) : NULL;
+	/* Session thread may outlive configuration snapshot (e.g. while queued by admission control) */
+	conf->profile = grpc_stt_profile_dup(profile);
 	pthread_t thread;
+	__atomic_add_fetch(&session_thread_count, 1, __ATOMIC_SEQ_CST);
 	if (ast_pthread_create_detached_background(&thread, NULL, (void *) thread_start, conf)) {
+		__atomic_sub_fetch(&session_thread_count, 1, __ATOMIC_SEQ_CST);
 		ast_log(AST_LOG_ERROR, "Failed to start thread\n");
+		grpc_stt_profile_release(conf->profile);
 		ast_channel_unref(chan);
 		close(terminate_event_fd);
 		close(child_terminate_event_fd);
+		if (prepare) {
+			close(start_event_fd);
+			close(child_start_event_fd);
+			ao2_ref(prepared_state, -2);
+		}
+		grpc_stt_handle_release(conf->handle);
+		grpc_stt_handle_release(handle);
+		ast_free(persistent_conf);
+		ast_free(conf);
 		return -1;
 	}
-	replace_channel_control_state(chan, terminate_event_fd);
+	replace_channel_control_state(chan, terminate_event_fd, start_event_fd, prepared_state, handle, persistent_conf);
 
 	return 0;
 }
+static int grpcsttbackground_exec(struct ast_channel *chan, const char *data)
+{
+	if (start_prepared_session(chan))
+		return 0;
+	return start_session(chan, data, 0);
+}
+static int grpcsttbackgroundprepare_exec(struct ast_channel *chan, const char *data)
+{
+	return start_session(chan, data, 1);
+}
+static int grpcsttsegment_exec(struct ast_channel *chan, const char *data)
+{
+	ast_channel_lock(chan);
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &grpcsttbackground_ds_info, NULL);
+	if (datastore) {
+		struct grpcsttbackground_control *control = datastore->data;
+		grpc_stt_handle_mark_segment(control->handle, S_OR(data, ""));
+	} else {
+		ast_log(LOG_WARNING, "%s: No recognition session running at channel %s\n", app_segment, ast_channel_name(chan));
+	}
+	ast_channel_unlock(chan);
+	return 0;
+}
+static void set_channel_pause(struct ast_channel *chan, int paused, const char *app_name)
+{
+	ast_channel_lock(chan);
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &grpcsttbackground_ds_info, NULL);
+	if (datastore) {
+		struct grpcsttbackground_control *control = datastore->data;
+		grpc_stt_handle_pause(control->handle, paused);
+	} else {
+		ast_log(LOG_WARNING, "%s: No recognition session running at channel %s\n", app_name, ast_channel_name(chan));
+	}
+	ast_channel_unlock(chan);
+}
+static int grpcsttbackgroundpause_exec(struct ast_channel *chan, const char *data)
+{
+	set_channel_pause(chan, 1, app_pause);
+	return 0;
+}
+static int grpcsttbackgroundresume_exec(struct ast_channel *chan, const char *data)
+{
+	set_channel_pause(chan, 0, app_resume);
+	return 0;
+}
+static int grpcsttpreroll_exec(struct ast_channel *chan, const char *data)
+{
+	int duration_ms = 500;
+	if (data && *data) {
+		char *eptr;
+		long value = strtol(data, &eptr, 10);
+		if (*eptr || value < 0) {
+			ast_log(LOG_ERROR, "%s: Invalid duration '%s'\n", app_preroll, data);
+			return -1;
+		}
+		duration_ms = value;
+	}
+	if (!duration_ms) {
+		grpc_stt_preroll_remove(chan);
+		return 0;
+	}
+	if (grpc_stt_preroll_install(chan, duration_ms)) {
+		ast_log(LOG_ERROR, "%s: Failed to install pre-roll buffer at channel %s\n", app_preroll, ast_channel_name(chan));
+		return -1;
+	}
+	return 0;
+}
+static int grpcsttamd_exec(struct ast_channel *chan, const char *data)
+{
+	RAII_VAR(struct grpcstt_conf_snapshot *, snapshot, ao2_global_obj_ref(grpcstt_conf), ao2_cleanup);
+	if (grpc_stt_amd_start(chan, snapshot ? &snapshot->amd_conf : &grpc_stt_amd_dflt_conf)) {
+		ast_log(LOG_ERROR, "%s: Failed to start answering machine classifier at channel %s\n", app_amd, ast_channel_name(chan));
+		return -1;
+	}
+	return 0;
+}
 static int grpcsttbackgroundfinish_exec(struct ast_channel *chan, const char *data)
 {
 	clear_channel_control_state(chan);
@@ -691,24 +1690,75 @@ static int grpcsttbackgroundfinish_exec(struct ast_channel *chan, const char *da
 }
 
 
+static char *handle_cli_bench_stt(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit bench stt";
+		e->usage =
+			"Usage: voicekit bench stt [MIN_MSEC]\n"
+			"       Runs micro-benchmarks of STT per-frame and per-result code\n"
+			"       (frame conversion, silence generation, result event building)\n"
+			"       for at least MIN_MSEC (200 by default) each and prints JSON line\n"
+			"       with time and allocations per call for every benchmark\n"
+			"       (allocations are null unless built with --enable-bench-alloc-count).\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3 && a->argc != 4)
+		return CLI_SHOWUSAGE;
+	int min_time_ms = (a->argc == 4) ? atoi(a->argv[3]) : VOICEKIT_BENCH_DFLT_MIN_TIME_MS;
+	if (min_time_ms <= 0)
+		return CLI_SHOWUSAGE;
+
+	grpc_stt_bench(a->fd, min_time_ms);
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_grpcstt[] = {
+	AST_CLI_DEFINE(handle_cli_bench_stt, "Run STT micro-benchmarks"),
+};
+
+
 static int unload_module(void)
 {
-	grpc_shutdown();
-	ast_mutex_lock(&dflt_thread_conf_mutex);
-	clear_config();
-	ast_mutex_unlock(&dflt_thread_conf_mutex);
-	return
+	/* Detached session threads hold admission tickets and wait in its queue */
+	if (__atomic_load_n(&session_thread_count, __ATOMIC_SEQ_CST) || grpc_stt_admission_close()) {
+		ast_log(AST_LOG_WARNING, "%s: Module is not unloaded: recognition sessions are running\n", app);
+		return -1;
+	}
+	ast_cli_unregister_multiple(cli_grpcstt, ARRAY_LEN(cli_grpcstt));
+	ao2_global_obj_release(grpcstt_conf);
+	grpc_stt_pool_shutdown();
+	int ret =
 		ast_unregister_application(app) |
+		ast_unregister_application(app_prepare) |
+		ast_unregister_application(app_segment) |
+		ast_unregister_application(app_pause) |
+		ast_unregister_application(app_resume) |
+		ast_unregister_application(app_preroll) |
+		ast_unregister_application(app_amd) |
 		ast_unregister_application(app_finish);
+	grpc_stt_admission_destroy();
+	return ret;
 }
 
 static int load_module(void)
 {
-	grpc_init();
+	grpc_stt_admission_init();
 	if (load_config(0) ||
 	    (ast_register_application_xml(app, grpcsttbackground_exec) |
+	     ast_register_application_xml(app_prepare, grpcsttbackgroundprepare_exec) |
+	     ast_register_application_xml(app_segment, grpcsttsegment_exec) |
+	     ast_register_application_xml(app_pause, grpcsttbackgroundpause_exec) |
+	     ast_register_application_xml(app_resume, grpcsttbackgroundresume_exec) |
+	     ast_register_application_xml(app_preroll, grpcsttpreroll_exec) |
+	     ast_register_application_xml(app_amd, grpcsttamd_exec) |
 	     ast_register_application_xml(app_finish, grpcsttbackgroundfinish_exec)))
 		return AST_MODULE_LOAD_DECLINE;
+	ast_cli_register_multiple(cli_grpcstt, ARRAY_LEN(cli_grpcstt));
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -724,4 +1774,5 @@ AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_DEFAULT, "[" ASTERISK_MODULE_VERSI
 		.load = load_module,
 		.unload = unload_module,
 		.reload = reload,
+		.requires = "res_voicekit_grpc",
 );
@@ -0,0 +1,243 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Voicemail beep detector: Goertzel filters for all configured frequencies
+ * evaluated together over 40ms blocks (tone loop is innermost and operates
+ * on fixed-size arrays so compiler vectorizes it). Block length gives 25 Hz
+ * resolution: 10ms blocks (100 Hz) could not tell 425, 440 and 480 Hz apart.
+ * Tone is detected when single frequency holds most of block energy and
+ * outweighs every frequency resolvable from it for minimal duration.
+ */
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include "beep_detector.h"
+
+#include <asterisk.h>
+#include <asterisk/channel.h>
+#include <asterisk/format_cache.h>
+#include <asterisk/alaw.h>
+#include <asterisk/ulaw.h>
+#include <asterisk/json.h>
+#include <asterisk/stasis_channels.h>
+#include <asterisk/utils.h>
+
+#include <math.h>
+
+
+#define SAMPLE_RATE 8000
+#define BLOCK_SAMPLES 320
+/* Frequencies closer than that fall into the same Goertzel bin */
+#define BIN_WIDTH ((float) SAMPLE_RATE/BLOCK_SAMPLES)
+/* Minimal power ratio of detected frequency to strongest resolvable one (6 dB) */
+#define MIN_BIN_RATIO 4.0f
+#define CONVERSION_CHUNK_SAMPLES 160
+
+const struct grpc_stt_beep_conf grpc_stt_beep_dflt_conf = {
+	.frequencies = { 425, 440, 480, 620, 850, 950, 1000, 1100, 1400 },
+	.frequency_count = 9,
+	.min_duration = 150,
+	.tone_ratio = 0.7,
+	.min_level = 100,
+};
+
+struct grpc_stt_beep_detector {
+	float coeffs[GRPC_STT_BEEP_MAX_FREQUENCIES];
+	float s1[GRPC_STT_BEEP_MAX_FREQUENCIES];
+	float s2[GRPC_STT_BEEP_MAX_FREQUENCIES];
+	float frequencies[GRPC_STT_BEEP_MAX_FREQUENCIES];
+	int frequency_count;
+	float energy;
+	size_t block_fill;
+	float min_block_energy;
+	float tone_ratio;
+	size_t min_tone_samples;
+	int tone_index;      /* -1 if no tone in last block */
+	size_t tone_samples;
+	int reported;
+};
+
+
+int grpc_stt_beep_parse_frequencies(struct grpc_stt_beep_conf *conf, const char *value)
+{
+	int count = 0;
+	const char *p = value;
+	while (*p) {
+		char *eptr;
+		double frequency = strtod(p, &eptr);
+		if (eptr == p || frequency <= 0.0 || frequency >= SAMPLE_RATE/2 || count == GRPC_STT_BEEP_MAX_FREQUENCIES)
+			return -1;
+		conf->frequencies[count++] = frequency;
+		while (*eptr == ' ' || *eptr == '\t')
+			++eptr;
+		if (*eptr == ',')
+			++eptr;
+		else if (*eptr)
+			return -1;
+		p = eptr;
+		while (*p == ' ' || *p == '\t')
+			++p;
+	}
+	if (!count)
+		return -1;
+	conf->frequency_count = count;
+	return 0;
+}
+
+struct grpc_stt_beep_detector *grpc_stt_beep_detector_create(const struct grpc_stt_beep_conf *conf)
+{
+	struct grpc_stt_beep_detector *detector = ast_calloc(1, sizeof(struct grpc_stt_beep_detector));
+	if (!detector)
+		return NULL;
+	/* Unused slots keep zero coefficient: computed but never reported */
+	detector->frequency_count = conf->frequency_count;
+	for (int i = 0; i < conf->frequency_count; ++i) {
+		detector->frequencies[i] = conf->frequencies[i];
+		detector->coeffs[i] = 2.0f*cosf(2.0f*M_PI*conf->frequencies[i]/SAMPLE_RATE);
+	}
+	detector->min_block_energy = ((float) conf->min_level)*conf->min_level*BLOCK_SAMPLES;
+	detector->tone_ratio = conf->tone_ratio;
+	detector->min_tone_samples = ((size_t) conf->min_duration)*SAMPLE_RATE/1000;
+	detector->tone_index = -1;
+	return detector;
+}
+void grpc_stt_beep_detector_destroy(struct grpc_stt_beep_detector *detector)
+{
+	ast_free(detector);
+}
+
+/* Returns index of frequency dominating finished block or -1 */
+static int finish_block(struct grpc_stt_beep_detector *detector)
+{
+	float powers[GRPC_STT_BEEP_MAX_FREQUENCIES];
+	int best_index = -1;
+	float best_power = 0.0f;
+	for (int i = 0; i < detector->frequency_count; ++i) {
+		powers[i] = detector->s1[i]*detector->s1[i] + detector->s2[i]*detector->s2[i] - detector->coeffs[i]*detector->s1[i]*detector->s2[i];
+		if (powers[i] > best_power) {
+			best_power = powers[i];
+			best_index = i;
+		}
+	}
+	/* Neighbours within the same bin share tone power: only resolvable frequencies compete */
+	float rival_power = 0.0f;
+	for (int i = 0; i < detector->frequency_count; ++i) {
+		if (best_index != -1 && fabsf(detector->frequencies[i] - detector->frequencies[best_index]) >= BIN_WIDTH && powers[i] > rival_power)
+			rival_power = powers[i];
+	}
+	float energy = detector->energy;
+	for (int i = 0; i < GRPC_STT_BEEP_MAX_FREQUENCIES; ++i) {
+		detector->s1[i] = 0.0f;
+		detector->s2[i] = 0.0f;
+	}
+	detector->energy = 0.0f;
+	detector->block_fill = 0;
+
+	/* Pure tone of amplitude A gives Goertzel power (A*N/2)^2 and block energy N*A^2/2 */
+	if (energy < detector->min_block_energy || best_power*2.0f/(energy*BLOCK_SAMPLES) < detector->tone_ratio ||
+	    best_power < rival_power*MIN_BIN_RATIO)
+		return -1;
+	return best_index;
+}
+int grpc_stt_beep_detector_process(struct grpc_stt_beep_detector *detector, const int16_t *samples, size_t count,
+				   float *frequency, size_t *offset)
+{
+	int detected = 0;
+	while (count) {
+		size_t n = BLOCK_SAMPLES - detector->block_fill;
+		if (n > count)
+			n = count;
+		for (size_t j = 0; j < n; ++j) {
+			float x = samples[j];
+			detector->energy += x*x;
+			for (int i = 0; i < GRPC_STT_BEEP_MAX_FREQUENCIES; ++i) {
+				float s0 = x + detector->coeffs[i]*detector->s1[i] - detector->s2[i];
+				detector->s2[i] = detector->s1[i];
+				detector->s1[i] = s0;
+			}
+		}
+		samples += n;
+		count -= n;
+		detector->block_fill += n;
+		if (detector->block_fill < BLOCK_SAMPLES)
+			break;
+
+		int tone_index = finish_block(detector);
+		if (tone_index == -1 || tone_index != detector->tone_index) {
+			detector->tone_samples = 0;
+			detector->reported = 0;
+		}
+		detector->tone_index = tone_index;
+		if (tone_index == -1)
+			continue;
+		detector->tone_samples += BLOCK_SAMPLES;
+		if (!detector->reported && detector->tone_samples >= detector->min_tone_samples) {
+			detector->reported = 1;
+			detected = 1;
+			*frequency = detector->frequencies[tone_index];
+			*offset = detector->tone_samples + count;
+		}
+	}
+	return detected;
+}
+
+static void publish_beep(struct ast_channel *chan, float frequency, size_t offset)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	double detect_time = now.tv_sec + now.tv_nsec/1000000000.0;
+	double start_time = detect_time - ((double) offset)/SAMPLE_RATE;
+	char body[256];
+	snprintf(body, sizeof(body), "{\"frequency\": %.0f, \"start_time\": %.3f, \"detect_time\": %.3f}", frequency, start_time, detect_time);
+	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", "VoicemailBeep", "eventbody", body);
+	if (!blob)
+		return;
+	ast_multi_object_blob_single_channel_publish(chan, ast_multi_user_event_type(), blob);
+	ast_json_unref(blob);
+}
+void grpc_stt_beep_detector_process_frame(struct grpc_stt_beep_detector *detector, struct ast_channel *chan, struct ast_frame *f)
+{
+	size_t sample_count = f->samples;
+	int16_t buffer[CONVERSION_CHUNK_SAMPLES];
+	for (size_t done = 0; done < sample_count; ) {
+		size_t n = sample_count - done;
+		if (n > CONVERSION_CHUNK_SAMPLES)
+			n = CONVERSION_CHUNK_SAMPLES;
+		if (f->subclass.format == ast_format_alaw) {
+			uint8_t *sptr = ((uint8_t *) f->data.ptr) + done;
+			for (size_t i = 0; i < n; ++i)
+				buffer[i] = AST_ALAW(sptr[i]);
+		} else if (f->subclass.format == ast_format_ulaw) {
+			uint8_t *sptr = ((uint8_t *) f->data.ptr) + done;
+			for (size_t i = 0; i < n; ++i)
+				buffer[i] = AST_MULAW(sptr[i]);
+		} else if (f->subclass.format == ast_format_slin) {
+			int16_t *sptr = ((int16_t *) f->data.ptr) + done;
+			for (size_t i = 0; i < n; ++i)
+				buffer[i] = sptr[i];
+		} else {
+			return;
+		}
+		done += n;
+
+		float frequency;
+		size_t offset;
+		/* Remaining samples of frame were received at the same moment */
+		if (grpc_stt_beep_detector_process(detector, buffer, n, &frequency, &offset))
+			publish_beep(chan, frequency, offset + (sample_count - done));
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_BEEP_DETECTOR_H
+#define GRPC_STT_BEEP_DETECTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define GRPC_STT_BEEP_MAX_FREQUENCIES 16
+
+struct ast_channel;
+struct ast_frame;
+
+struct grpc_stt_beep_conf {
+	float frequencies[GRPC_STT_BEEP_MAX_FREQUENCIES]; /* Hz */
+	int frequency_count;
+	int min_duration;  /* Milliseconds */
+	double tone_ratio; /* Minimal share of block energy at single frequency */
+	int min_level;     /* Minimal block RMS amplitude (SLINEAR) */
+};
+
+extern const struct grpc_stt_beep_conf grpc_stt_beep_dflt_conf;
+
+/* Parses comma-separated list of frequencies; returns 0 on success */
+extern int grpc_stt_beep_parse_frequencies(struct grpc_stt_beep_conf *conf, const char *value);
+
+struct grpc_stt_beep_detector;
+
+extern struct grpc_stt_beep_detector *grpc_stt_beep_detector_create(const struct grpc_stt_beep_conf *conf);
+extern void grpc_stt_beep_detector_destroy(struct grpc_stt_beep_detector *detector);
+
+/* Feeds 8kHz SLINEAR samples. Returns 1 once per tone when it lasted for min_duration:
+   *frequency is set to detected frequency and *offset to number of samples of the tone
+   (including samples before this call) up to the end of passed samples. */
+extern int grpc_stt_beep_detector_process(struct grpc_stt_beep_detector *detector, const int16_t *samples, size_t count,
+					  float *frequency, size_t *offset);
+
+/* Feeds channel read frame and publishes "VoicemailBeep" user event on detection.
+   Channel must be locked (as in framehook callback). */
+extern void grpc_stt_beep_detector_process_frame(struct grpc_stt_beep_detector *detector, struct ast_channel *chan, struct ast_frame *frame);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
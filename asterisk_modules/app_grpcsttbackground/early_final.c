@@ -0,0 +1,139 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Early final: speculative finalization of interim hypotheses. Final result
+ * arrives only after server VAD detects silence_duration_threshold of silence;
+ * interim transcript unchanged for enough consecutive results and time is
+ * reported ahead of it. Comparison ignores case and differences in whitespace,
+ * so re-punctuated or re-spaced hypotheses do not restart stability.
+ */
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include "early_final.h"
+
+#include <asterisk.h>
+#include <asterisk/utils.h>
+
+#include <ctype.h>
+
+
+const struct grpc_stt_early_final_conf grpc_stt_early_final_dflt_conf = {
+	.min_interims = 2,
+	.min_stable_ms = 300,
+	.max_words = 0,
+};
+
+struct grpc_stt_early_final {
+	struct grpc_stt_early_final_conf conf;
+	char *transcript;  /* Normalized transcript of current utterance; NULL if none */
+	int interims;      /* Consecutive interims with transcript */
+	int64_t since_ms;  /* Time transcript was first received */
+	int reported;
+};
+
+
+/* Returns lower-cased copy with whitespace runs collapsed to single space and trimmed */
+static char *normalize_transcript(const char *transcript, int *word_count)
+{
+	char *normalized = ast_malloc(strlen(transcript) + 1);
+	if (!normalized)
+		return NULL;
+	char *dptr = normalized;
+	int words = 0;
+	int in_word = 0;
+	for (const unsigned char *sptr = (const unsigned char *) transcript; *sptr; ++sptr) {
+		if (isspace(*sptr)) {
+			in_word = 0;
+			continue;
+		}
+		if (!in_word) {
+			if (words)
+				*dptr++ = ' ';
+			++words;
+			in_word = 1;
+		}
+		*dptr++ = tolower(*sptr);
+	}
+	*dptr = '\0';
+	*word_count = words;
+	return normalized;
+}
+
+struct grpc_stt_early_final *grpc_stt_early_final_create(const struct grpc_stt_early_final_conf *conf)
+{
+	struct grpc_stt_early_final *early_final = ast_calloc(1, sizeof(struct grpc_stt_early_final));
+	if (!early_final)
+		return NULL;
+	early_final->conf = *conf;
+	return early_final;
+}
+void grpc_stt_early_final_destroy(struct grpc_stt_early_final *early_final)
+{
+	if (!early_final)
+		return;
+	ast_free(early_final->transcript);
+	ast_free(early_final);
+}
+void grpc_stt_early_final_reset(struct grpc_stt_early_final *early_final)
+{
+	ast_free(early_final->transcript);
+	early_final->transcript = NULL;
+	early_final->interims = 0;
+	early_final->reported = 0;
+}
+int grpc_stt_early_final_interim(struct grpc_stt_early_final *early_final, const char *transcript, int64_t now_ms)
+{
+	int word_count;
+	char *normalized = normalize_transcript(transcript, &word_count);
+	if (!normalized)
+		return 0;
+
+	/* Once reported, utterance keeps its early final till final result */
+	if (early_final->reported) {
+		ast_free(normalized);
+		return 0;
+	}
+	if (!early_final->transcript || strcmp(early_final->transcript, normalized)) {
+		ast_free(early_final->transcript);
+		early_final->transcript = normalized;
+		early_final->interims = 1;
+		early_final->since_ms = now_ms;
+	} else {
+		ast_free(normalized);
+		++early_final->interims;
+	}
+
+	if (!word_count || (early_final->conf.max_words > 0 && word_count > early_final->conf.max_words))
+		return 0;
+	if (early_final->interims < early_final->conf.min_interims || now_ms - early_final->since_ms < early_final->conf.min_stable_ms)
+		return 0;
+	early_final->reported = 1;
+	return 1;
+}
+int grpc_stt_early_final_final(struct grpc_stt_early_final *early_final, const char *transcript)
+{
+	int result = -1;
+	if (early_final->reported) {
+		int word_count;
+		char *normalized = normalize_transcript(transcript, &word_count);
+		result = (!normalized || strcmp(early_final->transcript, normalized)) ? 1 : 0;
+		ast_free(normalized);
+	}
+	grpc_stt_early_final_reset(early_final);
+	return result;
+}
@@ -0,0 +1,54 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_EARLY_FINAL_H
+#define GRPC_STT_EARLY_FINAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct grpc_stt_early_final_conf {
+	int min_interims;  /* Consecutive interim results with same transcript */
+	int min_stable_ms; /* Milliseconds transcript stays unchanged */
+	int max_words;     /* Longer transcripts are not finalized early; 0 for any length */
+};
+
+extern const struct grpc_stt_early_final_conf grpc_stt_early_final_dflt_conf;
+
+struct grpc_stt_early_final;
+
+extern struct grpc_stt_early_final *grpc_stt_early_final_create(const struct grpc_stt_early_final_conf *conf);
+extern void grpc_stt_early_final_destroy(struct grpc_stt_early_final *early_final);
+
+/* Forgets current utterance (at recognition stream start) */
+extern void grpc_stt_early_final_reset(struct grpc_stt_early_final *early_final);
+
+/* Feeds top transcript of interim result received at monotonic now_ms.
+   Returns 1 once per utterance when transcript became stable. */
+extern int grpc_stt_early_final_interim(struct grpc_stt_early_final *early_final, const char *transcript, int64_t now_ms);
+
+/* Feeds top transcript of final result and starts next utterance.
+   Returns -1 if no early final was reported for utterance, 0 if final transcript
+   matches reported one and 1 if it differs. */
+extern int grpc_stt_early_final_final(struct grpc_stt_early_final *early_final, const char *transcript);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
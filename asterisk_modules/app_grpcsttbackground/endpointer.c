@@ -0,0 +1,94 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Client-side endpointer: energy-based end of utterance detection at session
+ * writer. Utterance starts with min_speech of continuous voice and ends after
+ * hangover of silence (gaps filled with silence count as well), so recognition
+ * stream may be half-closed without waiting for server VAD.
+ */
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include "endpointer.h"
+#include "amd.h"
+
+#include <asterisk.h>
+#include <asterisk/frame.h>
+#include <asterisk/utils.h>
+
+
+#define SAMPLE_RATE 8000
+
+const struct grpc_stt_endpointer_conf grpc_stt_endpointer_dflt_conf = {
+	.silence_threshold = 256,
+	.min_speech = 100,
+	.hangover = 600,
+};
+
+struct grpc_stt_endpointer {
+	struct grpc_stt_endpointer_conf conf;
+	int voice_ms;    /* Continuous voice before utterance start */
+	int silence_ms;  /* Silence since utterance voice */
+	int in_utterance;
+	int ended;
+};
+
+
+struct grpc_stt_endpointer *grpc_stt_endpointer_create(const struct grpc_stt_endpointer_conf *conf)
+{
+	struct grpc_stt_endpointer *endpointer = ast_calloc(1, sizeof(struct grpc_stt_endpointer));
+	if (!endpointer)
+		return NULL;
+	endpointer->conf = *conf;
+	return endpointer;
+}
+void grpc_stt_endpointer_destroy(struct grpc_stt_endpointer *endpointer)
+{
+	ast_free(endpointer);
+}
+
+static int process(struct grpc_stt_endpointer *endpointer, int amplitude, int duration_ms)
+{
+	if (endpointer->ended)
+		return 0;
+	if (amplitude >= endpointer->conf.silence_threshold) {
+		endpointer->silence_ms = 0;
+		endpointer->voice_ms += duration_ms;
+		if (endpointer->voice_ms >= endpointer->conf.min_speech)
+			endpointer->in_utterance = 1;
+		return 0;
+	}
+	endpointer->voice_ms = 0;
+	if (!endpointer->in_utterance)
+		return 0;
+	endpointer->silence_ms += duration_ms;
+	if (endpointer->silence_ms < endpointer->conf.hangover)
+		return 0;
+	endpointer->ended = 1;
+	return 1;
+}
+int grpc_stt_endpointer_process_frame(struct grpc_stt_endpointer *endpointer, struct ast_frame *f)
+{
+	int amplitude = grpc_stt_frame_average_amplitude(f);
+	if (amplitude < 0)
+		return 0;
+	return process(endpointer, amplitude, f->samples*1000/SAMPLE_RATE);
+}
+int grpc_stt_endpointer_process_gap(struct grpc_stt_endpointer *endpointer, int samples)
+{
+	return process(endpointer, 0, samples*1000/SAMPLE_RATE);
+}
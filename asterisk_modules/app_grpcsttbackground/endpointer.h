@@ -0,0 +1,48 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_ENDPOINTER_H
+#define GRPC_STT_ENDPOINTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ast_frame;
+
+struct grpc_stt_endpointer_conf {
+	int silence_threshold; /* Average absolute SLINEAR amplitude below which audio is silence */
+	int min_speech;        /* Milliseconds of continuous voice starting utterance */
+	int hangover;          /* Milliseconds of silence after utterance ending it */
+};
+
+extern const struct grpc_stt_endpointer_conf grpc_stt_endpointer_dflt_conf;
+
+struct grpc_stt_endpointer;
+
+extern struct grpc_stt_endpointer *grpc_stt_endpointer_create(const struct grpc_stt_endpointer_conf *conf);
+extern void grpc_stt_endpointer_destroy(struct grpc_stt_endpointer *endpointer);
+
+/* Feeds voice frame. Returns 1 once when utterance is over. */
+extern int grpc_stt_endpointer_process_frame(struct grpc_stt_endpointer *endpointer, struct ast_frame *f);
+
+/* Feeds gap of missing audio (filled with silence at stream). Returns 1 once when utterance is over. */
+extern int grpc_stt_endpointer_process_gap(struct grpc_stt_endpointer *endpointer, int samples);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
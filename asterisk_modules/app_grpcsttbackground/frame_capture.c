@@ -0,0 +1,122 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Frame capture recorder: records are appended with buffered stdio under
+ * capture lock from framehook and from dialplan (markers), in the same order
+ * frames are queued to writer.
+ */
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include "frame_capture.h"
+#include "grpc_stt.h"
+
+#include <asterisk.h>
+#include <asterisk/format_cache.h>
+#include <asterisk/frame.h>
+#include <asterisk/lock.h>
+#include <asterisk/logger.h>
+#include <asterisk/utils.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+struct grpc_stt_frame_capture {
+	ast_mutex_t mutex;
+	FILE *file;
+	struct timespec start;
+	int failed;
+};
+
+
+static inline int64_t elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return ((int64_t) (now.tv_sec - start->tv_sec))*1000000000 + (now.tv_nsec - start->tv_nsec);
+}
+static uint8_t frame_codec(const struct ast_frame *frame)
+{
+	if (frame->subclass.format == ast_format_alaw)
+		return GRPC_STT_FRAME_FORMAT_ALAW;
+	if (frame->subclass.format == ast_format_ulaw)
+		return GRPC_STT_FRAME_FORMAT_MULAW;
+	if (frame->subclass.format == ast_format_slin)
+		return GRPC_STT_FRAME_FORMAT_SLINEAR16;
+	return GRPC_STT_CAPTURE_CODEC_UNKNOWN;
+}
+
+struct grpc_stt_frame_capture *grpc_stt_frame_capture_open(const char *path, int frame_format)
+{
+	struct grpc_stt_frame_capture *capture = ast_calloc(1, sizeof(struct grpc_stt_frame_capture));
+	if (!capture)
+		return NULL;
+	capture->file = fopen(path, "wb");
+	if (!capture->file) {
+		ast_log(LOG_ERROR, "Failed to create STT frame capture '%s': %s\n", path, strerror(errno));
+		ast_free(capture);
+		return NULL;
+	}
+	ast_mutex_init(&capture->mutex);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &capture->start);
+	struct timespec realtime;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	struct grpc_stt_capture_header header = {
+		.magic = GRPC_STT_CAPTURE_MAGIC,
+		.version = GRPC_STT_CAPTURE_VERSION,
+		.start_realtime_ns = ((int64_t) realtime.tv_sec)*1000000000 + realtime.tv_nsec,
+		.frame_format = frame_format,
+		.reserved = 0,
+	};
+	if (fwrite(&header, sizeof(header), 1, capture->file) != 1)
+		capture->failed = 1;
+	return capture;
+}
+void grpc_stt_frame_capture_record(struct grpc_stt_frame_capture *capture, enum grpc_stt_capture_kind kind, const struct ast_frame *frame)
+{
+	int voice = kind == GRPC_STT_CAPTURE_VOICE || kind == GRPC_STT_CAPTURE_PREROLL;
+	struct grpc_stt_capture_record record = {
+		.arrival_ns = elapsed_ns(&capture->start),
+		.kind = kind,
+		.codec = voice ? frame_codec(frame) : GRPC_STT_CAPTURE_CODEC_UNKNOWN,
+		.reserved = 0,
+		.samples = voice ? frame->samples : 0,
+		.length = (voice || frame->datalen <= 0) ? frame->datalen : (uint32_t) strlen(frame->data.ptr),
+	};
+
+	ast_mutex_lock(&capture->mutex);
+	if (!capture->failed) {
+		if (fwrite(&record, sizeof(record), 1, capture->file) != 1 ||
+		    (record.length && fwrite(frame->data.ptr, record.length, 1, capture->file) != 1)) {
+			/* Replay stops at truncated record */
+			ast_log(LOG_WARNING, "STT frame capture stopped: %s\n", strerror(errno));
+			capture->failed = 1;
+		}
+	}
+	ast_mutex_unlock(&capture->mutex);
+}
+void grpc_stt_frame_capture_close(struct grpc_stt_frame_capture *capture)
+{
+	if (!capture)
+		return;
+	fclose(capture->file);
+	ast_mutex_destroy(&capture->mutex);
+	ast_free(capture);
+}
@@ -0,0 +1,84 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Capture of frames queued to STT writer ([capture] section of grpcstt.conf).
+ *
+ * File is header followed by records in queue order: record header + payload
+ * (audio bytes as captured or marker text). Arrival times are CLOCK_MONOTONIC_RAW
+ * (the clock of writer) relative to capture start. All fields are host byte order.
+ *
+ * Format part of this header is intentionally free of Asterisk dependencies so
+ * that it can be used by replay tool (stt_replay.cpp).
+ */
+
+#ifndef GRPC_STT_FRAME_CAPTURE_H
+#define GRPC_STT_FRAME_CAPTURE_H
+
+#include <stdint.h>
+
+#define GRPC_STT_CAPTURE_MAGIC 0x50414353 /* "SCAP" */
+#define GRPC_STT_CAPTURE_VERSION 1
+
+#define GRPC_STT_CAPTURE_FILE_SUFFIX ".sttcap"
+
+enum grpc_stt_capture_kind {
+	GRPC_STT_CAPTURE_VOICE = 1,
+	GRPC_STT_CAPTURE_PREROLL = 2, /* voice frame of buffered past audio */
+	GRPC_STT_CAPTURE_SEGMENT = 3, /* payload: segment name */
+	GRPC_STT_CAPTURE_PAUSE = 4,   /* payload: "1" (paused) or "0" (resumed) */
+};
+
+/* Codec of voice payload: values of enum grpc_stt_frame_format */
+#define GRPC_STT_CAPTURE_CODEC_UNKNOWN 0xFF
+
+struct grpc_stt_capture_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t start_realtime_ns; /* CLOCK_REALTIME of capture start */
+	uint32_t frame_format; /* enum grpc_stt_frame_format of session stream */
+	uint32_t reserved;
+};
+
+struct grpc_stt_capture_record {
+	int64_t arrival_ns; /* since capture start */
+	uint8_t kind; /* enum grpc_stt_capture_kind */
+	uint8_t codec;
+	uint16_t reserved;
+	uint32_t samples;
+	uint32_t length; /* payload bytes following record header */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ast_frame;
+struct grpc_stt_frame_capture;
+
+/* Returns NULL if file can't be created (error is logged) */
+extern struct grpc_stt_frame_capture *grpc_stt_frame_capture_open(const char *path, int frame_format);
+
+/* Appends frame queued to writer: audio for voice kinds, text of marker otherwise. Thread-safe. */
+extern void grpc_stt_frame_capture_record(struct grpc_stt_frame_capture *capture, enum grpc_stt_capture_kind kind,
+					  const struct ast_frame *frame);
+
+extern void grpc_stt_frame_capture_close(struct grpc_stt_frame_capture *capture);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -18,17 +18,27 @@ extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
 
 #define typeof __typeof__
 #include "stt.grpc.pb.h"
-#include "roots.pem.h"
 #include "grpc_stt.h"
-#include "jwt.h"
+#include "grpc_stt_stream.h"
+#include "stream_pool.h"
+#include "shm_stt.h"
+#include "preroll.h"
+#include "stt_profile.h"
+#include "stt_pacer.h"
+#include "frame_capture.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <iostream>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <string>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 
 #include <grpcpp/channel.h>
@@ -51,47 +61,81 @@ extern "C" {
 }
 
 
-// 7 days
-#define EXPIRATION_PERIOD (7*86400)
+// Source of text frames queued into audio frame list as segment markers
+#define SEGMENT_MARKER_SRC "GRPCSTTSegment"
 
-#define INTERNAL_SAMPLE_RATE 8000
-#define MAX_FRAME_DURATION_MSEC 100
-#define MAX_FRAME_SAMPLES 800
-#define ALIGNMENT_SAMPLES 80
+// Source of text frames queued into audio frame list as pause ("1") and resume ("0") markers
+#define PAUSE_MARKER_SRC "GRPCSTTPause"
 
+// Source prefix of frames written by PlayBackground() (app_playbackground)
+#define PLAYBACKGROUND_FRAME_SRC_PREFIX "PlayBackground"
 
-static const std::string grpc_roots_pem_string ((const char *) grpc_roots_pem, sizeof(grpc_roots_pem));
+// Automatic pause lasts this long after last PlayBackground() frame to cover echo tail
+#define AUTO_PAUSE_HANGOVER_MSEC 300
 
+// Written audio frames remembered for latency timestamps (a minute of 20 ms frames)
+#define MAX_AUDIO_MARKS 3000
 
-static inline int delta_samples(const struct timespec *a, const struct timespec *b)
+
+// Moment of processing stage: clocks are the same as of GET_TIME_NSEC(MONOTONIC) and GET_TIME_NSEC(UTC)
+struct GRPCSTTTimestamp
 {
-	struct timespec delta;
-	delta.tv_sec = a->tv_sec - b->tv_sec;
-	delta.tv_nsec = a->tv_nsec - b->tv_nsec;
-	if (delta.tv_nsec < 0) {
-		delta.tv_sec--;
-		delta.tv_nsec += 1000000000;
-	}
-	
-	return delta.tv_sec*INTERNAL_SAMPLE_RATE + ((int64_t) delta.tv_nsec)*INTERNAL_SAMPLE_RATE/1000000000;
+	struct timespec monotonic;
+	struct timespec realtime;
+};
+typedef std::vector<std::pair<const char *, GRPCSTTTimestamp>> GRPCSTTStages;
+
+// Audio frame written to stream: looked up by end time of recognition result
+struct GRPCSTTAudioMark
+{
+	int64_t end_samples; // stream sample offset past the frame
+	GRPCSTTTimestamp captured;
+	GRPCSTTTimestamp written;
+};
+
+
+static inline void eventfd_skip(int fd)
+{
+	eventfd_t value;
+	read(fd, &value, sizeof(eventfd_t));
 }
-static inline void time_add_samples(struct timespec *t, int samples)
+static inline GRPCSTTTimestamp timestamp_now()
 {
-	t->tv_sec += samples/INTERNAL_SAMPLE_RATE;
-	t->tv_nsec += ((int64_t) (samples%INTERNAL_SAMPLE_RATE))*1000000000/INTERNAL_SAMPLE_RATE;
-	if (t->tv_nsec >= 1000000000) {
-		t->tv_sec++;
-		t->tv_nsec -= 1000000000;
-	}
+	GRPCSTTTimestamp t;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t.monotonic);
+	clock_gettime(CLOCK_REALTIME, &t.realtime);
+	return t;
 }
-static inline int aligned_samples(int samples)
+static inline int64_t monotonic_msec()
 {
-	return (samples + ALIGNMENT_SAMPLES/2)/ALIGNMENT_SAMPLES*ALIGNMENT_SAMPLES;
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((int64_t) t.tv_sec)*1000 + t.tv_nsec/1000000;
 }
-static inline void eventfd_skip(int fd)
+static inline int64_t duration_samples(const google::protobuf::Duration &duration)
 {
-	eventfd_t value;
-	read(fd, &value, sizeof(eventfd_t));
+	return duration.seconds()*INTERNAL_SAMPLE_RATE + ((int64_t) duration.nanos())*INTERNAL_SAMPLE_RATE/1000000000;
+}
+static json_t *build_json_timestamps(const GRPCSTTStages &stages)
+{
+	GRPCSTTStages all_stages(stages);
+	all_stages.push_back(std::make_pair("event_published", timestamp_now()));
+	json_t *json_timestamps = json_object();
+	for (const std::pair<const char *, GRPCSTTTimestamp> &stage: all_stages) {
+		json_t *json_timestamp = json_object();
+		json_object_set_new_nocheck(json_timestamp, "monotonic", json_real(stage.second.monotonic.tv_sec + stage.second.monotonic.tv_nsec/1000000000.0));
+		json_object_set_new_nocheck(json_timestamp, "realtime", json_real(stage.second.realtime.tv_sec + stage.second.realtime.tv_nsec/1000000000.0));
+		json_object_set_new_nocheck(json_timestamps, stage.first, json_timestamp);
+	}
+	return json_timestamps;
+}
+static std::string dump_json(json_t *json_root, bool json_ensure_ascii)
+{
+	char *dump = json_dumps(json_root, (json_ensure_ascii ? (JSON_COMPACT | JSON_ENSURE_ASCII) : (JSON_COMPACT)));
+	std::string result(dump);
+	ast_json_free(dump);
+	json_decref(json_root);
+	return result;
 }
 static json_t *build_json_duration(const google::protobuf::Duration &duration)
 {
@@ -107,7 +151,8 @@ static json_t *build_json_gender_identification_result(const float male_proba, c
 	json_object_set_new_nocheck(json_gender_identification, "female_proba", json_real(female_proba));
 	return json_gender_identification;
 }
-static std::string build_grpcstt_event(struct ast_channel *chan, const voiptime::cloud::stt::v1::StreamingRecognitionResult &stream_result, bool json_ensure_ascii)
+static std::string build_grpcstt_event(struct ast_channel *chan, const voiptime::cloud::stt::v1::StreamingRecognitionResult &stream_result,
+				       const std::string &segment, const GRPCSTTStages *stages, int early_final_differs, bool json_ensure_ascii)
 {
 	const voiptime::cloud::stt::v1::SpeechRecognitionResult &recognition_result = stream_result.recognition_result();
 	json_t *json_root = json_object();
@@ -129,6 +174,10 @@ static std::string build_grpcstt_event(struct ast_channel *chan, const voiptime:
     json_object_set_new_nocheck(json_root, "configuration", json_string(variable_value));
 	json_object_set_new_nocheck(json_root, "start_time", build_json_duration(recognition_result.start_time()));
 	json_object_set_new_nocheck(json_root, "end_time", build_json_duration(recognition_result.end_time()));
+	if (segment.size())
+		json_object_set_new_nocheck(json_root, "segment", json_string(segment.c_str()));
+	if (early_final_differs != -1)
+		json_object_set_new_nocheck(json_root, "early_final_differs", json_boolean(early_final_differs));
 
 	const voiptime::cloud::stt::v1::SpeechGenderIdentificationResult &gender_identification_result = recognition_result.gender_identification_result();
 	const float male_proba = gender_identification_result.male_proba();
@@ -136,16 +185,24 @@ static std::string build_grpcstt_event(struct ast_channel *chan, const voiptime:
 	if (!(male_proba == 0 && female_proba == 0)) {
 		json_object_set_new_nocheck(json_root, "gender_identification_result", build_json_gender_identification_result(male_proba, female_proba));
 	}
+	if (stages)
+		json_object_set_new_nocheck(json_root, "timestamps", build_json_timestamps(*stages));
 
-	char *dump = json_dumps(json_root, (json_ensure_ascii ? (JSON_COMPACT | JSON_ENSURE_ASCII) : (JSON_COMPACT)));
-	std::string result(dump);
-	ast_json_free(dump);
-	json_decref(json_root);
-	return result;
+	return dump_json(json_root, json_ensure_ascii);
+}
+static std::string build_grpcstt_x_request_id_event(const std::string &x_request_id, const GRPCSTTStages *stages)
+{
+	if (!stages)
+		return x_request_id;
+	json_t *json_root = json_object();
+	json_object_set_new_nocheck(json_root, "x_request_id", json_string(x_request_id.c_str()));
+	json_object_set_new_nocheck(json_root, "timestamps", build_json_timestamps(*stages));
+	return dump_json(json_root, false);
 }
-static void push_grpcstt_event(struct ast_channel *chan, const std::string &data, bool ensure_ascii)
+static void push_grpcstt_event(struct ast_channel *chan, const std::string &data, bool ensure_ascii, bool early_final)
 {
-	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", (ensure_ascii ? "SpeechRecognition" : "SpeechRecognition"), "eventbody", data.c_str());
+	const char *eventname = early_final ? "SpeechEarlyFinal" : (ensure_ascii ? "SpeechRecognition" : "SpeechRecognition");
+	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", eventname, "eventbody", data.c_str());
 	if (!blob)
 		return;
 
@@ -167,9 +224,38 @@ static void push_grpcstt_x_request_id_event(struct ast_channel *chan, const std:
 
 	ast_json_unref(blob);
 }
-static void push_grpcstt_session_finished_event(struct ast_channel *chan, bool success, int error_code, const std::string &error_message)
+static json_t *build_json_usage(const struct voicekit_usage_report &report)
 {
-	std::string data = success ? "{\"status\": \"SUCCESS\"}" : ("{\"status\": \"FAILURE\", \"code\":" + std::to_string(error_code) + ", \"message\":\"" + error_message + "\"}");
+	double cpu_ms = report.cpu_time*1000.0;
+	json_t *json_usage = json_object();
+	json_object_set_new_nocheck(json_usage, "cpu_ms", json_real(cpu_ms));
+	json_object_set_new_nocheck(json_usage, "cpu_ms_per_second", json_real((report.duration > 0.0) ? cpu_ms/report.duration : 0.0));
+	json_object_set_new_nocheck(json_usage, "duration", json_real(report.duration));
+	json_object_set_new_nocheck(json_usage, "peak_queue_bytes", json_integer(report.peak_queued_bytes));
+	return json_usage;
+}
+static void push_grpcstt_session_finished_event(struct ast_channel *chan, bool success, int error_code, const std::string &error_message,
+						const struct voicekit_usage_report &usage_report, const GRPCSTTStages *stages)
+{
+	json_t *json_root = json_object();
+	if (success) {
+		json_object_set_new_nocheck(json_root, "status", json_string("SUCCESS"));
+	} else {
+		if (error_code == grpc::StatusCode::RESOURCE_EXHAUSTED) {
+			json_object_set_new_nocheck(json_root, "status", json_string("REJECTED"));
+			json_object_set_new_nocheck(json_root, "reason", json_string("RESOURCE_EXHAUSTED"));
+		} else {
+			json_object_set_new_nocheck(json_root, "status", json_string("FAILURE"));
+		}
+		json_object_set_new_nocheck(json_root, "code", json_integer(error_code));
+		// Message comes from service or exception text: not necessarily valid UTF-8
+		json_t *json_message = json_string(error_message.c_str());
+		json_object_set_new_nocheck(json_root, "message", json_message ? json_message : json_string("(invalid UTF-8)"));
+	}
+	json_object_set_new_nocheck(json_root, "usage", build_json_usage(usage_report));
+	if (stages)
+		json_object_set_new_nocheck(json_root, "timestamps", build_json_timestamps(*stages));
+	std::string data = dump_json(json_root, false);
 	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", "SpeechSession", "eventbody", data.c_str());
 	if (!blob)
 		return;
@@ -277,17 +363,6 @@ static const char *get_frame_samples(struct ast_frame *f, enum grpc_stt_frame_fo
 
 	return data;
 }
-static std::vector<uint8_t> make_silence_samples(enum grpc_stt_frame_format frame_format, size_t samples)
-{
-	switch (frame_format) {
-	case GRPC_STT_FRAME_FORMAT_SLINEAR16:
-		return std::vector<uint8_t>(samples*sizeof(int16_t), 0);
-	case GRPC_STT_FRAME_FORMAT_MULAW:
-		return std::vector<uint8_t>(samples, 0x7F /* SLINEAR16 (0) */);
-	default: /* GRPC_STT_FRAME_FORMAT_ALAW */
-		return std::vector<uint8_t>(samples, 0xD5 /* SLINEAR16 (8) */);
-	}
-}
 
 
 AST_LIST_HEAD(grpcstt_frame_list, ast_frame);
@@ -299,7 +374,9 @@ public:
 	static void DetachFromChannel(std::shared_ptr<GRPCSTT> &grpc_stt) noexcept;
 
 public:
-	GRPCSTT(int terminate_event_fd, std::shared_ptr<grpc::Channel> grpc_channel,
+	GRPCSTT(int terminate_event_fd, int start_event_fd, int *prepared_state, double prepare_max_wait,
+		const std::string &endpoint, int ssl_grpc, const std::string &ca_file,
+		std::shared_ptr<grpc::Channel> grpc_channel, const std::string &shm_socket_path,
 		const char *authorization_api_key, const char *authorization_secret_key,
 		const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
 		struct ast_channel *chan,
@@ -307,15 +384,41 @@ public:
 		bool vad_disable, double vad_min_speech_duration, double vad_max_speech_duration,
 		double vad_silence_duration_threshold, double vad_silence_prob_threshold, double vad_aggressiveness,
 		bool interim_results_enable, double interim_results_max_interval, int interim_results_max_predictions,
-		bool enable_gender_identification);
+		bool enable_gender_identification, bool preroll, const struct grpc_stt_beep_conf *beep_conf, bool latency_timestamps,
+		const struct grpc_stt_early_final_conf *early_final_conf, const struct grpc_stt_endpointer_conf *endpointer_conf,
+		bool persistent, bool auto_pause, std::shared_ptr<const GRPCSTTProfile> profile, int setup_timeout_ms,
+		struct grpc_stt_frame_capture *frame_capture, std::shared_ptr<VoiceKitUsage> usage);
 	~GRPCSTT();
 	void ReapAudioFrame(struct ast_frame *frame);
+	void DetectBeep(struct ast_frame *frame);
+	void MarkSegment(const std::string &name);
+	void Pause(bool paused);
+	void ObserveFrame(struct ast_frame *frame, bool written);
+	void Reconfigure(const GRPCSTTRecognitionSettings &settings);
 	void Terminate() noexcept;
+	bool Open(int &error_status, std::string &error_message);
+	bool WaitForStart(int &error_status, std::string &error_message);
 	bool Run(int &error_status, std::string &error_message);
 
+private:
+	bool RunStream(int &error_status, std::string &error_message);
+	bool Finishing();
+	bool ApplyReconfiguration();
+	GRPCSTTRecognitionSettings CurrentSettings() const;
+	bool AutoPaused();
+	std::string SegmentAt(const voiptime::cloud::stt::v1::SpeechRecognitionResult &result);
+	bool AudioMarkAt(const voiptime::cloud::stt::v1::SpeechRecognitionResult &result, GRPCSTTAudioMark &mark);
+
 private:
 	int terminate_event_fd;
-	std::unique_ptr<voiptime::cloud::stt::v1::SpeechToText::Stub> stt_stub;
+	int start_event_fd;
+	int *prepared_state;
+	double prepare_max_wait;
+	std::string endpoint;
+	int ssl_grpc;
+	std::string ca_file;
+	std::shared_ptr<grpc::Channel> grpc_channel;
+	std::string shm_socket_path;
 	std::string authorization_api_key;
 	std::string authorization_secret_key;
 	std::string authorization_issuer;
@@ -327,6 +430,7 @@ private:
 	enum grpc_stt_frame_format frame_format;
 	int frame_event_fd;
 	struct grpcstt_frame_list audio_frames;
+	std::deque<GRPCSTTTimestamp> capture_times; // one per frame of audio_frames (under its lock) if latency_timestamps
 	int framehook_id;
 	bool vad_disable;
 	double vad_min_speech_duration;
@@ -338,14 +442,47 @@ private:
 	double interim_results_max_interval;
 	int interim_results_max_predictions;
 	bool enable_gender_identification;
+	bool preroll;
+	struct grpc_stt_beep_detector *beep_detector; // accessed from framehook only
+	std::shared_ptr<STTStream> stream;
+	int stream_end_event_fd;
+	int reconfigure_event_fd;
+	std::mutex reconfigure_mutex;
+	bool reconfigure_pending;
+	GRPCSTTRecognitionSettings pending_settings;
+	std::string current_segment; // accessed by writer only
+	std::mutex segments_mutex;
+	std::vector<std::pair<int64_t, std::string>> segments; // (stream sample offset, name) of current stream
+	bool latency_timestamps;
+	std::mutex audio_marks_mutex;
+	std::deque<GRPCSTTAudioMark> audio_marks; // of current stream
+	std::shared_ptr<VoiceKitUsage> usage; // audio_frames bytes are accounted as session queue
+	struct grpc_stt_early_final *early_final; // accessed by reader only; NULL if disabled
+	bool endpointing;
+	struct grpc_stt_endpointer_conf endpointer_conf;
+	bool persistent;
+	std::atomic<bool> utterance_finished; // endpointed utterance of current stream ended (by writer) or got final result (by reader)
+	bool manual_paused; // accessed by writer only
+	bool auto_pause;
+	std::atomic<bool> on_hold; // set from framehook
+	std::atomic<int64_t> playback_active_until; // monotonic milliseconds; set from framehook
+	std::shared_ptr<const GRPCSTTProfile> profile; // nullptr if session has no profile
+	int setup_timeout_ms;
+	struct grpc_stt_frame_capture *frame_capture; // owned; NULL unless frames are captured
 };
 
 
 static struct ast_frame *framehook_event_callback (struct ast_channel *chan, struct ast_frame *frame, enum ast_framehook_event event, void *data)
 {
 	if (frame) {
-		if (event == AST_FRAMEHOOK_EVENT_READ)
+		if (event == AST_FRAMEHOOK_EVENT_READ) {
 			(*(std::shared_ptr<GRPCSTT>*) data)->ReapAudioFrame(frame);
+			if (frame->frametype == AST_FRAME_VOICE)
+				(*(std::shared_ptr<GRPCSTT>*) data)->DetectBeep(frame);
+			(*(std::shared_ptr<GRPCSTT>*) data)->ObserveFrame(frame, false);
+		} else if (event == AST_FRAMEHOOK_EVENT_WRITE) {
+			(*(std::shared_ptr<GRPCSTT>*) data)->ObserveFrame(frame, true);
+		}
 	}
 
 	return frame;
@@ -386,6 +523,23 @@ void GRPCSTT::AttachToChannel(std::shared_ptr<GRPCSTT> &grpc_stt)
 	interface.destroy_cb = framehook_destroy_callback;
 	interface.data = (void*) new std::shared_ptr<GRPCSTT>(grpc_stt);
 	ast_channel_lock(grpc_stt->chan);
+	if (grpc_stt->preroll) {
+		// Taken under the same channel lock as framehook is attached so pre-roll continues exactly with captured audio
+		struct ast_frame *f = grpc_stt_preroll_frame_unlocked(grpc_stt->chan);
+		if (f) {
+			AST_LIST_LOCK(&grpc_stt->audio_frames);
+			AST_LIST_INSERT_HEAD(&grpc_stt->audio_frames, f, frame_list);
+			grpc_stt->usage->QueueAdd(f->datalen);
+			// Not reaped by ReapAudioFrame(): recorded here under the same list lock
+			if (grpc_stt->frame_capture)
+				grpc_stt_frame_capture_record(grpc_stt->frame_capture, GRPC_STT_CAPTURE_PREROLL, f);
+			// Past audio is stamped as captured when it is handed to session
+			if (grpc_stt->latency_timestamps)
+				grpc_stt->capture_times.push_front(timestamp_now());
+			AST_LIST_UNLOCK(&grpc_stt->audio_frames);
+			eventfd_write(grpc_stt->frame_event_fd, 1);
+		}
+	}
 	int id = ast_framehook_attach(grpc_stt->chan, &interface);
 	ast_channel_unlock(grpc_stt->chan);
 	grpc_stt->framehook_id = id;
@@ -400,15 +554,21 @@ void GRPCSTT::DetachFromChannel(std::shared_ptr<GRPCSTT> &grpc_stt) noexcept
 	ast_channel_unlock(grpc_stt->chan);
 	grpc_stt->framehook_id = -1;
 }
-GRPCSTT::GRPCSTT(int terminate_event_fd, std::shared_ptr<grpc::Channel> grpc_channel,
+GRPCSTT::GRPCSTT(int terminate_event_fd, int start_event_fd, int *prepared_state, double prepare_max_wait,
+		 const std::string &endpoint, int ssl_grpc, const std::string &ca_file,
+		 std::shared_ptr<grpc::Channel> grpc_channel, const std::string &shm_socket_path,
 		 const char *authorization_api_key, const char *authorization_secret_key,
 		 const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
 		 struct ast_channel *chan, const char *language_code, int max_alternatives, enum grpc_stt_frame_format frame_format,
 		 bool vad_disable, double vad_min_speech_duration, double vad_max_speech_duration,
 		 double vad_silence_duration_threshold, double vad_silence_prob_threshold, double vad_aggressiveness,
 		 bool interim_results_enable, double interim_results_max_interval, int interim_results_max_predictions,
-		 bool enable_gender_identification)
-	: terminate_event_fd(terminate_event_fd), stt_stub(voiptime::cloud::stt::v1::SpeechToText::NewStub(grpc_channel)),
+		 bool enable_gender_identification, bool preroll, const struct grpc_stt_beep_conf *beep_conf, bool latency_timestamps,
+		 const struct grpc_stt_early_final_conf *early_final_conf, const struct grpc_stt_endpointer_conf *endpointer_conf,
+		 bool persistent, bool auto_pause, std::shared_ptr<const GRPCSTTProfile> profile, int setup_timeout_ms,
+		 struct grpc_stt_frame_capture *frame_capture, std::shared_ptr<VoiceKitUsage> usage)
+	: terminate_event_fd(terminate_event_fd), start_event_fd(start_event_fd), prepared_state(prepared_state), prepare_max_wait(prepare_max_wait),
+	endpoint(endpoint), ssl_grpc(ssl_grpc), ca_file(ca_file), grpc_channel(grpc_channel), shm_socket_path(shm_socket_path),
 	authorization_api_key(authorization_api_key), authorization_secret_key(authorization_secret_key),
 	authorization_issuer(authorization_issuer), authorization_subject(authorization_subject), authorization_audience(authorization_audience),
 	chan(chan), language_code(language_code), max_alternatives(max_alternatives), frame_format(frame_format), framehook_id(-1),
@@ -416,20 +576,37 @@ GRPCSTT::GRPCSTT(int terminate_event_fd, std::shared_ptr<grpc::Channel> grpc_cha
 	vad_silence_duration_threshold(vad_silence_duration_threshold), vad_silence_prob_threshold(vad_silence_prob_threshold), vad_aggressiveness(vad_aggressiveness),
 	interim_results_enable(interim_results_enable), interim_results_max_interval(interim_results_max_interval),
 	interim_results_max_predictions(interim_results_max_predictions),
-	enable_gender_identification(enable_gender_identification)
+	enable_gender_identification(enable_gender_identification), preroll(preroll), reconfigure_pending(false),
+	latency_timestamps(latency_timestamps), usage(usage), endpointing(endpointer_conf != NULL),
+	endpointer_conf(endpointer_conf ? *endpointer_conf : grpc_stt_endpointer_dflt_conf), persistent(persistent), utterance_finished(false),
+	manual_paused(false), auto_pause(auto_pause), on_hold(false), playback_active_until(0), profile(profile),
+	setup_timeout_ms(setup_timeout_ms), frame_capture(frame_capture)
 {
+	beep_detector = beep_conf ? grpc_stt_beep_detector_create(beep_conf) : NULL;
+	early_final = early_final_conf ? grpc_stt_early_final_create(early_final_conf) : NULL;
 	frame_event_fd = eventfd(0, 0);
 	fcntl(frame_event_fd, F_SETFL, fcntl(frame_event_fd, F_GETFL) | O_NONBLOCK);
+	stream_end_event_fd = eventfd(0, 0);
+	fcntl(stream_end_event_fd, F_SETFL, fcntl(stream_end_event_fd, F_GETFL) | O_NONBLOCK);
+	reconfigure_event_fd = eventfd(0, 0);
+	fcntl(reconfigure_event_fd, F_SETFL, fcntl(reconfigure_event_fd, F_GETFL) | O_NONBLOCK);
 	AST_LIST_HEAD_INIT(&audio_frames);
 }
 GRPCSTT::~GRPCSTT()
 {
+	grpc_stt_beep_detector_destroy(beep_detector);
+	grpc_stt_early_final_destroy(early_final);
+	grpc_stt_frame_capture_close(frame_capture);
 	close(frame_event_fd);
+	close(stream_end_event_fd);
+	close(reconfigure_event_fd);
 
 	AST_LIST_LOCK(&audio_frames);
 	struct ast_frame *f;
-	while ((f = AST_LIST_REMOVE_HEAD(&audio_frames, frame_list)))
+	while ((f = AST_LIST_REMOVE_HEAD(&audio_frames, frame_list))) {
+		usage->QueueAdd(-(long long) f->datalen);
 		ast_frame_dtor(f);
+	}
 	AST_LIST_UNLOCK(&audio_frames);
 }
 void GRPCSTT::ReapAudioFrame(struct ast_frame *frame)
@@ -440,15 +617,164 @@ void GRPCSTT::ReapAudioFrame(struct ast_frame *frame)
 
 	AST_LIST_LOCK(&audio_frames);
 	AST_LIST_INSERT_TAIL(&audio_frames, f, frame_list);
+	usage->QueueAdd(f->datalen);
+	if (frame_capture) {
+		// Recorded under list lock: capture order is queue order
+		if (f->frametype == AST_FRAME_VOICE)
+			grpc_stt_frame_capture_record(frame_capture, GRPC_STT_CAPTURE_VOICE, f);
+		else if (f->frametype == AST_FRAME_TEXT && f->src && !strcmp(f->src, SEGMENT_MARKER_SRC))
+			grpc_stt_frame_capture_record(frame_capture, GRPC_STT_CAPTURE_SEGMENT, f);
+		else if (f->frametype == AST_FRAME_TEXT && f->src && !strcmp(f->src, PAUSE_MARKER_SRC))
+			grpc_stt_frame_capture_record(frame_capture, GRPC_STT_CAPTURE_PAUSE, f);
+	}
+	if (latency_timestamps)
+		capture_times.push_back(timestamp_now());
 	AST_LIST_UNLOCK(&audio_frames);
 
 	eventfd_write(frame_event_fd, 1);
 }
+void GRPCSTT::DetectBeep(struct ast_frame *frame)
+{
+	if (beep_detector)
+		grpc_stt_beep_detector_process_frame(beep_detector, chan, frame);
+}
+void GRPCSTT::MarkSegment(const std::string &name)
+{
+	// Marker goes through the same list as audio so it is ordered exactly against captured frames
+	struct ast_frame marker;
+	memset(&marker, 0, sizeof(marker));
+	marker.frametype = AST_FRAME_TEXT;
+	marker.src = SEGMENT_MARKER_SRC;
+	marker.data.ptr = (void *) name.c_str();
+	marker.datalen = name.size() + 1;
+	ReapAudioFrame(&marker);
+}
+void GRPCSTT::Pause(bool paused)
+{
+	// Marker is ordered against captured frames the same way as segment marker
+	struct ast_frame marker;
+	memset(&marker, 0, sizeof(marker));
+	marker.frametype = AST_FRAME_TEXT;
+	marker.src = PAUSE_MARKER_SRC;
+	marker.data.ptr = (void *) (paused ? "1" : "0");
+	marker.datalen = 2;
+	ReapAudioFrame(&marker);
+}
+void GRPCSTT::ObserveFrame(struct ast_frame *frame, bool written)
+{
+	if (!auto_pause)
+		return;
+	if (frame->frametype == AST_FRAME_CONTROL) {
+		// Hold may be indicated by either side
+		if (frame->subclass.integer == AST_CONTROL_HOLD)
+			on_hold = true;
+		else if (frame->subclass.integer == AST_CONTROL_UNHOLD)
+			on_hold = false;
+	} else if (written && frame->frametype == AST_FRAME_VOICE && frame->src &&
+		   !strncmp(frame->src, PLAYBACKGROUND_FRAME_SRC_PREFIX, sizeof(PLAYBACKGROUND_FRAME_SRC_PREFIX) - 1)) {
+		playback_active_until = monotonic_msec() + AUTO_PAUSE_HANGOVER_MSEC;
+	}
+}
+bool GRPCSTT::AutoPaused()
+{
+	return auto_pause && (on_hold || monotonic_msec() < playback_active_until);
+}
+void GRPCSTT::Reconfigure(const GRPCSTTRecognitionSettings &settings)
+{
+	{
+		std::lock_guard<std::mutex> lock(reconfigure_mutex);
+		pending_settings = settings;
+		reconfigure_pending = true;
+	}
+	eventfd_write(reconfigure_event_fd, 1);
+}
+bool GRPCSTT::Finishing()
+{
+	struct pollfd pfd = {
+		.fd = terminate_event_fd,
+		.events = POLLIN,
+		.revents = 0,
+	};
+	return poll(&pfd, 1, 0) > 0 || ast_check_hangup_locked(chan);
+}
+bool GRPCSTT::ApplyReconfiguration()
+{
+	if (Finishing())
+		return false;
+
+	std::lock_guard<std::mutex> lock(reconfigure_mutex);
+	if (!reconfigure_pending)
+		return false;
+	reconfigure_pending = false;
+	language_code = pending_settings.language_code;
+	max_alternatives = pending_settings.max_alternatives;
+	frame_format = pending_settings.frame_format;
+	vad_disable = pending_settings.vad_disable;
+	vad_min_speech_duration = pending_settings.vad_min_speech_duration;
+	vad_max_speech_duration = pending_settings.vad_max_speech_duration;
+	vad_silence_duration_threshold = pending_settings.vad_silence_duration_threshold;
+	vad_silence_prob_threshold = pending_settings.vad_silence_prob_threshold;
+	vad_aggressiveness = pending_settings.vad_aggressiveness;
+	interim_results_enable = pending_settings.interim_results_enable;
+	interim_results_max_interval = pending_settings.interim_results_max_interval;
+	interim_results_max_predictions = pending_settings.interim_results_max_predictions;
+	enable_gender_identification = pending_settings.enable_gender_identification;
+	return true;
+}
+GRPCSTTRecognitionSettings GRPCSTT::CurrentSettings() const
+{
+	GRPCSTTRecognitionSettings settings;
+	settings.language_code = language_code;
+	settings.max_alternatives = max_alternatives;
+	settings.frame_format = frame_format;
+	settings.vad_disable = vad_disable;
+	settings.vad_min_speech_duration = vad_min_speech_duration;
+	settings.vad_max_speech_duration = vad_max_speech_duration;
+	settings.vad_silence_duration_threshold = vad_silence_duration_threshold;
+	settings.vad_silence_prob_threshold = vad_silence_prob_threshold;
+	settings.vad_aggressiveness = vad_aggressiveness;
+	settings.interim_results_enable = interim_results_enable;
+	settings.interim_results_max_interval = interim_results_max_interval;
+	settings.interim_results_max_predictions = interim_results_max_predictions;
+	settings.enable_gender_identification = enable_gender_identification;
+	return settings;
+}
+std::string GRPCSTT::SegmentAt(const voiptime::cloud::stt::v1::SpeechRecognitionResult &result)
+{
+	std::lock_guard<std::mutex> lock(segments_mutex);
+	// Result without timing belongs to latest segment
+	if (!result.has_start_time())
+		return segments.back().second;
+	int64_t start_samples = duration_samples(result.start_time());
+	for (std::vector<std::pair<int64_t, std::string>>::reverse_iterator it = segments.rbegin(); it != segments.rend(); ++it) {
+		if (it->first <= start_samples)
+			return it->second;
+	}
+	return segments.front().second;
+}
+bool GRPCSTT::AudioMarkAt(const voiptime::cloud::stt::v1::SpeechRecognitionResult &result, GRPCSTTAudioMark &mark)
+{
+	std::lock_guard<std::mutex> lock(audio_marks_mutex);
+	if (audio_marks.empty())
+		return false;
+	// Result without timing is attributed to latest audio
+	if (!result.has_end_time()) {
+		mark = audio_marks.back();
+		return true;
+	}
+	// First frame reaching result end carries last contributing audio
+	int64_t end_samples = duration_samples(result.end_time());
+	std::deque<GRPCSTTAudioMark>::iterator it = std::lower_bound(
+		audio_marks.begin(), audio_marks.end(), end_samples,
+		[](const GRPCSTTAudioMark &m, int64_t samples) { return m.end_samples < samples; });
+	mark = (it != audio_marks.end()) ? *it : audio_marks.back();
+	return true;
+}
 void GRPCSTT::Terminate() noexcept
 {
 	eventfd_write(terminate_event_fd, 1);
 }
-bool GRPCSTT::Run(int &error_status, std::string &error_message)
+bool GRPCSTT::Open(int &error_status, std::string &error_message)
 {
 	error_status = 0;
 	error_message = "";
@@ -456,47 +782,54 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
     const char *variable_configuration = "ai_voicemail";
     const char *variable_configuration_value = pbx_builtin_getvar_helper(chan, variable_configuration);
 
-    authorization_api_key = get_voiptime_value_for_key(variable_configuration_value, "access_token");
-
-	grpc::ClientContext context;
-	if (authorization_api_key.size() && authorization_secret_key.size() &&
-	    authorization_issuer.size() && authorization_subject.size() && authorization_audience.size()) {
-		int64_t expiration_time_sec = time(NULL) + EXPIRATION_PERIOD;
-
-		std::string jwt = "Bearer " + GenerateJWT(
-			authorization_api_key, authorization_secret_key,
-			authorization_issuer, authorization_subject, authorization_audience,
-			expiration_time_sec);
-		context.AddMetadata("authorization", jwt);
+	const char *access_token = variable_configuration_value ? get_voiptime_value_for_key(variable_configuration_value, "access_token") : nullptr;
+	if (access_token) {
+		authorization_api_key = access_token;
+		delete[] access_token;
 	}
 
-	std::shared_ptr<grpc::ClientReaderWriter<voiptime::cloud::stt::v1::StreamingRecognizeRequest,
-						 voiptime::cloud::stt::v1::StreamingRecognizeResponse>> stream(stt_stub->StreamingRecognize(&context));
-
+	std::string authorization = voicekit_grpc_authorization(
+		authorization_api_key, authorization_secret_key,
+		authorization_issuer, authorization_subject, authorization_audience);
 
+	GRPCSTTStages stages;
 	try {
+		if (grpc_channel) {
+			stream = grpc_stt_stream_pool.Take(endpoint, ssl_grpc, ca_file,
+							   authorization_api_key, authorization_secret_key,
+							   authorization_issuer, authorization_subject, authorization_audience);
+			if (!stream)
+				stream = std::make_shared<GRPCSTTStream>(grpc_channel, authorization);
+		} else {
+			stream = std::make_shared<SHMSTTStream>(shm_socket_path);
+		}
+		if (latency_timestamps)
+			stages.push_back(std::make_pair("stream_opened", timestamp_now()));
+		// Unreachable or stalled service fails setup instead of holding session (shared memory peer is local)
+		std::shared_ptr<GRPCSTTStream> grpc_stream = std::dynamic_pointer_cast<GRPCSTTStream>(stream);
+		VoiceKitDeadline setup_deadline(grpc_stream ? setup_timeout_ms : 0,
+						[grpc_stream]()
+						{
+							grpc_stream->Cancel();
+						});
+
 		std::thread writer(
-			[stream, &variable_configuration_value, this]()
+			[&variable_configuration_value, this]()
 			{
+				VoiceKitUsageThreadScope usage_thread_scope(usage, "grpcstt-config");
 				{
 					voiptime::cloud::stt::v1::StreamingRecognizeRequest initial_request;
 					voiptime::cloud::stt::v1::StreamingRecognitionConfig *streaming_recognition_config = initial_request.mutable_streaming_config();
+					GRPCSTTRecognitionSettings settings = CurrentSettings();
+					if (profile && profile->Settings() == settings)
+						streaming_recognition_config->CopyFrom(profile->Config());
+					else
+						GRPCSTTProfile::BuildConfig(settings, streaming_recognition_config);
+					// Stream is half-closed at end of utterance anyway: let service finish at first phrase too
+					if (endpointing)
+						streaming_recognition_config->set_single_utterance(true);
 					{
 						voiptime::cloud::stt::v1::RecognitionConfig *recognition_config = streaming_recognition_config->mutable_config();
-						switch (frame_format) {
-						case GRPC_STT_FRAME_FORMAT_SLINEAR16:
-							recognition_config->set_encoding(voiptime::cloud::stt::v1::LINEAR16);
-							break;
-						case GRPC_STT_FRAME_FORMAT_MULAW:
-							recognition_config->set_encoding(voiptime::cloud::stt::v1::MULAW);
-							break;
-						default:
-							recognition_config->set_encoding(voiptime::cloud::stt::v1::ALAW);
-						}
-						recognition_config->set_sample_rate_hertz(INTERNAL_SAMPLE_RATE);
-						recognition_config->set_num_channels(1);
-						if (language_code.size())
-							recognition_config->set_language_code(language_code);
 						const char *variable_name = "MACRO_EXTEN";
                         const char *variable_value = pbx_builtin_getvar_helper(chan, variable_name);
 						recognition_config->set_channel_exten(variable_value);
@@ -510,35 +843,24 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
 						recognition_config->set_application_id(application_id);
 						recognition_config->set_statistic_id(statistic_id);
 						recognition_config->set_request_uuid(request_uuid);
-						recognition_config->set_max_alternatives(max_alternatives);
-						if (vad_disable) {
-							recognition_config->set_do_not_perform_vad(true);
-						} else {
-							voiptime::cloud::stt::v1::VoiceActivityDetectionConfig *vad_config = recognition_config->mutable_vad_config();
-							vad_config->set_min_speech_duration(vad_min_speech_duration);
-							vad_config->set_max_speech_duration(vad_max_speech_duration);
-							vad_config->set_silence_duration_threshold(vad_silence_duration_threshold);
-							vad_config->set_silence_prob_threshold(vad_silence_prob_threshold);
-							vad_config->set_aggressiveness(vad_aggressiveness);
-						}
-						recognition_config->set_enable_gender_identification(enable_gender_identification);
-					}
-					{
-						voiptime::cloud::stt::v1::InterimResultsConfig *interim_results_config = streaming_recognition_config->mutable_interim_results_config();
-						interim_results_config->set_enable_interim_results(interim_results_enable);
-						interim_results_config->set_interval(interim_results_max_interval);
-						interim_results_config->set_max_predictions(interim_results_max_predictions);
 					}
 					stream->Write(initial_request);
 				}
 			}
 		);
 		writer.join();
+		if (latency_timestamps)
+			stages.push_back(std::make_pair("config_written", timestamp_now()));
 
-		stream->WaitForInitialMetadata();
-		const std::multimap<grpc::string_ref, grpc::string_ref> &metadata = context.GetServerInitialMetadata();
-		std::multimap<grpc::string_ref, grpc::string_ref>::const_iterator x_request_id_it = metadata.find("x-request-id");
-		push_grpcstt_x_request_id_event(chan, (x_request_id_it != metadata.end()) ? std::string(x_request_id_it->second.data(), x_request_id_it->second.size()) : "");
+		std::string x_request_id = stream->WaitForRequestId();
+		if (setup_deadline.Disarm()) {
+			error_status = grpc::StatusCode::DEADLINE_EXCEEDED;
+			error_message = "GRPC STT stream was not set up within " + std::to_string(setup_timeout_ms) + " milliseconds";
+			return false;
+		}
+		if (latency_timestamps)
+			stages.push_back(std::make_pair("request_id_received", timestamp_now()));
+		push_grpcstt_x_request_id_event(chan, build_grpcstt_x_request_id_event(x_request_id, (latency_timestamps ? &stages : NULL)));
 	} catch (const std::exception &ex) {
 		error_status = -1;
 		error_message = std::string("GRPC STT finished with error: ") + ex.what();
@@ -548,16 +870,105 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
 		error_message = "GRPC STT finished with unknown error";
 		return false;
 	}
+	return true;
+}
+bool GRPCSTT::WaitForStart(int &error_status, std::string &error_message)
+{
+	if (start_event_fd == -1)
+		return true;
+
+	struct timespec start_moment;
+	clock_gettime(CLOCK_MONOTONIC, &start_moment);
+	while (__atomic_load_n(prepared_state, __ATOMIC_SEQ_CST) != GRPC_STT_PREPARED_STARTED) {
+		struct timespec current_moment;
+		clock_gettime(CLOCK_MONOTONIC, &current_moment);
+		int remaining_msec = (prepare_max_wait - (current_moment.tv_sec - start_moment.tv_sec) -
+				      (current_moment.tv_nsec - start_moment.tv_nsec)/1000000000.0)*1000;
+		if (remaining_msec <= 0) {
+			int expected = GRPC_STT_PREPARED_WAITING;
+			if (!__atomic_compare_exchange_n(prepared_state, &expected, GRPC_STT_PREPARED_ABANDONED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+				break; /* Started just now */
+			error_status = grpc::StatusCode::DEADLINE_EXCEEDED;
+			error_message = "GRPC STT prepared session was not started within " + std::to_string(prepare_max_wait) + " seconds";
+			return false;
+		}
+
+		struct pollfd pfds[2] = {
+			{
+				.fd = terminate_event_fd,
+				.events = POLLIN,
+				.revents = 0,
+			},
+			{
+				.fd = start_event_fd,
+				.events = POLLIN,
+				.revents = 0,
+			},
+		};
+		poll(pfds, 2, remaining_msec);
+		// Finished before start: run as usual to close stream gracefully
+		if (pfds[0].revents & POLLIN)
+			break;
+		if (pfds[1].revents & POLLIN)
+			eventfd_skip(start_event_fd);
+	}
+	return true;
+}
+bool GRPCSTT::Run(int &error_status, std::string &error_message)
+{
+	// Session continues with a new stream when recognition config is replaced or, if persistent,
+	// after endpointed utterance (single_utterance stream cannot take next one)
+	while (RunStream(error_status, error_message)) {
+		if (!ApplyReconfiguration() && !(persistent && utterance_finished && !Finishing()))
+			return true;
+		if (!Open(error_status, error_message))
+			return false;
+	}
+	return false;
+}
+bool GRPCSTT::RunStream(int &error_status, std::string &error_message)
+{
+	error_status = 0;
+	error_message = "";
+
+	{
+		std::lock_guard<std::mutex> lock(segments_mutex);
+		segments.assign(1, std::make_pair((int64_t) 0, current_segment));
+	}
+	{
+		std::lock_guard<std::mutex> lock(audio_marks_mutex);
+		audio_marks.clear();
+	}
+	if (early_final)
+		grpc_stt_early_final_reset(early_final);
+	utterance_finished = false;
 
 	std::thread writer(
-		[stream, this]()
+		[this]()
 		{
-			bool stream_valid = true;
+			VoiceKitUsageThreadScope usage_thread_scope(usage, "grpcstt-writer");
+			// Created per stream: endpointing is restarted with replaced stream
+			struct grpc_stt_endpointer *endpointer = endpointing ? grpc_stt_endpointer_create(&endpointer_conf) : NULL;
+			bool utterance_ended = false;
 			bool warned = false;
-			struct timespec last_frame_moment;
-			clock_gettime(CLOCK_MONOTONIC_RAW, &last_frame_moment);
-			while (stream_valid && !ast_check_hangup_locked(chan)) {
-				struct pollfd pfds[2] = {
+			struct timespec start_moment;
+			clock_gettime(CLOCK_MONOTONIC_RAW, &start_moment);
+			GRPCSTTPacer pacer(frame_format, start_moment,
+					   [this](const char *data, size_t len) -> bool
+					   {
+						   voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
+						   request.set_audio_content(data, len);
+						   return stream->Write(request);
+					   });
+			// Returns true if audio is not to be sent now; writes keepalive silence while paused
+			auto pause_tick = [&]() -> bool
+			{
+				struct timespec current_moment;
+				clock_gettime(CLOCK_MONOTONIC_RAW, &current_moment);
+				return pacer.PauseTick(current_moment, manual_paused || AutoPaused());
+			};
+			while (pacer.Valid() && !utterance_ended && !ast_check_hangup_locked(chan)) {
+				struct pollfd pfds[4] = {
 					{
 						.fd = terminate_event_fd,
 						.events = POLLIN,
@@ -568,73 +979,114 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
 						.events = POLLIN,
 						.revents = 0,
 					},
+					{
+						.fd = stream_end_event_fd,
+						.events = POLLIN,
+						.revents = 0,
+					},
+					{
+						.fd = reconfigure_event_fd,
+						.events = POLLIN,
+						.revents = 0,
+					},
 				};
-				poll(pfds, 2, MAX_FRAME_DURATION_MSEC*2);
-				if (pfds[0].revents & POLLIN)
+				poll(pfds, 4, MAX_FRAME_DURATION_MSEC*2);
+				if ((pfds[0].revents & POLLIN) || (pfds[2].revents & POLLIN))
 					break;
+				if (pfds[3].revents & POLLIN) {
+					eventfd_skip(reconfigure_event_fd);
+					std::lock_guard<std::mutex> lock(reconfigure_mutex);
+					if (reconfigure_pending)
+						break;
+				}
 
 				if (!(pfds[1].revents & POLLIN)) {
+					if (pause_tick())
+						continue;
 					struct timespec current_moment;
 					clock_gettime(CLOCK_MONOTONIC_RAW, &current_moment);
-					int gap_samples = aligned_samples(delta_samples(&current_moment, &last_frame_moment) - MAX_FRAME_SAMPLES);
-					if (gap_samples > 0) {
-//					    ast_log(LOG_WARNING, "Stream GAP SAMPLES specified\n");
-						voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
-						std::vector<uint8_t> buffer = make_silence_samples(frame_format, gap_samples);
-						request.set_audio_content(buffer.data(), buffer.size());
-						if (!stream->Write(request))
-							stream_valid = false;
-						time_add_samples(&last_frame_moment, gap_samples);
-					}
+					int gap_samples = pacer.FillGap(current_moment, MAX_FRAME_SAMPLES);
+					if (gap_samples > 0 && endpointer && grpc_stt_endpointer_process_gap(endpointer, gap_samples))
+						utterance_ended = true;
 					continue;
 				}
 
 				eventfd_skip(frame_event_fd);
 				bool gap_handled = false;
-				while (stream_valid) {
+				while (pacer.Valid()) {
 //				    ast_log(LOG_WARNING, "Stream valid specified\n");
 					AST_LIST_LOCK(&audio_frames);
 					struct ast_frame *f = AST_LIST_REMOVE_HEAD(&audio_frames, frame_list);
+					GRPCSTTTimestamp captured = {};
+					if (f && latency_timestamps) {
+						captured = capture_times.front();
+						capture_times.pop_front();
+					}
 					AST_LIST_UNLOCK(&audio_frames);
 					if (!f) {
 //					    ast_log(LOG_WARNING, "Not f\n");
 					    break;
 					}
+					usage->QueueAdd(-(long long) f->datalen);
+					if (f->frametype == AST_FRAME_VOICE && pause_tick()) {
+						ast_frame_dtor(f);
+						continue;
+					}
 //                    ast_log(LOG_WARNING, "Stream after valid specified\n");
 					if (f->frametype == AST_FRAME_VOICE) {
 //					    ast_log(LOG_WARNING, "Frame voice specified\n");
 						struct timespec current_moment;
 						clock_gettime(CLOCK_MONOTONIC_RAW, &current_moment);
 						if (!gap_handled) {
-							int gap_samples = aligned_samples(delta_samples(&current_moment, &last_frame_moment) - f->samples);
-							if (gap_samples > 0) {
-								voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
-								std::vector<uint8_t> buffer = make_silence_samples(frame_format, gap_samples);
-								request.set_audio_content(buffer.data(), buffer.size());
-								if (!stream->Write(request))
-									stream_valid = false;
-								time_add_samples(&last_frame_moment, gap_samples);
-							}
+							int gap_samples = pacer.FillGap(current_moment, f->samples);
+							if (gap_samples > 0 && endpointer && grpc_stt_endpointer_process_gap(endpointer, gap_samples))
+								utterance_ended = true;
 							gap_handled = true;
 						}
 
-						voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
 						std::vector<uint8_t> buffer;
 						size_t len = 0;
 						const char *data = get_frame_samples(f, frame_format, buffer, &len, &warned);
 						if (data) {
 //						    ast_log(LOG_WARNING, "Data voice specified\n");
-							time_add_samples(&last_frame_moment, f->samples);
-							request.set_audio_content(data, len);
-							if (!stream->Write(request))
-                                stream_valid = false;
+							pacer.WriteAudio(data, len, f->samples);
+							if (latency_timestamps) {
+								GRPCSTTAudioMark mark = {
+									.end_samples = pacer.StreamSamples(),
+									.captured = captured,
+									.written = timestamp_now(),
+								};
+								std::lock_guard<std::mutex> lock(audio_marks_mutex);
+								audio_marks.push_back(mark);
+								if (audio_marks.size() > MAX_AUDIO_MARKS)
+									audio_marks.pop_front();
+							}
+							// Pre-roll is past audio: real-time gap tracking restarts after it
+							if (f->src && !strcmp(f->src, GRPC_STT_PREROLL_SRC)) {
+								clock_gettime(CLOCK_MONOTONIC_RAW, &current_moment);
+								pacer.Restart(current_moment);
+							}
+							if (endpointer && grpc_stt_endpointer_process_frame(endpointer, f))
+								utterance_ended = true;
 						}
+					} else if (f->frametype == AST_FRAME_TEXT && f->src && !strcmp(f->src, SEGMENT_MARKER_SRC)) {
+						current_segment = (const char *) f->data.ptr;
+						std::lock_guard<std::mutex> lock(segments_mutex);
+						segments.push_back(std::make_pair(pacer.StreamSamples(), current_segment));
+					} else if (f->frametype == AST_FRAME_TEXT && f->src && !strcmp(f->src, PAUSE_MARKER_SRC)) {
+						manual_paused = ((const char *) f->data.ptr)[0] == '1';
 					}
 
 					ast_frame_dtor(f);
+					if (utterance_ended)
+						break;
 				}
 			}
 
+			grpc_stt_endpointer_destroy(endpointer);
+			if (utterance_ended)
+				utterance_finished = true;
+			// Half-close: reader drains final result right away
 			stream->WritesDone();
 		}
 	);
@@ -643,8 +1095,34 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
 		voiptime::cloud::stt::v1::StreamingRecognizeResponse response;
 		while (stream->Read(&response)) {
 //		    ast_log(LOG_WARNING, "RESPONSE received\n");
+			GRPCSTTTimestamp received = {};
+			if (latency_timestamps)
+				received = timestamp_now();
 			for (const voiptime::cloud::stt::v1::StreamingRecognitionResult &stream_result: response.results()) {
-				push_grpcstt_event(chan, build_grpcstt_event(chan, stream_result, false), false);
+				GRPCSTTStages stages;
+				if (latency_timestamps) {
+					GRPCSTTAudioMark mark;
+					if (AudioMarkAt(stream_result.recognition_result(), mark)) {
+						stages.push_back(std::make_pair("audio_captured", mark.captured));
+						stages.push_back(std::make_pair("audio_written", mark.written));
+					}
+					stages.push_back(std::make_pair("response_received", received));
+				}
+				if (endpointing && stream_result.is_final())
+					utterance_finished = true;
+				int early_final_differs = -1;
+				if (early_final) {
+					const voiptime::cloud::stt::v1::SpeechRecognitionResult &recognition_result = stream_result.recognition_result();
+					const char *transcript = recognition_result.alternatives_size() ? recognition_result.alternatives(0).transcript().c_str() : "";
+					if (stream_result.is_final()) {
+						early_final_differs = grpc_stt_early_final_final(early_final, transcript);
+					} else if (grpc_stt_early_final_interim(early_final, transcript, monotonic_msec())) {
+						push_grpcstt_event(chan, build_grpcstt_event(chan, stream_result, SegmentAt(recognition_result),
+											     (latency_timestamps ? &stages : NULL), -1, false), false, true);
+					}
+				}
+				push_grpcstt_event(chan, build_grpcstt_event(chan, stream_result, SegmentAt(stream_result.recognition_result()),
+									     (latency_timestamps ? &stages : NULL), early_final_differs, false), false, false);
 //				push_grpcstt_event(chan, build_grpcstt_event(stream_result, true), true);
 			}
 		}
@@ -661,8 +1139,9 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
 		error_message = "GRPC STT finished with unknown error";
 		return false;
 	}
-	Terminate();
+	eventfd_write(stream_end_event_fd, 1);
 	writer.join();
+	eventfd_skip(stream_end_event_fd);
 	grpc::Status status = stream->Finish();
 	if (!status.ok()) {
 		error_status = status.error_code();
@@ -673,48 +1152,329 @@ bool GRPCSTT::Run(int &error_status, std::string &error_message)
 }
 
 
-extern "C" void grpc_stt_run(int terminate_event_fd, const char *endpoint, const char *authorization_api_key, const char *authorization_secret_key,
+// Shared between dialplan and session thread handles
+struct GRPCSTTLink
+{
+	std::mutex mutex;
+	std::shared_ptr<GRPCSTT> grpc_stt; // set while session is running
+	std::string segment; // marked before session is running
+	bool paused; // set before session is running
+	bool finished;
+};
+struct grpc_stt_handle
+{
+	std::shared_ptr<GRPCSTTLink> link;
+};
+
+extern "C" struct grpc_stt_handle *grpc_stt_handle_create(void)
+{
+	try {
+		struct grpc_stt_handle *handle = new grpc_stt_handle;
+		handle->link = std::make_shared<GRPCSTTLink>();
+		handle->link->paused = false;
+		handle->link->finished = false;
+		return handle;
+	} catch (...) {
+		return NULL;
+	}
+}
+extern "C" struct grpc_stt_handle *grpc_stt_handle_dup(struct grpc_stt_handle *handle)
+{
+	try {
+		return new grpc_stt_handle(*handle);
+	} catch (...) {
+		return NULL;
+	}
+}
+extern "C" void grpc_stt_handle_release(struct grpc_stt_handle *handle)
+{
+	delete handle;
+}
+extern "C" void grpc_stt_handle_detach(struct grpc_stt_handle *handle)
+{
+	{
+		std::lock_guard<std::mutex> lock(handle->link->mutex);
+		handle->link->finished = true;
+		handle->link->grpc_stt.reset();
+	}
+	delete handle;
+}
+extern "C" int grpc_stt_handle_finished(struct grpc_stt_handle *handle)
+{
+	std::lock_guard<std::mutex> lock(handle->link->mutex);
+	return handle->link->finished;
+}
+extern "C" void grpc_stt_handle_mark_segment(struct grpc_stt_handle *handle, const char *name)
+{
+	std::lock_guard<std::mutex> lock(handle->link->mutex);
+	if (handle->link->grpc_stt)
+		handle->link->grpc_stt->MarkSegment(name);
+	else
+		handle->link->segment = name;
+}
+extern "C" void grpc_stt_handle_pause(struct grpc_stt_handle *handle, int paused)
+{
+	std::lock_guard<std::mutex> lock(handle->link->mutex);
+	if (handle->link->grpc_stt)
+		handle->link->grpc_stt->Pause(paused);
+	else
+		handle->link->paused = paused;
+}
+extern "C" int grpc_stt_handle_reconfigure(struct grpc_stt_handle *handle, const char *language_code, int max_alternatives,
+					   enum grpc_stt_frame_format frame_format,
+					   int vad_disable, double vad_min_speech_duration, double vad_max_speech_duration,
+					   double vad_silence_duration_threshold, double vad_silence_prob_threshold, double vad_aggressiveness,
+					   int interim_results_enable, double interim_results_max_interval, int interim_results_max_predictions,
+					   int enable_gender_identification)
+{
+	std::lock_guard<std::mutex> lock(handle->link->mutex);
+	if (!handle->link->grpc_stt)
+		return -1;
+	GRPCSTTRecognitionSettings settings;
+	settings.language_code = language_code ? language_code : "";
+	settings.max_alternatives = max_alternatives;
+	settings.frame_format = frame_format;
+	settings.vad_disable = vad_disable;
+	settings.vad_min_speech_duration = vad_min_speech_duration;
+	settings.vad_max_speech_duration = vad_max_speech_duration;
+	settings.vad_silence_duration_threshold = vad_silence_duration_threshold;
+	settings.vad_silence_prob_threshold = vad_silence_prob_threshold;
+	settings.vad_aggressiveness = vad_aggressiveness;
+	settings.interim_results_enable = interim_results_enable;
+	settings.interim_results_max_interval = interim_results_max_interval;
+	settings.interim_results_max_predictions = interim_results_max_predictions;
+	settings.enable_gender_identification = enable_gender_identification;
+	handle->link->grpc_stt->Reconfigure(settings);
+	return 0;
+}
+
+extern "C" void grpc_stt_run(struct grpc_stt_handle *handle, int terminate_event_fd, const char *endpoint, const char *authorization_api_key, const char *authorization_secret_key,
 			     const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
-			     struct ast_channel *chan, int ssl_grpc, const char *ca_data,
+			     struct ast_channel *chan, int ssl_grpc, const char *ca_file,
 			     const char *language_code, int max_alternatives, enum grpc_stt_frame_format frame_format,
 			     int vad_disable, double vad_min_speech_duration, double vad_max_speech_duration,
 			     double vad_silence_duration_threshold, double vad_silence_prob_threshold, double vad_aggressiveness,
 			     int interim_results_enable, double interim_results_max_interval, int interim_results_max_predictions,
-			     int enable_gender_identification)
+			     int enable_gender_identification, int start_event_fd, int *prepared_state, double prepare_max_wait, int preroll,
+			     const struct grpc_stt_beep_conf *beep_conf, int latency_timestamps,
+			     const struct grpc_stt_early_final_conf *early_final_conf, const struct grpc_stt_endpointer_conf *endpointer_conf,
+			     int persistent, int auto_pause, const struct grpc_stt_profile *profile, int setup_timeout_ms, const char *capture_dir,
+			     const struct voicekit_breaker_conf *breaker_conf, int breaker_ticket)
 {
 	bool success = false;
+	bool set_up = false;
+	bool breaker_released = false;
+	// Outcome is known at setup: ticket (a half-open probe in particular) is not held for rest of session
+	auto release_breaker = [&]()
+		{
+			if (breaker_conf && !breaker_released)
+				voicekit_breaker_release(endpoint, breaker_conf, breaker_ticket,
+							 set_up ? VOICEKIT_BREAKER_SUCCESS : VOICEKIT_BREAKER_FAILURE);
+			breaker_released = true;
+		};
 	int error_status;
 	std::string error_message;
+	GRPCSTTStages stages;
+	if (latency_timestamps)
+		stages.push_back(std::make_pair("session_started", timestamp_now()));
+	std::shared_ptr<VoiceKitUsage> usage = std::make_shared<VoiceKitUsage>("STT", ast_channel_name(chan), endpoint);
+	VoiceKitUsageThreadScope usage_thread_scope(usage, "grpcstt-session");
 	try {
-		grpc::SslCredentialsOptions ssl_credentials_options = {
-			.pem_root_certs = ca_data ? ca_data : grpc_roots_pem_string,
-		};
+		std::shared_ptr<grpc::Channel> grpc_channel;
+		std::string shm_socket_path;
+		if (!strncmp(endpoint, SHM_STT_ENDPOINT_PREFIX, strlen(SHM_STT_ENDPOINT_PREFIX)))
+			shm_socket_path = endpoint + strlen(SHM_STT_ENDPOINT_PREFIX);
+		else
+			grpc_channel = voicekit_grpc_get_channel(endpoint, ssl_grpc, (ca_file ? ca_file : ""), grpc_stt_stream_pool.KeepaliveTimeMs());
+		struct grpc_stt_frame_capture *frame_capture = NULL;
+		if (capture_dir) {
+			struct timespec realtime;
+			clock_gettime(CLOCK_REALTIME, &realtime);
+			std::string capture_path = std::string(capture_dir) + "/" + ast_channel_uniqueid(chan) + "-" +
+				std::to_string(((int64_t) realtime.tv_sec)*1000 + realtime.tv_nsec/1000000) + GRPC_STT_CAPTURE_FILE_SUFFIX;
+			frame_capture = grpc_stt_frame_capture_open(capture_path.c_str(), frame_format);
+		}
 #define NON_NULL_STRING(str) ((str) ? (str) : "")
 		std::shared_ptr<GRPCSTT> grpc_stt = std::make_shared<GRPCSTT>(
-			terminate_event_fd,
-			grpc::CreateChannel(endpoint, (ssl_grpc ? grpc::SslCredentials(ssl_credentials_options) : grpc::InsecureChannelCredentials())),
+			terminate_event_fd, start_event_fd, prepared_state, prepare_max_wait,
+			endpoint, ssl_grpc, NON_NULL_STRING(ca_file), grpc_channel, shm_socket_path,
 			NON_NULL_STRING(authorization_api_key), NON_NULL_STRING(authorization_secret_key),
 			NON_NULL_STRING(authorization_issuer), NON_NULL_STRING(authorization_subject), NON_NULL_STRING(authorization_audience),
 			chan, (language_code ? language_code : ""), max_alternatives, frame_format,
 			vad_disable, vad_min_speech_duration, vad_max_speech_duration,
 			vad_silence_duration_threshold, vad_silence_prob_threshold, vad_aggressiveness,
 			interim_results_enable, interim_results_max_interval, interim_results_max_predictions,
-			enable_gender_identification
+			enable_gender_identification, preroll, beep_conf, latency_timestamps, early_final_conf, endpointer_conf, persistent, auto_pause,
+			(profile ? profile->profile : nullptr), setup_timeout_ms, frame_capture, usage
 		);
 #undef NON_NULL_STRING
-		GRPCSTT::AttachToChannel(grpc_stt);
-		try {
-			success = grpc_stt->Run(error_status, error_message);
-			GRPCSTT::DetachFromChannel(grpc_stt);
-		} catch (...) {
-			GRPCSTT::DetachFromChannel(grpc_stt);
-			throw;
+		{
+			std::lock_guard<std::mutex> lock(handle->link->mutex);
+			handle->link->grpc_stt = grpc_stt;
+			if (handle->link->segment.size())
+				grpc_stt->MarkSegment(handle->link->segment);
+			if (handle->link->paused)
+				grpc_stt->Pause(true);
+		}
+		set_up = grpc_stt->Open(error_status, error_message);
+		release_breaker();
+		if (set_up && grpc_stt->WaitForStart(error_status, error_message)) {
+			GRPCSTT::AttachToChannel(grpc_stt);
+			try {
+				success = grpc_stt->Run(error_status, error_message);
+				GRPCSTT::DetachFromChannel(grpc_stt);
+			} catch (...) {
+				GRPCSTT::DetachFromChannel(grpc_stt);
+				throw;
+			}
 		}
 	} catch (const std::exception &ex) {
 		error_status = -1;
 		error_message = std::string("GRPCSTTBackgrond background thread finished with exception: ") + ex.what();
 	}
+	{
+		std::lock_guard<std::mutex> lock(handle->link->mutex);
+		handle->link->grpc_stt.reset();
+	}
+	release_breaker();
 	if (!success)
 		ast_log(AST_LOG_ERROR, "%s\n", error_message.c_str());
-	push_grpcstt_session_finished_event(chan, success, error_status, error_message);
+	if (prepared_state) {
+		// Not started prepared session must not be started after its failure is reported
+		int expected = GRPC_STT_PREPARED_WAITING;
+		__atomic_compare_exchange_n(prepared_state, &expected, GRPC_STT_PREPARED_ABANDONED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	}
+	if (latency_timestamps)
+		stages.push_back(std::make_pair("session_finished", timestamp_now()));
+	struct voicekit_usage_report usage_report;
+	usage->Report(&usage_report);
+	push_grpcstt_session_finished_event(chan, success, error_status, error_message, usage_report, (latency_timestamps ? &stages : NULL));
+}
+static void push_grpcstt_session_status_event(struct ast_channel *chan, const char *status, const char *reason)
+{
+	struct ast_json *body = ast_json_pack("{s: s, s: s}", "status", status, "reason", reason);
+	if (!body)
+		return;
+	char *data = ast_json_dump_string(body);
+	ast_json_unref(body);
+	if (!data)
+		return;
+	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", "SpeechSession", "eventbody", data);
+	ast_json_free(data);
+	if (!blob)
+		return;
+
+	ast_channel_lock(chan);
+	ast_multi_object_blob_single_channel_publish(chan, ast_multi_user_event_type(), blob);
+	ast_channel_unlock(chan);
+
+	ast_json_unref(blob);
+}
+extern "C" void grpc_stt_reject(struct ast_channel *chan, const char *reason)
+{
+	push_grpcstt_session_status_event(chan, "REJECTED", reason);
+}
+extern "C" void grpc_stt_skip(struct ast_channel *chan, const char *reason)
+{
+	push_grpcstt_session_status_event(chan, "SKIPPED", reason);
+}
+
+
+// Frame as captured from channel: 20 ms
+#define BENCH_FRAME_SAMPLES 160
+
+// Keeps results of benchmarked calls observable
+static volatile uint8_t bench_sink;
+
+extern "C" void grpc_stt_bench(int fd, int min_time_ms)
+{
+	// Writer conversions run as in session: buffer is allocated per frame
+	struct {
+		const char *name;
+		struct ast_format **format;
+	} source_formats[] = {
+		{"alaw", &ast_format_alaw},
+		{"mulaw", &ast_format_ulaw},
+		{"slin", &ast_format_slin},
+	};
+	struct {
+		const char *name;
+		enum grpc_stt_frame_format frame_format;
+	} stream_formats[] = {
+		{"alaw", GRPC_STT_FRAME_FORMAT_ALAW},
+		{"mulaw", GRPC_STT_FRAME_FORMAT_MULAW},
+		{"slin", GRPC_STT_FRAME_FORMAT_SLINEAR16},
+	};
+	uint8_t payload[BENCH_FRAME_SAMPLES*sizeof(int16_t)];
+	for (size_t i = 0; i < sizeof(payload); ++i)
+		payload[i] = (uint8_t) (i*37);
+	struct ast_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.frametype = AST_FRAME_VOICE;
+	frame.samples = BENCH_FRAME_SAMPLES;
+	frame.data.ptr = payload;
+	bool warned = false;
+	for (const auto &source: source_formats) {
+		frame.subclass.format = *source.format;
+		frame.datalen = BENCH_FRAME_SAMPLES*((*source.format == ast_format_slin) ? sizeof(int16_t) : 1);
+		for (const auto &stream: stream_formats) {
+			std::string name = std::string("stt/get_frame_samples/") + source.name + "-" + stream.name;
+			voicekit_bench_run(fd, name.c_str(), min_time_ms,
+					   [&]()
+					   {
+						   std::vector<uint8_t> buffer;
+						   size_t len = 0;
+						   const char *data = get_frame_samples(&frame, stream.frame_format, buffer, &len, &warned);
+						   bench_sink = data[len - 1];
+					   });
+		}
+	}
+
+	for (const auto &stream: stream_formats) {
+		for (size_t samples: {(size_t) ALIGNMENT_SAMPLES, (size_t) MAX_FRAME_SAMPLES}) {
+			std::string name = std::string("stt/make_silence_samples/") + stream.name + "-" + std::to_string(samples);
+			voicekit_bench_run(fd, name.c_str(), min_time_ms,
+					   [&]()
+					   {
+						   make_silence_samples(stream.frame_format, samples);
+					   });
+		}
+	}
+
+	struct ast_channel *chan = ast_dummy_channel_alloc();
+	if (!chan) {
+		ast_log(AST_LOG_ERROR, "Failed to allocate dummy channel for benchmark\n");
+		return;
+	}
+	voiptime::cloud::stt::v1::StreamingRecognitionResult stream_result;
+	{
+		stream_result.set_is_final(true);
+		stream_result.set_request_uuid("00000000-0000-0000-0000-000000000000");
+		voiptime::cloud::stt::v1::SpeechRecognitionResult *recognition_result = stream_result.mutable_recognition_result();
+		voiptime::cloud::stt::v1::SpeechRecognitionAlternative *alternative = recognition_result->add_alternatives();
+		alternative->set_transcript("добрий день чим можу вам допомогти сьогодні");
+		alternative->set_confidence(-1.5);
+		recognition_result->mutable_start_time()->set_seconds(3);
+		recognition_result->mutable_end_time()->set_seconds(5);
+		recognition_result->mutable_end_time()->set_nanos(420000000);
+	}
+	GRPCSTTStages stages;
+	for (const char *stage: {"captured", "written", "result_received", "result_processed"})
+		stages.push_back(std::make_pair(stage, timestamp_now()));
+	voicekit_bench_run(fd, "stt/build_grpcstt_event/final", min_time_ms,
+			   [&]()
+			   {
+				   build_grpcstt_event(chan, stream_result, "", NULL, -1, false);
+			   });
+	voicekit_bench_run(fd, "stt/build_grpcstt_event/final_ensure_ascii", min_time_ms,
+			   [&]()
+			   {
+				   build_grpcstt_event(chan, stream_result, "", NULL, -1, true);
+			   });
+	voicekit_bench_run(fd, "stt/build_grpcstt_event/final_timestamps", min_time_ms,
+			   [&]()
+			   {
+				   build_grpcstt_event(chan, stream_result, "segment", &stages, -1, false);
+			   });
+	ast_channel_unref(chan);
 }
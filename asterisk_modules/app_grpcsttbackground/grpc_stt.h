@@ -16,11 +16,16 @@
 #ifndef GRPC_STT_H
 #define GRPC_STT_H
 
+#include "beep_detector.h"
+#include "early_final.h"
+#include "endpointer.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct ast_channel;
+struct voicekit_breaker_conf;
 
 enum grpc_stt_frame_format {
 	GRPC_STT_FRAME_FORMAT_ALAW = 0,
@@ -28,7 +33,74 @@ enum grpc_stt_frame_format {
 	GRPC_STT_FRAME_FORMAT_SLINEAR16 = 2,
 };
 
+/* State of session opened by GRPCSTTBackgroundPrepare(): changed with atomic compare-and-swap only */
+enum grpc_stt_prepared_state {
+	GRPC_STT_PREPARED_WAITING = 0,
+	GRPC_STT_PREPARED_STARTED = 1,
+	GRPC_STT_PREPARED_ABANDONED = 2,
+};
+
+/* Dialplan-side link to session thread: used to mark segments and to reconfigure running session */
+struct grpc_stt_handle;
+
+extern struct grpc_stt_handle *grpc_stt_handle_create(void);
+extern struct grpc_stt_handle *grpc_stt_handle_dup(struct grpc_stt_handle *handle);
+extern void grpc_stt_handle_release(struct grpc_stt_handle *handle);
+
+/* Releases handle of session thread marking session finished */
+extern void grpc_stt_handle_detach(struct grpc_stt_handle *handle);
+
+/* Returns 0 until session thread detaches its handle */
+extern int grpc_stt_handle_finished(struct grpc_stt_handle *handle);
+
+/* Results of audio captured after this call are tagged with segment name */
+extern void grpc_stt_handle_mark_segment(struct grpc_stt_handle *handle, const char *name);
+
+/* Audio captured after this call is not sent (paused) or sent again (resumed) */
+extern void grpc_stt_handle_pause(struct grpc_stt_handle *handle, int paused);
+
+/* Closes current stream and continues capture with a new one opened with new recognition config.
+   Returns -1 if session is already finished. */
+extern int grpc_stt_handle_reconfigure(
+	struct grpc_stt_handle *handle,
+	const char *language_code,
+	int max_alternatives,
+	enum grpc_stt_frame_format frame_format,
+	int vad_disable,
+	double vad_min_speech_duration,
+	double vad_max_speech_duration,
+	double vad_silence_duration_threshold,
+	double vad_silence_prob_threshold,
+	double vad_aggressiveness,
+	int interim_results_enable,
+	double interim_results_max_interval,
+	int interim_results_max_predictions,
+	int enable_gender_identification);
+
+/* Recognition profile: streaming config compiled once for named set of recognition settings */
+struct grpc_stt_profile;
+
+extern struct grpc_stt_profile *grpc_stt_profile_compile(
+	const char *name,
+	const char *language_code,
+	int max_alternatives,
+	enum grpc_stt_frame_format frame_format,
+	int vad_disable,
+	double vad_min_speech_duration,
+	double vad_max_speech_duration,
+	double vad_silence_duration_threshold,
+	double vad_silence_prob_threshold,
+	double vad_aggressiveness,
+	int interim_results_enable,
+	double interim_results_max_interval,
+	int interim_results_max_predictions,
+	int enable_gender_identification);
+extern struct grpc_stt_profile *grpc_stt_profile_dup(struct grpc_stt_profile *profile);
+extern void grpc_stt_profile_release(struct grpc_stt_profile *profile);
+
+/* Breaker ticket is released with setup outcome as soon as first stream is set up or fails */
 extern void grpc_stt_run(
+	struct grpc_stt_handle *handle,
 	int terminate_event_fd,
 	const char *target,
 	const char *authorization_api_key,
@@ -38,7 +110,7 @@ extern void grpc_stt_run(
 	const char *authorization_audience,
 	struct ast_channel *chan,
 	int ssl_grpc,
-	const char *ca_data,
+	const char *ca_file,
 	const char *language_code,
 	int max_alternatives,
 	enum grpc_stt_frame_format frame_format,
@@ -51,7 +123,46 @@ extern void grpc_stt_run(
 	int interim_results_enable,
 	double interim_results_max_interval,
 	int interim_results_max_predictions,
-	int enable_gender_identification);
+	int enable_gender_identification,
+	int start_event_fd, /* -1 if not prepared */
+	int *prepared_state,
+	double prepare_max_wait,
+	int preroll, /* prepend audio buffered by GRPCSTTPreroll() */
+	const struct grpc_stt_beep_conf *beep_conf, /* NULL to disable beep detection */
+	int latency_timestamps, /* add per-stage timestamps to event bodies */
+	const struct grpc_stt_early_final_conf *early_final_conf, /* NULL to disable early finals */
+	const struct grpc_stt_endpointer_conf *endpointer_conf, /* NULL to disable client-side endpointing */
+	int persistent, /* with endpointing: next utterance is recognized with new stream instead of finishing session */
+	int auto_pause, /* pause while PlayBackground() plays at channel or call is on hold */
+	const struct grpc_stt_profile *profile, /* streaming config used while recognition settings match it; NULL if none */
+	int setup_timeout_ms, /* deadline of stream setup until request id is received; 0 for none */
+	const char *capture_dir, /* directory to record frames queued to writer into (see frame_capture.h); NULL to disable */
+	const struct voicekit_breaker_conf *breaker_conf, /* NULL if breaker is disabled */
+	int breaker_ticket);
+
+extern void grpc_stt_pool_configure(
+	const char *endpoint, /* NULL to disable pool */
+	int ssl_grpc,
+	const char *ca_file,
+	const char *authorization_api_key,
+	const char *authorization_secret_key,
+	const char *authorization_issuer,
+	const char *authorization_subject,
+	const char *authorization_audience,
+	int size,
+	double max_idle,
+	int keepalive_time_ms);
+
+extern void grpc_stt_pool_shutdown(void);
+
+/* Reports session not started due to admission control */
+extern void grpc_stt_reject(struct ast_channel *chan, const char *reason);
+
+/* Reports session not started by decision of local classifier (e.g. answering machine) */
+extern void grpc_stt_skip(struct ast_channel *chan, const char *reason);
+
+/* "voicekit bench stt": writer frame conversion, silence and result event building */
+extern void grpc_stt_bench(int fd, int min_time_ms);
 
 #ifdef __cplusplus
 };
@@ -0,0 +1,72 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_STREAM_H
+#define GRPC_STT_STREAM_H
+
+#include "stt_stream.h"
+#include "voicekit_grpc.h"
+
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+
+
+// gRPC transport: StreamingRecognize call is started (and initial metadata is sent) at construction
+class GRPCSTTStream: public STTStream
+{
+public:
+	GRPCSTTStream(std::shared_ptr<grpc::Channel> grpc_channel, const std::string &authorization)
+		: stt_stub(voiptime::cloud::stt::v1::SpeechToText::NewStub(grpc_channel))
+	{
+		if (authorization.size())
+			context.AddMetadata("authorization", authorization);
+		stream = stt_stub->StreamingRecognize(&context);
+	}
+	bool Write(const voiptime::cloud::stt::v1::StreamingRecognizeRequest &request) override
+	{
+		return stream->Write(request);
+	}
+	bool WritesDone() override
+	{
+		return stream->WritesDone();
+	}
+	std::string WaitForRequestId() override
+	{
+		stream->WaitForInitialMetadata();
+		const std::multimap<grpc::string_ref, grpc::string_ref> &metadata = context.GetServerInitialMetadata();
+		std::multimap<grpc::string_ref, grpc::string_ref>::const_iterator x_request_id_it = metadata.find("x-request-id");
+		return (x_request_id_it != metadata.end()) ? std::string(x_request_id_it->second.data(), x_request_id_it->second.size()) : "";
+	}
+	bool Read(voiptime::cloud::stt::v1::StreamingRecognizeResponse *response) override
+	{
+		return stream->Read(response);
+	}
+	grpc::Status Finish() override
+	{
+		return stream->Finish();
+	}
+	void Cancel()
+	{
+		context.TryCancel();
+	}
+
+private:
+	grpc::ClientContext context;
+	std::unique_ptr<voiptime::cloud::stt::v1::SpeechToText::Stub> stt_stub;
+	std::unique_ptr<grpc::ClientReaderWriter<voiptime::cloud::stt::v1::StreamingRecognizeRequest,
+						 voiptime::cloud::stt::v1::StreamingRecognizeResponse>> stream;
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Pre-roll buffer: lightweight framehook keeping last N ms of caller audio
+ * in fixed ring of 8kHz SLINEAR samples. Ring is accessed from framehook and
+ * session start only, both with channel locked, so it needs no own lock.
+ */
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include "preroll.h"
+
+#include <asterisk.h>
+#include <asterisk/channel.h>
+#include <asterisk/framehook.h>
+#include <asterisk/format_cache.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/alaw.h>
+#include <asterisk/ulaw.h>
+#include <asterisk/utils.h>
+
+
+#define SAMPLE_RATE 8000
+
+struct preroll_ring {
+	int framehook_id;
+	size_t capacity;
+	size_t start;
+	size_t count;
+	int16_t samples[0];
+};
+
+
+static inline void ring_push(struct preroll_ring *ring, int16_t sample)
+{
+	if (ring->count < ring->capacity) {
+		ring->samples[(ring->start + ring->count) % ring->capacity] = sample;
+		++ring->count;
+	} else {
+		ring->samples[ring->start] = sample;
+		ring->start = (ring->start + 1) % ring->capacity;
+	}
+}
+static void ring_push_frame(struct preroll_ring *ring, struct ast_frame *f)
+{
+	size_t sample_count = f->samples;
+	if (f->subclass.format == ast_format_alaw) {
+		uint8_t *sptr = f->data.ptr;
+		for (size_t i = 0; i < sample_count; ++i)
+			ring_push(ring, AST_ALAW(sptr[i]));
+	} else if (f->subclass.format == ast_format_ulaw) {
+		uint8_t *sptr = f->data.ptr;
+		for (size_t i = 0; i < sample_count; ++i)
+			ring_push(ring, AST_MULAW(sptr[i]));
+	} else if (f->subclass.format == ast_format_slin) {
+		int16_t *sptr = f->data.ptr;
+		for (size_t i = 0; i < sample_count; ++i)
+			ring_push(ring, sptr[i]);
+	}
+}
+
+static struct ast_frame *framehook_event_callback(struct ast_channel *chan, struct ast_frame *frame, enum ast_framehook_event event, void *data)
+{
+	if (frame && event == AST_FRAMEHOOK_EVENT_READ && frame->frametype == AST_FRAME_VOICE)
+		ring_push_frame(data, frame);
+	return frame;
+}
+static int framehook_consume_callback(void *data, enum ast_frame_type type)
+{
+	return 0;
+}
+static void framehook_destroy_callback(void *data)
+{
+	ao2_ref(data, -1);
+}
+
+static void destroy_preroll_datastore(void *data)
+{
+	ao2_ref(data, -1);
+}
+static const struct ast_datastore_info preroll_ds_info = {
+	.type = "grpcsttpreroll",
+	.destroy = destroy_preroll_datastore,
+};
+
+static void remove_unlocked(struct ast_channel *chan)
+{
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &preroll_ds_info, NULL);
+	if (!datastore)
+		return;
+	struct preroll_ring *ring = datastore->data;
+	if (ring->framehook_id != -1)
+		ast_framehook_detach(chan, ring->framehook_id);
+	ast_channel_datastore_remove(chan, datastore);
+	ast_datastore_free(datastore);
+}
+
+
+int grpc_stt_preroll_install(struct ast_channel *chan, int duration_ms)
+{
+	if (duration_ms > GRPC_STT_PREROLL_MAX_DURATION_MSEC)
+		duration_ms = GRPC_STT_PREROLL_MAX_DURATION_MSEC;
+	size_t capacity = ((size_t) duration_ms)*SAMPLE_RATE/1000;
+	if (!capacity)
+		return -1;
+	struct preroll_ring *ring = ao2_alloc_options(sizeof(struct preroll_ring) + capacity*sizeof(int16_t), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!ring)
+		return -1;
+	ring->framehook_id = -1;
+	ring->capacity = capacity;
+	ring->start = 0;
+	ring->count = 0;
+
+	struct ast_datastore *datastore = ast_datastore_alloc(&preroll_ds_info, NULL);
+	if (!datastore) {
+		ao2_ref(ring, -1);
+		return -1;
+	}
+	datastore->data = ring;
+
+	struct ast_framehook_interface interface = {
+		.version = AST_FRAMEHOOK_INTERFACE_VERSION,
+		.event_cb = framehook_event_callback,
+		.consume_cb = framehook_consume_callback,
+		.destroy_cb = framehook_destroy_callback,
+		.data = ao2_bump(ring),
+	};
+	ast_channel_lock(chan);
+	remove_unlocked(chan);
+	ring->framehook_id = ast_framehook_attach(chan, &interface);
+	if (ring->framehook_id == -1) {
+		ast_channel_unlock(chan);
+		ao2_ref(ring, -1);
+		ast_datastore_free(datastore);
+		return -1;
+	}
+	ast_channel_datastore_add(chan, datastore);
+	ast_channel_unlock(chan);
+	return 0;
+}
+void grpc_stt_preroll_remove(struct ast_channel *chan)
+{
+	ast_channel_lock(chan);
+	remove_unlocked(chan);
+	ast_channel_unlock(chan);
+}
+struct ast_frame *grpc_stt_preroll_frame_unlocked(struct ast_channel *chan)
+{
+	struct ast_datastore *datastore = ast_channel_datastore_find(chan, &preroll_ds_info, NULL);
+	if (!datastore)
+		return NULL;
+	struct preroll_ring *ring = datastore->data;
+	if (!ring->count)
+		return NULL;
+
+	int16_t *samples = ast_malloc(ring->count*sizeof(int16_t));
+	if (!samples)
+		return NULL;
+	for (size_t i = 0; i < ring->count; ++i)
+		samples[i] = ring->samples[(ring->start + i) % ring->capacity];
+	struct ast_frame frame = {
+		.frametype = AST_FRAME_VOICE,
+		.subclass.format = ast_format_slin,
+		.datalen = ring->count*sizeof(int16_t),
+		.samples = ring->count,
+		.src = GRPC_STT_PREROLL_SRC,
+		.data.ptr = samples,
+	};
+	struct ast_frame *f = ast_frdup(&frame);
+	ast_free(samples);
+	/* Taken audio belongs to this session: next one starts with audio buffered after it */
+	if (f) {
+		ring->start = 0;
+		ring->count = 0;
+	}
+	return f;
+}
@@ -0,0 +1,46 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_PREROLL_H
+#define GRPC_STT_PREROLL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Source of pre-roll frame built by grpc_stt_preroll_frame_unlocked() */
+#define GRPC_STT_PREROLL_SRC "GRPCSTTPreroll"
+
+#define GRPC_STT_PREROLL_MAX_DURATION_MSEC 10000
+
+struct ast_channel;
+struct ast_frame;
+
+/* Installs (or replaces) framehook keeping last duration_ms of channel read audio.
+   Returns 0 on success. */
+extern int grpc_stt_preroll_install(struct ast_channel *chan, int duration_ms);
+
+extern void grpc_stt_preroll_remove(struct ast_channel *chan);
+
+/* Takes buffered audio as single SLINEAR frame (to be freed with ast_frfree()) and empties
+   buffer; returns NULL if pre-roll is not installed or empty. Channel must be locked: called
+   together with framehook attachment no frame is lost or duplicated. */
+extern struct ast_frame *grpc_stt_preroll_frame_unlocked(struct ast_channel *chan);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#include "shm_stt.h"
+#include "shm_stt_protocol.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// Maximal time to wait for server to free ring space
+#define WRITE_TIMEOUT_MSEC 1000
+
+
+static inline void eventfd_skip(int fd)
+{
+	eventfd_t value;
+	read(fd, &value, sizeof(eventfd_t));
+}
+static std::string errno_string(const char *what)
+{
+	return std::string(what) + ": " + strerror(errno);
+}
+
+
+SHMSTTStream::SHMSTTStream(const std::string &socket_path)
+	: socket_fd(-1), memfd(-1), data_event_fd(-1), space_event_fd(-1), ring(NULL),
+	  ring_size(shm_stt_ring_size(SHM_STT_RING_CAPACITY)), message_buffer(sizeof(struct shm_stt_message_header) + SHM_STT_MAX_MESSAGE_SIZE),
+	  status_received(false)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("Shared-memory STT socket path is too long: " + socket_path);
+	strcpy(addr.sun_path, socket_path.c_str());
+
+	try {
+		socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (socket_fd == -1)
+			throw std::runtime_error(errno_string("Failed to create socket"));
+		if (connect(socket_fd, (struct sockaddr *) &addr, sizeof(addr)))
+			throw std::runtime_error(errno_string(("Failed to connect to " + socket_path).c_str()));
+
+		memfd = memfd_create("grpcstt_ring", MFD_CLOEXEC);
+		if (memfd == -1)
+			throw std::runtime_error(errno_string("Failed to create memfd"));
+		if (ftruncate(memfd, ring_size))
+			throw std::runtime_error(errno_string("Failed to resize memfd"));
+		void *mapping = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+		if (mapping == MAP_FAILED)
+			throw std::runtime_error(errno_string("Failed to map memfd"));
+		ring = (struct shm_stt_ring *) mapping;
+		shm_stt_ring_init(ring, SHM_STT_RING_CAPACITY);
+
+		data_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		space_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (data_event_fd == -1 || space_event_fd == -1)
+			throw std::runtime_error(errno_string("Failed to create eventfd"));
+
+		struct {
+			struct shm_stt_message_header header;
+			struct shm_stt_hello hello;
+		} message;
+		message.header.type = SHM_STT_MESSAGE_HELLO;
+		message.header.length = sizeof(message.hello);
+		message.hello.version = SHM_STT_PROTOCOL_VERSION;
+		message.hello.ring_size = ring_size;
+
+		int fds[3] = {memfd, data_event_fd, space_event_fd};
+		char control[CMSG_SPACE(sizeof(fds))];
+		memset(control, 0, sizeof(control));
+		struct iovec iov = {
+			.iov_base = &message,
+			.iov_len = sizeof(message),
+		};
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+		if (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) != sizeof(message))
+			throw std::runtime_error(errno_string("Failed to send shared-memory STT handshake"));
+	} catch (...) {
+		Close();
+		throw;
+	}
+}
+SHMSTTStream::~SHMSTTStream()
+{
+	Close();
+}
+bool SHMSTTStream::Write(const voiptime::cloud::stt::v1::StreamingRecognizeRequest &request)
+{
+	if (request.has_streaming_config()) {
+		std::string payload;
+		request.SerializeToString(&payload);
+		if (!SendMessage(SHM_STT_MESSAGE_CONFIG, payload))
+			return false;
+	}
+	if (request.audio_content().size())
+		return WriteAudio(request.audio_content());
+	return true;
+}
+bool SHMSTTStream::WritesDone()
+{
+	return SendMessage(SHM_STT_MESSAGE_WRITES_DONE, std::string());
+}
+std::string SHMSTTStream::WaitForRequestId()
+{
+	std::string payload;
+	while (true) {
+		int type = ReceiveMessage(payload);
+		if (type == SHM_STT_MESSAGE_INITIAL_METADATA)
+			return payload;
+		if (type == SHM_STT_MESSAGE_RESPONSE)
+			early_responses.push_back(std::move(payload));
+		if (type == -1 || type == SHM_STT_MESSAGE_STATUS)
+			return "";
+	}
+}
+bool SHMSTTStream::Read(voiptime::cloud::stt::v1::StreamingRecognizeResponse *response)
+{
+	std::string payload;
+	while (true) {
+		int type;
+		if (early_responses.size()) {
+			payload = std::move(early_responses.front());
+			early_responses.pop_front();
+			type = SHM_STT_MESSAGE_RESPONSE;
+		} else {
+			type = ReceiveMessage(payload);
+		}
+		if (type == -1 || type == SHM_STT_MESSAGE_STATUS)
+			return false;
+		if (type == SHM_STT_MESSAGE_RESPONSE) {
+			if (response->ParseFromString(payload))
+				return true;
+			SetStatus(grpc::StatusCode::INTERNAL, "Failed to parse shared-memory STT response");
+			return false;
+		}
+	}
+}
+grpc::Status SHMSTTStream::Finish()
+{
+	if (!status_received)
+		SetStatus(grpc::StatusCode::UNAVAILABLE, "Shared-memory STT connection closed without status");
+	return status;
+}
+bool SHMSTTStream::SendMessage(uint32_t type, const std::string &payload)
+{
+	struct shm_stt_message_header header = {
+		.type = type,
+		.length = (uint32_t) payload.size(),
+	};
+	struct iovec iov[2] = {
+		{
+			.iov_base = &header,
+			.iov_len = sizeof(header),
+		},
+		{
+			.iov_base = (void *) payload.data(),
+			.iov_len = payload.size(),
+		},
+	};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	return sendmsg(socket_fd, &msg, MSG_NOSIGNAL) == (ssize_t) (sizeof(header) + payload.size());
+}
+int SHMSTTStream::ReceiveMessage(std::string &payload)
+{
+	if (status_received)
+		return -1;
+	ssize_t len;
+	do {
+		len = recv(socket_fd, message_buffer.data(), message_buffer.size(), 0);
+	} while (len == -1 && errno == EINTR);
+	if (len < (ssize_t) sizeof(struct shm_stt_message_header)) {
+		SetStatus(grpc::StatusCode::UNAVAILABLE, len ? errno_string("Shared-memory STT connection failed") : "Shared-memory STT connection closed by server");
+		return -1;
+	}
+	struct shm_stt_message_header header;
+	memcpy(&header, message_buffer.data(), sizeof(header));
+	if (header.length != len - sizeof(header)) {
+		SetStatus(grpc::StatusCode::INTERNAL, "Malformed shared-memory STT message");
+		return -1;
+	}
+	payload.assign(message_buffer.data() + sizeof(header), header.length);
+	if (header.type == SHM_STT_MESSAGE_STATUS) {
+		struct shm_stt_status status;
+		if (payload.size() < sizeof(status)) {
+			SetStatus(grpc::StatusCode::INTERNAL, "Malformed shared-memory STT status message");
+			return -1;
+		}
+		memcpy(&status, payload.data(), sizeof(status));
+		SetStatus(status.code, payload.substr(sizeof(status)));
+	}
+	return header.type;
+}
+bool SHMSTTStream::WriteAudio(const std::string &data)
+{
+	const char *p = data.data();
+	size_t remaining = data.size();
+	while (remaining) {
+		size_t written = shm_stt_ring_write(ring, p, remaining);
+		if (written) {
+			eventfd_write(data_event_fd, 1);
+			p += written;
+			remaining -= written;
+			continue;
+		}
+
+		struct pollfd pfds[2] = {
+			{
+				.fd = space_event_fd,
+				.events = POLLIN,
+				.revents = 0,
+			},
+			{
+				.fd = socket_fd,
+				.events = 0,
+				.revents = 0,
+			},
+		};
+		int ret = poll(pfds, 2, WRITE_TIMEOUT_MSEC);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0 || (pfds[1].revents & (POLLHUP | POLLERR)))
+			return false;
+		eventfd_skip(space_event_fd);
+	}
+	return true;
+}
+void SHMSTTStream::Close()
+{
+	if (ring)
+		munmap(ring, ring_size);
+	ring = NULL;
+	for (int *fd: {&socket_fd, &memfd, &data_event_fd, &space_event_fd}) {
+		if (*fd != -1)
+			close(*fd);
+		*fd = -1;
+	}
+}
+void SHMSTTStream::SetStatus(int code, const std::string &message)
+{
+	if (status_received)
+		return;
+	status = grpc::Status((grpc::StatusCode) code, message);
+	status_received = true;
+}
@@ -0,0 +1,62 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef SHM_STT_H
+#define SHM_STT_H
+
+#include "stt_stream.h"
+
+#include <deque>
+#include <vector>
+
+
+#define SHM_STT_ENDPOINT_PREFIX "shm:"
+
+struct shm_stt_ring;
+
+// Client side of shared-memory transport (see shm_stt_protocol.h)
+class SHMSTTStream: public STTStream
+{
+public:
+	SHMSTTStream(const std::string &socket_path);
+	~SHMSTTStream();
+
+	bool Write(const voiptime::cloud::stt::v1::StreamingRecognizeRequest &request) override;
+	bool WritesDone() override;
+	std::string WaitForRequestId() override;
+	bool Read(voiptime::cloud::stt::v1::StreamingRecognizeResponse *response) override;
+	grpc::Status Finish() override;
+
+private:
+	bool SendMessage(uint32_t type, const std::string &payload);
+	int ReceiveMessage(std::string &payload);
+	bool WriteAudio(const std::string &data);
+	void Close();
+	void SetStatus(int code, const std::string &message);
+
+private:
+	int socket_fd;
+	int memfd;
+	int data_event_fd;
+	int space_event_fd;
+	struct shm_stt_ring *ring;
+	size_t ring_size;
+	std::vector<char> message_buffer;
+	std::deque<std::string> early_responses; // received before initial metadata, returned by Read() first
+	bool status_received;
+	grpc::Status status;
+};
+
+#endif
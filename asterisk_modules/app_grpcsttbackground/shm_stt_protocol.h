@@ -0,0 +1,133 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Shared-memory transport to a co-located recognizer.
+ *
+ * Client connects to SOCK_SEQPACKET Unix socket and sends SHM_STT_MESSAGE_HELLO
+ * carrying (via SCM_RIGHTS) memfd of audio ring, "data" eventfd (client -> server
+ * wakeups) and "space" eventfd (server -> client wakeups). Audio bytes are then
+ * written into the ring only; every other request/response is a single
+ * seqpacket message of header + payload. Protobuf payloads are the same
+ * messages as used by gRPC transport (see stt.proto).
+ *
+ * This header is intentionally free of Asterisk dependencies so that it can be
+ * used by server implementations.
+ */
+
+#ifndef SHM_STT_PROTOCOL_H
+#define SHM_STT_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define SHM_STT_PROTOCOL_MAGIC 0x52545453 /* "STTR" */
+#define SHM_STT_PROTOCOL_VERSION 1
+
+/* Must be power of two: 64 KiB is 4 seconds of SLINEAR16 audio at 8 kHz */
+#define SHM_STT_RING_CAPACITY (1 << 16)
+#define SHM_STT_MAX_MESSAGE_SIZE (1 << 16)
+
+enum shm_stt_message_type {
+	SHM_STT_MESSAGE_HELLO = 1,            /* client -> server: struct shm_stt_hello + 3 fds */
+	SHM_STT_MESSAGE_CONFIG = 2,           /* client -> server: serialized StreamingRecognizeRequest */
+	SHM_STT_MESSAGE_WRITES_DONE = 3,      /* client -> server: no payload */
+	SHM_STT_MESSAGE_INITIAL_METADATA = 4, /* server -> client: X-Request-ID string */
+	SHM_STT_MESSAGE_RESPONSE = 5,         /* server -> client: serialized StreamingRecognizeResponse */
+	SHM_STT_MESSAGE_STATUS = 6,           /* server -> client: struct shm_stt_status + message string */
+};
+
+struct shm_stt_message_header {
+	uint32_t type;
+	uint32_t length; /* payload length */
+};
+
+struct shm_stt_hello {
+	uint32_t version;
+	uint32_t ring_size; /* whole memfd size */
+};
+
+struct shm_stt_status {
+	int32_t code; /* grpc::StatusCode */
+};
+
+/* Single producer (client) + single consumer (server) byte ring */
+struct shm_stt_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t reserved;
+	uint64_t write_pos __attribute__((aligned(64))); /* Total bytes written: updated by producer only */
+	uint64_t read_pos __attribute__((aligned(64)));  /* Total bytes consumed: updated by consumer only */
+	uint8_t data[] __attribute__((aligned(64)));
+};
+
+static inline size_t shm_stt_ring_size(uint32_t capacity)
+{
+	return sizeof(struct shm_stt_ring) + capacity;
+}
+static inline void shm_stt_ring_init(struct shm_stt_ring *ring, uint32_t capacity)
+{
+	ring->magic = SHM_STT_PROTOCOL_MAGIC;
+	ring->version = SHM_STT_PROTOCOL_VERSION;
+	ring->capacity = capacity;
+	ring->reserved = 0;
+	__atomic_store_n(&ring->write_pos, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->read_pos, 0, __ATOMIC_RELAXED);
+}
+static inline int shm_stt_ring_valid(const struct shm_stt_ring *ring, size_t mapped_size)
+{
+	return mapped_size >= sizeof(struct shm_stt_ring) &&
+		ring->magic == SHM_STT_PROTOCOL_MAGIC && ring->version == SHM_STT_PROTOCOL_VERSION &&
+		ring->capacity && !(ring->capacity & (ring->capacity - 1)) &&
+		shm_stt_ring_size(ring->capacity) <= mapped_size;
+}
+/* Producer-only: returns number of bytes actually written (may be less than len if ring is full) */
+static inline size_t shm_stt_ring_write(struct shm_stt_ring *ring, const void *data, size_t len)
+{
+	uint64_t write_pos = __atomic_load_n(&ring->write_pos, __ATOMIC_RELAXED);
+	uint64_t read_pos = __atomic_load_n(&ring->read_pos, __ATOMIC_ACQUIRE);
+	size_t space = ring->capacity - (size_t) (write_pos - read_pos);
+	if (len > space)
+		len = space;
+	size_t offset = write_pos & (ring->capacity - 1);
+	size_t first = ring->capacity - offset;
+	if (first > len)
+		first = len;
+	memcpy(ring->data + offset, data, first);
+	memcpy(ring->data, (const uint8_t *) data + first, len - first);
+	__atomic_store_n(&ring->write_pos, write_pos + len, __ATOMIC_RELEASE);
+	return len;
+}
+/* Consumer-only: returns number of bytes actually read */
+static inline size_t shm_stt_ring_read(struct shm_stt_ring *ring, void *data, size_t len)
+{
+	uint64_t read_pos = __atomic_load_n(&ring->read_pos, __ATOMIC_RELAXED);
+	uint64_t write_pos = __atomic_load_n(&ring->write_pos, __ATOMIC_ACQUIRE);
+	size_t available = (size_t) (write_pos - read_pos);
+	if (len > available)
+		len = available;
+	size_t offset = read_pos & (ring->capacity - 1);
+	size_t first = ring->capacity - offset;
+	if (first > len)
+		first = len;
+	memcpy(data, ring->data + offset, first);
+	memcpy((uint8_t *) data + first, ring->data, len - first);
+	__atomic_store_n(&ring->read_pos, read_pos + len, __ATOMIC_RELEASE);
+	return len;
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Reference server for shared-memory STT transport.
+ *
+ * Accepts sessions at Unix socket, drains audio ring and reports amount of
+ * received audio as recognition results: interim result every second of audio
+ * and final result on WritesDone. Intended for testing of transport only.
+ *
+ * Usage: shm_stt_stub SOCKET_PATH
+ */
+
+#include "stt.pb.h"
+#include "shm_stt_protocol.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+#define SAMPLE_RATE 8000
+#define READ_CHUNK_SIZE 4096
+
+
+static bool send_message(int fd, uint32_t type, const std::string &payload)
+{
+	struct shm_stt_message_header header = {
+		.type = type,
+		.length = (uint32_t) payload.size(),
+	};
+	struct iovec iov[2] = {
+		{
+			.iov_base = &header,
+			.iov_len = sizeof(header),
+		},
+		{
+			.iov_base = (void *) payload.data(),
+			.iov_len = payload.size(),
+		},
+	};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t) (sizeof(header) + payload.size());
+}
+static void send_status(int fd, int code, const std::string &message)
+{
+	struct shm_stt_status status = {
+		.code = code,
+	};
+	send_message(fd, SHM_STT_MESSAGE_STATUS, std::string((const char *) &status, sizeof(status)) + message);
+}
+static void send_result(int fd, uint64_t samples, uint64_t reported_samples, bool is_final)
+{
+	voiptime::cloud::stt::v1::StreamingRecognizeResponse response;
+	voiptime::cloud::stt::v1::StreamingRecognitionResult *result = response.add_results();
+	result->set_is_final(is_final);
+	result->set_stability(is_final ? 1.0 : 0.5);
+	voiptime::cloud::stt::v1::SpeechRecognitionResult *recognition_result = result->mutable_recognition_result();
+	voiptime::cloud::stt::v1::SpeechRecognitionAlternative *alternative = recognition_result->add_alternatives();
+	char transcript[64];
+	snprintf(transcript, sizeof(transcript), "%.3f seconds of audio", (double) samples/SAMPLE_RATE);
+	alternative->set_transcript(transcript);
+	alternative->set_confidence(1.0);
+	recognition_result->mutable_start_time()->set_seconds(reported_samples/SAMPLE_RATE);
+	recognition_result->mutable_start_time()->set_nanos(reported_samples%SAMPLE_RATE*(1000000000/SAMPLE_RATE));
+	recognition_result->mutable_end_time()->set_seconds(samples/SAMPLE_RATE);
+	recognition_result->mutable_end_time()->set_nanos(samples%SAMPLE_RATE*(1000000000/SAMPLE_RATE));
+
+	std::string payload;
+	response.SerializeToString(&payload);
+	send_message(fd, SHM_STT_MESSAGE_RESPONSE, payload);
+}
+static int receive_hello(int fd, int fds[3], struct shm_stt_hello *hello)
+{
+	struct {
+		struct shm_stt_message_header header;
+		struct shm_stt_hello hello;
+	} message;
+	char control[CMSG_SPACE(3*sizeof(int))];
+	struct iovec iov = {
+		.iov_base = &message,
+		.iov_len = sizeof(message),
+	};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(message) || message.header.type != SHM_STT_MESSAGE_HELLO)
+		return -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3*sizeof(int)))
+		return -1;
+	memcpy(fds, CMSG_DATA(cmsg), 3*sizeof(int));
+	*hello = message.hello;
+	return 0;
+}
+static void serve_session(int fd)
+{
+	static unsigned int session_counter = 0;
+	int fds[3] = {-1, -1, -1};
+	struct shm_stt_hello hello;
+	struct shm_stt_ring *ring = NULL;
+	std::vector<char> message(sizeof(struct shm_stt_message_header) + SHM_STT_MAX_MESSAGE_SIZE);
+	std::vector<char> audio(READ_CHUNK_SIZE);
+	size_t bytes_per_sample = 1;
+	uint64_t samples = 0;
+	uint64_t reported_samples = 0;
+	bool writes_done = false;
+
+	if (receive_hello(fd, fds, &hello) || hello.version != SHM_STT_PROTOCOL_VERSION) {
+		fprintf(stderr, "Bad handshake\n");
+		goto cleanup;
+	}
+	ring = (struct shm_stt_ring *) mmap(NULL, hello.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (ring == MAP_FAILED || !shm_stt_ring_valid(ring, hello.ring_size)) {
+		ring = NULL;
+		send_status(fd, 3 /* INVALID_ARGUMENT */, "Invalid audio ring");
+		goto cleanup;
+	}
+
+	while (!writes_done) {
+		struct pollfd pfds[2] = {
+			{
+				.fd = fd,
+				.events = POLLIN,
+				.revents = 0,
+			},
+			{
+				.fd = fds[1],
+				.events = POLLIN,
+				.revents = 0,
+			},
+		};
+		if (poll(pfds, 2, -1) == -1 && errno != EINTR)
+			break;
+		if (pfds[0].revents & POLLIN) {
+			ssize_t len = recv(fd, message.data(), message.size(), 0);
+			if (len < (ssize_t) sizeof(struct shm_stt_message_header))
+				goto cleanup;
+			struct shm_stt_message_header header;
+			memcpy(&header, message.data(), sizeof(header));
+			if (header.type == SHM_STT_MESSAGE_CONFIG) {
+				voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
+				if (!request.ParseFromArray(message.data() + sizeof(header), len - sizeof(header)) || !request.has_streaming_config()) {
+					send_status(fd, 3 /* INVALID_ARGUMENT */, "Invalid streaming config");
+					goto cleanup;
+				}
+				if (request.streaming_config().config().encoding() == voiptime::cloud::stt::v1::LINEAR16)
+					bytes_per_sample = 2;
+				char request_id[32];
+				snprintf(request_id, sizeof(request_id), "shm-stub-%d-%u", (int) getpid(), __sync_add_and_fetch(&session_counter, 1));
+				send_message(fd, SHM_STT_MESSAGE_INITIAL_METADATA, request_id);
+			} else if (header.type == SHM_STT_MESSAGE_WRITES_DONE) {
+				writes_done = true;
+			}
+		} else if (pfds[0].revents & (POLLHUP | POLLERR)) {
+			goto cleanup;
+		}
+		if (pfds[1].revents & POLLIN) {
+			eventfd_t value;
+			read(fds[1], &value, sizeof(value));
+		}
+
+		// Drain ring even on WritesDone: audio is always written before it
+		size_t len;
+		while ((len = shm_stt_ring_read(ring, audio.data(), audio.size())))
+			samples += len/bytes_per_sample;
+		eventfd_write(fds[2], 1);
+
+		if (samples - reported_samples >= SAMPLE_RATE) {
+			send_result(fd, samples, reported_samples, false);
+			reported_samples = samples;
+		}
+	}
+	send_result(fd, samples, 0, true);
+	send_status(fd, 0, "");
+
+cleanup:
+	if (ring)
+		munmap(ring, hello.ring_size);
+	for (int i = 0; i < 3; ++i) {
+		if (fds[i] != -1)
+			close(fds[i]);
+	}
+	close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s SOCKET_PATH\n", argv[0]);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, argv[1]);
+	unlink(argv[1]);
+
+	int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(listen_fd, 64)) {
+		perror("Failed to listen");
+		return 1;
+	}
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed to accept");
+			return 1;
+		}
+		std::thread(serve_session, fd).detach();
+	}
+}
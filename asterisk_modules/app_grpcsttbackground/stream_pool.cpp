@@ -0,0 +1,215 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "stream_pool.h"
+#include "grpc_stt.h"
+
+#include <vector>
+
+extern "C" {
+#include <asterisk.h>
+#include <asterisk/logger.h>
+}
+
+
+// Pool is re-checked for expired streams at least this often
+#define CHECK_INTERVAL_MSEC 1000
+
+
+GRPCSTTStreamPool grpc_stt_stream_pool;
+
+
+static std::string make_authorization(const GRPCSTTStreamPool::Config &config)
+{
+	return voicekit_grpc_authorization(
+		config.authorization_api_key, config.authorization_secret_key,
+		config.authorization_issuer, config.authorization_subject, config.authorization_audience);
+}
+
+
+GRPCSTTStreamPool::GRPCSTTStreamPool()
+	: generation(0), stopping(false)
+{
+	config.ssl_grpc = 0;
+	config.size = 0;
+	config.max_idle = 0.0;
+	config.keepalive_time_ms = 0;
+}
+GRPCSTTStreamPool::~GRPCSTTStreamPool()
+{
+	Shutdown();
+}
+void GRPCSTTStreamPool::Configure(const Config &new_config)
+{
+	std::shared_ptr<grpc::Channel> new_channel;
+	if (new_config.endpoint.size() && new_config.size) {
+		try {
+			new_channel = voicekit_grpc_get_channel(new_config.endpoint, new_config.ssl_grpc, new_config.ca_file, new_config.keepalive_time_ms);
+		} catch (const std::exception &ex) {
+			ast_log(AST_LOG_ERROR, "GRPCSTTBackground: stream pool disabled: %s\n", ex.what());
+		}
+	}
+
+	std::vector<std::shared_ptr<GRPCSTTStream>> streams;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		config = new_config;
+		++generation;
+		channel = new_channel;
+		for (Entry &entry: entries)
+			streams.push_back(entry.stream);
+		entries.clear();
+		stopping = false;
+		if (channel && !thread.joinable())
+			thread = std::thread(&GRPCSTTStreamPool::ThreadRoutine, this);
+	}
+	cond.notify_all();
+	CloseStreams(streams);
+}
+void GRPCSTTStreamPool::Shutdown()
+{
+	std::vector<std::shared_ptr<GRPCSTTStream>> streams;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		for (Entry &entry: entries)
+			streams.push_back(entry.stream);
+		entries.clear();
+		channel.reset();
+	}
+	cond.notify_all();
+	if (thread.joinable())
+		thread.join();
+	CloseStreams(streams);
+}
+int GRPCSTTStreamPool::KeepaliveTimeMs()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return config.keepalive_time_ms;
+}
+std::shared_ptr<GRPCSTTStream> GRPCSTTStreamPool::Take(const std::string &endpoint, int ssl_grpc, const std::string &ca_file,
+						       const std::string &authorization_api_key, const std::string &authorization_secret_key,
+						       const std::string &authorization_issuer, const std::string &authorization_subject,
+						       const std::string &authorization_audience)
+{
+	std::shared_ptr<GRPCSTTStream> stream;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (entries.empty() || !channel || endpoint != config.endpoint || ssl_grpc != config.ssl_grpc || ca_file != config.ca_file ||
+		    authorization_api_key != config.authorization_api_key || authorization_secret_key != config.authorization_secret_key ||
+		    authorization_issuer != config.authorization_issuer || authorization_subject != config.authorization_subject ||
+		    authorization_audience != config.authorization_audience)
+			return nullptr;
+		// Streams opened over broken connection would fail on first write
+		if (channel->GetState(false) != GRPC_CHANNEL_READY)
+			return nullptr;
+		stream = entries.back().stream;
+		entries.pop_back();
+	}
+	cond.notify_all();
+	return stream;
+}
+void GRPCSTTStreamPool::ThreadRoutine()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		std::vector<std::shared_ptr<GRPCSTTStream>> expired;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> max_idle(config.max_idle);
+		while (entries.size() && now - entries.front().open_time >= max_idle) {
+			expired.push_back(entries.front().stream);
+			entries.pop_front();
+		}
+
+		if (!channel || entries.size() >= config.size) {
+			lock.unlock();
+			CloseStreams(expired);
+			lock.lock();
+			if (!stopping)
+				cond.wait_for(lock, std::chrono::milliseconds(CHECK_INTERVAL_MSEC));
+			continue;
+		}
+
+		unsigned int open_generation = generation;
+		std::shared_ptr<grpc::Channel> open_channel = channel;
+		Config open_config = config;
+		lock.unlock();
+		CloseStreams(expired);
+		std::shared_ptr<GRPCSTTStream> stream;
+		try {
+			stream = std::make_shared<GRPCSTTStream>(open_channel, make_authorization(open_config));
+		} catch (const std::exception &ex) {
+			ast_log(AST_LOG_WARNING, "GRPCSTTBackground: failed to open pooled stream: %s\n", ex.what());
+		}
+		lock.lock();
+
+		if (stream && open_generation == generation && !stopping) {
+			Entry entry = {
+				.open_time = std::chrono::steady_clock::now(),
+				.stream = stream,
+			};
+			entries.push_back(entry);
+		} else {
+			lock.unlock();
+			std::vector<std::shared_ptr<GRPCSTTStream>> streams;
+			if (stream)
+				streams.push_back(stream);
+			CloseStreams(streams);
+			lock.lock();
+			if (!stream && !stopping)
+				cond.wait_for(lock, std::chrono::milliseconds(CHECK_INTERVAL_MSEC));
+		}
+	}
+}
+void GRPCSTTStreamPool::CloseStreams(std::vector<std::shared_ptr<GRPCSTTStream>> &streams)
+{
+	for (std::shared_ptr<GRPCSTTStream> &stream: streams) {
+		stream->Cancel();
+		stream->Finish();
+	}
+	streams.clear();
+}
+
+
+#define NON_NULL_STRING(str) ((str) ? (str) : "")
+extern "C" void grpc_stt_pool_configure(const char *endpoint, int ssl_grpc, const char *ca_file,
+					const char *authorization_api_key, const char *authorization_secret_key,
+					const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
+					int size, double max_idle, int keepalive_time_ms)
+{
+	GRPCSTTStreamPool::Config config;
+	config.endpoint = NON_NULL_STRING(endpoint);
+	config.ssl_grpc = ssl_grpc;
+	config.ca_file = NON_NULL_STRING(ca_file);
+	config.authorization_api_key = NON_NULL_STRING(authorization_api_key);
+	config.authorization_secret_key = NON_NULL_STRING(authorization_secret_key);
+	config.authorization_issuer = NON_NULL_STRING(authorization_issuer);
+	config.authorization_subject = NON_NULL_STRING(authorization_subject);
+	config.authorization_audience = NON_NULL_STRING(authorization_audience);
+	// Streams expiring as soon as opened would be reopened in a busy loop: pool is disabled instead
+	config.size = (size > 0 && max_idle > 0.0) ? size : 0;
+	config.max_idle = max_idle;
+	config.keepalive_time_ms = keepalive_time_ms;
+	grpc_stt_stream_pool.Configure(config);
+}
+#undef NON_NULL_STRING
+extern "C" void grpc_stt_pool_shutdown(void)
+{
+	grpc_stt_stream_pool.Shutdown();
+}
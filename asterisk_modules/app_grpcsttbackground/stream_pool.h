@@ -0,0 +1,84 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_STREAM_POOL_H
+#define GRPC_STT_STREAM_POOL_H
+
+#include "grpc_stt_stream.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+
+// Module-wide pool of StreamingRecognize calls opened in advance to default
+// endpoint with default credentials. Streams are handed out without any request
+// written, so each session still sends its own streaming config.
+class GRPCSTTStreamPool
+{
+public:
+	struct Config
+	{
+		std::string endpoint; // empty - pool disabled
+		int ssl_grpc;
+		std::string ca_file;
+		std::string authorization_api_key;
+		std::string authorization_secret_key;
+		std::string authorization_issuer;
+		std::string authorization_subject;
+		std::string authorization_audience;
+		size_t size;
+		double max_idle; // seconds
+		int keepalive_time_ms;
+	};
+
+public:
+	GRPCSTTStreamPool();
+	~GRPCSTTStreamPool();
+	void Configure(const Config &config);
+	void Shutdown();
+	int KeepaliveTimeMs();
+	// Returns nullptr unless pool is configured for exactly same endpoint and credentials
+	std::shared_ptr<GRPCSTTStream> Take(const std::string &endpoint, int ssl_grpc, const std::string &ca_file,
+					    const std::string &authorization_api_key, const std::string &authorization_secret_key,
+					    const std::string &authorization_issuer, const std::string &authorization_subject,
+					    const std::string &authorization_audience);
+
+private:
+	struct Entry
+	{
+		std::chrono::steady_clock::time_point open_time;
+		std::shared_ptr<GRPCSTTStream> stream;
+	};
+
+	void ThreadRoutine();
+	static void CloseStreams(std::vector<std::shared_ptr<GRPCSTTStream>> &streams);
+
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	Config config;
+	unsigned int generation;
+	std::shared_ptr<grpc::Channel> channel;
+	std::deque<Entry> entries;
+	std::thread thread;
+	bool stopping;
+};
+
+extern GRPCSTTStreamPool grpc_stt_stream_pool;
+
+#endif
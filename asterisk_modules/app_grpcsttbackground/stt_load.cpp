@@ -0,0 +1,336 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Synthetic-channel load generator for STT (see stt_mock_server.cpp).
+ *
+ * Each simulated channel runs back-to-back sessions of SESSION_SEC of audio
+ * until TOTAL_SEC elapse. Session runs the transport and pacing code of
+ * module session: streaming config is built by GRPCSTTProfile, stream is
+ * GRPCSTTStream (one gRPC channel shared by all simulated channels, as with
+ * channel pool of size 1) or SHMSTTStream for "shm:" endpoints, and audio is
+ * written through GRPCSTTPacer from writer thread while reader thread
+ * consumes results. Synthetic audio is a tone in real time, 20 ms per frame.
+ *
+ * Reported latencies: "setup" (stream start to x-request-id) and
+ * "final_result" (final result arrival to moment when its end of phrase
+ * audio was written). Throughput, CPU, RSS and thread count are of whole
+ * process. Dialplan, Asterisk frames and Asterisk scheduling are not part of
+ * the measurement.
+ *
+ * Usage: stt_load [-e ENDPOINT] [-n CHANNELS] [-d SESSION_SEC] [-t TOTAL_SEC] [-f alaw|mulaw|slin] [-I]
+ */
+
+#include "grpc_stt_stream.h"
+#include "shm_stt.h"
+#include "stt_pacer.h"
+#include "stt_profile.h"
+#include "voicekit_loadtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+
+
+#define DEFAULT_ENDPOINT "127.0.0.1:8090"
+#define FRAME_MSEC 20
+#define FRAME_SAMPLES (INTERNAL_SAMPLE_RATE*FRAME_MSEC/1000)
+#define TONE_HZ 440 /* integer number of periods per second: frames repeat every second */
+#define TONE_AMPLITUDE 8000
+#define SAMPLE_PROCESS_MSEC 200
+
+
+struct LoadSettings
+{
+	std::string endpoint;
+	std::shared_ptr<grpc::Channel> grpc_channel;
+	GRPCSTTRecognitionSettings recognition_settings;
+	double session_sec;
+	int64_t end_ns;
+	std::vector<std::string> frames; // one second of synthetic audio in stream frame format
+};
+
+
+/* Reference G.711 encoders */
+static uint8_t linear_to_alaw(int16_t pcm)
+{
+	static const int seg_end[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+	int val = pcm >> 3;
+	uint8_t mask;
+	if (val >= 0) {
+		mask = 0xD5;
+	} else {
+		mask = 0x55;
+		val = -val - 1;
+	}
+	int seg = 0;
+	while (seg < 8 && val > seg_end[seg])
+		seg++;
+	if (seg >= 8)
+		return 0x7F ^ mask;
+	uint8_t aval = seg << 4;
+	aval |= (seg < 2) ? ((val >> 1) & 0x0F) : ((val >> seg) & 0x0F);
+	return aval ^ mask;
+}
+static uint8_t linear_to_ulaw(int16_t pcm)
+{
+	static const int seg_end[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+	int val = pcm >> 2;
+	uint8_t mask;
+	if (val < 0) {
+		val = -val;
+		mask = 0x7F;
+	} else {
+		mask = 0xFF;
+	}
+	if (val > 8159)
+		val = 8159;
+	val += 0x21;
+	int seg = 0;
+	while (seg < 8 && val > seg_end[seg])
+		seg++;
+	if (seg >= 8)
+		return 0x7F ^ mask;
+	return ((seg << 4) | ((val >> (seg + 1)) & 0x0F)) ^ mask;
+}
+
+static std::vector<std::string> make_tone_frames(enum grpc_stt_frame_format frame_format)
+{
+	std::vector<std::string> frames;
+	for (int frame = 0; frame < INTERNAL_SAMPLE_RATE/FRAME_SAMPLES; ++frame) {
+		std::string data;
+		for (int i = 0; i < FRAME_SAMPLES; ++i) {
+			int n = frame*FRAME_SAMPLES + i;
+			int16_t sample = (int16_t) (TONE_AMPLITUDE*sin(2.0*M_PI*TONE_HZ*n/INTERNAL_SAMPLE_RATE));
+			switch (frame_format) {
+			case GRPC_STT_FRAME_FORMAT_SLINEAR16:
+				data.append((const char *) &sample, sizeof(sample));
+				break;
+			case GRPC_STT_FRAME_FORMAT_MULAW:
+				data.push_back((char) linear_to_ulaw(sample));
+				break;
+			default:
+				data.push_back((char) linear_to_alaw(sample));
+			}
+		}
+		frames.push_back(data);
+	}
+	return frames;
+}
+
+static int parse_frame_format(const char *str)
+{
+	if (!strcmp(str, "alaw"))
+		return GRPC_STT_FRAME_FORMAT_ALAW;
+	if (!strcmp(str, "mulaw"))
+		return GRPC_STT_FRAME_FORMAT_MULAW;
+	if (!strcmp(str, "slin"))
+		return GRPC_STT_FRAME_FORMAT_SLINEAR16;
+	return -1;
+}
+
+static inline int64_t monotonic_nsec()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((int64_t) t.tv_sec)*1000000000 + t.tv_nsec;
+}
+static inline struct timespec timespec_of(int64_t ns)
+{
+	struct timespec t = {
+		.tv_sec = (time_t) (ns/1000000000),
+		.tv_nsec = (long) (ns%1000000000),
+	};
+	return t;
+}
+static inline void sleep_until_nsec(int64_t ns)
+{
+	struct timespec t = timespec_of(ns);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+}
+
+
+static void run_session(const LoadSettings &settings, VoiceKitLoadReport &report)
+{
+	int64_t setup_start_ns = monotonic_nsec();
+	std::unique_ptr<STTStream> stream;
+	try {
+		if (!settings.endpoint.compare(0, strlen(SHM_STT_ENDPOINT_PREFIX), SHM_STT_ENDPOINT_PREFIX))
+			stream.reset(new SHMSTTStream(settings.endpoint.substr(strlen(SHM_STT_ENDPOINT_PREFIX))));
+		else
+			stream.reset(new GRPCSTTStream(settings.grpc_channel, ""));
+	} catch (const std::exception &ex) {
+		report.AddError(ex.what());
+		report.AddSession(false, 0.0);
+		return;
+	}
+	{
+		voiptime::cloud::stt::v1::StreamingRecognizeRequest initial_request;
+		GRPCSTTProfile::BuildConfig(settings.recognition_settings, initial_request.mutable_streaming_config());
+		stream->Write(initial_request);
+	}
+	if (stream->WaitForRequestId().empty()) {
+		grpc::Status status = stream->Finish();
+		report.AddError("setup: " + std::to_string((int) status.error_code()) + " " + status.error_message());
+		report.AddSession(false, 0.0);
+		return;
+	}
+	int64_t audio_start_ns = monotonic_nsec();
+	report.AddLatency("setup", (audio_start_ns - setup_start_ns)/1e6);
+
+	std::thread reader(
+		[&stream, &report, audio_start_ns]()
+		{
+			voiptime::cloud::stt::v1::StreamingRecognizeResponse response;
+			while (stream->Read(&response)) {
+				int64_t now_ns = monotonic_nsec();
+				for (const voiptime::cloud::stt::v1::StreamingRecognitionResult &result: response.results()) {
+					if (!result.is_final())
+						continue;
+					const google::protobuf::Duration &end_time = result.recognition_result().end_time();
+					int64_t end_ns = audio_start_ns + end_time.seconds()*1000000000LL + end_time.nanos();
+					report.AddLatency("final_result", (now_ns - end_ns)/1e6);
+				}
+			}
+		});
+
+	GRPCSTTPacer pacer(settings.recognition_settings.frame_format, timespec_of(audio_start_ns),
+			   [&stream](const char *data, size_t len) -> bool
+			   {
+				   voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
+				   request.set_audio_content(data, len);
+				   return stream->Write(request);
+			   });
+	int frame_count = (int) (settings.session_sec*1000/FRAME_MSEC);
+	for (int i = 0; i < frame_count && pacer.Valid(); ++i) {
+		sleep_until_nsec(audio_start_ns + (i + 1)*FRAME_MSEC*1000000LL);
+		struct timespec now = timespec_of(monotonic_nsec());
+		pacer.FillGap(now, FRAME_SAMPLES);
+		const std::string &frame = settings.frames[i%settings.frames.size()];
+		pacer.WriteAudio(frame.data(), frame.size(), FRAME_SAMPLES);
+	}
+	stream->WritesDone();
+	reader.join();
+	grpc::Status status = stream->Finish();
+	if (!status.ok())
+		report.AddError("stream: " + std::to_string((int) status.error_code()) + " " + status.error_message());
+	report.AddSession(status.ok() && pacer.Valid(), (double) pacer.StreamSamples()/INTERNAL_SAMPLE_RATE);
+}
+
+
+static int usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-e ENDPOINT] [-n CHANNELS] [-d SESSION_SEC] [-t TOTAL_SEC] [-f alaw|mulaw|slin] [-I]\n", program);
+	return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	LoadSettings settings;
+	settings.endpoint = DEFAULT_ENDPOINT;
+	settings.session_sec = 10.0;
+	settings.recognition_settings.max_alternatives = 1;
+	settings.recognition_settings.frame_format = GRPC_STT_FRAME_FORMAT_ALAW;
+	settings.recognition_settings.vad_disable = false;
+	settings.recognition_settings.vad_min_speech_duration = 0.0;
+	settings.recognition_settings.vad_max_speech_duration = 0.0;
+	settings.recognition_settings.vad_silence_duration_threshold = 0.0;
+	settings.recognition_settings.vad_silence_prob_threshold = 0.0;
+	settings.recognition_settings.vad_aggressiveness = 0.0;
+	settings.recognition_settings.interim_results_enable = false;
+	settings.recognition_settings.interim_results_max_interval = 0.0;
+	settings.recognition_settings.interim_results_max_predictions = 2;
+	settings.recognition_settings.enable_gender_identification = false;
+	int channels = 1;
+	double total_sec = 60.0;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:n:d:t:f:I")) != -1) {
+		switch (opt) {
+		case 'e':
+			settings.endpoint = optarg;
+			break;
+		case 'n':
+			channels = atoi(optarg);
+			break;
+		case 'd':
+			settings.session_sec = atof(optarg);
+			break;
+		case 't':
+			total_sec = atof(optarg);
+			break;
+		case 'f': {
+			int frame_format = parse_frame_format(optarg);
+			if (frame_format < 0) {
+				fprintf(stderr, "Unknown frame format '%s'\n", optarg);
+				return 1;
+			}
+			settings.recognition_settings.frame_format = (enum grpc_stt_frame_format) frame_format;
+		} break;
+		case 'I':
+			settings.recognition_settings.interim_results_enable = true;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc || channels <= 0 || settings.session_sec <= 0.0 || total_sec <= 0.0)
+		return usage(argv[0]);
+
+	settings.frames = make_tone_frames(settings.recognition_settings.frame_format);
+	if (settings.endpoint.compare(0, strlen(SHM_STT_ENDPOINT_PREFIX), SHM_STT_ENDPOINT_PREFIX))
+		settings.grpc_channel = grpc::CreateChannel(settings.endpoint, grpc::InsecureChannelCredentials());
+	VoiceKitLoadReport report;
+	int64_t start_ns = monotonic_nsec();
+	settings.end_ns = start_ns + (int64_t) (total_sec*1e9);
+
+	std::vector<std::thread> channel_threads;
+	for (int i = 0; i < channels; ++i) {
+		channel_threads.push_back(std::thread(
+			[&settings, &report]()
+			{
+				while (monotonic_nsec() < settings.end_ns)
+					run_session(settings, report);
+			}));
+	}
+	std::atomic<bool> done(false);
+	std::thread sampler(
+		[&report, &done]()
+		{
+			while (!done) {
+				report.SampleProcess();
+				std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_PROCESS_MSEC));
+			}
+		});
+	for (std::thread &thread: channel_threads)
+		thread.join();
+	done = true;
+	sampler.join();
+
+	report.Print(stdout, channels, (monotonic_nsec() - start_ns)/1e9);
+	return 0;
+}
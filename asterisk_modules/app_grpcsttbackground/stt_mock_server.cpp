@@ -0,0 +1,213 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Mock SpeechToText gRPC service for local load tests (see stt_load.cpp).
+ *
+ * Audio is not recognized: incoming stream is cut into utterances of fixed
+ * audio duration and "utterance N" transcripts are returned with start/end
+ * times on stream timeline, so that results are deterministic for given audio
+ * length. Interim results ("utterance N part M") are sent if enabled by
+ * streaming config. Setup latency, jitter and errors are injected with seeded
+ * generator: setup errors are returned before response headers, stream errors
+ * at middle of first utterance.
+ *
+ * Usage: stt_mock_server [-l LISTEN_ADDRESS] [-r RESULT_MS] [-u UTTERANCE_SEC] [-i INTERIM_SEC]
+ *                        [-s SETUP_MS] [-j JITTER_MS] [-e SETUP_ERROR_RATE] [-E STREAM_ERROR_RATE] [-S SEED]
+ */
+
+#include "stt.grpc.pb.h"
+#include "voicekit_loadtest.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/security/server_credentials.h>
+
+
+#define DEFAULT_LISTEN_ADDRESS "0.0.0.0:8090"
+#define DEFAULT_UTTERANCE_SEC 3.0
+#define DEFAULT_INTERIM_SEC 1.0
+
+
+static void set_duration(google::protobuf::Duration *duration, int64_t samples, int sample_rate)
+{
+	duration->set_seconds(samples/sample_rate);
+	duration->set_nanos((int32_t) ((samples%sample_rate)*1000000000LL/sample_rate));
+}
+
+
+class MockSpeechToText final : public voiptime::cloud::stt::v1::SpeechToText::Service
+{
+public:
+	MockSpeechToText(VoiceKitMockFaults &faults, int result_ms, double utterance_sec, double interim_sec)
+		: faults(faults), result_ms(result_ms), utterance_sec(utterance_sec), interim_sec(interim_sec), request_counter(0) {}
+
+	grpc::Status StreamingRecognize(grpc::ServerContext *context,
+					grpc::ServerReaderWriter<voiptime::cloud::stt::v1::StreamingRecognizeResponse,
+								 voiptime::cloud::stt::v1::StreamingRecognizeRequest> *stream) override
+	{
+		faults.DelaySetup();
+		if (faults.FailSetup())
+			return grpc::Status(grpc::StatusCode::UNAVAILABLE, "mock: injected setup error");
+
+		voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
+		if (!stream->Read(&request) || !request.has_streaming_config())
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: streaming config expected as first message");
+		const voiptime::cloud::stt::v1::StreamingRecognitionConfig &config = request.streaming_config();
+		int bytes_per_sample;
+		switch (config.config().encoding()) {
+		case voiptime::cloud::stt::v1::LINEAR16:
+			bytes_per_sample = 2;
+			break;
+		case voiptime::cloud::stt::v1::MULAW:
+		case voiptime::cloud::stt::v1::ALAW:
+			bytes_per_sample = 1;
+			break;
+		default:
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: unsupported encoding");
+		}
+		int sample_rate = config.config().sample_rate_hertz();
+		if (sample_rate <= 0)
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: sample rate expected");
+		bool interim_enable = config.interim_results_config().enable_interim_results();
+		bool single_utterance = config.single_utterance();
+		bool fail_stream = faults.FailStream();
+
+		context->AddInitialMetadata("x-request-id", "mock-" + std::to_string(++request_counter));
+		stream->SendInitialMetadata();
+
+		int64_t utterance_samples = std::max((int64_t) 1, (int64_t) (utterance_sec*sample_rate));
+		int64_t interim_samples = std::max((int64_t) 1, (int64_t) (interim_sec*sample_rate));
+		int64_t stream_samples = 0;
+		int64_t utterance_start = 0;
+		int64_t next_interim = interim_samples;
+		int utterance = 1;
+		int part = 1;
+		while (stream->Read(&request)) {
+			if (request.streaming_request_case() != voiptime::cloud::stt::v1::StreamingRecognizeRequest::kAudioContent)
+				return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: audio content expected");
+			stream_samples += request.audio_content().size()/bytes_per_sample;
+			if (fail_stream && stream_samples >= utterance_samples/2)
+				return grpc::Status(grpc::StatusCode::UNAVAILABLE, "mock: injected stream error");
+			if (interim_enable && stream_samples - utterance_start >= next_interim && stream_samples - utterance_start < utterance_samples) {
+				std::string transcript = "utterance " + std::to_string(utterance) + " part " + std::to_string(part++);
+				if (!SendResult(stream, transcript, false, utterance_start, stream_samples, sample_rate))
+					return grpc::Status::OK;
+				next_interim += interim_samples;
+			}
+			if (stream_samples - utterance_start >= utterance_samples) {
+				faults.Delay(result_ms);
+				if (!SendResult(stream, "utterance " + std::to_string(utterance), true, utterance_start, stream_samples, sample_rate))
+					return grpc::Status::OK;
+				if (single_utterance)
+					return grpc::Status::OK;
+				utterance++;
+				part = 1;
+				utterance_start = stream_samples;
+				next_interim = interim_samples;
+			}
+		}
+		// Half-closed by client: remaining audio is final phrase
+		if (stream_samples > utterance_start) {
+			faults.Delay(result_ms);
+			SendResult(stream, "utterance " + std::to_string(utterance), true, utterance_start, stream_samples, sample_rate);
+		}
+		return grpc::Status::OK;
+	}
+
+private:
+	static bool SendResult(grpc::ServerReaderWriter<voiptime::cloud::stt::v1::StreamingRecognizeResponse,
+							voiptime::cloud::stt::v1::StreamingRecognizeRequest> *stream,
+			       const std::string &transcript, bool is_final, int64_t start_samples, int64_t end_samples, int sample_rate)
+	{
+		voiptime::cloud::stt::v1::StreamingRecognizeResponse response;
+		voiptime::cloud::stt::v1::StreamingRecognitionResult *result = response.add_results();
+		result->set_is_final(is_final);
+		voiptime::cloud::stt::v1::SpeechRecognitionResult *recognition_result = result->mutable_recognition_result();
+		voiptime::cloud::stt::v1::SpeechRecognitionAlternative *alternative = recognition_result->add_alternatives();
+		alternative->set_transcript(transcript);
+		alternative->set_confidence(1.0);
+		set_duration(recognition_result->mutable_start_time(), start_samples, sample_rate);
+		set_duration(recognition_result->mutable_end_time(), end_samples, sample_rate);
+		return stream->Write(response);
+	}
+
+private:
+	VoiceKitMockFaults &faults;
+	int result_ms;
+	double utterance_sec;
+	double interim_sec;
+	std::atomic<uint64_t> request_counter;
+};
+
+
+static int usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-l LISTEN_ADDRESS] [-r RESULT_MS] [-u UTTERANCE_SEC] [-i INTERIM_SEC] %s\n", program, VoiceKitMockFaults::Usage());
+	return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	std::string listen_address = DEFAULT_LISTEN_ADDRESS;
+	int result_ms = 0;
+	double utterance_sec = DEFAULT_UTTERANCE_SEC;
+	double interim_sec = DEFAULT_INTERIM_SEC;
+	VoiceKitMockFaults faults;
+	std::string options = std::string("l:r:u:i:") + VoiceKitMockFaults::Options();
+	int opt;
+	while ((opt = getopt(argc, argv, options.c_str())) != -1) {
+		switch (opt) {
+		case 'l':
+			listen_address = optarg;
+			break;
+		case 'r':
+			result_ms = atoi(optarg);
+			break;
+		case 'u':
+			utterance_sec = atof(optarg);
+			break;
+		case 'i':
+			interim_sec = atof(optarg);
+			break;
+		default:
+			if (opt == '?' || !faults.ParseOption(opt, optarg))
+				return usage(argv[0]);
+		}
+	}
+	if (optind != argc || utterance_sec <= 0.0 || interim_sec <= 0.0)
+		return usage(argv[0]);
+
+	MockSpeechToText service(faults, result_ms, utterance_sec, interim_sec);
+	grpc::ServerBuilder builder;
+	builder.AddListeningPort(listen_address, grpc::InsecureServerCredentials());
+	builder.RegisterService(&service);
+	std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+	if (!server) {
+		fprintf(stderr, "Failed to listen at %s\n", listen_address.c_str());
+		return 1;
+	}
+	fprintf(stderr, "Mock STT service listening at %s\n", listen_address.c_str());
+	server->Wait();
+	return 0;
+}
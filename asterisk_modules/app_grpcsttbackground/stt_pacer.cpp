@@ -0,0 +1,91 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#include "stt_pacer.h"
+
+
+std::vector<uint8_t> make_silence_samples(enum grpc_stt_frame_format frame_format, size_t samples)
+{
+	switch (frame_format) {
+	case GRPC_STT_FRAME_FORMAT_SLINEAR16:
+		return std::vector<uint8_t>(samples*sizeof(int16_t), 0);
+	case GRPC_STT_FRAME_FORMAT_MULAW:
+		return std::vector<uint8_t>(samples, 0x7F /* SLINEAR16 (0) */);
+	default: /* GRPC_STT_FRAME_FORMAT_ALAW */
+		return std::vector<uint8_t>(samples, 0xD5 /* SLINEAR16 (8) */);
+	}
+}
+
+
+GRPCSTTPacer::GRPCSTTPacer(enum grpc_stt_frame_format frame_format, const struct timespec &now, WriteFunction write)
+	: frame_format(frame_format), write(write), valid(true), stream_samples(0), last_frame_moment(now),
+	  was_paused(false), last_keepalive_moment(now), stats()
+{
+}
+int GRPCSTTPacer::FillGap(const struct timespec &now, int expected_samples)
+{
+	int gap_samples = aligned_samples(delta_samples(&now, &last_frame_moment) - expected_samples);
+	if (gap_samples <= 0)
+		return 0;
+	WriteSilence(gap_samples);
+	time_add_samples(&last_frame_moment, gap_samples);
+	stats.gaps++;
+	stats.gap_samples += gap_samples;
+	return gap_samples;
+}
+bool GRPCSTTPacer::WriteAudio(const char *data, size_t len, int samples)
+{
+	time_add_samples(&last_frame_moment, samples);
+	stream_samples += samples;
+	stats.messages++;
+	stats.audio_bytes += len;
+	stats.audio_samples += samples;
+	if (!write(data, len))
+		valid = false;
+	return valid;
+}
+bool GRPCSTTPacer::PauseTick(const struct timespec &now, bool paused)
+{
+	if (!paused) {
+		// Paused time is not gap-filled: stream timeline continues from resume moment
+		if (was_paused)
+			last_frame_moment = now;
+		was_paused = false;
+		return false;
+	}
+	if (!was_paused)
+		last_keepalive_moment = now;
+	was_paused = true;
+	if (delta_samples(&now, &last_keepalive_moment) >= PAUSE_KEEPALIVE_MSEC*INTERNAL_SAMPLE_RATE/1000) {
+		WriteSilence(PAUSE_KEEPALIVE_SAMPLES);
+		stats.keepalives++;
+		last_keepalive_moment = now;
+	}
+	return true;
+}
+void GRPCSTTPacer::Restart(const struct timespec &now)
+{
+	last_frame_moment = now;
+}
+bool GRPCSTTPacer::WriteSilence(int samples)
+{
+	std::vector<uint8_t> buffer = make_silence_samples(frame_format, samples);
+	stream_samples += samples;
+	stats.messages++;
+	stats.audio_bytes += buffer.size();
+	if (!write((const char *) buffer.data(), buffer.size()))
+		valid = false;
+	return valid;
+}
@@ -0,0 +1,121 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Stream timeline of STT writer: captured audio is written as is, arrival gaps
+ * are filled with silence and paused stream gets keepalive silence only.
+ *
+ * Clock is passed by caller and this header is intentionally free of Asterisk
+ * dependencies so that capture replay tool (stt_replay.cpp) runs exactly the
+ * same pacing as session writer.
+ */
+
+#ifndef STT_PACER_H
+#define STT_PACER_H
+
+#include "grpc_stt.h"
+
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+
+#define INTERNAL_SAMPLE_RATE 8000
+#define MAX_FRAME_DURATION_MSEC 100
+#define MAX_FRAME_SAMPLES 800
+#define ALIGNMENT_SAMPLES 80
+
+// While paused stream gets this much silence once per interval instead of audio
+#define PAUSE_KEEPALIVE_MSEC 1000
+#define PAUSE_KEEPALIVE_SAMPLES ALIGNMENT_SAMPLES
+
+
+static inline int delta_samples(const struct timespec *a, const struct timespec *b)
+{
+	struct timespec delta;
+	delta.tv_sec = a->tv_sec - b->tv_sec;
+	delta.tv_nsec = a->tv_nsec - b->tv_nsec;
+	if (delta.tv_nsec < 0) {
+		delta.tv_sec--;
+		delta.tv_nsec += 1000000000;
+	}
+
+	return delta.tv_sec*INTERNAL_SAMPLE_RATE + ((int64_t) delta.tv_nsec)*INTERNAL_SAMPLE_RATE/1000000000;
+}
+static inline void time_add_samples(struct timespec *t, int samples)
+{
+	t->tv_sec += samples/INTERNAL_SAMPLE_RATE;
+	t->tv_nsec += ((int64_t) (samples%INTERNAL_SAMPLE_RATE))*1000000000/INTERNAL_SAMPLE_RATE;
+	if (t->tv_nsec >= 1000000000) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000;
+	}
+}
+static inline int aligned_samples(int samples)
+{
+	return (samples + ALIGNMENT_SAMPLES/2)/ALIGNMENT_SAMPLES*ALIGNMENT_SAMPLES;
+}
+
+extern std::vector<uint8_t> make_silence_samples(enum grpc_stt_frame_format frame_format, size_t samples);
+
+
+// Counters of written requests: compared between versions by replay tool
+struct GRPCSTTPacerStats
+{
+	uint64_t messages;
+	uint64_t audio_bytes;
+	uint64_t audio_samples;
+	uint64_t gaps;
+	uint64_t gap_samples;
+	uint64_t keepalives;
+};
+
+class GRPCSTTPacer
+{
+public:
+	// Writes audio content of one request; returns false if stream is broken
+	typedef std::function<bool(const char *data, size_t len)> WriteFunction;
+
+public:
+	GRPCSTTPacer(enum grpc_stt_frame_format frame_format, const struct timespec &now, WriteFunction write);
+	// Writes silence for time since last audio beyond expected_samples (MAX_FRAME_SAMPLES while idle,
+	// samples of arrived frame otherwise). Returns number of silence samples written.
+	int FillGap(const struct timespec &now, int expected_samples);
+	// Writes audio already converted to stream frame format
+	bool WriteAudio(const char *data, size_t len, int samples);
+	// Returns true if audio is not to be written now; writes keepalive silence while paused
+	bool PauseTick(const struct timespec &now, bool paused);
+	// Restarts gap tracking (e.g. after pre-roll which is past audio)
+	void Restart(const struct timespec &now);
+	bool Valid() const { return valid; }
+	int64_t StreamSamples() const { return stream_samples; }
+	const GRPCSTTPacerStats &Stats() const { return stats; }
+
+private:
+	bool WriteSilence(int samples);
+
+private:
+	enum grpc_stt_frame_format frame_format;
+	WriteFunction write;
+	bool valid;
+	int64_t stream_samples;
+	struct timespec last_frame_moment;
+	bool was_paused;
+	struct timespec last_keepalive_moment;
+	GRPCSTTPacerStats stats;
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#include "stt_profile.h"
+
+
+#define INTERNAL_SAMPLE_RATE 8000
+
+bool GRPCSTTRecognitionSettings::operator==(const GRPCSTTRecognitionSettings &other) const
+{
+	return language_code == other.language_code && max_alternatives == other.max_alternatives &&
+		frame_format == other.frame_format && vad_disable == other.vad_disable &&
+		vad_min_speech_duration == other.vad_min_speech_duration && vad_max_speech_duration == other.vad_max_speech_duration &&
+		vad_silence_duration_threshold == other.vad_silence_duration_threshold &&
+		vad_silence_prob_threshold == other.vad_silence_prob_threshold && vad_aggressiveness == other.vad_aggressiveness &&
+		interim_results_enable == other.interim_results_enable && interim_results_max_interval == other.interim_results_max_interval &&
+		interim_results_max_predictions == other.interim_results_max_predictions &&
+		enable_gender_identification == other.enable_gender_identification;
+}
+
+GRPCSTTProfile::GRPCSTTProfile(const std::string &name, const GRPCSTTRecognitionSettings &settings)
+	: name(name), settings(settings)
+{
+	BuildConfig(settings, &config);
+}
+void GRPCSTTProfile::BuildConfig(const GRPCSTTRecognitionSettings &settings,
+				 voiptime::cloud::stt::v1::StreamingRecognitionConfig *streaming_recognition_config)
+{
+	{
+		voiptime::cloud::stt::v1::RecognitionConfig *recognition_config = streaming_recognition_config->mutable_config();
+		switch (settings.frame_format) {
+		case GRPC_STT_FRAME_FORMAT_SLINEAR16:
+			recognition_config->set_encoding(voiptime::cloud::stt::v1::LINEAR16);
+			break;
+		case GRPC_STT_FRAME_FORMAT_MULAW:
+			recognition_config->set_encoding(voiptime::cloud::stt::v1::MULAW);
+			break;
+		default:
+			recognition_config->set_encoding(voiptime::cloud::stt::v1::ALAW);
+		}
+		recognition_config->set_sample_rate_hertz(INTERNAL_SAMPLE_RATE);
+		recognition_config->set_num_channels(1);
+		if (settings.language_code.size())
+			recognition_config->set_language_code(settings.language_code);
+		recognition_config->set_max_alternatives(settings.max_alternatives);
+		if (settings.vad_disable) {
+			recognition_config->set_do_not_perform_vad(true);
+		} else {
+			voiptime::cloud::stt::v1::VoiceActivityDetectionConfig *vad_config = recognition_config->mutable_vad_config();
+			vad_config->set_min_speech_duration(settings.vad_min_speech_duration);
+			vad_config->set_max_speech_duration(settings.vad_max_speech_duration);
+			vad_config->set_silence_duration_threshold(settings.vad_silence_duration_threshold);
+			vad_config->set_silence_prob_threshold(settings.vad_silence_prob_threshold);
+			vad_config->set_aggressiveness(settings.vad_aggressiveness);
+		}
+		recognition_config->set_enable_gender_identification(settings.enable_gender_identification);
+	}
+	{
+		voiptime::cloud::stt::v1::InterimResultsConfig *interim_results_config = streaming_recognition_config->mutable_interim_results_config();
+		interim_results_config->set_enable_interim_results(settings.interim_results_enable);
+		interim_results_config->set_interval(settings.interim_results_max_interval);
+		interim_results_config->set_max_predictions(settings.interim_results_max_predictions);
+	}
+}
+
+
+extern "C" struct grpc_stt_profile *grpc_stt_profile_compile(const char *name, const char *language_code, int max_alternatives,
+							      enum grpc_stt_frame_format frame_format,
+							      int vad_disable, double vad_min_speech_duration, double vad_max_speech_duration,
+							      double vad_silence_duration_threshold, double vad_silence_prob_threshold, double vad_aggressiveness,
+							      int interim_results_enable, double interim_results_max_interval, int interim_results_max_predictions,
+							      int enable_gender_identification)
+{
+	try {
+		GRPCSTTRecognitionSettings settings;
+		settings.language_code = language_code ? language_code : "";
+		settings.max_alternatives = max_alternatives;
+		settings.frame_format = frame_format;
+		settings.vad_disable = vad_disable;
+		settings.vad_min_speech_duration = vad_min_speech_duration;
+		settings.vad_max_speech_duration = vad_max_speech_duration;
+		settings.vad_silence_duration_threshold = vad_silence_duration_threshold;
+		settings.vad_silence_prob_threshold = vad_silence_prob_threshold;
+		settings.vad_aggressiveness = vad_aggressiveness;
+		settings.interim_results_enable = interim_results_enable;
+		settings.interim_results_max_interval = interim_results_max_interval;
+		settings.interim_results_max_predictions = interim_results_max_predictions;
+		settings.enable_gender_identification = enable_gender_identification;
+		struct grpc_stt_profile *profile = new grpc_stt_profile;
+		profile->profile = std::make_shared<const GRPCSTTProfile>(name, settings);
+		return profile;
+	} catch (...) {
+		return NULL;
+	}
+}
+extern "C" struct grpc_stt_profile *grpc_stt_profile_dup(struct grpc_stt_profile *profile)
+{
+	if (!profile)
+		return NULL;
+	try {
+		return new grpc_stt_profile(*profile);
+	} catch (...) {
+		return NULL;
+	}
+}
+extern "C" void grpc_stt_profile_release(struct grpc_stt_profile *profile)
+{
+	delete profile;
+}
@@ -0,0 +1,72 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPC_STT_PROFILE_H
+#define GRPC_STT_PROFILE_H
+
+#include "stt.grpc.pb.h"
+#include "grpc_stt.h"
+
+#include <memory>
+#include <string>
+
+
+// Recognition config which may be replaced between streams of same session
+struct GRPCSTTRecognitionSettings
+{
+	std::string language_code;
+	int max_alternatives;
+	enum grpc_stt_frame_format frame_format;
+	bool vad_disable;
+	double vad_min_speech_duration;
+	double vad_max_speech_duration;
+	double vad_silence_duration_threshold;
+	double vad_silence_prob_threshold;
+	double vad_aggressiveness;
+	bool interim_results_enable;
+	double interim_results_max_interval;
+	int interim_results_max_predictions;
+	bool enable_gender_identification;
+
+	bool operator==(const GRPCSTTRecognitionSettings &other) const;
+};
+
+// Streaming config of [profile-NAME] section of grpcstt.conf built once at configuration load.
+// Session copies it and patches per-call fields only (channel exten, ids, request UUID)
+// as long as its recognition settings are those of profile.
+class GRPCSTTProfile
+{
+public:
+	GRPCSTTProfile(const std::string &name, const GRPCSTTRecognitionSettings &settings);
+	const std::string &Name() const { return name; }
+	const GRPCSTTRecognitionSettings &Settings() const { return settings; }
+	const voiptime::cloud::stt::v1::StreamingRecognitionConfig &Config() const { return config; }
+
+	// Fills session-independent part of streaming config
+	static void BuildConfig(const GRPCSTTRecognitionSettings &settings,
+				voiptime::cloud::stt::v1::StreamingRecognitionConfig *config);
+
+private:
+	std::string name;
+	GRPCSTTRecognitionSettings settings;
+	voiptime::cloud::stt::v1::StreamingRecognitionConfig config;
+};
+
+struct grpc_stt_profile
+{
+	std::shared_ptr<const GRPCSTTProfile> profile;
+};
+
+#endif
@@ -0,0 +1,435 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Replay of STT frame capture (see frame_capture.h) through writer pacing.
+ *
+ * Frames are fed to the same GRPCSTTPacer as session writer uses, waking up
+ * the way writer does: at each frame arrival and after MAX_FRAME_DURATION_MSEC*2
+ * of idle time. By default clock is virtual (as fast as possible, so results are
+ * deterministic); with -r frames are fed with original pacing. Requests go to
+ * shared-memory stub server (shm_stt_stub) if endpoint is given and are dropped
+ * otherwise; with -o they are also dumped (length-prefixed serialized requests)
+ * to be diffed between versions.
+ *
+ * Conversion between G.711 and SLINEAR16 uses reference G.711 algorithm rather
+ * than Asterisk codec tables. Client-side endpointing and automatic pause are
+ * not replayed (capture carries no PlayBackground() or hold state).
+ *
+ * Usage: stt_replay [-r] [-f alaw|mulaw|slin] [-e shm:SOCKET_PATH] [-o REQUESTS_FILE] CAPTURE_FILE
+ */
+
+#include "stt.pb.h"
+#include "frame_capture.h"
+#include "stt_pacer.h"
+#include "shm_stt.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define IDLE_WAKEUP_NSEC (MAX_FRAME_DURATION_MSEC*2*1000000LL)
+
+
+struct ReplayRecord
+{
+	struct grpc_stt_capture_record header;
+	std::string payload;
+};
+
+
+static int16_t alaw_to_linear(uint8_t a_val)
+{
+	a_val ^= 0x55;
+	int t = (a_val & 0x0F) << 4;
+	int seg = (a_val & 0x70) >> 4;
+	switch (seg) {
+	case 0:
+		t += 8;
+		break;
+	case 1:
+		t += 0x108;
+		break;
+	default:
+		t += 0x108;
+		t <<= seg - 1;
+	}
+	return (a_val & 0x80) ? t : -t;
+}
+static int16_t ulaw_to_linear(uint8_t u_val)
+{
+	u_val = ~u_val;
+	int t = ((u_val & 0x0F) << 3) + 0x84;
+	t <<= (u_val & 0x70) >> 4;
+	return (u_val & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+static int segment_of(int value, const int *ends)
+{
+	for (int i = 0; i < 8; ++i)
+		if (value <= ends[i])
+			return i;
+	return 8;
+}
+static uint8_t linear_to_alaw(int16_t pcm_val)
+{
+	static const int seg_aend[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+	int value = pcm_val >> 3;
+	uint8_t mask;
+	if (value >= 0) {
+		mask = 0xD5;
+	} else {
+		mask = 0x55;
+		value = -value - 1;
+	}
+	int seg = segment_of(value, seg_aend);
+	if (seg >= 8)
+		return 0x7F ^ mask;
+	uint8_t aval = seg << 4;
+	aval |= (seg < 2) ? ((value >> 1) & 0x0F) : ((value >> seg) & 0x0F);
+	return aval ^ mask;
+}
+static uint8_t linear_to_ulaw(int16_t pcm_val)
+{
+	static const int seg_uend[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+	int value = pcm_val >> 2;
+	uint8_t mask;
+	if (value < 0) {
+		value = -value;
+		mask = 0x7F;
+	} else {
+		mask = 0xFF;
+	}
+	if (value > 8159)
+		value = 8159;
+	value += 0x84 >> 2;
+	int seg = segment_of(value, seg_uend);
+	if (seg >= 8)
+		return 0x7F ^ mask;
+	return ((seg << 4) | ((value >> (seg + 1)) & 0x0F)) ^ mask;
+}
+
+// Returns NULL for unknown codec; same-format payload is passed as is like in session writer
+static const char *convert_samples(const ReplayRecord &record, enum grpc_stt_frame_format frame_format, std::vector<uint8_t> &buffer, size_t *len)
+{
+	size_t sample_count = record.header.samples;
+	const uint8_t *sptr = (const uint8_t *) record.payload.data();
+	int codec = record.header.codec;
+	if (codec == GRPC_STT_CAPTURE_CODEC_UNKNOWN)
+		return NULL;
+	if (record.payload.size() < sample_count*(codec == GRPC_STT_FRAME_FORMAT_SLINEAR16 ? sizeof(int16_t) : 1))
+		return NULL;
+	if (codec == frame_format) {
+		*len = record.payload.size();
+		return record.payload.data();
+	}
+
+	std::vector<int16_t> linear(sample_count);
+	for (size_t i = 0; i < sample_count; ++i) {
+		switch (codec) {
+		case GRPC_STT_FRAME_FORMAT_ALAW:
+			linear[i] = alaw_to_linear(sptr[i]);
+			break;
+		case GRPC_STT_FRAME_FORMAT_MULAW:
+			linear[i] = ulaw_to_linear(sptr[i]);
+			break;
+		default:
+			linear[i] = le16toh(((const int16_t *) sptr)[i]);
+		}
+	}
+	switch (frame_format) {
+	case GRPC_STT_FRAME_FORMAT_SLINEAR16:
+		buffer.resize(sample_count*sizeof(int16_t));
+		for (size_t i = 0; i < sample_count; ++i)
+			((int16_t *) buffer.data())[i] = htole16(linear[i]);
+		break;
+	case GRPC_STT_FRAME_FORMAT_MULAW:
+		buffer.resize(sample_count);
+		for (size_t i = 0; i < sample_count; ++i)
+			buffer[i] = linear_to_ulaw(linear[i]);
+		break;
+	default:
+		buffer.resize(sample_count);
+		for (size_t i = 0; i < sample_count; ++i)
+			buffer[i] = linear_to_alaw(linear[i]);
+	}
+	*len = buffer.size();
+	return (const char *) buffer.data();
+}
+
+static bool load_capture(const char *path, struct grpc_stt_capture_header &header, std::vector<ReplayRecord> &records)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != GRPC_STT_CAPTURE_MAGIC || header.version != GRPC_STT_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not a frame capture of supported version\n", path);
+		fclose(file);
+		return false;
+	}
+	ReplayRecord record;
+	while (fread(&record.header, sizeof(record.header), 1, file) == 1) {
+		record.payload.resize(record.header.length);
+		if (record.header.length && fread(&record.payload[0], record.header.length, 1, file) != 1) {
+			fprintf(stderr, "%s: truncated record ignored\n", path);
+			break;
+		}
+		records.push_back(record);
+	}
+	fclose(file);
+	return true;
+}
+
+static int parse_frame_format(const char *str)
+{
+	if (!strcmp(str, "alaw"))
+		return GRPC_STT_FRAME_FORMAT_ALAW;
+	if (!strcmp(str, "mulaw"))
+		return GRPC_STT_FRAME_FORMAT_MULAW;
+	if (!strcmp(str, "slin"))
+		return GRPC_STT_FRAME_FORMAT_SLINEAR16;
+	return -1;
+}
+
+static inline struct timespec timespec_of(int64_t ns)
+{
+	struct timespec t = {
+		.tv_sec = (time_t) (ns/1000000000),
+		.tv_nsec = (long) (ns%1000000000),
+	};
+	return t;
+}
+static inline int64_t monotonic_nsec()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((int64_t) t.tv_sec)*1000000000 + t.tv_nsec;
+}
+static inline int64_t process_cpu_nsec()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+	return ((int64_t) t.tv_sec)*1000000000 + t.tv_nsec;
+}
+
+
+static int usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-r] [-f alaw|mulaw|slin] [-e shm:SOCKET_PATH] [-o REQUESTS_FILE] CAPTURE_FILE\n", program);
+	return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	bool realtime = false;
+	int frame_format_override = -1;
+	std::string endpoint;
+	const char *dump_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "rf:e:o:")) != -1) {
+		switch (opt) {
+		case 'r':
+			realtime = true;
+			break;
+		case 'f':
+			frame_format_override = parse_frame_format(optarg);
+			if (frame_format_override < 0) {
+				fprintf(stderr, "Unknown frame format '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'e':
+			endpoint = optarg;
+			break;
+		case 'o':
+			dump_path = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		return usage(argv[0]);
+	if (endpoint.size() && endpoint.compare(0, strlen(SHM_STT_ENDPOINT_PREFIX), SHM_STT_ENDPOINT_PREFIX)) {
+		fprintf(stderr, "Only \"" SHM_STT_ENDPOINT_PREFIX "SOCKET_PATH\" endpoints are supported\n");
+		return 1;
+	}
+
+	struct grpc_stt_capture_header header;
+	std::vector<ReplayRecord> records;
+	if (!load_capture(argv[optind], header, records))
+		return 1;
+	enum grpc_stt_frame_format frame_format = (enum grpc_stt_frame_format)
+		(frame_format_override >= 0 ? frame_format_override : (int) header.frame_format);
+
+	FILE *dump = NULL;
+	if (dump_path && !(dump = fopen(dump_path, "wb"))) {
+		perror(dump_path);
+		return 1;
+	}
+	std::unique_ptr<SHMSTTStream> stream;
+	std::thread reader;
+	uint64_t responses = 0;
+	try {
+		if (endpoint.size()) {
+			stream.reset(new SHMSTTStream(endpoint.substr(strlen(SHM_STT_ENDPOINT_PREFIX))));
+			voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
+			voiptime::cloud::stt::v1::RecognitionConfig *recognition_config = request.mutable_streaming_config()->mutable_config();
+			recognition_config->set_encoding(frame_format == GRPC_STT_FRAME_FORMAT_SLINEAR16 ? voiptime::cloud::stt::v1::LINEAR16 :
+							 frame_format == GRPC_STT_FRAME_FORMAT_MULAW ? voiptime::cloud::stt::v1::MULAW :
+							 voiptime::cloud::stt::v1::ALAW);
+			recognition_config->set_sample_rate_hertz(INTERNAL_SAMPLE_RATE);
+			recognition_config->set_num_channels(1);
+			if (!stream->Write(request) || stream->WaitForRequestId().empty()) {
+				fprintf(stderr, "Stream setup failed: %s\n", stream->Finish().error_message().c_str());
+				return 1;
+			}
+			reader = std::thread([&stream, &responses]()
+					     {
+						     voiptime::cloud::stt::v1::StreamingRecognizeResponse response;
+						     while (stream->Read(&response))
+							     ++responses;
+					     });
+		}
+	} catch (const std::exception &ex) {
+		fprintf(stderr, "%s\n", ex.what());
+		return 1;
+	}
+
+	std::string serialized;
+	GRPCSTTPacer::WriteFunction write = [&stream, dump, &serialized](const char *data, size_t len) -> bool
+	{
+		voiptime::cloud::stt::v1::StreamingRecognizeRequest request;
+		request.set_audio_content(data, len);
+		if (dump) {
+			request.SerializeToString(&serialized);
+			uint32_t size = serialized.size();
+			fwrite(&size, sizeof(size), 1, dump);
+			fwrite(serialized.data(), serialized.size(), 1, dump);
+		}
+		return stream ? stream->Write(request) : true;
+	};
+
+	// Virtual clock returns target time at once, real one sleeps until it
+	int64_t start_ns = monotonic_nsec();
+	auto advance_to = [realtime, start_ns](int64_t target_ns) -> int64_t
+	{
+		if (!realtime)
+			return target_ns;
+		struct timespec wakeup = timespec_of(start_ns + target_ns);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+		return monotonic_nsec() - start_ns;
+	};
+
+	int64_t cpu_start_ns = process_cpu_nsec();
+	GRPCSTTPacer pacer(frame_format, timespec_of(0), write);
+	bool paused = false;
+	uint64_t voice_frames = 0;
+	uint64_t dropped_frames = 0;
+	uint64_t segments = 0;
+	int64_t wakeup_ns = 0;
+	size_t i = 0;
+	while (i < records.size() && pacer.Valid()) {
+		int64_t arrival_ns = records[i].header.arrival_ns;
+		while (arrival_ns - wakeup_ns > IDLE_WAKEUP_NSEC) {
+			wakeup_ns = advance_to(wakeup_ns + IDLE_WAKEUP_NSEC);
+			struct timespec now = timespec_of(wakeup_ns);
+			if (!pacer.PauseTick(now, paused))
+				pacer.FillGap(now, MAX_FRAME_SAMPLES);
+		}
+		wakeup_ns = advance_to(std::max(arrival_ns, wakeup_ns));
+		struct timespec now = timespec_of(wakeup_ns);
+
+		// Frames arrived by wakeup are drained at once with single gap check
+		bool gap_handled = false;
+		for (; i < records.size() && records[i].header.arrival_ns <= wakeup_ns && pacer.Valid(); ++i) {
+			const ReplayRecord &record = records[i];
+			switch (record.header.kind) {
+			case GRPC_STT_CAPTURE_VOICE:
+			case GRPC_STT_CAPTURE_PREROLL: {
+				++voice_frames;
+				if (pacer.PauseTick(now, paused)) {
+					++dropped_frames;
+					break;
+				}
+				if (!gap_handled) {
+					pacer.FillGap(now, record.header.samples);
+					gap_handled = true;
+				}
+				std::vector<uint8_t> buffer;
+				size_t len = 0;
+				const char *data = convert_samples(record, frame_format, buffer, &len);
+				if (!data) {
+					++dropped_frames;
+					break;
+				}
+				pacer.WriteAudio(data, len, record.header.samples);
+				if (record.header.kind == GRPC_STT_CAPTURE_PREROLL)
+					pacer.Restart(now);
+			} break;
+			case GRPC_STT_CAPTURE_SEGMENT:
+				++segments;
+				break;
+			case GRPC_STT_CAPTURE_PAUSE:
+				paused = record.payload.size() && record.payload[0] == '1';
+				break;
+			}
+		}
+	}
+	int64_t cpu_ns = process_cpu_nsec() - cpu_start_ns;
+	int64_t wall_ns = monotonic_nsec() - start_ns;
+
+	grpc::Status status;
+	if (stream) {
+		stream->WritesDone();
+		reader.join();
+		status = stream->Finish();
+	}
+	if (dump)
+		fclose(dump);
+
+	const GRPCSTTPacerStats &stats = pacer.Stats();
+	printf("records=%zu\n", records.size());
+	printf("capture_duration_sec=%.3f\n", records.size() ? records.back().header.arrival_ns/1e9 : 0.0);
+	printf("voice_frames=%llu\n", (unsigned long long) voice_frames);
+	printf("dropped_frames=%llu\n", (unsigned long long) dropped_frames);
+	printf("segments=%llu\n", (unsigned long long) segments);
+	printf("messages=%llu\n", (unsigned long long) stats.messages);
+	printf("audio_bytes=%llu\n", (unsigned long long) stats.audio_bytes);
+	printf("stream_samples=%lld\n", (long long) pacer.StreamSamples());
+	printf("audio_samples=%llu\n", (unsigned long long) stats.audio_samples);
+	printf("gaps=%llu\n", (unsigned long long) stats.gaps);
+	printf("gap_samples=%llu\n", (unsigned long long) stats.gap_samples);
+	printf("keepalives=%llu\n", (unsigned long long) stats.keepalives);
+	printf("cpu_ms=%.3f\n", cpu_ns/1e6);
+	printf("wall_ms=%.3f\n", wall_ns/1e6);
+	if (stream) {
+		printf("responses=%llu\n", (unsigned long long) responses);
+		printf("status=%d %s\n", (int) status.error_code(), status.error_message().c_str());
+	}
+	return pacer.Valid() ? 0 : 2;
+}
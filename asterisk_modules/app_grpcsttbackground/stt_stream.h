@@ -0,0 +1,38 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef STT_STREAM_H
+#define STT_STREAM_H
+
+#include "stt.grpc.pb.h"
+
+#include <string>
+
+
+// Bidirectional recognition stream independent of transport.
+// Write()/WritesDone() are called from writer thread, Read() from reader thread.
+class STTStream
+{
+public:
+	virtual ~STTStream() {}
+
+	virtual bool Write(const voiptime::cloud::stt::v1::StreamingRecognizeRequest &request) = 0;
+	virtual bool WritesDone() = 0;
+	virtual std::string WaitForRequestId() = 0;
+	virtual bool Read(voiptime::cloud::stt::v1::StreamingRecognizeResponse *response) = 0;
+	virtual grpc::Status Finish() = 0;
+};
+
+#endif
@@ -31,6 +31,7 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 #include "stream_layers.h"
 #include "grpctts.h"
 #include "grpctts_conf.h"
+#include "voicekit_grpc.h"
 
 #include <asterisk.h>
 
@@ -39,12 +40,14 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 #include <asterisk/module.h>
 #include <asterisk/manager.h>
 #include <asterisk/utils.h>
+#include <asterisk/astobj2.h>
 #include <asterisk/dlinkedlists.h>
 #include <asterisk/channel.h>
 #include <asterisk/channel_internal.h>
 #include <asterisk/mod_format.h>
 #include <asterisk/format_cache.h>
 #include <asterisk/paths.h>
+#include <asterisk/cli.h>
 
 #include <sys/eventfd.h>
 #include <sys/stat.h>
@@ -61,9 +64,11 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 			</parameter>
 			<parameter name="endpoint" required="false">
 				<para>Specifies endpointg for GRPC TTS service (must be specified here or at configuration file)</para>
+				<para>Either &quot;HOST:PORT&quot; or &quot;unix:PATH&quot; for service listening at Unix domain socket (TLS is not used for such endpoints unless &quot;use_ssl&quot; is set at configuration file)</para>
 			</parameter>
 			<parameter name="ca_file" required="false">
 				<para>Specifies CA filename to load as alternative list of CA (by default builtin CA list is used).</para>
+				<para>TLS credentials are built once per CA file and shared by all channels until the file changes on disk.</para>
 			</parameter>
 			<parameter name="remote_frame_format" required="false">
 				<para>Specifies remote audio frame format. Allowed values are "slin" and "opus". Default: "slin"</para>
@@ -98,8 +103,10 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 			<para><emphasis>At each playback begin an &quot;PlayBackgroundXRequestId(LAYER_N,X_REQUEST_ID)&quot; (only for synthesis) and quot;PlayBackgroundDuration(LAYER_N,DURATION_SECS)&quot; events are generated.</emphasis></para>
 			<para><emphasis>At each playback actual streaming begin (after initial buffer size was reached) an &quot;PlayBackgroundStreamingStarted(LAYER_N)&quot; event is generated.</emphasis></para>
 			<para><emphasis>At each playback end an &quot;PlayBackgroundFinished(LAYER_N)&quot; event is generated.</emphasis></para>
+			<para><emphasis>At each synthesis end (finished or interrupted) an &quot;PlayBackgroundUsage(LAYER_N,CPU_MS,CPU_MS_PER_SEC,PEAK_BUFFER_BYTES)&quot; event is generated before &quot;PlayBackgroundFinished&quot;: CPU time of synthesis thread (total and per second of job) and peak size of synthesized audio buffered but not yet played.</emphasis></para>
 			<para><emphasis>At each event task reached an &quot;PlayBackgroundEvent(LAYER_N,EVENT)&quot; event is generated.</emphasis></para>
 			<para><emphasis>At each playback error an &quot;PlayBackgroundError(LAYER_N)&quot; event is generated and remaining commands are dropped.</emphasis></para>
+			<para>Synthesis setup and first audio chunk are bounded by [failfast] setup_timeout and first_byte_timeout of configuration file: expired synthesis fails with playback error instead of playing silence. With [failfast] breaker enabled, jobs of endpoint that keeps failing fail at once (see &quot;voicekit show breakers&quot; CLI command).</para>
 			<para><emphasis>Note that invocation with empty arguments will stop current playback.</emphasis></para>
 			<example title="Play single file">
 			 PlayBackgorund(play,,directory1/file3); // At playback end &quot;PlayBackgroundFinished(0)&quot; event is generated
@@ -155,8 +162,32 @@ struct ht_playback_control {
 	int socket_fd_pipe_fd;
 };
 
-static struct grpctts_conf dflt_grpctts_conf = GRPCTTS_CONF_INITIALIZER;
-static ast_mutex_t dflt_grpctts_conf_mutex = AST_MUTEX_INIT_VALUE;
+/* Immutable snapshot of grpctts.conf: replaced as a whole on reload */
+struct grpctts_conf_snapshot {
+	struct grpctts_conf conf;
+};
+static AO2_GLOBAL_OBJ_STATIC(dflt_grpctts_conf);
+
+
+/* struct grpctts_conf_snapshot methods */
+static void destroy_grpctts_conf_snapshot(void *void_s)
+{
+	struct grpctts_conf_snapshot *s = void_s;
+	grpctts_conf_clear(&s->conf);
+}
+static int load_dflt_grpctts_conf(int reload)
+{
+	struct grpctts_conf_snapshot *snapshot = ao2_alloc_options(sizeof(struct grpctts_conf_snapshot), destroy_grpctts_conf_snapshot,
+								   AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!snapshot)
+		return -1;
+	grpctts_conf_init(&snapshot->conf);
+	int ret = grpctts_conf_load(&snapshot->conf, "grpctts.conf", reload);
+	if (!ret)
+		ao2_global_obj_replace_unref(dflt_grpctts_conf, snapshot);
+	ao2_ref(snapshot, -1);
+	return ret < 0 ? -1 : 0;
+}
 
 
 /* struct user_message methods */
@@ -207,7 +238,11 @@ static struct ht_playback_control *make_ht_playback_control(void)
 	fcntl(s->eventfd, F_SETFL, fcntl(s->eventfd, F_GETFL) | O_NONBLOCK);
 	ast_mutex_init(&s->mutex);
 	grpctts_conf_init(&s->conf);
-	grpctts_conf_cpy(&s->conf, &dflt_grpctts_conf, &dflt_grpctts_conf_mutex);
+	struct grpctts_conf_snapshot *snapshot = ao2_global_obj_ref(dflt_grpctts_conf);
+	if (snapshot) {
+		grpctts_conf_cpy(&s->conf, &snapshot->conf);
+		ao2_ref(snapshot, -1);
+	}
 	s->socket_fd_pipe_fd = -1;
 	return s;
 }
@@ -357,7 +392,7 @@ static int playbackgroundinitgrpctts_exec(struct ast_channel *chan, const char *
 
 	if (args.conf_fname && *args.conf_fname) {
 		grpctts_conf_clear(&control->conf);
-		grpctts_conf_load(&control->conf, NULL, args.conf_fname, 0);
+		grpctts_conf_load(&control->conf, args.conf_fname, 0);
 	}
 
 	if (args.endpoint && *args.endpoint) {
@@ -369,13 +404,16 @@ static int playbackgroundinitgrpctts_exec(struct ast_channel *chan, const char *
 		ast_log(LOG_ERROR, "PlayBackgroundInitGRPCTTS: Failed to execute application: no endpoint specified\n");
 		return -1;
 	}
+	if (!voicekit_grpc_endpoint_is_valid(control->conf.endpoint, 0)) {
+		ast_log(LOG_ERROR, "PlayBackgroundInitGRPCTTS: Failed to execute application: invalid endpoint '%s' (expected \"host:port\" or \"unix:path\")\n", control->conf.endpoint);
+		return -1;
+	}
 
 	if (args.ca_file && *args.ca_file) {
-		char *ca_data = grpctts_load_ca_from_file(args.ca_file);
-		if (!ca_data)
+		if (voicekit_grpc_credentials_check(args.ca_file))
 			return -1;
-		ast_free(control->conf.ca_data);
-		control->conf.ca_data = ca_data;
+		ast_free(control->conf.ca_file);
+		control->conf.ca_file = ast_strdup(args.ca_file);
 	}
 	if (args.remote_frame_format && *args.remote_frame_format) {
 		if (!strcmp(args.remote_frame_format, "slin")) {
@@ -390,9 +428,10 @@ static int playbackgroundinitgrpctts_exec(struct ast_channel *chan, const char *
 
 	ast_mutex_lock(&control->mutex);
 	if (!control->tts_channel)
-		control->tts_channel = grpctts_channel_create(control->conf.endpoint, control->conf.ca_data,
+		control->tts_channel = grpctts_channel_create(control->conf.endpoint, control->conf.ssl_grpc, control->conf.ca_file,
 							      control->conf.authorization_api_key, control->conf.authorization_secret_key,
-							      control->conf.authorization_issuer, control->conf.authorization_subject, control->conf.authorization_audience);
+							      control->conf.authorization_issuer, control->conf.authorization_subject, control->conf.authorization_audience,
+							      ast_channel_name(chan), &control->conf.failfast);
 	ast_mutex_unlock(&control->mutex);
 
 	return 0;
@@ -454,11 +493,177 @@ static void stream_error_callback(const char *message)
 	ast_log(LOG_ERROR, "%s\n", message);
 }
 
+
+static char *handle_cli_bench_tts(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit bench tts";
+		e->usage =
+			"Usage: voicekit bench tts [MIN_MSEC]\n"
+			"       Runs micro-benchmarks of TTS per-frame and per-chunk code\n"
+			"       (audio byte queue, mixing of 1 to 4 layers, buffer size parsing)\n"
+			"       for at least MIN_MSEC (200 by default) each and prints JSON line\n"
+			"       with time and allocations per call for every benchmark\n"
+			"       (allocations are null unless built with --enable-bench-alloc-count).\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3 && a->argc != 4)
+		return CLI_SHOWUSAGE;
+	int min_time_ms = (a->argc == 4) ? atoi(a->argv[3]) : VOICEKIT_BENCH_DFLT_MIN_TIME_MS;
+	if (min_time_ms <= 0)
+		return CLI_SHOWUSAGE;
+
+	grpctts_bench(a->fd, min_time_ms);
+	stream_layers_bench(a->fd, min_time_ms);
+	return CLI_SUCCESS;
+}
+
+static char *handle_cli_show_tts_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit show tts cache";
+		e->usage =
+			"Usage: voicekit show tts cache\n"
+			"       Shows size and hit/miss counters of synthesized audio cache.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4)
+		return CLI_SHOWUSAGE;
+
+	struct grpctts_cache_stats stats;
+	grpctts_cache_get_stats(&stats);
+	unsigned long long lookups = stats.memory_hits + stats.disk_hits + stats.misses;
+	ast_cli(a->fd, "Memory hits:       %llu\n", stats.memory_hits);
+	ast_cli(a->fd, "Disk hits:         %llu\n", stats.disk_hits);
+	ast_cli(a->fd, "Misses:            %llu\n", stats.misses);
+	ast_cli(a->fd, "Hit ratio:         %.1f%%\n", lookups ? 100.0*(stats.memory_hits + stats.disk_hits)/lookups : 0.0);
+	ast_cli(a->fd, "Stores:            %llu\n", stats.stores);
+	ast_cli(a->fd, "Expired:           %llu\n", stats.expired);
+	ast_cli(a->fd, "Memory evictions:  %llu\n", stats.memory_evictions);
+	ast_cli(a->fd, "Disk evictions:    %llu\n", stats.disk_evictions);
+	ast_cli(a->fd, "Memory entries:    %zu\n", stats.memory_entries);
+	ast_cli(a->fd, "Memory bytes:      %zu\n", stats.memory_bytes);
+	ast_cli(a->fd, "Disk bytes:        %zu\n", stats.disk_bytes);
+	return CLI_SUCCESS;
+}
+
+#define LOAD_DFLT_TEXT "Hello, this is a synthetic load test prompt."
+
+static char *handle_cli_load_tts(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit load tts";
+		e->usage =
+			"Usage: voicekit load tts ENDPOINT CHANNELS TOTAL_SEC [opus] [tls] [unique] [TEXT]\n"
+			"       Runs CHANNELS simulated channels, each synthesizing TEXT back to back\n"
+			"       at ENDPOINT for TOTAL_SEC seconds through the same reactor, channel\n"
+			"       pool and audio cache as PlayBackground() uses, then prints sessions,\n"
+			"       throughput, latency percentiles and process resource usage.\n"
+			"       Voice and failfast settings are taken from grpctts.conf and no\n"
+			"       authorization is sent; \"opus\" requests RAW_OPUS instead of LINEAR16, \"tls\"\n"
+			"       connects with TLS and \"unique\" makes every job text unique to\n"
+			"       bypass audio cache. Blocks CLI until finished.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc < 6)
+		return CLI_SHOWUSAGE;
+	int channels = atoi(a->argv[4]);
+	double total_sec = atof(a->argv[5]);
+	if (channels <= 0 || total_sec <= 0.0)
+		return CLI_SHOWUSAGE;
+	int opus = 0;
+	int tls = 0;
+	int unique_text = 0;
+	const char *text = LOAD_DFLT_TEXT;
+	for (int i = 6; i < a->argc; ++i) {
+		if (!strcasecmp(a->argv[i], "opus"))
+			opus = 1;
+		else if (!strcasecmp(a->argv[i], "tls"))
+			tls = 1;
+		else if (!strcasecmp(a->argv[i], "unique"))
+			unique_text = 1;
+		else if (*a->argv[i])
+			text = a->argv[i];
+		else
+			return CLI_SHOWUSAGE;
+	}
+
+	struct grpctts_job_conf job_conf;
+	struct grpctts_failfast_conf failfast_conf;
+	grpctts_job_conf_init(&job_conf);
+	grpctts_failfast_conf_init(&failfast_conf);
+	struct grpctts_conf_snapshot *snapshot = ao2_global_obj_ref(dflt_grpctts_conf);
+	if (snapshot) {
+		grpctts_job_conf_cpy(&job_conf, &snapshot->conf.job_conf);
+		failfast_conf = snapshot->conf.failfast;
+	}
+	ao2_cleanup(snapshot);
+	job_conf.remote_frame_format = opus ? GRPCTTS_FRAME_FORMAT_OPUS : GRPCTTS_FRAME_FORMAT_SLINEAR16;
+
+	grpctts_load(a->fd, a->argv[3], tls, channels, total_sec, unique_text, text, &job_conf, &failfast_conf);
+	grpctts_job_conf_clear(&job_conf);
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_playbackground[] = {
+	AST_CLI_DEFINE(handle_cli_bench_tts, "Run TTS micro-benchmarks"),
+	AST_CLI_DEFINE(handle_cli_load_tts, "Run TTS synthetic-channel load test"),
+	AST_CLI_DEFINE(handle_cli_show_tts_cache, "Show synthesized audio cache statistics"),
+};
+
+static int start_reactor(void)
+{
+	struct grpctts_conf_snapshot *snapshot = ao2_global_obj_ref(dflt_grpctts_conf);
+	int thread_count = snapshot ? snapshot->conf.reactor_threads : 0;
+	ao2_cleanup(snapshot);
+	if (grpctts_reactor_start(thread_count)) {
+		ast_log(LOG_ERROR, "Failed to start TTS synthesis reactor\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void configure_channel_pool(void)
+{
+	struct grpctts_conf_snapshot *snapshot = ao2_global_obj_ref(dflt_grpctts_conf);
+	grpctts_channel_pool_configure(snapshot ? snapshot->conf.pool_max_idle : 300.0);
+	ao2_cleanup(snapshot);
+}
+
+static void configure_cache(void)
+{
+	struct grpctts_conf_snapshot *snapshot = ao2_global_obj_ref(dflt_grpctts_conf);
+	if (snapshot) {
+		grpctts_cache_configure(&snapshot->conf.cache);
+	} else {
+		struct grpctts_cache_conf conf;
+		grpctts_cache_conf_init(&conf);
+		grpctts_cache_configure(&conf);
+	}
+	ao2_cleanup(snapshot);
+}
+
 static int unload_module(void)
 {
+	ast_cli_unregister_multiple(cli_playbackground, ARRAY_LEN(cli_playbackground));
+	grpctts_reactor_stop();
+	grpctts_cache_shutdown();
+	grpctts_channel_pool_clear();
 	stream_layers_global_uninit();
-	grpctts_shutdown();
 	grpctts_conf_global_uninit();
+	ao2_global_obj_release(dflt_grpctts_conf);
 	return ast_unregister_application(app);
 }
 
@@ -466,10 +671,14 @@ static int load_module(void)
 {
 	grpctts_conf_global_init();
 	grpctts_set_stream_error_callback(stream_error_callback);
-	grpctts_init();
 	stream_layers_global_init();
-	if (grpctts_conf_load(&dflt_grpctts_conf, &dflt_grpctts_conf_mutex, "grpctts.conf", 0))
+	if (load_dflt_grpctts_conf(0))
+		return AST_MODULE_LOAD_DECLINE;
+	if (start_reactor())
 		return AST_MODULE_LOAD_DECLINE;
+	configure_channel_pool();
+	configure_cache();
+	ast_cli_register_multiple(cli_playbackground, ARRAY_LEN(cli_playbackground));
 	return
 		ast_register_application_xml(app_initgrpctts, playbackgroundinitgrpctts_exec) |
 		ast_register_application_xml(app, playbackground_exec);
@@ -477,8 +686,10 @@ static int load_module(void)
 
 static int reload(void)
 {
-	if (grpctts_conf_load(&dflt_grpctts_conf, &dflt_grpctts_conf_mutex, "grpctts.conf", 1))
+	if (load_dflt_grpctts_conf(1))
 		return AST_MODULE_LOAD_DECLINE;
+	configure_channel_pool();
+	configure_cache();
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
@@ -487,4 +698,5 @@ AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_DEFAULT, "[" ASTERISK_MODULE_VERSI
 	.load = load_module,
 	.unload = unload_module,
 	.reload = reload,
+	.requires = "res_voicekit_grpc",
 );
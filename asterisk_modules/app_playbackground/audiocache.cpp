@@ -0,0 +1,448 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "audiocache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include <asterisk.h>
+#include <asterisk/utils.h>
+}
+
+
+#define CACHE_KEY_VERSION "grpctts-cache-v2"
+#define CACHE_MAX_ENTRY_SIZE (16*1024*1024) /* ~17 min of 8 kHz audio */
+#define CACHE_MAX_PENDING_DISK_WRITES 64
+#define CACHE_DISK_TRIM_PERCENT 90 /* Disk tier is trimmed to this share of its size */
+#define CACHE_STALE_TMP_SEC 3600
+#define CACHE_EXPIRE_SCAN_SEC 600 /* Maximal interval of disk scans removing expired files */
+#define CACHE_FILE_SUFFIX ".pcm"
+#define CACHE_TMP_SUFFIX ".tmp"
+
+/* File format of on-disk tier: header followed by samples */
+#define CACHE_FILE_MAGIC "VKTTSPCM"
+struct CacheFileHeader
+{
+	char magic[8];
+	uint64_t created_at;
+	uint64_t sample_bytes;
+	uint32_t x_request_id_len;
+	char x_request_id[256];
+};
+
+
+static inline std::string cache_file_path(const std::string &directory, const std::string &key)
+{
+	return directory + "/" + key + CACHE_FILE_SUFFIX;
+}
+static inline bool has_suffix(const char *name, const char *suffix)
+{
+	size_t name_len = strlen(name);
+	size_t suffix_len = strlen(suffix);
+	return name_len > suffix_len && !strcmp(name + name_len - suffix_len, suffix);
+}
+static bool write_all(int fd, const void *data, size_t size)
+{
+	const char *ptr = (const char *) data;
+	while (size) {
+		ssize_t ret = write(fd, ptr, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		ptr += ret;
+		size -= ret;
+	}
+	return true;
+}
+/* Creation time from header; modification time of file if header is unreadable */
+static time_t file_created_at(const std::string &path, time_t mtime)
+{
+	struct CacheFileHeader header;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return mtime;
+	ssize_t ret = pread(fd, &header, sizeof(header), 0);
+	close(fd);
+	if (ret != sizeof(header) || memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)))
+		return mtime;
+	return header.created_at;
+}
+
+
+namespace GRPCTTS {
+
+AudioCache grpctts_audio_cache;
+
+
+AudioCache::AudioCache()
+	: enable(false), memory_max_size(0), disk_max_size(0), ttl(0), memory_bytes(0),
+	  writer_stopping(false), disk_scanned(false), disk_bytes(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+AudioCache::~AudioCache()
+{
+	Shutdown();
+}
+void AudioCache::Configure(const struct grpctts_cache_conf &conf)
+{
+	std::string new_directory = (conf.enable && conf.directory) ? conf.directory : "";
+	if (!new_directory.empty() && ast_mkdir(new_directory.c_str(), 0775)) {
+		ast_log(AST_LOG_ERROR, "PlayBackground: failed to create TTS cache directory '%s': %s\n", new_directory.c_str(), strerror(errno));
+		new_directory.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	enable = conf.enable;
+	memory_max_size = enable ? (size_t) std::max(conf.memory_size_mb, 0)*1024*1024 : 0;
+	if (new_directory != directory) {
+		disk_scanned = false;
+		disk_bytes = 0;
+	}
+	directory = new_directory;
+	disk_max_size = (size_t) std::max(conf.disk_size_mb, 0)*1024*1024;
+	ttl = conf.ttl;
+	MemoryTrim();
+	if (!directory.empty() && !writer.joinable())
+		writer = std::thread(&AudioCache::WriterRoutine, this);
+	writer_cond.notify_all(); /* Expiration scans follow new ttl */
+}
+void AudioCache::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		writer_stopping = true;
+		enable = false;
+	}
+	writer_cond.notify_all();
+	if (writer.joinable())
+		writer.join();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	writer_stopping = false;
+	disk_writes.clear();
+	lru.clear();
+	memory_entries.clear();
+	memory_bytes = 0;
+}
+bool AudioCache::Enabled()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return enable;
+}
+std::string AudioCache::Key(const std::string &endpoint, const std::string &authorization_issuer, const std::string &authorization_subject,
+			    const std::string &text, const std::string &ssml,
+			    const std::string &voice_name, const std::string &voice_language_code, int ssml_gender,
+			    double speaking_rate, enum grpctts_frame_format remote_frame_format, int sample_rate)
+{
+	char numbers[128];
+	snprintf(numbers, sizeof(numbers), "%d|%.6f|%d|%d", ssml_gender, speaking_rate, (int) remote_frame_format, sample_rate);
+	std::string params(CACHE_KEY_VERSION);
+	for (const std::string *field: {&endpoint, &authorization_issuer, &authorization_subject,
+					&text, &ssml, &voice_name, &voice_language_code}) {
+		params.push_back('\0');
+		params.append(std::to_string(field->size()));
+		params.push_back(':');
+		params.append(*field);
+	}
+	params.push_back('\0');
+	params.append(numbers);
+
+	char hex[65];
+	voicekit_sha256_hex(params.data(), params.size(), hex);
+	return hex;
+}
+std::shared_ptr<const CachedAudio> AudioCache::Lookup(const std::string &key)
+{
+	time_t now = time(NULL);
+	std::string disk_directory;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!enable)
+			return nullptr;
+		std::unordered_map<std::string, MemoryEntry>::iterator it = memory_entries.find(key);
+		if (it != memory_entries.end()) {
+			if (!Expired(*it->second.audio, now)) {
+				lru.splice(lru.begin(), lru, it->second.lru_it);
+				++stats.memory_hits;
+				return it->second.audio;
+			}
+			++stats.expired;
+			MemoryErase(it);
+		}
+		disk_directory = directory;
+	}
+
+	std::shared_ptr<const CachedAudio> audio;
+	if (!disk_directory.empty())
+		audio = DiskRead(disk_directory, key);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (audio && Expired(*audio, now)) {
+		++stats.expired;
+		unlink(cache_file_path(disk_directory, key).c_str());
+		audio = nullptr;
+	}
+	if (!audio) {
+		++stats.misses;
+		return nullptr;
+	}
+	++stats.disk_hits;
+	if (audio->sample_bytes <= memory_max_size)
+		MemoryInsert(key, audio);
+	return audio;
+}
+void AudioCache::Store(const std::string &key, const std::string &x_request_id, std::string &&samples)
+{
+	if (samples.empty())
+		return;
+	std::shared_ptr<const std::string> storage = std::make_shared<const std::string>(std::move(samples));
+	std::shared_ptr<CachedAudio> audio = std::make_shared<CachedAudio>();
+	audio->x_request_id = x_request_id;
+	audio->samples = storage->data();
+	audio->sample_bytes = storage->size();
+	audio->storage = storage;
+	audio->created_at = time(NULL);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!enable)
+		return;
+	++stats.stores;
+	if (audio->sample_bytes <= memory_max_size)
+		MemoryInsert(key, audio);
+	if (!directory.empty() && audio->sample_bytes <= disk_max_size && disk_writes.size() < CACHE_MAX_PENDING_DISK_WRITES) {
+		DiskWrite write = {
+			.key = key,
+			.audio = audio,
+		};
+		disk_writes.push_back(write);
+		writer_cond.notify_one();
+	}
+}
+size_t AudioCache::MaxEntrySize()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!enable)
+		return 0;
+	size_t max_size = std::max(memory_max_size, directory.empty() ? 0 : disk_max_size);
+	return std::min(max_size, (size_t) CACHE_MAX_ENTRY_SIZE);
+}
+void AudioCache::GetStats(struct grpctts_cache_stats *stats)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*stats = this->stats;
+	stats->memory_entries = memory_entries.size();
+	stats->memory_bytes = memory_bytes;
+	stats->disk_bytes = disk_bytes;
+}
+
+bool AudioCache::Expired(const CachedAudio &audio, time_t now)
+{
+	return ttl > 0 && now - audio.created_at >= ttl;
+}
+void AudioCache::MemoryInsert(const std::string &key, std::shared_ptr<const CachedAudio> audio)
+{
+	std::unordered_map<std::string, MemoryEntry>::iterator it = memory_entries.find(key);
+	if (it != memory_entries.end())
+		MemoryErase(it);
+	lru.push_front(key);
+	MemoryEntry entry = {
+		.audio = audio,
+		.lru_it = lru.begin(),
+	};
+	memory_entries.insert(std::make_pair(key, entry));
+	memory_bytes += audio->sample_bytes;
+	MemoryTrim();
+}
+void AudioCache::MemoryErase(std::unordered_map<std::string, MemoryEntry>::iterator it)
+{
+	memory_bytes -= it->second.audio->sample_bytes;
+	lru.erase(it->second.lru_it);
+	memory_entries.erase(it);
+}
+void AudioCache::MemoryTrim()
+{
+	while (memory_bytes > memory_max_size && !lru.empty()) {
+		MemoryErase(memory_entries.find(lru.back()));
+		++stats.memory_evictions;
+	}
+}
+std::shared_ptr<const CachedAudio> AudioCache::DiskRead(const std::string &directory, const std::string &key)
+{
+	int fd = open(cache_file_path(directory, key).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return nullptr;
+	std::shared_ptr<CachedAudio> audio;
+	struct stat st;
+	if (!fstat(fd, &st) && (size_t) st.st_size >= sizeof(struct CacheFileHeader)) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			/* Files are replaced by rename() and never rewritten in place: mapping stays valid after unlink or trim */
+			size_t map_size = st.st_size;
+			std::shared_ptr<const void> mapping(map, [map_size](const void *map) { munmap((void *) map, map_size); });
+			const struct CacheFileHeader *header = (const struct CacheFileHeader *) map;
+			if (!memcmp(header->magic, CACHE_FILE_MAGIC, sizeof(header->magic)) &&
+			    header->sample_bytes == st.st_size - sizeof(struct CacheFileHeader) &&
+			    header->x_request_id_len <= sizeof(header->x_request_id)) {
+				audio = std::make_shared<CachedAudio>();
+				audio->x_request_id.assign(header->x_request_id, header->x_request_id_len);
+				audio->samples = (const char *) (header + 1);
+				audio->sample_bytes = header->sample_bytes;
+				audio->storage = mapping;
+				audio->created_at = header->created_at;
+			}
+		}
+	}
+	if (audio)
+		futimens(fd, NULL); /* Recently used files are trimmed last */
+	close(fd);
+	return audio;
+}
+bool AudioCache::DiskWriteFile(const std::string &directory, const DiskWrite &write)
+{
+	struct CacheFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+	header.created_at = write.audio->created_at;
+	header.sample_bytes = write.audio->sample_bytes;
+	header.x_request_id_len = std::min(write.audio->x_request_id.size(), sizeof(header.x_request_id));
+	memcpy(header.x_request_id, write.audio->x_request_id.data(), header.x_request_id_len);
+
+	/* Readers of other processes see either no file or complete one */
+	std::string tmp_path = directory + "/." + write.key + "." + std::to_string(getpid()) + CACHE_TMP_SUFFIX;
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664);
+	if (fd == -1)
+		return false;
+	bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, write.audio->samples, write.audio->sample_bytes);
+	close(fd);
+	if (!ok || rename(tmp_path.c_str(), cache_file_path(directory, write.key).c_str())) {
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+void AudioCache::DiskScan(const std::string &directory, size_t max_size, int ttl)
+{
+	struct File
+	{
+		time_t mtime;
+		size_t size;
+		std::string path;
+	};
+	std::vector<File> files;
+	size_t total_size = 0;
+	unsigned long long expired = 0;
+	time_t now = time(NULL);
+	DIR *dir = opendir(directory.c_str());
+	struct dirent *dirent;
+	while (dir && (dirent = readdir(dir))) {
+		std::string path = directory + "/" + dirent->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (dirent->d_name[0] == '.' && has_suffix(dirent->d_name, CACHE_TMP_SUFFIX)) {
+			if (now - st.st_mtime >= CACHE_STALE_TMP_SEC) /* Left by crashed writer */
+				unlink(path.c_str());
+		} else if (has_suffix(dirent->d_name, CACHE_FILE_SUFFIX)) {
+			/* Modification time is refreshed on hit: age is taken from header */
+			if (ttl > 0 && now - file_created_at(path, st.st_mtime) >= ttl) {
+				if (!unlink(path.c_str()))
+					++expired;
+				continue;
+			}
+			File file = {
+				.mtime = st.st_mtime,
+				.size = (size_t) st.st_size,
+				.path = path,
+			};
+			files.push_back(file);
+			total_size += st.st_size;
+		}
+	}
+	if (dir)
+		closedir(dir);
+
+	unsigned long long evictions = 0;
+	if (total_size > max_size) {
+		std::sort(files.begin(), files.end(), [](const File &a, const File &b) { return a.mtime < b.mtime; });
+		size_t target_size = max_size/100*CACHE_DISK_TRIM_PERCENT;
+		for (const File &file: files) {
+			if (total_size <= target_size)
+				break;
+			if (!unlink(file.path.c_str()))
+				++evictions;
+			total_size -= file.size;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (directory != this->directory)
+		return;
+	disk_scanned = true;
+	disk_bytes = total_size;
+	stats.disk_evictions += evictions;
+	stats.expired += expired;
+}
+void AudioCache::WriterRoutine()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	time_t last_scan = time(NULL);
+	while (true) {
+		auto ready = [this]() { return writer_stopping || !disk_writes.empty() || (!directory.empty() && !disk_scanned); };
+		if (ttl > 0)
+			writer_cond.wait_for(lock, std::chrono::seconds(std::min(ttl, CACHE_EXPIRE_SCAN_SEC)), ready);
+		else
+			writer_cond.wait(lock, ready);
+		if (writer_stopping)
+			break;
+		std::string write_directory = directory;
+		size_t max_size = disk_max_size;
+		int scan_ttl = ttl;
+		bool expiration_due = ttl > 0 && time(NULL) - last_scan >= std::min(ttl, CACHE_EXPIRE_SCAN_SEC);
+		if (!disk_writes.empty()) {
+			DiskWrite write = disk_writes.front();
+			disk_writes.pop_front();
+			lock.unlock();
+			bool written = !write_directory.empty() && DiskWriteFile(write_directory, write);
+			lock.lock();
+			if (written && write_directory == directory)
+				disk_bytes += sizeof(struct CacheFileHeader) + write.audio->sample_bytes;
+		}
+		if (!directory.empty() && directory == write_directory && (!disk_scanned || disk_bytes > disk_max_size || expiration_due)) {
+			lock.unlock();
+			DiskScan(write_directory, max_size, scan_ttl);
+			lock.lock();
+			last_scan = time(NULL);
+		}
+	}
+}
+
+};
@@ -0,0 +1,120 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPCTTS_AUDIO_CACHE_H
+#define GRPCTTS_AUDIO_CACHE_H
+
+#include "grpctts.h"
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <time.h>
+
+
+namespace GRPCTTS {
+
+struct CachedAudio
+{
+	std::string x_request_id;
+	const char *samples; // signed linear 8 kHz
+	size_t sample_bytes;
+	std::shared_ptr<const void> storage; // keeps samples alive: stored string or mapping of cache file
+	time_t created_at;
+};
+
+
+// Content-addressed cache of synthesized audio. Entries are keyed by SHA-256
+// of synthesis parameters, endpoint and authorization issuer/subject (so that
+// backends and tenants sharing cache never get audio of each other). Memory tier is LRU of decoded samples; on-disk tier
+// keeps one "<key>.pcm" file per entry, written by temporary file and rename()
+// and read by mmap(), so that directory may be shared by Asterisk processes of
+// host. Disk hits are served from the mapping, which lives as long as the
+// entry is referenced. Disk tier is trimmed to its size by its writer thread:
+// oldest files (by modification time, refreshed on hit) are removed first;
+// with ttl set, files older than ttl (by creation time of their header) are
+// removed by periodic scan as well.
+class AudioCache
+{
+public:
+	AudioCache();
+	~AudioCache();
+	void Configure(const struct grpctts_cache_conf &conf);
+	void Shutdown();
+	bool Enabled();
+	static std::string Key(const std::string &endpoint, const std::string &authorization_issuer, const std::string &authorization_subject,
+			       const std::string &text, const std::string &ssml,
+			       const std::string &voice_name, const std::string &voice_language_code, int ssml_gender,
+			       double speaking_rate, enum grpctts_frame_format remote_frame_format, int sample_rate);
+	// Returns nullptr on miss; disk hits are promoted to memory tier
+	std::shared_ptr<const CachedAudio> Lookup(const std::string &key);
+	void Store(const std::string &key, const std::string &x_request_id, std::string &&samples);
+	// Size of samples worth collecting for Store()
+	size_t MaxEntrySize();
+	void GetStats(struct grpctts_cache_stats *stats);
+
+private:
+	struct MemoryEntry
+	{
+		std::shared_ptr<const CachedAudio> audio;
+		std::list<std::string>::iterator lru_it;
+	};
+	struct DiskWrite
+	{
+		std::string key;
+		std::shared_ptr<const CachedAudio> audio;
+	};
+
+	bool Expired(const CachedAudio &audio, time_t now);
+	void MemoryInsert(const std::string &key, std::shared_ptr<const CachedAudio> audio);
+	void MemoryErase(std::unordered_map<std::string, MemoryEntry>::iterator it);
+	void MemoryTrim();
+	std::shared_ptr<const CachedAudio> DiskRead(const std::string &directory, const std::string &key);
+	bool DiskWriteFile(const std::string &directory, const DiskWrite &write);
+	void DiskScan(const std::string &directory, size_t max_size, int ttl);
+	void WriterRoutine();
+
+private:
+	std::mutex mutex;
+	std::condition_variable writer_cond;
+	bool enable;
+	size_t memory_max_size;
+	std::string directory;
+	size_t disk_max_size;
+	int ttl;
+
+	std::list<std::string> lru; // most recently used first
+	std::unordered_map<std::string, MemoryEntry> memory_entries;
+	size_t memory_bytes;
+
+	std::deque<DiskWrite> disk_writes;
+	std::thread writer;
+	bool writer_stopping;
+	bool disk_scanned;
+	size_t disk_bytes;
+
+	struct grpctts_cache_stats stats;
+};
+
+extern AudioCache grpctts_audio_cache;
+
+};
+
+#endif
@@ -14,6 +14,7 @@
  */
 
 #include "bytequeue.h"
+#include "voicekit_grpc.h"
 
 #include <sys/eventfd.h>
 #include <sys/socket.h>
@@ -27,33 +28,41 @@ namespace GRPCTTS {
 struct Record
 {
 	Record(bool completion_success)
-		: completion_success(completion_success), next(NULL)
+		: data(NULL), size(0), completion_success(completion_success), next(NULL)
 		{
 		}
 	Record(const std::string &data)
-		: data(data), completion_success(false), next(NULL)
+		: owned_data(data), data(owned_data.data()), size(owned_data.size()), completion_success(false), next(NULL)
+		{
+		}
+	Record(std::shared_ptr<const void> storage, const char *data, size_t size)
+		: storage(storage), data(data), size(size), completion_success(false), next(NULL)
 		{
 		}
 	bool IsEmpty()
 		{
-			return data.empty();
+			return !size;
 		}
 
-	std::string data;
+	std::string owned_data;
+	std::shared_ptr<const void> storage; // holds data unless it is owned_data
+	const char *data;
+	size_t size;
 	bool completion_success;
 	Record* next;
 };
 
 
-ByteQueue::ByteQueue()
+ByteQueue::ByteQueue(std::shared_ptr<VoiceKitUsage> usage)
 	: event_fd(eventfd(0, EFD_NONBLOCK)), exchange_head(NULL),
 	  recieved_head(NULL), recieved_tail_p(&recieved_head), head_offset(0), recieved_byte_count(0),
-	  termination_pushed(false), termination_called(false), completion_success(false)
+	  termination_pushed(false), termination_called(false), completion_success(false), usage(usage)
 {
 }
 ByteQueue::~ByteQueue()
 {
 	Collect();
+	usage->QueueAdd(-(long long) recieved_byte_count);
 	while (recieved_head) {
 		Record *record = recieved_head;
 		recieved_head = recieved_head->next;
@@ -65,8 +74,16 @@ void ByteQueue::Push(const std::string &data)
 {
 	if (termination_pushed)
 		return;
+	usage->QueueAdd(data.size());
 	PushRecord(new Record(data));
 }
+void ByteQueue::Push(std::shared_ptr<const void> storage, const char *data, size_t size)
+{
+	if (termination_pushed)
+		return;
+	usage->QueueAdd(size);
+	PushRecord(new Record(storage, data, size));
+}
 void ByteQueue::Terminate(bool completion_success)
 {
 	if (termination_pushed)
@@ -122,13 +139,14 @@ void ByteQueue::PushRecord(Record *object)
 }
 void ByteQueue::ExtractBytes(size_t byte_count, void *data)
 {
+	usage->QueueAdd(-(long long) byte_count);
 	size_t write_left = byte_count;
 	char *dptr = (char *) data;
 	while (write_left > 0) {
 		Record *head = recieved_head;
-		size_t left_at_record = head->data.size() - head_offset;
+		size_t left_at_record = head->size - head_offset;
 		if (write_left >= left_at_record) {
-			memcpy(dptr, head->data.data() + head_offset, left_at_record);
+			memcpy(dptr, head->data + head_offset, left_at_record);
 			dptr += left_at_record;
 			recieved_byte_count -= left_at_record;
 			write_left -= left_at_record;
@@ -138,7 +156,7 @@ void ByteQueue::ExtractBytes(size_t byte_count, void *data)
 			if (!recieved_head)
 				recieved_tail_p = &recieved_head;
 		} else {
-			memcpy(dptr, head->data.data() + head_offset, write_left);
+			memcpy(dptr, head->data + head_offset, write_left);
 			head_offset += write_left;
 			recieved_byte_count -= write_left;
 			break;
@@ -170,7 +188,7 @@ void ByteQueue::StoreReverseList(Record *queue)
 			termination_called = true;
 			completion_success = list_head->completion_success;
 		}
-		recieved_byte_count += list_head->data.size();
+		recieved_byte_count += list_head->size;
 		list_head = list_head->next;
 	}
 }
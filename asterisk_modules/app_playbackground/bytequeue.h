@@ -18,8 +18,11 @@
 
 #include <string>
 #include <deque>
+#include <memory>
 
 
+class VoiceKitUsage;
+
 namespace GRPCTTS {
 
 struct Record;
@@ -28,11 +31,12 @@ struct Record;
 class ByteQueue
 {
 public:
-	ByteQueue();
+	ByteQueue(std::shared_ptr<VoiceKitUsage> usage); // Queued bytes are accounted to usage
 	~ByteQueue();
 
 	// Sender-only methods
 	void Push(const std::string &data);
+	void Push(std::shared_ptr<const void> storage, const char *data, size_t size); // data is not copied: storage keeps it alive
 	void Terminate(bool success);
 
 	// Reader-only methods
@@ -59,6 +63,7 @@ private:
 	bool termination_pushed;
 	bool termination_called;
 	bool completion_success;
+	std::shared_ptr<VoiceKitUsage> usage;
 };
 
 };
@@ -16,6 +16,7 @@
 
 #include "job.h"
 #include "channelbackend.h"
+#include "channelpool.h"
 
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -27,10 +28,13 @@
 
 namespace GRPCTTS {
 
-Channel::Channel(const char *endpoint, const char *ca_data, const char *authorization_api_key, const char *authorization_secret_key,
-		 const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience)
-	: channel_backend (std::make_shared<ChannelBackend> (endpoint, ca_data, authorization_api_key, authorization_secret_key,
-							     authorization_issuer, authorization_subject, authorization_audience))
+Channel::Channel(const char *endpoint, int ssl_grpc, const char *ca_file, const char *authorization_api_key, const char *authorization_secret_key,
+		 const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
+		 const char *channel_name,
+		 const struct grpctts_failfast_conf &failfast_conf)
+	: channel_backend(grpctts_channel_pool.Acquire(endpoint, ssl_grpc, ca_file, authorization_api_key, authorization_secret_key,
+						       authorization_issuer, authorization_subject, authorization_audience)),
+	  endpoint(endpoint ? endpoint : ""), channel_name(channel_name ? channel_name : ""), failfast_conf(failfast_conf)
 {
 }
 Channel::~Channel()
@@ -41,7 +45,7 @@ Job *Channel::StartJob(double speaking_rate, double pitch, double volume_gain_db
 		       enum grpctts_frame_format remote_frame_format,
 		       const struct grpctts_job_input &job_input)
 {
-	return new Job(channel_backend,
+	return new Job(channel_backend, endpoint, channel_name, failfast_conf,
 		       speaking_rate, pitch, volume_gain_db,
 		       voice_language_code, voice_name, ssml_gender, remote_frame_format,
 		       job_input);
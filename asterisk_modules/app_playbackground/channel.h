@@ -39,8 +39,10 @@ class ChannelBackend;
 class Channel
 {
 public:
-	Channel(const char *endpoint, const char *ca_data, const char *authorization_api_key, const char *authorization_secret_key,
-		const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience);
+	Channel(const char *endpoint, int ssl_grpc, const char *ca_file, const char *authorization_api_key, const char *authorization_secret_key,
+		const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
+		const char *channel_name,
+		const struct grpctts_failfast_conf &failfast_conf);
 	~Channel();
 	Job *StartJob(double speaking_rate, double pitch, double volume_gain_db,
 		      const std::string &voice_language_code, const std::string &voice_name, enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender,
@@ -49,6 +51,9 @@ public:
 
 private:
 	std::shared_ptr<ChannelBackend> channel_backend;
+	std::string endpoint;
+	std::string channel_name;
+	struct grpctts_failfast_conf failfast_conf;
 };
 
 };
@@ -15,13 +15,11 @@
 
 #include "channelbackend.h"
 
-#include "roots.pem.h"
 #include "job.h"
-#include "jwt.h"
+#include "voicekit_grpc.h"
 
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/socket.h>
 #include <sys/eventfd.h>
 #include <grpcpp/create_channel_posix.h>
 #include <grpcpp/channel.h>
@@ -31,72 +29,26 @@
 #include <atomic>
 
 
-// 7 days
-#define EXPIRATION_PERIOD (7*86400)
-
-
 static grpctts_stream_error_callback_t grpctts_stream_error_callback = NULL;
 
-static const std::string grpc_roots_pem_string ((const char *) grpc_roots_pem, sizeof(grpc_roots_pem));
-
-
-static int *fd_rc_copy(int *p)
+static void thread_routine(int channel_completion_fd, const std::string &endpoint, int ssl_grpc, const std::string &ca_file, GRPCTTS::ChannelBackend *channel_backend)
 {
-	__atomic_add_fetch(&p[1], 1, __ATOMIC_SEQ_CST);
-	return p;
-}
-static void fd_rc_destroy(int *p)
-{
-	if (!p) return;
-
-	int count = __atomic_add_fetch(&p[1], -1, __ATOMIC_SEQ_CST);
-	if (count <= 0) {
-		close(p[0]);
-		free(p);
+	if (ssl_grpc < 0)
+		ssl_grpc = endpoint.compare(0, 5, "unix:") != 0;
+
+	/* Same channel and credentials cache as STT: calls to the same endpoint share connection */
+	std::shared_ptr<grpc::Channel> grpc_channel;
+	try {
+		grpc_channel = voicekit_grpc_get_channel(endpoint, ssl_grpc, ca_file, 0);
+	} catch (const std::exception &ex) {
+		/* Never fall back to plaintext: channel fails with all its jobs */
+		if (grpctts_stream_error_callback)
+			grpctts_stream_error_callback(ex.what());
+		channel_backend->SetFailed();
+		eventfd_write(channel_completion_fd, 1);
+		return;
 	}
-}
-static int fd_rc_cmp(int *p, int *q)
-{
-	if (*p < *q)
-		return -1;
-	if (*p > *q)
-		return 1;
-	return 0;
-}
-
-static const grpc_arg_pointer_vtable fd_rc_vtable = {
-	.copy = (void *(*)(void *)) fd_rc_copy,
-	.destroy = (void (*)(void *)) fd_rc_destroy,
-	.cmp = (int (*)(void *, void *)) fd_rc_cmp,
-};
-
-static int *fd_rc_new(int fd)
-{
-	int *fd_rc = (int *) malloc(sizeof(int[2]));
-	if (!fd_rc)
-		return nullptr;
-	fd_rc[0] = fd;
-	fd_rc[1] = 1;
-	return fd_rc;
-}
-
-static void thread_routine(int channel_completion_fd, const std::string &endpoint, const std::string &ca_data, int socket_fd_pipe_fd, GRPCTTS::ChannelBackend *channel_backend)
-{
-	grpc::SslCredentialsOptions ssl_credentials_options = {
-		.pem_root_certs = ca_data.length() ? ca_data : grpc_roots_pem_string,
-	};
-
-	std::shared_ptr<grpc::ChannelCredentials> channel_credentials = grpc::SslCredentials(ssl_credentials_options);
-	grpc::ChannelArguments arguments;
-	if (socket_fd_pipe_fd != -1) {
-		int *fd_rc = fd_rc_new(socket_fd_pipe_fd);
-		if (fd_rc) {
-			arguments.SetPointerWithVtable("socket_fd_pass_socket_fd", fd_rc, &fd_rc_vtable);
-			fd_rc_destroy(fd_rc);
-		}
-	}
-
-	std::shared_ptr<grpc::Channel> grpc_channel = grpc::CreateCustomChannel(endpoint, channel_credentials, arguments);
+	grpc_channel->GetState(true); /* Connect in advance: channel is pooled for first prompt of next calls */
 	channel_backend->SetChannel(grpc_channel);
 	eventfd_write(channel_completion_fd, 1);
 }
@@ -110,34 +62,17 @@ void ChannelBackend::SetErrorCallback(grpctts_stream_error_callback_t callback)
 }
 
 #define NON_NULL_STRING(str) ((str) ? (str) : "")
-ChannelBackend::ChannelBackend(const char *endpoint, const char *ca_data, const char *authorization_api_key, const char *authorization_secret_key,
+ChannelBackend::ChannelBackend(const char *endpoint, int ssl_grpc, const char *ca_file, const char *authorization_api_key, const char *authorization_secret_key,
 			       const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience)
-	: socket_fd_pass_socket_fd(-1), channel_completion_fd(eventfd(0, EFD_NONBLOCK)),
+	: failed(false), channel_completion_fd(eventfd(0, EFD_NONBLOCK)),
 	  authorization_api_key(NON_NULL_STRING(authorization_api_key)), authorization_secret_key(NON_NULL_STRING(authorization_secret_key)),
 	  authorization_issuer(NON_NULL_STRING(authorization_issuer)), authorization_subject(NON_NULL_STRING(authorization_subject)), authorization_audience(NON_NULL_STRING(authorization_audience))
 {
-	int socket_fd_pass_write_socket_fd = -1;
-	{
-		int socket_pair[2];
-		if (!socketpair(AF_UNIX, SOCK_STREAM, 0, socket_pair)) {
-			socket_fd_pass_socket_fd = socket_pair[0];
-			socket_fd_pass_write_socket_fd = socket_pair[1];
-		}
-	}
-
-	thread = std::thread(thread_routine, channel_completion_fd, std::string(endpoint), std::string(ca_data ? ca_data : ""), socket_fd_pass_write_socket_fd, this);
+	thread = std::thread(thread_routine, channel_completion_fd, std::string(endpoint), ssl_grpc, std::string(ca_file ? ca_file : ""), this);
 }
 #undef NON_NULL_STRING
 ChannelBackend::~ChannelBackend()
 {
-	if (socket_fd_pass_socket_fd != -1) {
-		int socket_fd;
-		if (recv(socket_fd_pass_socket_fd, &socket_fd, sizeof(int), MSG_DONTWAIT) == sizeof(int)) {
-			shutdown(socket_fd, SHUT_RDWR);
-			close(socket_fd);
-		}
-		close(socket_fd_pass_socket_fd);
-	}
 	thread.join();
 	close(channel_completion_fd);
 }
@@ -149,23 +84,31 @@ std::shared_ptr<grpc::Channel> ChannelBackend::GetChannel()
 {
 	return grpc_channel;
 }
+void ChannelBackend::SetFailed()
+{
+	failed = true;
+}
+bool ChannelBackend::Failed() const
+{
+	return failed;
+}
 int ChannelBackend::ChannelCompletionFD() const
 {
 	return channel_completion_fd;
 }
 std::string ChannelBackend::BuildAuthToken() const
 {
-	if (authorization_api_key.size() && authorization_secret_key.size() &&
-	    authorization_issuer.size() && authorization_subject.size() && authorization_audience.size()) {
-		int64_t expiration_time_sec = time(NULL) + EXPIRATION_PERIOD;
-
-		std::string jwt = "Bearer " + GenerateJWT(
-			authorization_api_key, authorization_secret_key,
-			authorization_issuer, authorization_subject, authorization_audience,
-			expiration_time_sec);
-		return jwt;
-	}
-	return "";
+	return voicekit_grpc_authorization(
+		authorization_api_key, authorization_secret_key,
+		authorization_issuer, authorization_subject, authorization_audience);
+}
+const std::string &ChannelBackend::AuthorizationIssuer() const
+{
+	return authorization_issuer;
+}
+const std::string &ChannelBackend::AuthorizationSubject() const
+{
+	return authorization_subject;
 }
 
 };
@@ -16,6 +16,7 @@
 #ifndef GRPCTTS_CHANNEL_BACKEND_H
 #define GRPCTTS_CHANNEL_BACKEND_H
 
+#include <atomic>
 #include <memory>
 #include <thread>
 
@@ -38,16 +39,20 @@ public:
 	static void SetErrorCallback(grpctts_stream_error_callback_t callback);
 
 public:
-	ChannelBackend(const char *endpoint, const char *ca_data, const char *authorization_api_key, const char *authorization_secret_key,
+	ChannelBackend(const char *endpoint, int ssl_grpc, const char *ca_file, const char *authorization_api_key, const char *authorization_secret_key,
 		       const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience);
 	~ChannelBackend();
 	void SetChannel(std::shared_ptr<grpc::Channel> grpc_channel);
 	std::shared_ptr<grpc::Channel> GetChannel(); // To be called after polling on channel_completion_fd shows some data
+	void SetFailed();
+	bool Failed() const; // Channel could not be created (e. g. CA file is not readable): jobs fail, pool drops backend
 	int ChannelCompletionFD() const;
 	std::string BuildAuthToken() const;
+	const std::string &AuthorizationIssuer() const;
+	const std::string &AuthorizationSubject() const;
 
 private:
-	int socket_fd_pass_socket_fd;
+	std::atomic<bool> failed;
 	std::shared_ptr<grpc::Channel> grpc_channel;
 	int channel_completion_fd;
 	const std::string authorization_api_key;
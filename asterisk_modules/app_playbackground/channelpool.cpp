@@ -0,0 +1,116 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#include "channelpool.h"
+
+#include "channelbackend.h"
+
+
+#define DEFAULT_MAX_IDLE 300.0 /* 5 min */
+
+#define NON_NULL_STRING(str) ((str) ? (str) : "")
+
+
+namespace GRPCTTS {
+
+ChannelPool grpctts_channel_pool;
+
+
+ChannelPool::ChannelPool()
+	: max_idle(DEFAULT_MAX_IDLE)
+{
+}
+ChannelPool::~ChannelPool()
+{
+}
+void ChannelPool::Configure(double max_idle)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->max_idle = max_idle;
+}
+void ChannelPool::Clear()
+{
+	std::map<std::string, Entry> cleared;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		cleared.swap(entries);
+	}
+	/* Backends still referenced by Asterisk channels are destroyed with them */
+}
+std::shared_ptr<ChannelBackend> ChannelPool::Acquire(const char *endpoint, int ssl_grpc, const char *ca_file,
+						     const char *authorization_api_key, const char *authorization_secret_key,
+						     const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience)
+{
+	std::string key;
+	for (const char *field: {endpoint, ca_file, authorization_api_key, authorization_secret_key,
+				 authorization_issuer, authorization_subject, authorization_audience}) {
+		key.append(NON_NULL_STRING(field));
+		key.push_back('\0');
+	}
+	key.append(std::to_string(ssl_grpc));
+
+	std::shared_ptr<ChannelBackend> backend;
+	std::vector<std::shared_ptr<ChannelBackend>> expired; /* Destroyed out of lock: destruction joins backend thread */
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		CollectIdle(std::chrono::steady_clock::now(), expired);
+		std::map<std::string, Entry>::iterator it = entries.find(key);
+		/* Failed backend is not reused: next Asterisk channel retries (e. g. with fixed CA file) */
+		if (it != entries.end() && it->second.backend->Failed()) {
+			expired.push_back(it->second.backend);
+			entries.erase(it);
+			it = entries.end();
+		}
+		if (it != entries.end()) {
+			it->second.idle = false;
+			backend = it->second.backend;
+		} else {
+			backend = std::make_shared<ChannelBackend>(endpoint, ssl_grpc, ca_file, authorization_api_key, authorization_secret_key,
+								   authorization_issuer, authorization_subject, authorization_audience);
+			Entry entry = {
+				.backend = backend,
+				.idle = false,
+				.idle_since = std::chrono::steady_clock::time_point(),
+			};
+			entries.insert(std::make_pair(key, entry));
+		}
+	}
+	return backend;
+}
+void ChannelPool::CollectIdle(std::chrono::steady_clock::time_point now, std::vector<std::shared_ptr<ChannelBackend>> &expired)
+{
+	std::chrono::duration<double> max_idle_duration(max_idle);
+	std::map<std::string, Entry>::iterator it = entries.begin();
+	while (it != entries.end()) {
+		Entry &entry = it->second;
+		if (entry.backend->Failed() && entry.backend.use_count() == 1) {
+			expired.push_back(entry.backend);
+			it = entries.erase(it);
+			continue;
+		} else if (entry.backend.use_count() > 1) { /* Referenced outside of pool */
+			entry.idle = false;
+		} else if (!entry.idle) {
+			entry.idle = true;
+			entry.idle_since = now;
+		} else if (now - entry.idle_since >= max_idle_duration) {
+			expired.push_back(entry.backend);
+			it = entries.erase(it);
+			continue;
+		}
+		++it;
+	}
+}
+
+};
@@ -0,0 +1,68 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPCTTS_CHANNEL_POOL_H
+#define GRPCTTS_CHANNEL_POOL_H
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace GRPCTTS {
+
+class ChannelBackend;
+
+
+// Module-wide pool of channel backends keyed by endpoint, TLS settings and
+// authorization identity, so that Asterisk channels with same settings share
+// one connected gRPC channel. Backend left unused by all Asterisk channels and
+// jobs is dropped once it is found unused for max_idle seconds (checked at Acquire()).
+// Backend whose channel could not be created is never handed out again.
+class ChannelPool
+{
+public:
+	ChannelPool();
+	~ChannelPool();
+	void Configure(double max_idle);
+	void Clear();
+	std::shared_ptr<ChannelBackend> Acquire(const char *endpoint, int ssl_grpc, const char *ca_file,
+						const char *authorization_api_key, const char *authorization_secret_key,
+						const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience);
+
+private:
+	struct Entry
+	{
+		std::shared_ptr<ChannelBackend> backend;
+		bool idle;
+		std::chrono::steady_clock::time_point idle_since;
+	};
+
+	void CollectIdle(std::chrono::steady_clock::time_point now, std::vector<std::shared_ptr<ChannelBackend>> &expired);
+
+private:
+	std::mutex mutex;
+	std::map<std::string, Entry> entries;
+	double max_idle; // seconds
+};
+
+extern ChannelPool grpctts_channel_pool;
+
+};
+
+#endif
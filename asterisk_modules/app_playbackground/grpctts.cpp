@@ -22,11 +22,15 @@ extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
 #include "channel.h"
 #include "grpctts_conf.h"
 #include "channelbackend.h"
+#include "channelpool.h"
+#include "audiocache.h"
 #include "job.h"
+#include "bytequeue.h"
+#include "reactor.h"
 #include "tts.grpc.pb.h"
 
-#include <grpc/grpc.h>
 #include <sys/stat.h>
+#include <thread>
 
 
 extern "C" void grpctts_set_stream_error_callback(grpctts_stream_error_callback_t callback)
@@ -34,22 +38,53 @@ extern "C" void grpctts_set_stream_error_callback(grpctts_stream_error_callback_
 	GRPCTTS::ChannelBackend::SetErrorCallback(callback);
 	GRPCTTS::Job::SetErrorCallback(callback);
 }
-extern "C" void grpctts_init()
+
+
+extern "C" int grpctts_reactor_start(int thread_count)
 {
-	grpc_init();
+	if (thread_count <= 0)
+		thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	return GRPCTTS::Reactor::Start(thread_count) ? 0 : -1;
 }
-extern "C" void grpctts_shutdown()
+extern "C" void grpctts_reactor_stop(void)
 {
-	grpc_shutdown();
+	GRPCTTS::Reactor::Stop();
 }
 
 
-extern "C" struct grpctts_channel *grpctts_channel_create(const char *endpoint, const char *ca_data,
+extern "C" void grpctts_channel_pool_configure(double max_idle)
+{
+	GRPCTTS::grpctts_channel_pool.Configure(max_idle);
+}
+extern "C" void grpctts_channel_pool_clear(void)
+{
+	GRPCTTS::grpctts_channel_pool.Clear();
+}
+
+
+extern "C" void grpctts_cache_configure(const struct grpctts_cache_conf *conf)
+{
+	GRPCTTS::grpctts_audio_cache.Configure(*conf);
+}
+extern "C" void grpctts_cache_shutdown(void)
+{
+	GRPCTTS::grpctts_audio_cache.Shutdown();
+}
+extern "C" void grpctts_cache_get_stats(struct grpctts_cache_stats *stats)
+{
+	GRPCTTS::grpctts_audio_cache.GetStats(stats);
+}
+
+
+extern "C" struct grpctts_channel *grpctts_channel_create(const char *endpoint, int ssl_grpc, const char *ca_file,
 							  const char *authorization_api_key, const char *authorization_secret_key,
-							  const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience)
+							  const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
+							  const char *channel_name,
+							  const struct grpctts_failfast_conf *failfast_conf)
 {
-	GRPCTTS::Channel *channel = new GRPCTTS::Channel(endpoint, ca_data, authorization_api_key, authorization_secret_key,
-							 authorization_issuer, authorization_subject, authorization_audience);
+	GRPCTTS::Channel *channel = new GRPCTTS::Channel(endpoint, ssl_grpc, ca_file, authorization_api_key, authorization_secret_key,
+							 authorization_issuer, authorization_subject, authorization_audience, channel_name,
+							 *failfast_conf);
 	return (struct grpctts_channel *) channel;
 }
 extern "C" void grpctts_channel_destroy(struct grpctts_channel *channel)
@@ -112,3 +147,35 @@ extern "C" int grpctts_job_completion_success(struct grpctts_job *job)
 {
 	return ((GRPCTTS::Job *) job)->CompletionSuccess();
 }
+extern "C" void grpctts_job_get_usage(struct grpctts_job *job, struct voicekit_usage_report *report)
+{
+	((GRPCTTS::Job *) job)->GetUsage(report);
+}
+
+
+#define BENCH_CHUNK_BYTES 320
+
+extern "C" void grpctts_bench(int fd, int min_time_ms)
+{
+	std::shared_ptr<VoiceKitUsage> usage = std::make_shared<VoiceKitUsage>("TTS", "bench", "");
+	GRPCTTS::ByteQueue queue(usage);
+	const std::string chunk(BENCH_CHUNK_BYTES, '\x01');
+	char block[BENCH_CHUNK_BYTES];
+	voicekit_bench_run(fd, "tts/byte_queue/push_collect_take", min_time_ms,
+			   [&]()
+			   {
+				   queue.Push(chunk);
+				   queue.Collect();
+				   queue.TakeBlock(sizeof(block), block);
+			   });
+
+	static const char *const buffer_sizes[] = {"1.5s", "50%", "50%+1.5s"};
+	for (const char *buffer_size_str: buffer_sizes) {
+		struct grpctts_buffer_size buffer_size;
+		voicekit_bench_run(fd, (std::string("tts/parse_buffer_size/") + buffer_size_str).c_str(), min_time_ms,
+				   [&]()
+				   {
+					   grpctts_parse_buffer_size(&buffer_size, buffer_size_str);
+				   });
+	}
+}
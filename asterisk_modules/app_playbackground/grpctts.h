@@ -18,6 +18,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "voicekit_grpc.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,6 +27,7 @@ extern "C" {
 struct grpctts_channel;
 struct grpctts_job;
 struct grpctts_job_conf;
+struct voicekit_usage_report;
 
 typedef void (*grpctts_stream_error_callback_t)(const char *message);
 
@@ -40,18 +43,70 @@ struct grpctts_job_input {
 	const char *ssml;
 };
 
+/* Bounds of synthesis stream setup: jobs failing them finish with error instead of blocking playback */
+struct grpctts_failfast_conf {
+	int setup_timeout; /* milliseconds until channel is connected and response headers arrive; 0 for none */
+	int first_byte_timeout; /* milliseconds until first audio chunk arrives; 0 for none */
+	int breaker; /* fail jobs at once while circuit breaker of endpoint is open */
+	struct voicekit_breaker_conf breaker_conf;
+};
+
+/* Cache of synthesized audio shared by all channels: memory tier of this process and
+   on-disk tier shared by Asterisk processes of host (module-wide: taken from grpctts.conf) */
+struct grpctts_cache_conf {
+	int enable;
+	int memory_size_mb; /* 0 disables memory tier */
+	char *directory; /* NULL disables on-disk tier */
+	int disk_size_mb;
+	int ttl; /* seconds since synthesis; 0 for none */
+};
+
+struct grpctts_cache_stats {
+	unsigned long long memory_hits;
+	unsigned long long disk_hits;
+	unsigned long long misses;
+	unsigned long long stores;
+	unsigned long long expired;
+	unsigned long long memory_evictions;
+	unsigned long long disk_evictions;
+	size_t memory_entries;
+	size_t memory_bytes;
+	size_t disk_bytes; /* as of last directory scan plus files written since by this process */
+};
+
 extern void grpctts_set_stream_error_callback(
 	grpctts_stream_error_callback_t callback);
 
-extern void grpctts_init(void);
+/* Synthesis streams of all jobs are driven by fixed pool of reactor threads (0: number of CPUs) */
+extern int grpctts_reactor_start(
+	int thread_count);
+
+/* Cancels running synthesis streams and waits for them to finish */
+extern void grpctts_reactor_stop(void);
+
+/* Channels are shared by endpoint, TLS settings and authorization identity; unused ones are kept for max_idle seconds */
+extern void grpctts_channel_pool_configure(
+	double max_idle);
 
-extern void grpctts_shutdown(void);
+extern void grpctts_channel_pool_clear(void);
+
+extern void grpctts_cache_configure(
+	const struct grpctts_cache_conf *conf);
+
+/* Drops memory tier and stops on-disk tier writer */
+extern void grpctts_cache_shutdown(void);
+
+extern void grpctts_cache_get_stats(
+	struct grpctts_cache_stats *stats);
 
 extern struct grpctts_channel *grpctts_channel_create(
 	const char *endpoint,
-	const char *ca_data,
+	int ssl_grpc,
+	const char *ca_file,
 	const char *authorization_api_key, const char *authorization_secret_key,
-	const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience);
+	const char *authorization_issuer, const char *authorization_subject, const char *authorization_audience,
+	const char *channel_name,
+	const struct grpctts_failfast_conf *failfast_conf);
 
 extern void grpctts_channel_destroy(
 	struct grpctts_channel *channel);
@@ -89,6 +144,27 @@ extern int grpctts_job_termination_called(
 extern int grpctts_job_completion_success(
 	struct grpctts_job *job);
 
+extern void grpctts_job_get_usage(
+	struct grpctts_job *job,
+	struct voicekit_usage_report *report);
+
+/* "voicekit load tts": simulated channels run back-to-back jobs through module code paths (see tts_load.cpp) */
+extern void grpctts_load(
+	int fd,
+	const char *endpoint,
+	int ssl_grpc,
+	int channels,
+	double total_sec,
+	int unique_text, /* append job number to text so that audio cache is bypassed */
+	const char *text,
+	const struct grpctts_job_conf *job_conf,
+	const struct grpctts_failfast_conf *failfast_conf);
+
+/* "voicekit bench tts": byte queue of job and buffer size parsing */
+extern void grpctts_bench(
+	int fd,
+	int min_time_ms);
+
 #ifdef __cplusplus
 };
 #endif
@@ -18,6 +18,7 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 
 #define _GNU_SOURCE 1
 #include "grpctts_conf.h"
+#include "voicekit_grpc.h"
 
 #include <stdio.h>
 #include <regex.h>
@@ -27,9 +28,6 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 #include <asterisk/pbx.h>
 
 
-#define MAX_INMEMORY_FILE_SIZE (256*1024*1024)
-
-
 static regex_t cre_fraction;
 static int cre_fraction_status;
 static regex_t cre_seconds;
@@ -49,45 +47,6 @@ void grpctts_conf_global_uninit(void)
 }
 
 
-char *grpctts_load_ca_from_file(const char *relative_fname)
-{
-	char fname[512];
-	snprintf(fname, sizeof(fname), "%s/%s", ast_config_AST_CONFIG_DIR, relative_fname);
-	FILE *fh = fopen(fname, "r");
-	if (!fh) {
-		ast_log(AST_LOG_ERROR, "Failed to open CA file '%s' for reading: %s\n", fname, strerror(errno));
-		return NULL;
-	}
-	struct stat st;
-	if (fstat(fileno(fh), &st)) {
-		ast_log(AST_LOG_ERROR, "Failed to stat CA file '%s' for reading: %s\n", fname, strerror(errno));
-		fclose(fh);
-		return NULL;
-	}
-	size_t size = st.st_size;
-	if (size > MAX_INMEMORY_FILE_SIZE) {
-		ast_log(AST_LOG_ERROR, "Failed to read CA file '%s' into memory: file too big\n", fname);
-		fclose(fh);
-		return NULL;
-	}
-	char *data = (char *) ast_malloc(size + 1);
-	if (!data) {
-		ast_log(AST_LOG_ERROR, "Failed to read CA file '%s' into memory: failed to allocate buffer\n", fname);
-		fclose(fh);
-		return NULL;
-	}
-	if (fread(data, 1, size, fh) != size) {
-		ast_log(AST_LOG_ERROR, "Failed to read CA file '%s' into memory: %s\n", fname, feof(fh) ? "unexpected EOF" : strerror(errno));
-		fclose(fh);
-		ast_free(data);
-		return NULL;
-	}
-	data[size] = '\0';
-	fclose(fh);
-	return data;
-}
-
-
 static int match_fraction(double *fraction_r, const char *str)
 {
 	if (cre_fraction_status)
@@ -219,23 +178,51 @@ struct grpctts_job_conf *grpctts_job_conf_cpy(struct grpctts_job_conf *dest, con
 }
 
 
+void grpctts_failfast_conf_init(struct grpctts_failfast_conf *conf)
+{
+	conf->setup_timeout = 10000;
+	conf->first_byte_timeout = 0;
+	conf->breaker = 0;
+	conf->breaker_conf = voicekit_breaker_dflt_conf;
+}
+
+
+void grpctts_cache_conf_init(struct grpctts_cache_conf *conf)
+{
+	conf->enable = 0;
+	conf->memory_size_mb = 64;
+	conf->directory = NULL;
+	conf->disk_size_mb = 1024;
+	conf->ttl = 86400;
+}
+void grpctts_cache_conf_clear(struct grpctts_cache_conf *conf)
+{
+	ast_free(conf->directory);
+	grpctts_cache_conf_init(conf);
+}
+
+
 void grpctts_conf_init(struct grpctts_conf *conf)
 {
 	conf->endpoint = NULL;
-	conf->ssl_grpc = 0;
-	conf->ca_data = NULL;
+	conf->ssl_grpc = -1;
+	conf->ca_file = NULL;
 	conf->authorization_api_key = NULL;
 	conf->authorization_secret_key = NULL;
 	conf->authorization_issuer = NULL;
 	conf->authorization_subject = NULL;
 	conf->authorization_audience = NULL;
+	conf->reactor_threads = 0;
+	conf->pool_max_idle = 300.0;
 
 	grpctts_job_conf_init(&conf->job_conf);
+	grpctts_failfast_conf_init(&conf->failfast);
+	grpctts_cache_conf_init(&conf->cache);
 }
 void grpctts_conf_clear(struct grpctts_conf *conf)
 {
 	ast_free(conf->endpoint);
-	ast_free(conf->ca_data);
+	ast_free(conf->ca_file);
 	ast_free(conf->authorization_api_key);
 	ast_free(conf->authorization_secret_key);
 	ast_free(conf->authorization_issuer);
@@ -243,38 +230,35 @@ void grpctts_conf_clear(struct grpctts_conf *conf)
 	ast_free(conf->authorization_audience);
 
 	conf->endpoint = NULL;
-	conf->ssl_grpc = 0;
-	conf->ca_data = NULL;
+	conf->ssl_grpc = -1;
+	conf->ca_file = NULL;
 	conf->authorization_api_key = NULL;
 	conf->authorization_secret_key = NULL;
 	conf->authorization_issuer = NULL;
 	conf->authorization_subject = NULL;
 	conf->authorization_audience = NULL;
+	conf->reactor_threads = 0;
+	conf->pool_max_idle = 300.0;
 
 	grpctts_job_conf_clear(&conf->job_conf);
+	grpctts_failfast_conf_init(&conf->failfast);
+	grpctts_cache_conf_clear(&conf->cache);
 }
-int grpctts_conf_load(struct grpctts_conf *conf, ast_mutex_t *mutex, const char *fname, int reload)
+int grpctts_conf_load(struct grpctts_conf *conf, const char *fname, int reload)
 {
 	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
 	struct ast_config *cfg = ast_config_load(fname, config_flags);
 	if (!cfg) {
-		if (mutex)
-			ast_mutex_lock(mutex);
 		grpctts_conf_clear(conf);
-		if (mutex)
-			ast_mutex_unlock(mutex);
 		return 0;
 	}
 	if (cfg == CONFIG_STATUS_FILEUNCHANGED)
-		return 0;
+		return 1;
 	if (cfg == CONFIG_STATUS_FILEINVALID) {
 		ast_log(LOG_ERROR, "Config file grpctts.conf is in an invalid format.  Aborting.\n");
 		return -1;
 	}
 
-	if (mutex)
-		ast_mutex_lock(mutex);
-
 	grpctts_conf_clear(conf);
 
 	char *cat = ast_category_browse(cfg, NULL);
@@ -283,19 +267,22 @@ int grpctts_conf_load(struct grpctts_conf *conf, ast_mutex_t *mutex, const char
 			struct ast_variable *var = ast_variable_browse(cfg, cat);
 			while (var) {
 				if (!strcasecmp(var->name, "endpoint")) {
+					if (!voicekit_grpc_endpoint_is_valid(var->value, 0)) {
+						ast_log(AST_LOG_ERROR, "PlayBackground: parse error at '%s': invalid endpoint '%s' (expected \"host:port\" or \"unix:path\")\n", fname, var->value);
+						ast_config_destroy(cfg);
+						return -1;
+					}
 					ast_free(conf->endpoint);
 					conf->endpoint = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "use_ssl")) {
 					conf->ssl_grpc = ast_true(var->value);
 				} else if (!strcasecmp(var->name, "ca_file")) {
-					char *ca_data = grpctts_load_ca_from_file(var->value);
-					if (!ca_data) {
-						if (mutex)
-							ast_mutex_unlock(mutex);
+					if (voicekit_grpc_credentials_check(var->value)) {
 						ast_config_destroy(cfg);
 						return -1;
 					}
-					conf->ca_data = ca_data;
+					ast_free(conf->ca_file);
+					conf->ca_file = ast_strdup(var->value);
 				} else if (!strcasecmp(var->name, "pitch")) {
 					char *eptr;
 					double value = strtod(var->value, &eptr);
@@ -341,6 +328,14 @@ int grpctts_conf_load(struct grpctts_conf *conf, ast_mutex_t *mutex, const char
 						conf->job_conf.remote_frame_format = GRPCTTS_FRAME_FORMAT_OPUS;
 					else
 						ast_log(AST_LOG_ERROR, "PlayBackground: parse error at '%s': invalid 'remote_frame_format' value\n", fname);
+				} else if (!strcasecmp(var->name, "reactor_threads")) {
+					conf->reactor_threads = atoi(var->value);
+					if (conf->reactor_threads < 0) {
+						ast_log(AST_LOG_ERROR, "PlayBackground: parse error at '%s': invalid 'reactor_threads' value\n", fname);
+						conf->reactor_threads = 0;
+					}
+				} else if (!strcasecmp(var->name, "pool_max_idle")) {
+					conf->pool_max_idle = atof(var->value);
 				} else {
 					ast_log(LOG_ERROR, "PlayBackground: parse error at '%s': category '%s': unknown keyword '%s' at line %d\n", fname, cat, var->name, var->lineno);
 				}
@@ -393,20 +388,69 @@ int grpctts_conf_load(struct grpctts_conf *conf, ast_mutex_t *mutex, const char
 				}
 				var = var->next;
 			}
+		} else if (!strcasecmp(cat, "failfast")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "setup_timeout")) {
+					conf->failfast.setup_timeout = atoi(var->value);
+				} else if (!strcasecmp(var->name, "first_byte_timeout")) {
+					conf->failfast.first_byte_timeout = atoi(var->value);
+				} else if (!strcasecmp(var->name, "breaker")) {
+					conf->failfast.breaker = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "failure_threshold")) {
+					conf->failfast.breaker_conf.failure_threshold = atoi(var->value);
+				} else if (!strcasecmp(var->name, "error_rate")) {
+					conf->failfast.breaker_conf.error_rate = atof(var->value);
+				} else if (!strcasecmp(var->name, "min_calls")) {
+					conf->failfast.breaker_conf.min_calls = atoi(var->value);
+				} else if (!strcasecmp(var->name, "window")) {
+					conf->failfast.breaker_conf.window = atof(var->value);
+				} else if (!strcasecmp(var->name, "open_time")) {
+					conf->failfast.breaker_conf.open_time = atof(var->value);
+				} else if (!strcasecmp(var->name, "half_open_probes")) {
+					conf->failfast.breaker_conf.half_open_probes = atoi(var->value);
+				} else {
+					ast_log(LOG_ERROR, "PlayBackground: parse error at '%s': category '%s': unknown keyword '%s' at line %d\n", fname, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
+		} else if (!strcasecmp(cat, "cache")) {
+			struct ast_variable *var = ast_variable_browse(cfg, cat);
+			while (var) {
+				if (!strcasecmp(var->name, "enable")) {
+					conf->cache.enable = ast_true(var->value);
+				} else if (!strcasecmp(var->name, "memory_size")) {
+					conf->cache.memory_size_mb = atoi(var->value);
+				} else if (!strcasecmp(var->name, "directory")) {
+					ast_free(conf->cache.directory);
+					conf->cache.directory = NULL;
+					if (*var->value) {
+						if (var->value[0] == '/')
+							conf->cache.directory = ast_strdup(var->value);
+						else if (ast_asprintf(&conf->cache.directory, "%s/%s", ast_config_AST_CACHE_DIR, var->value) < 0)
+							conf->cache.directory = NULL;
+					}
+				} else if (!strcasecmp(var->name, "disk_size")) {
+					conf->cache.disk_size_mb = atoi(var->value);
+				} else if (!strcasecmp(var->name, "ttl")) {
+					conf->cache.ttl = atoi(var->value);
+				} else {
+					ast_log(LOG_ERROR, "PlayBackground: parse error at '%s': category '%s': unknown keyword '%s' at line %d\n", fname, cat, var->name, var->lineno);
+				}
+				var = var->next;
+			}
 		}
 		cat = ast_category_browse(cfg, cat);
 	}
 
-	if (mutex)
-		ast_mutex_unlock(mutex);
 	ast_config_destroy(cfg);
 
 	return 0;
 }
-struct grpctts_conf *grpctts_conf_cpy(struct grpctts_conf *dest, const struct grpctts_conf *src, ast_mutex_t *src_mutex)
+struct grpctts_conf *grpctts_conf_cpy(struct grpctts_conf *dest, const struct grpctts_conf *src)
 {
 	ast_free(dest->endpoint);
-	ast_free(dest->ca_data);
+	ast_free(dest->ca_file);
 	ast_free(dest->authorization_api_key);
 	ast_free(dest->authorization_secret_key);
 	ast_free(dest->authorization_issuer);
@@ -415,26 +459,24 @@ struct grpctts_conf *grpctts_conf_cpy(struct grpctts_conf *dest, const struct gr
 	ast_free(dest->job_conf.voice_language_code);
 	ast_free(dest->job_conf.voice_name);
 
-	if (src_mutex)
-		ast_mutex_lock(src_mutex);
-
 	if (!grpctts_job_conf_cpy(&dest->job_conf, &src->job_conf)) {
-		if (src_mutex)
-			ast_mutex_unlock(src_mutex);
 		grpctts_conf_init(dest);
 		return NULL;
 	}
 	dest->endpoint = ast_strdup(src->endpoint);
 	dest->ssl_grpc = src->ssl_grpc;
-	dest->ca_data = ast_strdup(src->ca_data);
+	dest->ca_file = ast_strdup(src->ca_file);
 	dest->authorization_api_key = ast_strdup(src->authorization_api_key);
 	dest->authorization_secret_key = ast_strdup(src->authorization_secret_key);
 	dest->authorization_issuer = ast_strdup(src->authorization_issuer);
 	dest->authorization_subject = ast_strdup(src->authorization_subject);
 	dest->authorization_audience = ast_strdup(src->authorization_audience);
-
-	if (src_mutex)
-		ast_mutex_unlock(src_mutex);
+	dest->reactor_threads = src->reactor_threads;
+	dest->pool_max_idle = src->pool_max_idle;
+	dest->failfast = src->failfast;
+	ast_free(dest->cache.directory);
+	dest->cache = src->cache;
+	dest->cache.directory = ast_strdup(src->cache.directory);
 
 	return dest;
 }
@@ -63,15 +63,19 @@ struct grpctts_job_conf {
 
 struct grpctts_conf {
 	char *endpoint;
-	int ssl_grpc;
-	char *ca_data;
+	int ssl_grpc; /* -1: TLS for "host:port" and none for "unix:path" endpoints */
+	char *ca_file; /* relative to configuration directory; NULL for built-in CA */
 	char *authorization_api_key;
 	char *authorization_secret_key;
 	char *authorization_issuer;
 	char *authorization_subject;
 	char *authorization_audience;
+	int reactor_threads; /* applied at module load only; 0: number of CPUs */
+	double pool_max_idle; /* seconds unused pooled channel is kept; module-wide */
 
 	struct grpctts_job_conf job_conf;
+	struct grpctts_failfast_conf failfast;
+	struct grpctts_cache_conf cache;
 };
 
 #define GRPCTTS_JOB_CONF_INITIALIZER {				\
@@ -84,17 +88,36 @@ struct grpctts_conf {
 	.remote_frame_format = GRPCTTS_FRAME_FORMAT_SLINEAR16,	\
 }
 
+#define GRPCTTS_FAILFAST_CONF_INITIALIZER {		\
+	.setup_timeout = 10000,				\
+	.first_byte_timeout = 0,			\
+	.breaker = 0,					\
+	/* .breaker_conf is set by grpctts_failfast_conf_init() */ \
+}
+
+#define GRPCTTS_CACHE_CONF_INITIALIZER {		\
+	.enable = 0,					\
+	.memory_size_mb = 64,				\
+	.directory = NULL,				\
+	.disk_size_mb = 1024,				\
+	.ttl = 86400,					\
+}
+
 #define GRPCTTS_CONF_INITIALIZER {			\
 	.endpoint = NULL,				\
-	.ssl_grpc = 0,					\
-	.ca_data = NULL,				\
+	.ssl_grpc = -1,					\
+	.ca_file = NULL,				\
 	.authorization_api_key = NULL,			\
 	.authorization_secret_key = NULL,		\
 	.authorization_issuer = NULL,			\
 	.authorization_subject = NULL,			\
 	.authorization_audience = NULL,			\
+	.reactor_threads = 0,				\
+	.pool_max_idle = 300.0,				\
 							\
 	.job_conf = GRPCTTS_JOB_CONF_INITIALIZER,	\
+	.failfast = GRPCTTS_FAILFAST_CONF_INITIALIZER,	\
+	.cache = GRPCTTS_CACHE_CONF_INITIALIZER,	\
 }
 
 
@@ -103,9 +126,6 @@ extern void grpctts_conf_global_init(void);
 extern void grpctts_conf_global_uninit(void);
 
 
-extern char *grpctts_load_ca_from_file(
-	const char *relative_fname);
-
 extern int grpctts_parse_buffer_size(
 	struct grpctts_buffer_size *buffer_size,
 	const char *str);
@@ -124,22 +144,32 @@ extern struct grpctts_job_conf *grpctts_job_conf_cpy(
 	const struct grpctts_job_conf *src);
 
 
+extern void grpctts_failfast_conf_init(
+	struct grpctts_failfast_conf *conf);
+
+
+extern void grpctts_cache_conf_init(
+	struct grpctts_cache_conf *conf);
+
+extern void grpctts_cache_conf_clear(
+	struct grpctts_cache_conf *conf);
+
+
 extern void grpctts_conf_init(
 	struct grpctts_conf *conf);
 
 extern void grpctts_conf_clear(
 	struct grpctts_conf *conf);
 
+/* Returns 1 (conf is left untouched) if reloading and file is unchanged */
 extern int grpctts_conf_load(
 	struct grpctts_conf *conf,
-	ast_mutex_t *mutex,
 	const char *fname,
 	int reload);
 
 extern struct grpctts_conf *grpctts_conf_cpy(
 	struct grpctts_conf *dest,
-	const struct grpctts_conf *src,
-	ast_mutex_t *src_mutex);
+	const struct grpctts_conf *src);
 
 #ifdef __cplusplus
 };
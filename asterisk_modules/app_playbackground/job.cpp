@@ -17,10 +17,14 @@
 #include "bytequeue.h"
 #include "channelbackend.h"
 #include "grpctts.h"
-#include "RAII.h"
+#include "audiocache.h"
+#include "reactor.h"
+#include "voicekit_grpc.h"
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
-#include <thread>
+#include <mutex>
 #include <unordered_map>
 
 #include <unistd.h>
@@ -31,64 +35,281 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <opus.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/channel.h>
 #include <grpcpp/client_context.h>
+#include <grpcpp/completion_queue.h>
 
 
 #define CHANNEL_FRAME_SAMPLE_RATE 8000
 #define CHANNEL_MAX_OPUS_FRAME_SAMPLES 960
 #define CHANNEL_AWAIT_TIMEOUT 60000 /* 60 sec */
+#define CHANNEL_AWAIT_POLL_INTERVAL 5 /* msec */
 
 #define CXX_STRING(str) (std::string((str) ? (str) : ""))
 
 static grpctts_stream_error_callback_t grpctts_stream_error_callback = NULL;
 
 
+/* Announced duration and x-request-id which are taken by playback before audio */
+static std::string make_initial_data(int64_t num_samples, const std::string &x_request_id)
+{
+	std::string initial_data((const char *) &num_samples, sizeof(int64_t));
+	initial_data.append(1, uint8_t(x_request_id.size()));
+	initial_data.append(x_request_id);
+	return initial_data;
+}
+
+
 namespace GRPCTTS {
 
-static void thread_routine(std::shared_ptr<ChannelBackend> channel_backend,
-			   double speaking_rate, double pitch, double volume_gain_db,
-			   const std::string &voice_language_code, const std::string &voice_name, enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender,
-			   enum grpctts_frame_format remote_frame_format,
-			   const std::string &text, const std::string &ssml, std::shared_ptr<ByteQueue> byte_queue)
-{
-	auto gprc_shutdown_caller = BuildSafeRAII(grpc_shutdown /* To survie module unloading */);
-	auto byte_queue_finalizer = BuildSafeRAII([byte_queue]()
-						  {
-							  byte_queue->Terminate(false);
-						  });
-	OpusDecoder *opus_decoder = NULL;
-	auto opus_finalizer = BuildSafeRAII([&opus_decoder]()
-					    {
-						    if (opus_decoder)
-							    opus_decoder_destroy(opus_decoder);
-					    });
-
-	int channel_completion_fd = channel_backend->ChannelCompletionFD();
-	struct pollfd pfd = {
-		.fd = channel_completion_fd,
-		.events = POLLIN,
-		.revents = 0,
+class SynthesisCall;
+
+/* Shared by job and its synthesis call: job destroyed before call is finished (hangup,
+   interrupted playback) cancels it, so that service stops synthesizing at once */
+struct SynthesisCallLink
+{
+	SynthesisCallLink()
+		: call(NULL), cancelled(false)
+		{
+		}
+
+	std::mutex mutex;
+	SynthesisCall *call; // NULL once call is destroyed
+	std::atomic<bool> cancelled;
+};
+
+/* Synthesis stream of job: created at job start, destroys itself after stream is finished */
+class SynthesisCall : public ReactorCall
+{
+public:
+	SynthesisCall(std::shared_ptr<SynthesisCallLink> link, std::shared_ptr<ChannelBackend> channel_backend,
+		      const std::string &endpoint, const struct grpctts_failfast_conf &failfast_conf,
+		      double speaking_rate, double pitch, double volume_gain_db,
+		      const std::string &voice_language_code, const std::string &voice_name, enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender,
+		      enum grpctts_frame_format remote_frame_format,
+		      const std::string &text, const std::string &ssml, std::shared_ptr<ByteQueue> byte_queue,
+		      std::shared_ptr<VoiceKitUsage> usage, const std::string &cache_key);
+	~SynthesisCall();
+	static void Start(SynthesisCall *call);
+	void Proceed(bool ok) override;
+	void Cancel() override;
+
+private:
+	enum State {
+		STATE_AWAIT_CHANNEL,
+		STATE_START_CALL,
+		STATE_READ_INITIAL_METADATA,
+		STATE_READ,
+		STATE_FINISH,
 	};
-	poll(&pfd, 1, CHANNEL_AWAIT_TIMEOUT);
-	if (!(pfd.revents & POLLIN)) {
-		if (grpctts_stream_error_callback)
-			grpctts_stream_error_callback("GRPC TTS stream finished with error: failed to initialize channel");
+
+private:
+	void Fail(const char *message);
+	void Done();
+	void AwaitChannel(int timeout_ms);
+	void StartStream();
+	void PushInitialData();
+	bool PushAudioChunk();
+	void PushSamples(std::string &&samples);
+	void Finish();
+	void ReportStatus();
+
+private:
+	std::shared_ptr<SynthesisCallLink> link;
+	std::shared_ptr<ChannelBackend> channel_backend;
+	const struct grpctts_failfast_conf failfast_conf;
+	double speaking_rate;
+	double pitch;
+	double volume_gain_db;
+	const std::string voice_language_code;
+	const std::string voice_name;
+	enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender;
+	enum grpctts_frame_format remote_frame_format;
+	const std::string text;
+	const std::string ssml;
+	std::shared_ptr<ByteQueue> byte_queue;
+	std::shared_ptr<VoiceKitUsage> usage;
+
+	grpc::CompletionQueue *queue;
+	State state;
+	VoiceKitBreakerCall breaker_call;
+	std::chrono::steady_clock::time_point setup_start;
+	std::unique_ptr<grpc::Alarm> alarm;
+	OpusDecoder *opus_decoder;
+	grpc::ClientContext context;
+	std::unique_ptr<voiptime::cloud::tts::v1::TextToSpeech::Stub> tts_stub;
+	std::unique_ptr<grpc::ClientAsyncReader<voiptime::cloud::tts::v1::StreamingSynthesizeSpeechResponse>> stream;
+	std::unique_ptr<VoiceKitDeadline> setup_deadline;
+	std::unique_ptr<VoiceKitDeadline> first_byte_deadline;
+	voiptime::cloud::tts::v1::StreamingSynthesizeSpeechResponse response;
+	grpc::Status status;
+	bool setup_expired;
+	bool first_byte_expired;
+	bool first_response;
+	bool decode_failed;
+	std::string x_request_id;
+	std::string cache_key; // empty if audio is not collected for cache
+	std::string cache_samples;
+	size_t cache_max_size;
+};
+
+SynthesisCall::SynthesisCall(std::shared_ptr<SynthesisCallLink> link, std::shared_ptr<ChannelBackend> channel_backend,
+			     const std::string &endpoint, const struct grpctts_failfast_conf &failfast_conf,
+			     double speaking_rate, double pitch, double volume_gain_db,
+			     const std::string &voice_language_code, const std::string &voice_name, enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender,
+			     enum grpctts_frame_format remote_frame_format,
+			     const std::string &text, const std::string &ssml, std::shared_ptr<ByteQueue> byte_queue,
+			     std::shared_ptr<VoiceKitUsage> usage, const std::string &cache_key)
+	: link(link), channel_backend(channel_backend), failfast_conf(failfast_conf),
+	  speaking_rate(speaking_rate), pitch(pitch), volume_gain_db(volume_gain_db),
+	  voice_language_code(voice_language_code), voice_name(voice_name), ssml_gender(ssml_gender),
+	  remote_frame_format(remote_frame_format), text(text), ssml(ssml), byte_queue(byte_queue), usage(usage),
+	  queue(NULL), state(STATE_AWAIT_CHANNEL), breaker_call(endpoint, failfast_conf.breaker ? &failfast_conf.breaker_conf : NULL),
+	  setup_start(std::chrono::steady_clock::now()), opus_decoder(NULL),
+	  setup_expired(false), first_byte_expired(false), first_response(true), decode_failed(false),
+	  cache_key(cache_key), cache_max_size(cache_key.empty() ? 0 : grpctts_audio_cache.MaxEntrySize())
+{
+	std::lock_guard<std::mutex> lock(link->mutex);
+	link->call = this;
+}
+SynthesisCall::~SynthesisCall()
+{
+	{
+		std::lock_guard<std::mutex> lock(link->mutex);
+		link->call = NULL;
+	}
+	byte_queue->Terminate(false);
+	if (opus_decoder)
+		opus_decoder_destroy(opus_decoder);
+}
+void SynthesisCall::Start(SynthesisCall *call)
+{
+	if (call->breaker_call.Rejected()) {
+		call->Fail("GRPC TTS stream finished with error: circuit breaker is open");
+		delete call;
+		return;
+	}
+	call->queue = Reactor::Attach(call);
+	if (!call->queue) {
+		call->Fail("GRPC TTS stream finished with error: synthesis reactor is not running");
+		delete call;
+		return;
+	}
+	/* All steps including first one are run at reactor thread */
+	call->AwaitChannel(0);
+}
+void SynthesisCall::Proceed(bool ok)
+{
+	VoiceKitUsageThreadScope usage_thread_scope(usage, "grpctts-reactor");
+	switch (state) {
+	case STATE_AWAIT_CHANNEL: {
+		struct pollfd pfd = {
+			.fd = channel_backend->ChannelCompletionFD(),
+			.events = POLLIN,
+			.revents = 0,
+		};
+		poll(&pfd, 1, 0);
+		int await_timeout = failfast_conf.setup_timeout > 0 ? failfast_conf.setup_timeout : CHANNEL_AWAIT_TIMEOUT;
+		int setup_elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - setup_start).count();
+		if (Reactor::Stopping()) {
+			Fail("GRPC TTS stream finished with error: module is unloading");
+			Done();
+		} else if (link->cancelled) { /* Job is gone before stream was started */
+			Done();
+		} else if (pfd.revents & POLLIN) {
+			StartStream();
+		} else if (setup_elapsed_ms >= await_timeout) {
+			breaker_call.SetOutcome(VOICEKIT_BREAKER_FAILURE);
+			Fail("GRPC TTS stream finished with error: failed to initialize channel");
+			Done();
+		} else {
+			AwaitChannel(std::min(CHANNEL_AWAIT_POLL_INTERVAL, await_timeout - setup_elapsed_ms));
+		}
+	} break;
+	case STATE_START_CALL: {
+		if (!ok) {
+			Finish();
+			return;
+		}
+		state = STATE_READ_INITIAL_METADATA;
+		stream->ReadInitialMetadata(this);
+	} break;
+	case STATE_READ_INITIAL_METADATA: {
+		setup_expired = setup_deadline->Disarm();
+		PushInitialData();
+		if (!ok) {
+			Finish();
+			return;
+		}
+		state = STATE_READ;
+		stream->Read(&response, this);
+	} break;
+	case STATE_READ: {
+		if (!ok) {
+			Finish();
+			return;
+		}
+		if (first_response) {
+			first_response = false;
+			first_byte_expired = first_byte_deadline->Disarm();
+			if (!first_byte_expired)
+				breaker_call.Release(VOICEKIT_BREAKER_SUCCESS);
+		}
+		if (!PushAudioChunk()) {
+			decode_failed = true;
+			context.TryCancel();
+			Finish();
+			return;
+		}
+		stream->Read(&response, this);
+	} break;
+	case STATE_FINISH: {
+		ReportStatus();
+		Done();
+	} break;
+	}
+}
+void SynthesisCall::Cancel()
+{
+	/* Channel await checks for reactor stop on next poll */
+	context.TryCancel();
+}
+void SynthesisCall::Fail(const char *message)
+{
+	if (grpctts_stream_error_callback)
+		grpctts_stream_error_callback(message);
+}
+void SynthesisCall::Done()
+{
+	Reactor::Detach(this);
+	delete this;
+}
+void SynthesisCall::AwaitChannel(int timeout_ms)
+{
+	state = STATE_AWAIT_CHANNEL;
+	alarm.reset(new grpc::Alarm());
+	alarm->Set(queue, std::chrono::system_clock::now() + std::chrono::milliseconds(timeout_ms), this);
+}
+void SynthesisCall::StartStream()
+{
+	if (channel_backend->Failed()) { /* Local reason: not counted by breaker */
+		Fail("GRPC TTS stream finished with error: failed to initialize channel credentials");
+		Done();
 		return;
 	}
-
 	std::shared_ptr<grpc::Channel> grpc_channel = channel_backend->GetChannel();
 	if (!grpc_channel) {
-		if (grpctts_stream_error_callback)
-			grpctts_stream_error_callback("GRPC TTS stream finished with error: failed to initialize channel");
+		breaker_call.SetOutcome(VOICEKIT_BREAKER_FAILURE);
+		Fail("GRPC TTS stream finished with error: failed to initialize channel");
+		Done();
 		return;
 	}
 
-	grpc::ClientContext context;
 	std::string auth_token(channel_backend->BuildAuthToken());
 	if (auth_token.length())
 		context.AddMetadata("authorization", auth_token);
-	std::unique_ptr<voiptime::cloud::tts::v1::TextToSpeech::Stub> tts_stub = voiptime::cloud::tts::v1::TextToSpeech::NewStub(grpc_channel);
+	tts_stub = voiptime::cloud::tts::v1::TextToSpeech::NewStub(grpc_channel);
 	voiptime::cloud::tts::v1::SynthesizeSpeechRequest request;
 
 	if (text.size() || ssml.size()) {
@@ -119,8 +340,8 @@ static void thread_routine(std::shared_ptr<ChannelBackend> channel_backend,
 			int error;
 			opus_decoder = opus_decoder_create(CHANNEL_FRAME_SAMPLE_RATE, 1, &error);
 			if (error != OPUS_OK || !opus_decoder) {
-				if (grpctts_stream_error_callback)
-					grpctts_stream_error_callback("GRPC TTS stream finished with error: failed to initialize Opus decoder");
+				Fail("GRPC TTS stream finished with error: failed to initialize Opus decoder");
+				Done();
 				return;
 			}
 		}
@@ -129,9 +350,19 @@ static void thread_routine(std::shared_ptr<ChannelBackend> channel_backend,
 		// audio_config->set_volume_gain_db(volume_gain_db); - ingore for now
 		audio_config->set_sample_rate_hertz(CHANNEL_FRAME_SAMPLE_RATE);
 	}
-	std::unique_ptr<grpc::ClientReader<voiptime::cloud::tts::v1::StreamingSynthesizeSpeechResponse>> stream = tts_stub->StreamingSynthesize(&context, request);
-	stream->WaitForInitialMetadata();
-	std::string x_request_id;
+
+	/* Remaining setup time (after channel await) bounds response headers; first byte time counts from job start */
+	int setup_elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - setup_start).count();
+	setup_deadline.reset(new VoiceKitDeadline(failfast_conf.setup_timeout > 0 ? std::max(failfast_conf.setup_timeout - setup_elapsed_ms, 1) : 0,
+						  [this]() { context.TryCancel(); }));
+	first_byte_deadline.reset(new VoiceKitDeadline(failfast_conf.first_byte_timeout > 0 ? std::max(failfast_conf.first_byte_timeout - setup_elapsed_ms, 1) : 0,
+						       [this]() { context.TryCancel(); }));
+	stream = tts_stub->PrepareAsyncStreamingSynthesize(&context, request, queue);
+	state = STATE_START_CALL;
+	stream->StartCall(this);
+}
+void SynthesisCall::PushInitialData()
+{
 	int64_t num_samples = -1;
 	const std::multimap<grpc::string_ref, grpc::string_ref> &metadata = context.GetServerInitialMetadata();
 	{
@@ -154,45 +385,74 @@ static void thread_routine(std::shared_ptr<ChannelBackend> channel_backend,
 				num_samples = -1;
 		}
 	}
-	{
-		std::string initial_data((const char *) &num_samples, sizeof(int64_t));
-		initial_data.append(1, uint8_t(x_request_id.size()));
-		initial_data.append(x_request_id);
-		byte_queue->Push(initial_data);
-	}
-
-	voiptime::cloud::tts::v1::StreamingSynthesizeSpeechResponse response;
-	while (stream->Read(&response)) {
-		switch (remote_frame_format) {
-		case GRPCTTS_FRAME_FORMAT_OPUS: {
-			const std::string &audio_chunk = response.audio_chunk();
-			int16_t frame_samples[CHANNEL_MAX_OPUS_FRAME_SAMPLES];
-			int num_samples_per_channel = opus_decode(opus_decoder, (const unsigned char *) audio_chunk.data(), audio_chunk.size(),
-								  frame_samples, sizeof(frame_samples)/sizeof(frame_samples[0]), 0);
-			if (!num_samples_per_channel) {
-				if (grpctts_stream_error_callback)
-					grpctts_stream_error_callback("GRPC TTS stream finished with error: no audio decoded from Opus");
-				return;
-			} else if (num_samples_per_channel < 0) {
-				if (grpctts_stream_error_callback) {
-					char message[4096];
-					snprintf(message, sizeof(message), "GRPC TTS stream finished with error: failed to decoded audio from Opus: %s", opus_strerror(num_samples_per_channel));
-					grpctts_stream_error_callback(message);
-				}
-				return;
+	byte_queue->Push(make_initial_data(num_samples, x_request_id));
+}
+bool SynthesisCall::PushAudioChunk()
+{
+	switch (remote_frame_format) {
+	case GRPCTTS_FRAME_FORMAT_OPUS: {
+		const std::string &audio_chunk = response.audio_chunk();
+		int16_t frame_samples[CHANNEL_MAX_OPUS_FRAME_SAMPLES];
+		int num_samples_per_channel = opus_decode(opus_decoder, (const unsigned char *) audio_chunk.data(), audio_chunk.size(),
+							  frame_samples, sizeof(frame_samples)/sizeof(frame_samples[0]), 0);
+		if (!num_samples_per_channel) {
+			Fail("GRPC TTS stream finished with error: no audio decoded from Opus");
+			return false;
+		} else if (num_samples_per_channel < 0) {
+			if (grpctts_stream_error_callback) {
+				char message[4096];
+				snprintf(message, sizeof(message), "GRPC TTS stream finished with error: failed to decoded audio from Opus: %s", opus_strerror(num_samples_per_channel));
+				grpctts_stream_error_callback(message);
 			}
-			byte_queue->Push(std::string((const char *) frame_samples, num_samples_per_channel*sizeof(int16_t)));
-		} break;
-		default: {
-			byte_queue->Push(response.audio_chunk());
+			return false;
 		}
+		PushSamples(std::string((const char *) frame_samples, num_samples_per_channel*sizeof(int16_t)));
+	} break;
+	default: {
+		PushSamples(std::move(*response.mutable_audio_chunk()));
+	}
+	}
+	return true;
+}
+void SynthesisCall::PushSamples(std::string &&samples)
+{
+	if (!cache_key.empty()) {
+		if (cache_samples.size() + samples.size() <= cache_max_size) {
+			cache_samples.append(samples);
+		} else { /* Too long to be cached */
+			cache_key.clear();
+			std::string().swap(cache_samples);
 		}
 	}
-	grpc::Status status = stream->Finish();
+	byte_queue->Push(samples);
+}
+void SynthesisCall::Finish()
+{
+	state = STATE_FINISH;
+	stream->Finish(&status, this);
+}
+void SynthesisCall::ReportStatus()
+{
+	if (first_response)
+		first_byte_expired = first_byte_deadline->Disarm();
+	if (decode_failed) /* Already reported; stream was cancelled */
+		return;
+	if (link->cancelled && !status.ok()) /* Cancelled by job: not an error, not counted by breaker */
+		return;
+	if (status.ok() && !cache_key.empty())
+		grpctts_audio_cache.Store(cache_key, x_request_id, std::move(cache_samples));
 	byte_queue->Terminate(status.ok());
+	if (status.ok())
+		breaker_call.SetOutcome(VOICEKIT_BREAKER_SUCCESS);
+	else if (first_response)
+		breaker_call.SetOutcome(VOICEKIT_BREAKER_FAILURE);
 	if (!status.ok() && grpctts_stream_error_callback) {
 		char message[4096];
-		snprintf(message, sizeof(message), "GRPC TTS stream finished with error (code = %d): %s", (int) status.error_code(), status.error_message().c_str());
+		if (setup_expired || first_byte_expired)
+			snprintf(message, sizeof(message), "GRPC TTS stream finished with error (code = %d): %s deadline exceeded",
+				 (int) grpc::StatusCode::DEADLINE_EXCEEDED, setup_expired ? "setup" : "first byte");
+		else
+			snprintf(message, sizeof(message), "GRPC TTS stream finished with error (code = %d): %s", (int) status.error_code(), status.error_message().c_str());
 		grpctts_stream_error_callback(message);
 	}
 }
@@ -206,22 +466,43 @@ void Job::SetErrorCallback(grpctts_stream_error_callback_t callback)
 
 static std::atomic<int> Job_alloc_balance;
 
-Job::Job(std::shared_ptr<ChannelBackend> channel_backend,
+Job::Job(std::shared_ptr<ChannelBackend> channel_backend, const std::string &endpoint, const std::string &channel_name,
+	 const struct grpctts_failfast_conf &failfast_conf,
 	 double speaking_rate, double pitch, double volume_gain_db,
 	 const std::string &voice_language_code, const std::string &voice_name, enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender,
 	 enum grpctts_frame_format remote_frame_format, const struct grpctts_job_input &job_input)
-	: byte_queue(std::make_shared<ByteQueue>())
+	: usage(std::make_shared<VoiceKitUsage>("TTS", channel_name, endpoint)), byte_queue(std::make_shared<ByteQueue>(usage))
 {
-	grpc_init(); // To survie module unloading
-	std::thread thread = std::thread(thread_routine,
-					 channel_backend,
-					 speaking_rate, pitch, volume_gain_db,
-					 voice_language_code, voice_name, ssml_gender, remote_frame_format,
-					 CXX_STRING(job_input.text), CXX_STRING(job_input.ssml), byte_queue);
-	thread.detach();
+	std::string text = CXX_STRING(job_input.text);
+	std::string ssml = CXX_STRING(job_input.ssml);
+	std::string cache_key;
+	if (grpctts_audio_cache.Enabled()) {
+		cache_key = AudioCache::Key(endpoint, channel_backend->AuthorizationIssuer(), channel_backend->AuthorizationSubject(),
+					    text, ssml, voice_name, voice_language_code, ssml_gender, speaking_rate,
+					    remote_frame_format, CHANNEL_FRAME_SAMPLE_RATE);
+		std::shared_ptr<const CachedAudio> audio = grpctts_audio_cache.Lookup(cache_key);
+		if (audio) {
+			/* Whole audio is queued at once: playback starts and duration is known without synthesis */
+			byte_queue->Push(make_initial_data(audio->sample_bytes/sizeof(int16_t), audio->x_request_id));
+			byte_queue->Push(audio, audio->samples, audio->sample_bytes);
+			byte_queue->Terminate(true);
+			return;
+		}
+	}
+	call_link = std::make_shared<SynthesisCallLink>();
+	SynthesisCall::Start(new SynthesisCall(call_link, channel_backend, endpoint, failfast_conf,
+					       speaking_rate, pitch, volume_gain_db,
+					       voice_language_code, voice_name, ssml_gender, remote_frame_format,
+					       text, ssml, byte_queue, usage, cache_key));
 }
 Job::~Job()
 {
+	if (!call_link)
+		return;
+	std::lock_guard<std::mutex> lock(call_link->mutex);
+	call_link->cancelled = true;
+	if (call_link->call)
+		call_link->call->Cancel();
 }
 int Job::EventFD()
 {
@@ -251,5 +532,9 @@ bool Job::CompletionSuccess()
 {
 	return byte_queue->CompletionSuccess();
 }
+void Job::GetUsage(struct voicekit_usage_report *report)
+{
+	usage->Report(report);
+}
 
 };
@@ -26,6 +26,8 @@
 typedef void (*grpctts_stream_error_callback_t)(const char *message);
 
 struct grpctts_job_input;
+struct voicekit_usage_report;
+class VoiceKitUsage;
 
 namespace grpc {
 class Channel;
@@ -36,6 +38,7 @@ namespace GRPCTTS {
 
 class ByteQueue;
 class ChannelBackend;
+struct SynthesisCallLink;
 
 
 class Job
@@ -44,7 +47,8 @@ public:
 	static void SetErrorCallback(grpctts_stream_error_callback_t callback);
 
 public:
-	Job(std::shared_ptr<ChannelBackend> channel_backend,
+	Job(std::shared_ptr<ChannelBackend> channel_backend, const std::string &endpoint, const std::string &channel_name,
+	    const struct grpctts_failfast_conf &failfast_conf,
 	    double speaking_rate, double pitch, double volume_gain_db,
 	    const std::string &voice_language_code, const std::string &voice_name, enum voiptime::cloud::tts::v1::SsmlVoiceGender ssml_gender,
 	    enum grpctts_frame_format remote_frame_format,
@@ -57,9 +61,12 @@ public:
 	size_t TakeTail(size_t byte_count, void *data);
 	bool TerminationCalled();
 	bool CompletionSuccess();
+	void GetUsage(struct voicekit_usage_report *report);
 
 private:
+	std::shared_ptr<VoiceKitUsage> usage; // shared with synthesis call and byte queue
 	std::shared_ptr<ByteQueue> byte_queue;
+	std::shared_ptr<SynthesisCallLink> call_link; // nullptr if job is served from cache
 };
 
 };
@@ -0,0 +1,107 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#include "reactor.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <grpcpp/completion_queue.h>
+
+
+namespace GRPCTTS {
+
+static std::mutex reactor_mutex;
+static std::condition_variable reactor_drained;
+static std::set<ReactorCall*> reactor_calls;
+static std::vector<std::unique_ptr<grpc::CompletionQueue>> reactor_queues;
+static std::vector<std::thread> reactor_threads;
+static std::atomic<unsigned> reactor_next_queue;
+static bool reactor_running = false;
+static std::atomic<bool> reactor_stopping(false);
+
+
+static void thread_routine(grpc::CompletionQueue *queue)
+{
+	pthread_setname_np(pthread_self(), "grpctts-reactor");
+	void *tag;
+	bool ok;
+	while (queue->Next(&tag, &ok))
+		static_cast<ReactorCall *>(tag)->Proceed(ok);
+}
+
+
+bool Reactor::Start(int thread_count)
+{
+	std::lock_guard<std::mutex> lock(reactor_mutex);
+	if (reactor_running || thread_count <= 0)
+		return false;
+	for (int i = 0; i < thread_count; ++i) {
+		reactor_queues.push_back(std::unique_ptr<grpc::CompletionQueue>(new grpc::CompletionQueue()));
+		reactor_threads.push_back(std::thread(thread_routine, reactor_queues.back().get()));
+	}
+	reactor_running = true;
+	return true;
+}
+void Reactor::Stop()
+{
+	{
+		std::unique_lock<std::mutex> lock(reactor_mutex);
+		if (!reactor_running)
+			return;
+		reactor_stopping = true;
+		for (ReactorCall *call: reactor_calls)
+			call->Cancel();
+		reactor_drained.wait(lock, []() { return reactor_calls.empty(); });
+	}
+	// No operations are pending: queues are drained at once
+	for (std::unique_ptr<grpc::CompletionQueue> &queue: reactor_queues)
+		queue->Shutdown();
+	for (std::thread &thread: reactor_threads)
+		thread.join();
+
+	std::lock_guard<std::mutex> lock(reactor_mutex);
+	reactor_threads.clear();
+	reactor_queues.clear();
+	reactor_running = false;
+	reactor_stopping = false;
+}
+bool Reactor::Stopping()
+{
+	return reactor_stopping;
+}
+grpc::CompletionQueue *Reactor::Attach(ReactorCall *call)
+{
+	std::lock_guard<std::mutex> lock(reactor_mutex);
+	if (!reactor_running || reactor_stopping)
+		return NULL;
+	reactor_calls.insert(call);
+	return reactor_queues[reactor_next_queue++ % reactor_queues.size()].get();
+}
+void Reactor::Detach(ReactorCall *call)
+{
+	std::lock_guard<std::mutex> lock(reactor_mutex);
+	reactor_calls.erase(call);
+	if (reactor_calls.empty())
+		reactor_drained.notify_all();
+}
+
+};
@@ -0,0 +1,55 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef GRPCTTS_REACTOR_H
+#define GRPCTTS_REACTOR_H
+
+
+namespace grpc {
+class CompletionQueue;
+};
+
+
+namespace GRPCTTS {
+
+// Asynchronous call driven by reactor threads: call itself is tag of its completion queue operations,
+// so that call must have at most one operation pending at a time
+class ReactorCall
+{
+public:
+	virtual ~ReactorCall() {}
+	// Called at reactor thread on completion of pending operation
+	virtual void Proceed(bool ok) = 0;
+	// Called at any thread on reactor stop: pending operation must complete soon
+	virtual void Cancel() = 0;
+};
+
+// Fixed pool of threads, each serving its own completion queue
+class Reactor
+{
+public:
+	static bool Start(int thread_count);
+	// Cancels attached calls, waits for them to detach and joins threads
+	static void Stop();
+	static bool Stopping();
+	// Returns completion queue assigned to call or NULL if reactor is not running
+	static grpc::CompletionQueue *Attach(ReactorCall *call);
+	// To be called by call before destroying itself
+	static void Detach(ReactorCall *call);
+};
+
+};
+
+#endif
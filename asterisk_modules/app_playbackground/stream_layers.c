@@ -20,6 +20,7 @@ extern struct ast_module *AST_MODULE_SELF_SYM(void);
 #include "stream_layers.h"
 
 #include "grpctts.h"
+#include "voicekit_grpc.h"
 
 #include <asterisk/utils.h>
 #include <asterisk/channel.h>
@@ -166,6 +167,22 @@ static void push_playbackground_duration_event(struct ast_channel *chan, int lay
 
 	ast_json_unref(blob);
 }
+static void push_playbackground_usage_event(struct ast_channel *chan, int layer_i, const struct voicekit_usage_report *report)
+{
+	char data[256];
+	double cpu_ms = report->cpu_time*1000.0;
+	snprintf(data, sizeof(data), "%d,%.1f,%.1f,%lld", layer_i, cpu_ms, ((report->duration > 0.0) ? cpu_ms/report->duration : 0.0),
+		 report->peak_queued_bytes);
+	struct ast_json *blob = ast_json_pack("{s: s, s: s}", "eventname", "PlayBackgroundUsage", "eventbody", data);
+	if (!blob)
+		return;
+
+	ast_channel_lock(chan);
+	ast_multi_object_blob_single_channel_publish(chan, ast_multi_user_event_type(), blob);
+	ast_channel_unlock(chan);
+
+	ast_json_unref(blob);
+}
 static void push_playbackground_streaming_started_event(struct ast_channel *chan, int layer_i)
 {
 	char data[64];
@@ -382,6 +399,9 @@ static void stream_source_stop(struct stream_source *source)
 		ast_channel_lock(chan);
 		ast_stopstream(chan);
 		ast_channel_unlock(chan);
+		struct voicekit_usage_report usage_report;
+		grpctts_job_get_usage(source->source.synthesis.job, &usage_report);
+		push_playbackground_usage_event(chan, source->source.synthesis.layer_i, &usage_report);
 		grpctts_job_destroy(source->source.synthesis.job);
 		ast_frame_dtor(source->source.synthesis.buffered_frame);
 	} break;
@@ -410,7 +430,7 @@ static inline void stream_source_start_sleep(struct stream_source *source, const
 	source->type = STREAM_SOURCE_SLEEP;
 	source->source.sleep.sample_count = timeout->tv_sec*ZERO_FRAME_SAMPLE_RATE + timeout->tv_nsec/(1000000000/ZERO_FRAME_SAMPLE_RATE);
 }
-static inline void stream_source_start_synthesis(struct stream_source *source, struct stream_state *state,
+static inline void stream_source_start_synthesis(struct stream_source *source, struct stream_state *state, int layer_i,
 						 const struct grpctts_job_conf *conf, const struct grpctts_job_input *job_input)
 {
 	if (!state->tts_channel) {
@@ -422,6 +442,7 @@ static inline void stream_source_start_synthesis(struct stream_source *source, s
 	source->type = STREAM_SOURCE_SYNTHESIS;
 	source->source.synthesis.chan = state->chan;
 	source->source.synthesis.job = grpctts_channel_start_job(state->tts_channel, conf, job_input);
+	source->source.synthesis.layer_i = layer_i;
 	source->source.synthesis.buffered_frame = NULL;
 	source->source.synthesis.starvation_policy = conf->starvation_policy;
 	source->source.synthesis.initial_buffer_size = conf->initial_buffer_size;
@@ -448,7 +469,7 @@ static inline int stream_source_synthesis_get_initial_data(struct stream_source
 	grpctts_job_collect(source->source.synthesis.job);
 	uint8_t x_request_id_len;
 	if (grpctts_job_buffer_size(source->source.synthesis.job) < (sizeof(int64_t) + sizeof(uint8_t)))
-		return 0;
+		return grpctts_job_termination_called(source->source.synthesis.job) ? -1 : 0; /* Job failed before stream was set up */
 	if (!grpctts_job_take_block(source->source.synthesis.job, sizeof(int64_t), duration)) {
 		ast_log(LOG_ERROR, "PlayBackground() failed: memory allocation error\n");
 		return -1;
@@ -802,7 +823,7 @@ static inline int stream_layer_check_jobs(struct stream_layer *layer, struct str
 				grpctts_job_conf_clear(&job_conf);
 				return -1;
 			}
-			stream_source_start_synthesis(&layer->source, state, &job_conf, &job_input);
+			stream_source_start_synthesis(&layer->source, state, layer_i, &job_conf, &job_input);
 			parse_say_input_state_free(&parse_state);
 			grpctts_job_conf_clear(&job_conf);
 		} else if (!strcmp(command, "event")) {
@@ -1197,3 +1218,73 @@ int stream_layers(struct stream_state *state, struct stream_layer *layers, int l
 	}
 	return 0;
 }
+
+
+/* Synthesis layers are fed from long static buffer rewound before its end, so that neither job nor channel is touched */
+#define BENCH_SOURCE_SAMPLES (SAMPLE_RATE*10)
+static int16_t bench_source_samples[BENCH_SOURCE_SAMPLES];
+
+struct stream_layers_bench_arg {
+	struct ast_frame *target_frame;
+	struct stream_layer *layers;
+	int layer_count;
+	struct stream_state *state;
+};
+
+static void stream_layers_bench_merge(void *arg)
+{
+	struct stream_layers_bench_arg *bench = arg;
+	memset(bench->target_frame->data.ptr, 0, bench->target_frame->datalen);
+	int i;
+	for (i = 0; i < bench->layer_count; ++i) {
+		struct stream_source_synthesis *synthesis = &bench->layers[i].source.source.synthesis;
+		if (synthesis->buffered_frame_off + bench->target_frame->samples >= synthesis->buffered_frame->samples)
+			synthesis->buffered_frame_off = 0;
+		stream_layer_merge_frame(bench->target_frame, &bench->layers[i], bench->state, i);
+	}
+}
+
+void stream_layers_bench(int fd, int min_time_ms)
+{
+	int i;
+	for (i = 0; i < BENCH_SOURCE_SAMPLES; ++i)
+		bench_source_samples[i] = (int16_t) (8000*sin(2.0*M_PI*440*i/SAMPLE_RATE));
+	struct ast_frame source_frame = zero_frame;
+	source_frame.datalen = sizeof(bench_source_samples);
+	source_frame.samples = BENCH_SOURCE_SAMPLES;
+	source_frame.data.ptr = bench_source_samples;
+	int16_t target_samples[ZERO_FRAME_SAMPLES];
+	struct ast_frame target_frame = zero_frame;
+	target_frame.data.ptr = target_samples;
+
+	struct stream_state state;
+	stream_state_init(&state, NULL, -1);
+	struct stream_layer layers[STREAM_LAYERS_BENCH_MAX_LAYERS];
+	for (i = 0; i < STREAM_LAYERS_BENCH_MAX_LAYERS; ++i) {
+		stream_layer_init(&layers[i]);
+		struct stream_source_synthesis *synthesis = &layers[i].source.source.synthesis;
+		layers[i].source.type = STREAM_SOURCE_SYNTHESIS;
+		memset(synthesis, 0, sizeof(*synthesis));
+		synthesis->starvation_policy = GRPCTTS_STARVATION_POLICY_WAIT;
+		synthesis->initial_buffer_reached = 1;
+		synthesis->duration_announced = 1;
+		synthesis->buffered_frame = &source_frame;
+		synthesis->buffered_frame_off = (i*ZERO_FRAME_SAMPLES/STREAM_LAYERS_BENCH_MAX_LAYERS); /* Unaligned layers */
+	}
+
+	struct stream_layers_bench_arg arg = {
+		.target_frame = &target_frame,
+		.layers = layers,
+		.state = &state,
+	};
+	for (arg.layer_count = 1; arg.layer_count <= STREAM_LAYERS_BENCH_MAX_LAYERS; ++arg.layer_count) {
+		char name[64];
+		snprintf(name, sizeof(name), "tts/stream_layer_merge_frame/%d", arg.layer_count);
+		voicekit_bench_run(fd, name, min_time_ms, stream_layers_bench_merge, &arg);
+	}
+
+	/* Sources are static: detached rather than stopped */
+	for (i = 0; i < STREAM_LAYERS_BENCH_MAX_LAYERS; ++i)
+		layers[i].source.type = STREAM_SOURCE_NONE;
+	stream_state_uninit(&state);
+}
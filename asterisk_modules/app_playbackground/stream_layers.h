@@ -48,6 +48,7 @@ struct stream_source_sleep {
 struct stream_source_synthesis {
 	struct ast_channel *chan;
 	struct grpctts_job *job;
+	int layer_i;
 	struct ast_frame *buffered_frame;
 	int buffered_frame_off;
 	enum grpctts_starvation_policy starvation_policy;
@@ -125,4 +126,10 @@ extern int stream_layers(
 	struct stream_layer *layers,
 	int layer_count);
 
+/* "voicekit bench tts": mixing of 1 to STREAM_LAYERS_BENCH_MAX_LAYERS synthesis layers into frame */
+#define STREAM_LAYERS_BENCH_MAX_LAYERS 4
+extern void stream_layers_bench(
+	int fd,
+	int min_time_ms);
+
 #endif
@@ -0,0 +1,180 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Synthetic-channel load generator for TTS: "voicekit load tts" CLI command
+ * (see tts_mock_server.cpp).
+ *
+ * Runs inside module so that load goes through the same code paths as
+ * PlayBackground() does: each simulated channel creates its own grpctts_channel
+ * and runs back-to-back jobs through grpctts_channel_start_job() until
+ * TOTAL_SEC elapse, so streams are driven by reactor threads, backends are
+ * shared by channel pool and repeated texts are served by audio cache (unless
+ * every job is given unique text). Job output is read like stream_layers.c
+ * reads it: initial data (duration and x-request-id) first, then audio, which
+ * is counted rather than played.
+ *
+ * Reported latencies: "setup" (job start to initial data), "first_chunk" (job
+ * start to first audio) and "synthesis" (job start to successful end). CPU,
+ * RSS and thread count are of whole Asterisk process: run on idle instance.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "grpctts.h"
+#include "grpctts_conf.h"
+#include "voicekit_loadtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <stdio.h>
+
+extern "C" {
+#include <asterisk.h>
+#include <asterisk/cli.h>
+#include <asterisk/utils.h>
+}
+
+
+#define CHANNEL_FRAME_SAMPLE_RATE 8000
+#define JOB_POLL_MSEC 100
+#define SAMPLE_PROCESS_MSEC 200
+#define TAKE_BLOCK_BYTES 4096
+
+
+static inline double msec_since(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void run_job(struct grpctts_channel *channel, const struct grpctts_job_conf *job_conf, const std::string &text, VoiceKitLoadReport &report)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	struct grpctts_job_input job_input;
+	job_input.text = text.c_str();
+	job_input.ssml = NULL;
+	struct grpctts_job *job = grpctts_channel_start_job(channel, job_conf, &job_input);
+	if (!job) {
+		report.AddError("failed to start job");
+		report.AddSession(false, 0.0);
+		return;
+	}
+
+	int64_t announced_samples = -1;
+	int x_request_id_len = -1; // taken with duration; -1 until initial data arrives
+	bool initial_data = false;
+	bool first_chunk = true;
+	int64_t samples = 0;
+	char block[TAKE_BLOCK_BYTES];
+	while (true) {
+		struct pollfd pfd = {
+			.fd = grpctts_job_event_fd(job),
+			.events = POLLIN,
+			.revents = 0,
+		};
+		poll(&pfd, 1, JOB_POLL_MSEC);
+		grpctts_job_collect(job);
+		if (x_request_id_len < 0 && grpctts_job_buffer_size(job) >= sizeof(int64_t) + sizeof(uint8_t)) {
+			uint8_t len;
+			grpctts_job_take_block(job, sizeof(int64_t), &announced_samples);
+			grpctts_job_take_block(job, sizeof(uint8_t), &len);
+			x_request_id_len = len;
+		}
+		if (!initial_data && x_request_id_len >= 0 && grpctts_job_buffer_size(job) >= (size_t) x_request_id_len) {
+			grpctts_job_take_block(job, x_request_id_len, block);
+			initial_data = true;
+			report.AddLatency("setup", msec_since(start));
+		}
+		if (initial_data) {
+			size_t byte_count;
+			while ((byte_count = grpctts_job_take_tail(job, sizeof(block), block))) {
+				if (first_chunk) {
+					first_chunk = false;
+					report.AddLatency("first_chunk", msec_since(start));
+				}
+				samples += byte_count/sizeof(int16_t);
+			}
+		}
+		if (grpctts_job_termination_called(job))
+			break;
+	}
+	bool success = grpctts_job_completion_success(job);
+	grpctts_job_destroy(job);
+
+	if (!success)
+		report.AddError(initial_data ? "stream failed" : "setup failed");
+	else if (announced_samples >= 0 && samples < announced_samples)
+		report.AddError("less audio than announced by x-audio-num-samples");
+	else
+		report.AddLatency("synthesis", msec_since(start));
+	report.AddSession(success, (double) samples/CHANNEL_FRAME_SAMPLE_RATE);
+}
+
+
+extern "C" void grpctts_load(int fd, const char *endpoint, int ssl_grpc, int channels, double total_sec, int unique_text, const char *text,
+			     const struct grpctts_job_conf *job_conf, const struct grpctts_failfast_conf *failfast_conf)
+{
+	VoiceKitLoadReport report;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point end = start + std::chrono::microseconds((int64_t) (total_sec*1e6));
+	std::atomic<uint64_t> job_counter(0);
+
+	std::vector<std::thread> channel_threads;
+	for (int i = 0; i < channels; ++i) {
+		channel_threads.push_back(std::thread(
+			[&, i]()
+			{
+				std::string channel_name = "load/tts-" + std::to_string(i);
+				struct grpctts_channel *channel = grpctts_channel_create(endpoint, ssl_grpc, NULL, NULL, NULL, NULL, NULL, NULL,
+											 channel_name.c_str(), failfast_conf);
+				if (!channel) {
+					report.AddError("failed to create channel");
+					return;
+				}
+				while (std::chrono::steady_clock::now() < end)
+					run_job(channel, job_conf, unique_text ? std::string(text) + " " + std::to_string(++job_counter) : std::string(text), report);
+				grpctts_channel_destroy(channel);
+			}));
+	}
+	std::atomic<bool> done(false);
+	std::thread sampler(
+		[&report, &done]()
+		{
+			while (!done) {
+				report.SampleProcess();
+				std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_PROCESS_MSEC));
+			}
+		});
+	for (std::thread &thread: channel_threads)
+		thread.join();
+	done = true;
+	sampler.join();
+
+	char *output = NULL;
+	size_t output_size = 0;
+	FILE *out = open_memstream(&output, &output_size);
+	if (!out)
+		return;
+	report.Print(out, channels, msec_since(start)/1000.0);
+	fclose(out);
+	ast_cli(fd, "%s", output);
+	ast_std_free(output);
+}
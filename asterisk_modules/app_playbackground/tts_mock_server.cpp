@@ -0,0 +1,201 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Mock TextToSpeech gRPC service for local load tests (see "voicekit load tts" in tts_load.cpp).
+ *
+ * Synthesized audio is a tone of duration deterministic for input length
+ * (MOCK_MSEC_PER_CHARACTER per character of text or SSML, at least
+ * MOCK_MIN_DURATION_MSEC), sent as LINEAR16 chunks of CHUNK_MS or as RAW_OPUS
+ * with one 20 ms frame per message. Audio duration is announced with
+ * x-audio-num-samples like real service does. Chunks are sent REALTIME_FACTOR
+ * times faster than real time (0: as fast as possible). Setup latency, jitter
+ * and errors are injected with seeded generator: setup errors are returned
+ * before response headers, stream errors at middle of audio.
+ *
+ * Usage: tts_mock_server [-l LISTEN_ADDRESS] [-c CHUNK_MS] [-x REALTIME_FACTOR]
+ *                        [-s SETUP_MS] [-j JITTER_MS] [-e SETUP_ERROR_RATE] [-E STREAM_ERROR_RATE] [-S SEED]
+ */
+
+#include "tts.grpc.pb.h"
+#include "voicekit_loadtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <opus.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/security/server_credentials.h>
+
+
+#define DEFAULT_LISTEN_ADDRESS "0.0.0.0:8091"
+#define DEFAULT_CHUNK_MSEC 100
+#define DEFAULT_REALTIME_FACTOR 1.0
+#define MOCK_MSEC_PER_CHARACTER 60
+#define MOCK_MIN_DURATION_MSEC 500
+#define OPUS_FRAME_MSEC 20
+#define OPUS_MAX_PACKET_SIZE 1500
+#define TONE_HZ 440
+#define TONE_AMPLITUDE 8000
+
+
+static std::vector<int16_t> make_tone(int sample_rate, int64_t samples)
+{
+	std::vector<int16_t> tone(samples);
+	for (int64_t n = 0; n < samples; ++n)
+		tone[n] = (int16_t) (TONE_AMPLITUDE*sin(2.0*M_PI*TONE_HZ*n/sample_rate));
+	return tone;
+}
+
+
+class MockTextToSpeech final : public voiptime::cloud::tts::v1::TextToSpeech::Service
+{
+public:
+	MockTextToSpeech(VoiceKitMockFaults &faults, int chunk_ms, double realtime_factor)
+		: faults(faults), chunk_ms(chunk_ms), realtime_factor(realtime_factor), request_counter(0) {}
+
+	grpc::Status StreamingSynthesize(grpc::ServerContext *context, const voiptime::cloud::tts::v1::SynthesizeSpeechRequest *request,
+					 grpc::ServerWriter<voiptime::cloud::tts::v1::StreamingSynthesizeSpeechResponse> *writer) override
+	{
+		faults.DelaySetup();
+		if (faults.FailSetup())
+			return grpc::Status(grpc::StatusCode::UNAVAILABLE, "mock: injected setup error");
+
+		const voiptime::cloud::tts::v1::AudioConfig &audio_config = request->audio_config();
+		bool opus = audio_config.audio_encoding() == voiptime::cloud::tts::v1::RAW_OPUS;
+		if (!opus && audio_config.audio_encoding() != voiptime::cloud::tts::v1::LINEAR16)
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: unsupported encoding");
+		int sample_rate = audio_config.sample_rate_hertz();
+		if (sample_rate <= 0)
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: sample rate expected");
+		size_t characters = request->input().text().size() + request->input().ssml().size();
+		if (!characters)
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "mock: empty input");
+		bool fail_stream = faults.FailStream();
+
+		int64_t duration_ms = std::max((int64_t) MOCK_MIN_DURATION_MSEC, (int64_t) characters*MOCK_MSEC_PER_CHARACTER);
+		int64_t total_samples = duration_ms*sample_rate/1000;
+		context->AddInitialMetadata("x-request-id", "mock-" + std::to_string(++request_counter));
+		context->AddInitialMetadata("x-audio-num-samples", std::to_string(total_samples));
+		writer->SendInitialMetadata();
+
+		OpusEncoder *encoder = NULL;
+		int64_t samples_per_chunk = (int64_t) chunk_ms*sample_rate/1000;
+		if (opus) {
+			int error;
+			encoder = opus_encoder_create(sample_rate, 1, OPUS_APPLICATION_VOIP, &error);
+			if (error != OPUS_OK || !encoder)
+				return grpc::Status(grpc::StatusCode::INTERNAL, "mock: failed to initialize Opus encoder");
+			samples_per_chunk = OPUS_FRAME_MSEC*sample_rate/1000;
+		}
+		std::vector<int16_t> tone = make_tone(sample_rate, total_samples + samples_per_chunk);
+
+		grpc::Status status = grpc::Status::OK;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int64_t offset = 0; offset < total_samples; offset += samples_per_chunk) {
+			if (fail_stream && offset >= total_samples/2) {
+				status = grpc::Status(grpc::StatusCode::UNAVAILABLE, "mock: injected stream error");
+				break;
+			}
+			if (context->IsCancelled())
+				break;
+			if (realtime_factor > 0.0)
+				std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t) (offset*1000000/sample_rate/realtime_factor)));
+			voiptime::cloud::tts::v1::StreamingSynthesizeSpeechResponse response;
+			if (opus) {
+				// Opus frames are always whole: tail is padded by tone
+				unsigned char packet[OPUS_MAX_PACKET_SIZE];
+				int size = opus_encode(encoder, tone.data() + offset, samples_per_chunk, packet, sizeof(packet));
+				if (size < 0) {
+					status = grpc::Status(grpc::StatusCode::INTERNAL, std::string("mock: failed to encode Opus: ") + opus_strerror(size));
+					break;
+				}
+				response.set_audio_chunk(packet, size);
+			} else {
+				int64_t samples = std::min(samples_per_chunk, total_samples - offset);
+				response.set_audio_chunk((const char *) (tone.data() + offset), samples*sizeof(int16_t));
+			}
+			if (!writer->Write(response))
+				break;
+		}
+		if (encoder)
+			opus_encoder_destroy(encoder);
+		return status;
+	}
+
+private:
+	VoiceKitMockFaults &faults;
+	int chunk_ms;
+	double realtime_factor;
+	std::atomic<uint64_t> request_counter;
+};
+
+
+static int usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-l LISTEN_ADDRESS] [-c CHUNK_MS] [-x REALTIME_FACTOR] %s\n", program, VoiceKitMockFaults::Usage());
+	return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	std::string listen_address = DEFAULT_LISTEN_ADDRESS;
+	int chunk_ms = DEFAULT_CHUNK_MSEC;
+	double realtime_factor = DEFAULT_REALTIME_FACTOR;
+	VoiceKitMockFaults faults;
+	std::string options = std::string("l:c:x:") + VoiceKitMockFaults::Options();
+	int opt;
+	while ((opt = getopt(argc, argv, options.c_str())) != -1) {
+		switch (opt) {
+		case 'l':
+			listen_address = optarg;
+			break;
+		case 'c':
+			chunk_ms = atoi(optarg);
+			break;
+		case 'x':
+			realtime_factor = atof(optarg);
+			break;
+		default:
+			if (opt == '?' || !faults.ParseOption(opt, optarg))
+				return usage(argv[0]);
+		}
+	}
+	if (optind != argc || chunk_ms <= 0 || realtime_factor < 0.0)
+		return usage(argv[0]);
+
+	MockTextToSpeech service(faults, chunk_ms, realtime_factor);
+	grpc::ServerBuilder builder;
+	builder.AddListeningPort(listen_address, grpc::InsecureServerCredentials());
+	builder.RegisterService(&service);
+	std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+	if (!server) {
+		fprintf(stderr, "Failed to listen at %s\n", listen_address.c_str());
+		return 1;
+	}
+	fprintf(stderr, "Mock TTS service listening at %s\n", listen_address.c_str());
+	server->Wait();
+	return 0;
+}
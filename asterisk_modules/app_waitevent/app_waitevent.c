@@ -104,6 +104,18 @@ static const char *waitevent_app = "WaitEvent";
 				<variable name="WAITEVENTBODY">
 					<para>Contains event body if event is recieved or empty string otherwise.</para>
 				</variable>
+				<variable name="GRPCSTT_TRANSCRIPT">
+					<para>Contains transcript of the first alternative if &quot;SpeechRecognition&quot; event is recieved or empty string otherwise.</para>
+				</variable>
+				<variable name="GRPCSTT_TRANSCRIPT_JSON">
+					<para>Contains the same transcript as quoted and escaped JSON string (e. g. &quot;\&quot;say \\\&quot;hi\\\&quot;\&quot;&quot;) to be embedded into JSON documents such as PlayBackground() commands, or empty string.</para>
+				</variable>
+				<variable name="GRPCSTT_IS_FINAL">
+					<para>Contains &quot;1&quot; for final and &quot;0&quot; for interim recognition result if &quot;SpeechRecognition&quot; event is recieved or empty string otherwise.</para>
+				</variable>
+				<variable name="GRPCSTT_CONFIDENCE">
+					<para>Contains confidence of the first alternative if &quot;SpeechRecognition&quot; event is recieved or empty string otherwise.</para>
+				</variable>
 			</variablelist>
 			<para><emphasis>Event generation using AMI is described at examples.</emphasis></para>
 			<example title="Wait 2400ms for next event">
@@ -114,8 +126,36 @@ static const char *waitevent_app = "WaitEvent";
 			<ref type="application">WaitEventInit</ref>
 			<ref type="application">GRPCSTTBackground</ref>
 			<ref type="application">PlayBackground</ref>
+			<ref type="function">GRPCSTT_FIELD</ref>
 		</see-also>
 	</application>
+	<function name="GRPCSTT_FIELD" language="en_US">
+		<synopsis>
+			Extracts field from JSON event body.
+		</synopsis>
+		<syntax>
+			<parameter name="body" required="false">
+				<para>JSON event body (usually ${WAITEVENTBODY}). If empty, body of last event recieved by WaitEvent() is used.</para>
+			</parameter>
+			<parameter name="path" required="true">
+				<para>Field path: object keys separated by dots and array indices in square brackets.</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>Returns string fields as is, numbers in decimal notation, booleans as &quot;1&quot; or &quot;0&quot;, objects and arrays as JSON and empty string for null or missing fields.</para>
+			<para>Parsed body is cached per channel, so subsequent calls for the same body do not parse it again.</para>
+			<example title="Get transcript of the first alternative">
+			 Set(TEXT=${GRPCSTT_FIELD(${WAITEVENTBODY},alternatives[0].transcript)});
+			</example>
+			<example title="Get end time of last recieved result">
+			 Set(END_SEC=${GRPCSTT_FIELD(,end_time.seconds)});
+			</example>
+		</description>
+		<see-also>
+			<ref type="application">WaitEvent</ref>
+			<ref type="application">GRPCSTTBackground</ref>
+		</see-also>
+	</function>
  ***/
 
 
@@ -133,6 +173,8 @@ struct ht_user_message_queue {
 	ast_mutex_t mutex;
 	AST_DLLIST_HEAD(entries, user_message) entries;
 	struct stasis_subscription *stasis_subscription;
+	char *parsed_body; /* Last event body parsed by GRPCSTT_FIELD() or WaitEvent() */
+	struct ast_json *parsed_json;
 };
 
 
@@ -161,6 +203,9 @@ static void destroy_ht_user_message_queue(void *void_s)
 		ast_free (entry);
 	}
 	AST_DLLIST_HEAD_DESTROY(&s->entries);
+	if (s->parsed_json)
+		ast_json_unref(s->parsed_json);
+	ast_free(s->parsed_body);
 	ast_free(s);
 }
 static const struct ast_datastore_info waitevent_ds_info = {
@@ -188,6 +233,25 @@ static struct user_message *ht_user_message_queue_take_first (struct ht_user_mes
 
 	return NULL;
 }
+/* Returns new reference to parsed body (or NULL on parse error) reusing cached parse for unchanged body */
+static struct ast_json *ht_user_message_queue_parse_body(struct ht_user_message_queue *s, const char *body)
+{
+	if (!s)
+		return ast_json_load_string(body, NULL);
+
+	ast_mutex_lock(&s->mutex);
+	if (!s->parsed_body || strcmp(s->parsed_body, body)) {
+		if (s->parsed_json)
+			ast_json_unref(s->parsed_json);
+		ast_free(s->parsed_body);
+		s->parsed_json = ast_json_load_string(body, NULL);
+		s->parsed_body = ast_strdup(body);
+	}
+	struct ast_json *json = s->parsed_json ? ast_json_ref(s->parsed_json) : NULL;
+	ast_mutex_unlock(&s->mutex);
+
+	return json;
+}
 
 
 /* WaitEventInit methods */
@@ -344,8 +408,194 @@ static int waiteventinit_exec(struct ast_channel *chan, const char *data)
 }
 
 
+/* Returns length of str[0..len) without trailing incomplete UTF-8 sequence */
+static size_t utf8_complete_length(const char *str, size_t len)
+{
+	size_t continuation_count = 0;
+	while (continuation_count < len && continuation_count < 3 && (((unsigned char) str[len - continuation_count - 1]) & 0xc0) == 0x80)
+		++continuation_count;
+	if (continuation_count == len)
+		return len;
+	unsigned char lead = str[len - continuation_count - 1];
+	size_t expected = lead >= 0xf0 ? 3 : (lead >= 0xe0 ? 2 : (lead >= 0xc0 ? 1 : 0));
+	if (lead < 0x80)
+		return len - continuation_count;
+	return continuation_count == expected ? len : len - continuation_count - 1;
+}
+
+
+/* GRPCSTT_FIELD methods */
+static struct ast_json *json_get_path(struct ast_json *json, const char *path)
+{
+	char key[256];
+	while (json && *path) {
+		if (*path == '.') {
+			++path;
+		} else if (*path == '[') {
+			char *eptr;
+			long index = strtol(path + 1, &eptr, 10);
+			if (eptr == path + 1 || *eptr != ']' || index < 0 || ast_json_typeof(json) != AST_JSON_ARRAY)
+				return NULL;
+			json = ast_json_array_get(json, index);
+			path = eptr + 1;
+		} else {
+			size_t len = strcspn(path, ".[");
+			if (len >= sizeof(key) || ast_json_typeof(json) != AST_JSON_OBJECT)
+				return NULL;
+			memcpy(key, path, len);
+			key[len] = '\0';
+			json = ast_json_object_get(json, key);
+			path += len;
+		}
+	}
+	return json;
+}
+static void json_value_to_string(struct ast_json *value, char *buf, size_t len)
+{
+	*buf = '\0';
+	if (!value)
+		return;
+	switch (ast_json_typeof(value)) {
+	case AST_JSON_STRING:
+		ast_copy_string(buf, ast_json_string_get(value), len);
+		buf[utf8_complete_length(buf, strlen(buf))] = '\0';
+		break;
+	case AST_JSON_INTEGER:
+		snprintf(buf, len, "%jd", ast_json_integer_get(value));
+		break;
+	case AST_JSON_REAL: {
+		/* Shortest representation reading back as the same value (as jansson encodes reals) */
+		double real = ast_json_real_get(value);
+		for (int precision = 15; precision <= 17; ++precision) {
+			snprintf(buf, len, "%.*g", precision, real);
+			if (strtod(buf, NULL) == real)
+				break;
+		}
+	} break;
+	case AST_JSON_TRUE:
+		ast_copy_string(buf, "1", len);
+		break;
+	case AST_JSON_FALSE:
+		ast_copy_string(buf, "0", len);
+		break;
+	case AST_JSON_NULL:
+		break;
+	default: {
+		char *dump = ast_json_dump_string(value);
+		if (dump) {
+			ast_copy_string(buf, dump, len);
+			ast_json_free(dump);
+		}
+	}
+	}
+}
+static int grpcstt_field_read(struct ast_channel *chan, const char *cmd, char *data, char *buf, size_t len)
+{
+	*buf = '\0';
+	char *path = strrchr(data, ',');
+	if (!path) {
+		ast_log(AST_LOG_WARNING, "%s: Syntax is %s(<body>,<path>)\n", cmd, cmd);
+		return -1;
+	}
+	*path++ = '\0';
+
+	const char *body = data;
+	struct ht_user_message_queue *queue = NULL;
+	if (chan) {
+		queue = get_channel_queue(chan);
+		if (!*body) {
+			ast_channel_lock(chan);
+			body = ast_strdupa(S_OR(pbx_builtin_getvar_helper(chan, "WAITEVENTBODY"), ""));
+			ast_channel_unlock(chan);
+		}
+	}
+	if (!*body)
+		return 0;
+
+	struct ast_json *json = ht_user_message_queue_parse_body(queue, body);
+	if (!json) {
+		ast_log(AST_LOG_WARNING, "%s: Failed to parse event body as JSON\n", cmd);
+		return -1;
+	}
+	json_value_to_string(json_get_path(json, path), buf, len);
+	ast_json_unref(json);
+
+	return 0;
+}
+static struct ast_custom_function grpcstt_field_function = {
+	.name = "GRPCSTT_FIELD",
+	.read = grpcstt_field_read,
+};
+
+
 /* WaitEvent methods */
-static void store_event(struct ast_channel *chan, struct ast_json *root)
+/* Writes str as quoted JSON string; output is truncated at code point boundary and stays valid JSON */
+static void json_quote_string(const char *str, char *buf, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t off = 0;
+	if (len < 3) {
+		*buf = '\0';
+		return;
+	}
+	buf[off++] = '"';
+	for (; *str; ++str) {
+		unsigned char c = *str;
+		char escaped[7];
+		size_t escaped_len = 0;
+		if (c == '"' || c == '\\') {
+			escaped[escaped_len++] = '\\';
+			escaped[escaped_len++] = c;
+		} else if (c == '\n') {
+			escaped[escaped_len++] = '\\';
+			escaped[escaped_len++] = 'n';
+		} else if (c == '\r') {
+			escaped[escaped_len++] = '\\';
+			escaped[escaped_len++] = 'r';
+		} else if (c == '\t') {
+			escaped[escaped_len++] = '\\';
+			escaped[escaped_len++] = 't';
+		} else if (c < 0x20) {
+			memcpy(escaped, "\\u00", 4);
+			escaped_len = 4;
+			escaped[escaped_len++] = hex[c >> 4];
+			escaped[escaped_len++] = hex[c & 0xf];
+		} else {
+			escaped[escaped_len++] = c;
+		}
+		if (off + escaped_len + 2 > len) {
+			off = 1 + utf8_complete_length(buf + 1, off - 1);
+			break;
+		}
+		memcpy(buf + off, escaped, escaped_len);
+		off += escaped_len;
+	}
+	buf[off++] = '"';
+	buf[off] = '\0';
+}
+static void set_speech_recognition_variables(struct ast_channel *chan, struct ht_user_message_queue *queue, const char *name, const char *body)
+{
+	char transcript[4096] = "";
+	char is_final[8] = "";
+	char confidence[32] = "";
+	if (!strcmp(name, "SpeechRecognition")) {
+		struct ast_json *json = ht_user_message_queue_parse_body(queue, body);
+		if (json) {
+			json_value_to_string(json_get_path(json, "alternatives[0].transcript"), transcript, sizeof(transcript));
+			json_value_to_string(json_get_path(json, "is_final"), is_final, sizeof(is_final));
+			json_value_to_string(json_get_path(json, "alternatives[0].confidence"), confidence, sizeof(confidence));
+			ast_json_unref(json);
+		}
+	}
+	char transcript_json[sizeof(transcript)*2 + 2] = "";
+	if (*transcript)
+		json_quote_string(transcript, transcript_json, sizeof(transcript_json));
+	pbx_builtin_setvar_helper(chan, "GRPCSTT_TRANSCRIPT", transcript);
+	pbx_builtin_setvar_helper(chan, "GRPCSTT_TRANSCRIPT_JSON", transcript_json);
+	pbx_builtin_setvar_helper(chan, "GRPCSTT_IS_FINAL", is_final);
+	pbx_builtin_setvar_helper(chan, "GRPCSTT_CONFIDENCE", confidence);
+}
+static void store_event(struct ast_channel *chan, struct ht_user_message_queue *queue, struct ast_json *root)
 {
 	if (!root)
 		goto fail;
@@ -359,7 +609,9 @@ static void store_event(struct ast_channel *chan, struct ast_json *root)
 		goto fail;
 
 	struct ast_json *eventbody = ast_json_object_get(userevent, "eventbody");
-	set_success_status(chan, name, (eventbody ? ast_json_string_get(eventbody) : ""));
+	const char *body = eventbody ? S_OR(ast_json_string_get(eventbody), "") : "";
+	set_success_status(chan, name, body);
+	set_speech_recognition_variables(chan, queue, name, body);
 	return;
 
 fail:
@@ -530,7 +782,7 @@ static int waitevent_exec(struct ast_channel *chan, const char *data)
 
 	if (entry) {
 		struct ast_json *root = entry->json_value;
-		store_event(chan, root);
+		store_event(chan, queue, root);
 		ast_json_unref(root);
 		ast_free (entry);
 		return 0;
@@ -546,6 +798,7 @@ static int unload_module(void)
 {
 	ast_manager_unregister_hook(&user_event_hook);
 	return
+		ast_custom_function_unregister(&grpcstt_field_function) |
 		ast_unregister_application(waiteventinit_app) |
 		ast_unregister_application(waitevent_app);
 }
@@ -554,6 +807,7 @@ static int load_module(void)
 {
 	ast_manager_register_hook(&user_event_hook);
 	return
+		ast_custom_function_register(&grpcstt_field_function) |
 		ast_register_application_xml(waiteventinit_app, waiteventinit_exec) |
 		ast_register_application_xml(waitevent_app, waitevent_exec);
 }
@@ -0,0 +1,143 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "voicekit_grpc.h"
+#include "runtime.h"
+#include "jwt.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <time.h>
+
+extern "C" {
+#include <asterisk.h>
+#include <asterisk/cli.h>
+}
+
+
+#define MAX_ITERATIONS 1000000000LL
+#define MAX_ITERATIONS_GROWTH 100
+
+
+/* Counters of calling thread: counted only while benchmark is measured */
+static __thread int alloc_counting;
+static __thread long long alloc_count;
+static __thread long long alloc_bytes;
+
+#ifdef VOICEKIT_BENCH_ALLOC_COUNT
+static inline void count_alloc(size_t size)
+{
+	if (alloc_counting) {
+		++alloc_count;
+		alloc_bytes += size;
+	}
+}
+
+/* Wrappers reached from modules linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=_Znwm,--wrap=_Znam */
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real__Znwm(size_t size);
+void *__real__Znam(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	count_alloc(size);
+	return __real_malloc(size);
+}
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	count_alloc(nmemb*size);
+	return __real_calloc(nmemb, size);
+}
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	count_alloc(size);
+	return __real_realloc(ptr, size);
+}
+void *__wrap__Znwm(size_t size)
+{
+	count_alloc(size);
+	return __real__Znwm(size);
+}
+void *__wrap__Znam(size_t size)
+{
+	count_alloc(size);
+	return __real__Znam(size);
+}
+}
+#endif
+
+
+static inline long long monotonic_nsec()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((long long) t.tv_sec)*1000000000 + t.tv_nsec;
+}
+
+extern "C" void voicekit_bench_run(int fd, const char *name, int min_time_ms, voicekit_bench_op_t op, void *arg)
+{
+	long long min_time_ns = ((long long) std::max(min_time_ms, 1))*1000000;
+	op(arg); /* Warm up caches and lazily initialized state */
+
+	long long iterations = 1;
+	long long elapsed_ns;
+	while (true) {
+		alloc_count = 0;
+		alloc_bytes = 0;
+		alloc_counting = 1;
+		long long start_ns = monotonic_nsec();
+		for (long long i = 0; i < iterations; ++i)
+			op(arg);
+		elapsed_ns = monotonic_nsec() - start_ns;
+		alloc_counting = 0;
+		if (elapsed_ns >= min_time_ns || iterations >= MAX_ITERATIONS)
+			break;
+		/* Next round aims at 1.2 of minimal time */
+		double target = (elapsed_ns > 0) ? 1.2*iterations*min_time_ns/elapsed_ns : (double) iterations*MAX_ITERATIONS_GROWTH;
+		iterations = (long long) std::min(std::max(target, 2.0*iterations), (double) iterations*MAX_ITERATIONS_GROWTH);
+		iterations = std::min(iterations, MAX_ITERATIONS);
+	}
+#ifdef VOICEKIT_BENCH_ALLOC_COUNT
+	ast_cli(fd, "{\"benchmark\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"alloc_bytes_per_op\": %.1f}\n",
+		name, iterations, ((double) elapsed_ns)/iterations, ((double) alloc_count)/iterations, ((double) alloc_bytes)/iterations);
+#else
+	ast_cli(fd, "{\"benchmark\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.1f, \"allocs_per_op\": null, \"alloc_bytes_per_op\": null}\n",
+		name, iterations, ((double) elapsed_ns)/iterations);
+#endif
+}
+
+
+extern "C" void voicekit_bench_jwt(int fd, int min_time_ms)
+{
+	const std::string api_key = "bench_api_key";
+	const std::string secret_key = "YmVuY2hfc2VjcmV0X2tleV9vZl8zMl9ieXRlc19sb25n"; /* base64 */
+	const std::string issuer = "bench_issuer";
+	const std::string subject = "bench_subject";
+	const std::string audience = "bench_audience";
+	int64_t expires_at = time(NULL) + 3600;
+	std::string jwt;
+	voicekit_bench_run(fd, "jwt/generate", min_time_ms,
+			   [&]()
+			   {
+				   jwt = GenerateJWT(api_key, secret_key, issuer, subject, audience, expires_at);
+			   });
+}
@@ -0,0 +1,157 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "voicekit_grpc.h"
+#include "runtime.h"
+#include "roots.pem.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+
+extern "C" {
+#include <asterisk.h>
+#include <asterisk/paths.h>
+}
+
+
+#define MAX_INMEMORY_FILE_SIZE (256*1024*1024)
+
+// Cached CA file is checked for modification no more often than this
+#define RECHECK_INTERVAL_SEC 1
+
+
+struct CachedCredentials
+{
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	time_t checked_at;
+	std::shared_ptr<grpc::ChannelCredentials> credentials;
+};
+
+static std::mutex cache_mutex;
+static std::map<std::string, CachedCredentials> cache;
+static std::shared_ptr<grpc::ChannelCredentials> builtin_credentials;
+
+
+static time_t monotonic_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec;
+}
+static bool same_file(const CachedCredentials &entry, const struct stat &st)
+{
+	return entry.dev == st.st_dev && entry.ino == st.st_ino && entry.size == st.st_size &&
+		entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+static std::string error_string(const std::string &what, const std::string &fname, const char *reason)
+{
+	return "Failed to " + what + " CA file '" + fname + "': " + reason;
+}
+static std::shared_ptr<grpc::ChannelCredentials> load_credentials(const std::string &fname, struct stat &st)
+{
+	FILE *fh = fopen(fname.c_str(), "r");
+	if (!fh)
+		throw std::runtime_error(error_string("open", fname, strerror(errno)));
+	if (fstat(fileno(fh), &st)) {
+		int saved_errno = errno;
+		fclose(fh);
+		throw std::runtime_error(error_string("stat", fname, strerror(saved_errno)));
+	}
+	if (st.st_size > MAX_INMEMORY_FILE_SIZE) {
+		fclose(fh);
+		throw std::runtime_error(error_string("read", fname, "file too big"));
+	}
+	std::string data(st.st_size, '\0');
+	if (fread(&data[0], 1, data.size(), fh) != data.size()) {
+		const char *reason = feof(fh) ? "unexpected EOF" : strerror(errno);
+		fclose(fh);
+		throw std::runtime_error(error_string("read", fname, reason));
+	}
+	fclose(fh);
+
+	grpc::SslCredentialsOptions ssl_credentials_options;
+	ssl_credentials_options.pem_root_certs = data;
+	return grpc::SslCredentials(ssl_credentials_options);
+}
+
+
+std::shared_ptr<grpc::ChannelCredentials> voicekit_grpc_get_ssl_credentials(const char *ca_file)
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+
+	if (!ca_file || !*ca_file) {
+		if (!builtin_credentials) {
+			grpc::SslCredentialsOptions ssl_credentials_options;
+			ssl_credentials_options.pem_root_certs = std::string((const char *) grpc_roots_pem, sizeof(grpc_roots_pem));
+			builtin_credentials = grpc::SslCredentials(ssl_credentials_options);
+		}
+		return builtin_credentials;
+	}
+
+	std::string fname = std::string(ast_config_AST_CONFIG_DIR) + "/" + ca_file;
+	time_t now = monotonic_seconds();
+	std::map<std::string, CachedCredentials>::iterator it = cache.find(fname);
+	if (it != cache.end()) {
+		if (now - it->second.checked_at < RECHECK_INTERVAL_SEC)
+			return it->second.credentials;
+		struct stat st;
+		if (!stat(fname.c_str(), &st) && same_file(it->second, st)) {
+			it->second.checked_at = now;
+			return it->second.credentials;
+		}
+	}
+
+	struct stat st;
+	std::shared_ptr<grpc::ChannelCredentials> credentials = load_credentials(fname, st);
+	CachedCredentials &entry = cache[fname];
+	entry.dev = st.st_dev;
+	entry.ino = st.st_ino;
+	entry.size = st.st_size;
+	entry.mtime = st.st_mtim;
+	entry.checked_at = now;
+	entry.credentials = credentials;
+	return credentials;
+}
+
+extern "C" int voicekit_grpc_credentials_check(const char *ca_file)
+{
+	try {
+		voicekit_grpc_get_ssl_credentials(ca_file);
+	} catch (const std::exception &ex) {
+		ast_log(AST_LOG_ERROR, "%s\n", ex.what());
+		return -1;
+	}
+	return 0;
+}
+extern "C" void voicekit_grpc_credentials_cache_clear(void)
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	cache.clear();
+	builtin_credentials.reset();
+}
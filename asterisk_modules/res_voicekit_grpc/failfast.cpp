@@ -0,0 +1,394 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "voicekit_grpc.h"
+#include "runtime.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <string.h>
+#include <thread>
+
+extern "C" {
+#include <asterisk.h>
+#include <asterisk/logger.h>
+}
+
+
+const struct voicekit_breaker_conf voicekit_breaker_dflt_conf = {
+	.failure_threshold = 5,
+	.error_rate = 0.5,
+	.min_calls = 20,
+	.window = 30.0,
+	.open_time = 10.0,
+	.half_open_probes = 1,
+};
+
+
+#define BREAKER_WINDOW_BUCKETS 10
+#define BREAKER_SWEEP_INTERVAL 60.0
+
+
+enum BreakerState
+{
+	BREAKER_CLOSED,
+	BREAKER_OPEN,
+	BREAKER_HALF_OPEN,
+};
+
+// Setup outcomes of one window/BREAKER_WINDOW_BUCKETS slice of time
+struct BreakerBucket
+{
+	long long index = -1; // number of slice since breaker creation
+	int calls = 0;
+	int failures = 0;
+};
+
+struct Breaker
+{
+	BreakerState state = BREAKER_CLOSED;
+	int consecutive_failures = 0;
+	std::chrono::steady_clock::time_point created_at;
+	std::chrono::steady_clock::time_point last_used_at;
+	double window = 0.0; // of last configuration which released breaker
+	BreakerBucket buckets[BREAKER_WINDOW_BUCKETS];
+	std::chrono::steady_clock::time_point opened_at;
+	double open_time = 0.0; // of configuration which opened breaker
+	int probes = 0; // probe setups in flight while half-open
+	int in_flight = 0; // setups admitted and not released yet
+	long long rejected = 0;
+};
+
+static std::mutex breakers_mutex;
+static std::map<std::string, Breaker> breakers;
+static std::chrono::steady_clock::time_point breakers_swept_at;
+
+
+static double seconds_between(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(b - a).count();
+}
+static long long bucket_index(const Breaker &breaker, double window, std::chrono::steady_clock::time_point now)
+{
+	double bucket_length = std::max(window, 0.001)/BREAKER_WINDOW_BUCKETS;
+	return (long long) (seconds_between(breaker.created_at, now)/bucket_length);
+}
+// Sums outcomes of buckets covering last window
+static void window_counts(const Breaker &breaker, double window, std::chrono::steady_clock::time_point now, int *calls, int *failures)
+{
+	long long current = bucket_index(breaker, window, now);
+	*calls = 0;
+	*failures = 0;
+	for (const BreakerBucket &bucket: breaker.buckets) {
+		if (bucket.index >= 0 && bucket.index > current - BREAKER_WINDOW_BUCKETS && bucket.index <= current) {
+			*calls += bucket.calls;
+			*failures += bucket.failures;
+		}
+	}
+}
+static void count_outcome(Breaker &breaker, double window, std::chrono::steady_clock::time_point now, bool failure)
+{
+	if (window != breaker.window) {
+		// Bucket length changed with configuration: previous slices are incomparable
+		for (BreakerBucket &bucket: breaker.buckets)
+			bucket = BreakerBucket();
+		breaker.window = window;
+	}
+	long long current = bucket_index(breaker, window, now);
+	BreakerBucket &bucket = breaker.buckets[current%BREAKER_WINDOW_BUCKETS];
+	if (bucket.index != current) {
+		bucket.index = current;
+		bucket.calls = 0;
+		bucket.failures = 0;
+	}
+	++bucket.calls;
+	if (failure)
+		++bucket.failures;
+}
+static void open_breaker(const std::string &endpoint, Breaker &breaker, const struct voicekit_breaker_conf *conf,
+			 std::chrono::steady_clock::time_point now)
+{
+	if (breaker.state != BREAKER_OPEN) {
+		int window_calls, window_failures;
+		window_counts(breaker, conf->window, now, &window_calls, &window_failures);
+		ast_log(AST_LOG_WARNING, "VoiceKit: circuit breaker of '%s' opened after %d consecutive failures (%d of %d setups failed within window)\n",
+			endpoint.c_str(), breaker.consecutive_failures, window_failures, window_calls);
+	}
+	breaker.state = BREAKER_OPEN;
+	breaker.opened_at = now;
+	breaker.open_time = conf->open_time;
+	breaker.probes = 0;
+}
+static void close_breaker(const std::string &endpoint, Breaker &breaker)
+{
+	ast_log(AST_LOG_NOTICE, "VoiceKit: circuit breaker of '%s' closed after successful probe\n", endpoint.c_str());
+	breaker.state = BREAKER_CLOSED;
+	breaker.consecutive_failures = 0;
+	for (BreakerBucket &bucket: breaker.buckets)
+		bucket = BreakerBucket();
+	breaker.probes = 0;
+}
+// Endpoints come from dialplan: closed breakers unused for longer than their window are dropped
+static void sweep_breakers(std::chrono::steady_clock::time_point now)
+{
+	if (seconds_between(breakers_swept_at, now) < BREAKER_SWEEP_INTERVAL)
+		return;
+	breakers_swept_at = now;
+	for (std::map<std::string, Breaker>::iterator it = breakers.begin(); it != breakers.end(); ) {
+		const Breaker &breaker = it->second;
+		if (breaker.state == BREAKER_CLOSED && !breaker.in_flight &&
+		    seconds_between(breaker.last_used_at, now) >= std::max(breaker.window, BREAKER_SWEEP_INTERVAL))
+			it = breakers.erase(it);
+		else
+			++it;
+	}
+}
+
+extern "C" int voicekit_breaker_acquire(const char *endpoint, const struct voicekit_breaker_conf *conf)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(breakers_mutex);
+	sweep_breakers(now);
+	std::map<std::string, Breaker>::iterator it = breakers.find(endpoint);
+	if (it == breakers.end()) {
+		it = breakers.insert(std::make_pair(std::string(endpoint), Breaker())).first;
+		it->second.created_at = now;
+		it->second.window = conf->window;
+	}
+	Breaker &breaker = it->second;
+	breaker.last_used_at = now;
+	if (breaker.state == BREAKER_OPEN) {
+		if (seconds_between(breaker.opened_at, now) < conf->open_time) {
+			++breaker.rejected;
+			return VOICEKIT_BREAKER_REJECTED;
+		}
+		breaker.state = BREAKER_HALF_OPEN;
+		breaker.probes = 0;
+	}
+	if (breaker.state == BREAKER_HALF_OPEN) {
+		if (breaker.probes >= std::max(conf->half_open_probes, 1)) {
+			++breaker.rejected;
+			return VOICEKIT_BREAKER_REJECTED;
+		}
+		++breaker.probes;
+		++breaker.in_flight;
+		return VOICEKIT_BREAKER_PROBE;
+	}
+	++breaker.in_flight;
+	return VOICEKIT_BREAKER_ADMITTED;
+}
+extern "C" void voicekit_breaker_release(const char *endpoint, const struct voicekit_breaker_conf *conf, int ticket,
+					 enum voicekit_breaker_outcome outcome)
+{
+	if (ticket == VOICEKIT_BREAKER_REJECTED)
+		return;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(breakers_mutex);
+	std::map<std::string, Breaker>::iterator it = breakers.find(endpoint);
+	if (it == breakers.end())
+		return;
+	Breaker &breaker = it->second;
+	breaker.last_used_at = now;
+	if (breaker.in_flight > 0)
+		--breaker.in_flight;
+	bool probe = ticket == VOICEKIT_BREAKER_PROBE && breaker.state == BREAKER_HALF_OPEN;
+	if (probe)
+		--breaker.probes;
+	if (outcome == VOICEKIT_BREAKER_CANCELLED)
+		return;
+
+	count_outcome(breaker, conf->window, now, outcome == VOICEKIT_BREAKER_FAILURE);
+	if (outcome == VOICEKIT_BREAKER_FAILURE)
+		++breaker.consecutive_failures;
+	else
+		breaker.consecutive_failures = 0;
+
+	if (probe) {
+		if (outcome == VOICEKIT_BREAKER_SUCCESS)
+			close_breaker(it->first, breaker);
+		else
+			open_breaker(it->first, breaker, conf, now);
+	} else if (breaker.state == BREAKER_CLOSED && outcome == VOICEKIT_BREAKER_FAILURE) {
+		// Setups admitted before breaker opened do not reopen it
+		int window_calls, window_failures;
+		window_counts(breaker, conf->window, now, &window_calls, &window_failures);
+		if ((conf->failure_threshold > 0 && breaker.consecutive_failures >= conf->failure_threshold) ||
+		    (conf->error_rate > 0.0 && window_calls >= conf->min_calls &&
+		     window_failures >= conf->error_rate*window_calls))
+			open_breaker(it->first, breaker, conf, now);
+	}
+}
+extern "C" void voicekit_breaker_foreach(voicekit_breaker_callback_t callback, void *arg)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(breakers_mutex);
+	for (const std::pair<const std::string, Breaker> &entry: breakers) {
+		struct voicekit_breaker_report report;
+		size_t len = std::min(entry.first.size(), sizeof(report.endpoint) - 1);
+		memcpy(report.endpoint, entry.first.data(), len);
+		report.endpoint[len] = '\0';
+		const Breaker &breaker = entry.second;
+		report.state = (breaker.state == BREAKER_OPEN) ? "OPEN" : (breaker.state == BREAKER_HALF_OPEN) ? "HALF_OPEN" : "CLOSED";
+		report.consecutive_failures = breaker.consecutive_failures;
+		window_counts(breaker, breaker.window, now, &report.window_calls, &report.window_failures);
+		report.rejected = breaker.rejected;
+		report.open_remaining = (breaker.state == BREAKER_OPEN) ?
+			std::max(breaker.open_time - seconds_between(breaker.opened_at, now), 0.0) : 0.0;
+		callback(&report, arg);
+	}
+}
+
+
+VoiceKitBreakerCall::VoiceKitBreakerCall(const std::string &endpoint, const struct voicekit_breaker_conf *conf)
+	: endpoint(endpoint), conf(conf ? *conf : voicekit_breaker_dflt_conf), enabled(conf != NULL),
+	  ticket(conf ? voicekit_breaker_acquire(endpoint.c_str(), conf) : VOICEKIT_BREAKER_ADMITTED),
+	  outcome(VOICEKIT_BREAKER_CANCELLED)
+{
+}
+VoiceKitBreakerCall::~VoiceKitBreakerCall()
+{
+	if (enabled)
+		voicekit_breaker_release(endpoint.c_str(), &conf, ticket, outcome);
+}
+void VoiceKitBreakerCall::Release(enum voicekit_breaker_outcome outcome)
+{
+	if (enabled)
+		voicekit_breaker_release(endpoint.c_str(), &conf, ticket, outcome);
+	enabled = false;
+}
+
+
+// Single thread running actions of all deadlines in expiration order
+class VoiceKitDeadlineTimer
+{
+public:
+	void Arm(VoiceKitDeadline *deadline, int timeout_ms);
+	bool Disarm(VoiceKitDeadline *deadline);
+	void Shutdown();
+
+private:
+	void ThreadRoutine();
+
+private:
+	typedef std::pair<std::chrono::steady_clock::time_point, VoiceKitDeadline*> Entry;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable fired_cond;
+	std::set<Entry> entries;
+	std::map<VoiceKitDeadline*, std::chrono::steady_clock::time_point> expiration_times;
+	VoiceKitDeadline *firing = nullptr;
+	std::thread thread;
+	bool stopping = false;
+};
+
+static VoiceKitDeadlineTimer deadline_timer;
+
+void VoiceKitDeadlineTimer::Arm(VoiceKitDeadline *deadline, int timeout_ms)
+{
+	std::chrono::steady_clock::time_point at = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping)
+		return;
+	if (!thread.joinable())
+		thread = std::thread(&VoiceKitDeadlineTimer::ThreadRoutine, this);
+	entries.insert(Entry(at, deadline));
+	expiration_times[deadline] = at;
+	cond.notify_one();
+}
+bool VoiceKitDeadlineTimer::Disarm(VoiceKitDeadline *deadline)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (firing == deadline)
+		fired_cond.wait(lock);
+	std::map<VoiceKitDeadline*, std::chrono::steady_clock::time_point>::iterator it = expiration_times.find(deadline);
+	if (it != expiration_times.end()) {
+		entries.erase(Entry(it->second, deadline));
+		expiration_times.erase(it);
+	}
+	return deadline->expired;
+}
+void VoiceKitDeadlineTimer::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		cond.notify_one();
+	}
+	if (thread.joinable())
+		thread.join();
+}
+void VoiceKitDeadlineTimer::ThreadRoutine()
+{
+	pthread_setname_np(pthread_self(), "voicekit-timer");
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		if (entries.empty()) {
+			cond.wait(lock);
+			continue;
+		}
+		Entry entry = *entries.begin();
+		if (entry.first > std::chrono::steady_clock::now()) {
+			cond.wait_until(lock, entry.first);
+			continue;
+		}
+		entries.erase(entries.begin());
+		expiration_times.erase(entry.second);
+		firing = entry.second;
+		firing->expired = true;
+		lock.unlock();
+		try {
+			firing->action();
+		} catch (...) {
+		}
+		lock.lock();
+		firing = nullptr;
+		fired_cond.notify_all();
+	}
+}
+
+VoiceKitDeadline::VoiceKitDeadline(int timeout_ms, std::function<void()> action)
+	: action(action), armed(timeout_ms > 0), expired(false)
+{
+	if (armed)
+		deadline_timer.Arm(this, timeout_ms);
+}
+VoiceKitDeadline::~VoiceKitDeadline()
+{
+	Disarm();
+}
+bool VoiceKitDeadline::Disarm()
+{
+	if (armed) {
+		deadline_timer.Disarm(this);
+		armed = false;
+	}
+	return expired;
+}
+bool VoiceKitDeadline::Expired()
+{
+	return expired;
+}
+
+
+extern "C" void voicekit_deadline_timer_shutdown(void)
+{
+	deadline_timer.Shutdown();
+}
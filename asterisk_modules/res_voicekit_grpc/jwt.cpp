@@ -18,6 +18,7 @@ extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
 
 #define _GNU_SOURCE 1
 #include "jwt.h"
+#include "voicekit_grpc.h"
 
 #include <string>
 #include <string.h>
@@ -206,3 +207,15 @@ std::string GenerateJWT(const std::string &api_key, const std::string &secret_ke
 
 	return jwt;
 }
+
+extern "C" void voicekit_sha256_hex(const void *data, size_t len, char hex[65])
+{
+	static const char hex_alpha[] = "0123456789abcdef";
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char *) data, len, digest);
+	for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+		hex[2*i] = hex_alpha[digest[i] >> 4];
+		hex[2*i + 1] = hex_alpha[digest[i] & 0xf];
+	}
+	hex[2*SHA256_DIGEST_LENGTH] = '\0';
+}
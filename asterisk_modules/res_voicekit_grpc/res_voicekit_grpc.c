@@ -0,0 +1,201 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief gRPC runtime shared by VoiceKit modules
+ *
+ *
+ * \ingroup resources
+ */
+
+/*** MODULEINFO
+	<support_level>extended</support_level>
+ ***/
+
+extern struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#include <asterisk.h>
+
+#include <asterisk/module.h>
+#include <asterisk/cli.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+
+#include "voicekit_grpc.h"
+#include "runtime.h"
+
+
+#define SHOW_SESSIONS_HEADER_FORMAT "%-4s %-40s %9s %10s %8s %12s %12s %7s  %s\n"
+#define SHOW_SESSIONS_FORMAT "%-4s %-40.40s %9.1f %10.1f %8.1f %12lld %12lld %7d  %s\n"
+#define SHOW_BREAKERS_HEADER_FORMAT "%-9s %8s %9s %10s %9s  %s\n"
+#define SHOW_BREAKERS_FORMAT "%-9s %8d %4d/%-4d %10lld %9.1f  %s\n"
+
+
+int voicekit_grpc_endpoint_is_valid(const char *endpoint, int allow_shm)
+{
+	if (!endpoint || !*endpoint)
+		return 0;
+	if (!strncmp(endpoint, "unix:", 5) || (allow_shm && !strncmp(endpoint, "shm:", 4))) {
+		const char *path = strchr(endpoint, ':') + 1;
+		if (!strncmp(path, "///", 3))
+			path += 2;
+		return *path && strlen(path) < sizeof(((struct sockaddr_un *) NULL)->sun_path);
+	}
+	const char *port = strrchr(endpoint, ':');
+	if (!port || port == endpoint || !port[1])
+		return 0;
+	char *eptr;
+	long value = strtol(port + 1, &eptr, 10);
+	return !*eptr && value > 0 && value <= 65535;
+}
+
+
+struct show_sessions_state {
+	int fd;
+	int count;
+};
+
+static void show_session(const struct voicekit_usage_report *report, void *arg)
+{
+	struct show_sessions_state *state = arg;
+	double cpu_ms = report->cpu_time*1000.0;
+	ast_cli(state->fd, SHOW_SESSIONS_FORMAT, report->kind, report->channel_name, report->duration, cpu_ms,
+		(report->duration > 0.0) ? cpu_ms/report->duration : 0.0,
+		report->queued_bytes, report->peak_queued_bytes, report->thread_count, report->endpoint);
+	++state->count;
+}
+
+static char *handle_cli_show_sessions(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit show sessions";
+		e->usage =
+			"Usage: voicekit show sessions\n"
+			"       Lists running STT and TTS sessions with CPU time used by their\n"
+			"       threads (total and per second of session) and bytes of audio\n"
+			"       held in their queues (current and peak).\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	struct show_sessions_state state = {
+		.fd = a->fd,
+		.count = 0,
+	};
+	ast_cli(a->fd, SHOW_SESSIONS_HEADER_FORMAT, "Kind", "Channel", "Duration", "CPU ms", "CPU ms/s", "Queued", "Peak queued", "Threads", "Endpoint");
+	voicekit_usage_foreach(show_session, &state);
+	ast_cli(a->fd, "%d active session%s\n", state.count, (state.count == 1) ? "" : "s");
+	return CLI_SUCCESS;
+}
+
+static void show_breaker(const struct voicekit_breaker_report *report, void *arg)
+{
+	struct show_sessions_state *state = arg;
+	ast_cli(state->fd, SHOW_BREAKERS_FORMAT, report->state, report->consecutive_failures,
+		report->window_failures, report->window_calls, report->rejected, report->open_remaining, report->endpoint);
+	++state->count;
+}
+
+static char *handle_cli_show_breakers(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit show breakers";
+		e->usage =
+			"Usage: voicekit show breakers\n"
+			"       Lists circuit breakers of STT and TTS endpoints with their state,\n"
+			"       consecutive and windowed setup failures, setups rejected while\n"
+			"       open and time left until probing.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	struct show_sessions_state state = {
+		.fd = a->fd,
+		.count = 0,
+	};
+	ast_cli(a->fd, SHOW_BREAKERS_HEADER_FORMAT, "State", "Failures", "Window", "Rejected", "Open left", "Endpoint");
+	voicekit_breaker_foreach(show_breaker, &state);
+	ast_cli(a->fd, "%d endpoint%s\n", state.count, (state.count == 1) ? "" : "s");
+	return CLI_SUCCESS;
+}
+
+static char *handle_cli_bench_jwt(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "voicekit bench jwt";
+		e->usage =
+			"Usage: voicekit bench jwt [MIN_MSEC]\n"
+			"       Runs micro-benchmark of JWT generation for at least MIN_MSEC\n"
+			"       (200 by default) and prints JSON line with time and\n"
+			"       allocations per call (null unless built with\n"
+			"       --enable-bench-alloc-count).\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3 && a->argc != 4)
+		return CLI_SHOWUSAGE;
+	int min_time_ms = (a->argc == 4) ? atoi(a->argv[3]) : VOICEKIT_BENCH_DFLT_MIN_TIME_MS;
+	if (min_time_ms <= 0)
+		return CLI_SHOWUSAGE;
+
+	voicekit_bench_jwt(a->fd, min_time_ms);
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_voicekit[] = {
+	AST_CLI_DEFINE(handle_cli_show_sessions, "List VoiceKit sessions with their resource usage"),
+	AST_CLI_DEFINE(handle_cli_show_breakers, "List VoiceKit endpoint circuit breakers"),
+	AST_CLI_DEFINE(handle_cli_bench_jwt, "Run VoiceKit JWT generation micro-benchmark"),
+};
+
+
+static int unload_module(void)
+{
+	ast_cli_unregister_multiple(cli_voicekit, ARRAY_LEN(cli_voicekit));
+	voicekit_grpc_runtime_shutdown();
+	return 0;
+}
+
+static int load_module(void)
+{
+	voicekit_grpc_runtime_init();
+	ast_cli_register_multiple(cli_voicekit, ARRAY_LEN(cli_voicekit));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+/* Symbols must be global: application modules resolve gRPC and protobuf against this module */
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_GLOBAL_SYMBOLS | AST_MODFLAG_LOAD_ORDER, "[" ASTERISK_MODULE_VERSION_STRING "] VoiceKit gRPC Runtime",
+		.support_level = AST_MODULE_SUPPORT_EXTENDED,
+		.load = load_module,
+		.unload = unload_module,
+		.load_pri = AST_MODPRI_APP_DEPEND,
+);
@@ -0,0 +1,149 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "voicekit_grpc.h"
+#include "runtime.h"
+#include "jwt.h"
+
+#include <map>
+#include <mutex>
+#include <time.h>
+#include <grpc/grpc.h>
+#include <grpcpp/create_channel.h>
+
+
+// 7 days
+#define EXPIRATION_PERIOD (7*86400)
+
+// Cached token is re-issued when less than this is left till its expiration
+#define REISSUE_PERIOD (EXPIRATION_PERIOD/2)
+
+// Tokens built from per-call access keys must not grow cache without limit
+#define MAX_CACHED_TOKENS 1024
+
+// Channel not handed out for this long is dropped unless still used by someone
+#define CHANNEL_MAX_IDLE_SEC 300
+
+
+struct CachedChannel
+{
+	std::shared_ptr<grpc::ChannelCredentials> credentials; // Re-created once CA file is changed
+	std::shared_ptr<grpc::Channel> channel;
+	time_t used_at;
+};
+
+struct CachedToken
+{
+	std::string authorization;
+	time_t expires_at;
+};
+
+static std::mutex channel_cache_mutex;
+static std::map<std::string, CachedChannel> channel_cache;
+
+static std::mutex token_cache_mutex;
+static std::map<std::string, CachedToken> token_cache;
+
+
+static time_t monotonic_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec;
+}
+static void purge_idle_channels(time_t now)
+{
+	std::map<std::string, CachedChannel>::iterator it = channel_cache.begin();
+	while (it != channel_cache.end()) {
+		if (it->second.channel.use_count() == 1 && now - it->second.used_at >= CHANNEL_MAX_IDLE_SEC)
+			it = channel_cache.erase(it);
+		else
+			++it;
+	}
+}
+
+
+std::shared_ptr<grpc::Channel> voicekit_grpc_get_channel(const std::string &endpoint, int ssl_grpc, const std::string &ca_file,
+							 int keepalive_time_ms)
+{
+	std::shared_ptr<grpc::ChannelCredentials> credentials = ssl_grpc ? voicekit_grpc_get_ssl_credentials(ca_file.c_str()) : nullptr;
+	std::string key = endpoint + '\0' + (ssl_grpc ? "1" : "0") + '\0' + ca_file + '\0' + std::to_string(keepalive_time_ms);
+	time_t now = monotonic_seconds();
+
+	std::lock_guard<std::mutex> lock(channel_cache_mutex);
+	purge_idle_channels(now);
+	std::map<std::string, CachedChannel>::iterator it = channel_cache.find(key);
+	if (it != channel_cache.end() && it->second.credentials == credentials) {
+		it->second.used_at = now;
+		return it->second.channel;
+	}
+
+	grpc::ChannelArguments arguments;
+	if (keepalive_time_ms > 0) {
+		arguments.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, keepalive_time_ms);
+		arguments.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+	}
+	CachedChannel &entry = channel_cache[key];
+	entry.credentials = credentials;
+	entry.channel = grpc::CreateCustomChannel(endpoint, (ssl_grpc ? credentials : grpc::InsecureChannelCredentials()), arguments);
+	entry.used_at = now;
+	return entry.channel;
+}
+
+std::string voicekit_grpc_authorization(const std::string &api_key, const std::string &secret_key,
+					const std::string &issuer, const std::string &subject, const std::string &audience)
+{
+	if (!api_key.size() || !secret_key.size() || !issuer.size() || !subject.size() || !audience.size())
+		return "";
+
+	std::string key = api_key + '\0' + secret_key + '\0' + issuer + '\0' + subject + '\0' + audience;
+	time_t now = time(NULL);
+
+	std::lock_guard<std::mutex> lock(token_cache_mutex);
+	std::map<std::string, CachedToken>::iterator it = token_cache.find(key);
+	if (it != token_cache.end() && it->second.expires_at - now > REISSUE_PERIOD)
+		return it->second.authorization;
+
+	if (it == token_cache.end() && token_cache.size() >= MAX_CACHED_TOKENS)
+		token_cache.clear();
+	CachedToken &entry = token_cache[key];
+	entry.expires_at = now + EXPIRATION_PERIOD;
+	entry.authorization = "Bearer " + GenerateJWT(api_key, secret_key, issuer, subject, audience, entry.expires_at);
+	return entry.authorization;
+}
+
+
+extern "C" void voicekit_grpc_runtime_init(void)
+{
+	grpc_init();
+}
+extern "C" void voicekit_grpc_runtime_shutdown(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(channel_cache_mutex);
+		channel_cache.clear();
+	}
+	{
+		std::lock_guard<std::mutex> lock(token_cache_mutex);
+		token_cache.clear();
+	}
+	voicekit_grpc_credentials_cache_clear();
+	voicekit_deadline_timer_shutdown();
+	grpc_shutdown();
+}
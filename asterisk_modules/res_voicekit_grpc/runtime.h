@@ -0,0 +1,38 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef VOICEKIT_GRPC_RUNTIME_H
+#define VOICEKIT_GRPC_RUNTIME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runtime lifetime, called from module load/unload only */
+extern void voicekit_grpc_runtime_init(void);
+extern void voicekit_grpc_runtime_shutdown(void);
+
+extern void voicekit_grpc_credentials_cache_clear(void);
+
+extern void voicekit_deadline_timer_shutdown(void);
+
+/* "voicekit bench jwt" */
+extern void voicekit_bench_jwt(int fd, int min_time_ms);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+extern "C" struct ast_module *AST_MODULE_SELF_SYM(void);
+#define AST_MODULE_SELF_SYM AST_MODULE_SELF_SYM
+
+#define typeof __typeof__
+#include "voicekit_grpc.h"
+
+#include <set>
+#include <string.h>
+
+
+// Linux limit for thread name excluding terminator
+#define MAX_THREAD_NAME_LEN 15
+
+
+static std::mutex registry_mutex;
+static std::set<VoiceKitUsage*> registry;
+
+
+static double clock_seconds(clockid_t clock)
+{
+	struct timespec t;
+	if (clock_gettime(clock, &t))
+		return 0.0;
+	return t.tv_sec + t.tv_nsec*0.000000001;
+}
+static void copy_string(char *target, size_t target_size, const std::string &source)
+{
+	size_t len = std::min(source.size(), target_size - 1);
+	memcpy(target, source.data(), len);
+	target[len] = '\0';
+}
+
+
+VoiceKitUsage::VoiceKitUsage(const char *kind, const std::string &channel_name, const std::string &endpoint)
+	: kind(kind), channel_name(channel_name), endpoint(endpoint), finished_cpu_time(0.0), queued_bytes(0), peak_queued_bytes(0)
+{
+	clock_gettime(CLOCK_MONOTONIC, &created_at);
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry.insert(this);
+}
+VoiceKitUsage::~VoiceKitUsage()
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry.erase(this);
+}
+void VoiceKitUsage::ThreadEnter(const char *thread_name)
+{
+	char name[MAX_THREAD_NAME_LEN + 1];
+	snprintf(name, sizeof(name), "%s", thread_name);
+	pthread_setname_np(pthread_self(), name);
+
+	Thread thread;
+	thread.thread = pthread_self();
+	if (pthread_getcpuclockid(thread.thread, &thread.clock))
+		thread.clock = CLOCK_THREAD_CPUTIME_ID;
+	thread.cpu_time_at_enter = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	threads.push_back(thread);
+}
+void VoiceKitUsage::ThreadLeave()
+{
+	double cpu_time = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+	pthread_t self = pthread_self();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::vector<Thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+		if (pthread_equal(it->thread, self)) {
+			finished_cpu_time += cpu_time - it->cpu_time_at_enter;
+			threads.erase(it);
+			break;
+		}
+	}
+}
+void VoiceKitUsage::QueueAdd(long long bytes)
+{
+	long long current = (queued_bytes += bytes);
+	long long peak = peak_queued_bytes.load();
+	while (current > peak && !peak_queued_bytes.compare_exchange_weak(peak, current));
+}
+void VoiceKitUsage::Report(struct voicekit_usage_report *report)
+{
+	copy_string(report->kind, sizeof(report->kind), kind);
+	copy_string(report->channel_name, sizeof(report->channel_name), channel_name);
+	copy_string(report->endpoint, sizeof(report->endpoint), endpoint);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	report->duration = (now.tv_sec - created_at.tv_sec) + (now.tv_nsec - created_at.tv_nsec)*0.000000001;
+	report->queued_bytes = queued_bytes;
+	report->peak_queued_bytes = peak_queued_bytes;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	// Clocks of running threads are valid since they leave under this lock before exiting
+	report->cpu_time = finished_cpu_time;
+	for (const Thread &thread: threads)
+		report->cpu_time += clock_seconds(thread.clock) - thread.cpu_time_at_enter;
+	report->thread_count = threads.size();
+}
+
+
+extern "C" void voicekit_usage_foreach(voicekit_usage_callback_t callback, void *arg)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (VoiceKitUsage *usage: registry) {
+		struct voicekit_usage_report report;
+		usage->Report(&report);
+		callback(&report, arg);
+	}
+}
@@ -0,0 +1,279 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+#ifndef VOICEKIT_GRPC_H
+#define VOICEKIT_GRPC_H
+
+/* Interface of res_voicekit_grpc runtime module.
+
+   Runtime module is the only one linking gRPC and protobuf libraries: it
+   initializes gRPC core once per Asterisk process and exports its symbols
+   globally, so application modules resolve gRPC, protobuf and functions below
+   against single copy instead of linking their own. Application modules declare
+   it in ".requires" of their module info.
+
+   google/api/{annotations,http}.proto descriptors are compiled into runtime
+   module as well, since every generated descriptor may be registered in shared
+   protobuf pool only once.
+
+   Runtime module also keeps registry of running STT and TTS sessions for
+   resource accounting: every session creates VoiceKitUsage object, each of its
+   dedicated threads is named and enters it for its lifetime (so its CPU clock
+   is sampled) and bytes of audio held in session queues are added and removed
+   as they flow. Threads of gRPC core pollers are shared by all sessions and are
+   not accounted. Registry is listed by "voicekit show sessions" CLI command.
+
+   Backends are guarded by per-endpoint circuit breakers shared by all modules:
+   session acquires breaker before setting its call up and releases it with
+   setup outcome. Breaker opens after consecutive setup failures or failure rate
+   within sliding time window (counted in ten slices of window), rejects setups
+   while open and lets limited number of probe setups through once open time
+   passes (half-open); successful probe closes it. Closed breakers unused for
+   longer than their window are dropped.
+   Setup and first-byte deadlines of calls are run by single shared timer thread.
+   Breakers are listed by "voicekit show breakers" CLI command.
+
+   Micro-benchmarks of code run per frame or per event are run in-process by
+   "voicekit bench" CLI commands (each module registers its own subcommand) and
+   print one JSON object per benchmark line. Allocations of benchmark thread are
+   counted only by development builds configured with --enable-bench-alloc-count
+   (null otherwise): wrappers of malloc(), calloc(), realloc() and operator new
+   are defined here and modules link with "--wrap" of these symbols, so calls
+   made from module code (including statically linked libraries) are counted
+   while calls made inside Asterisk core or system libraries are not. All three
+   modules must be configured alike. */
+
+#include <stddef.h>
+
+/* Default of "voicekit bench" commands */
+#define VOICEKIT_BENCH_DFLT_MIN_TIME_MS 200
+
+/* Snapshot of session resource usage */
+struct voicekit_usage_report {
+	char kind[8]; /* "STT" or "TTS" */
+	char channel_name[80];
+	char endpoint[256];
+	double duration; /* Seconds since session was created */
+	double cpu_time; /* CPU seconds used by session threads, both running and finished */
+	long long queued_bytes; /* Currently held in session queues */
+	long long peak_queued_bytes;
+	int thread_count; /* Currently running session threads */
+};
+
+typedef void (*voicekit_usage_callback_t)(const struct voicekit_usage_report *report, void *arg);
+
+/* Circuit breaker thresholds: passed by module on every call, so each module keeps its own configuration */
+struct voicekit_breaker_conf {
+	int failure_threshold; /* consecutive setup failures opening breaker; 0 to ignore */
+	double error_rate; /* fraction of failed setups within window opening breaker; 0 to ignore */
+	int min_calls; /* setups within window required to apply error_rate */
+	double window; /* seconds */
+	double open_time; /* seconds before probing */
+	int half_open_probes; /* concurrent probe setups while half-open */
+};
+
+enum voicekit_breaker_ticket {
+	VOICEKIT_BREAKER_REJECTED = -1,
+	VOICEKIT_BREAKER_ADMITTED = 0,
+	VOICEKIT_BREAKER_PROBE = 1,
+};
+
+enum voicekit_breaker_outcome {
+	VOICEKIT_BREAKER_SUCCESS = 0,
+	VOICEKIT_BREAKER_FAILURE = 1,
+	VOICEKIT_BREAKER_CANCELLED = 2, /* call was not set up for local reasons: outcome is not counted */
+};
+
+/* Snapshot of endpoint breaker state */
+struct voicekit_breaker_report {
+	char endpoint[256];
+	const char *state; /* "CLOSED", "OPEN" or "HALF_OPEN" */
+	int consecutive_failures;
+	int window_calls;
+	int window_failures;
+	long long rejected; /* setups rejected since breaker was created */
+	double open_remaining; /* seconds until probing while open */
+};
+
+typedef void (*voicekit_breaker_callback_t)(const struct voicekit_breaker_report *report, void *arg);
+
+extern const struct voicekit_breaker_conf voicekit_breaker_dflt_conf;
+
+#ifdef __cplusplus
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <grpcpp/channel.h>
+#include <grpcpp/security/credentials.h>
+
+/* Returns TLS credentials shared by all sessions using same CA file (NULL or
+   empty for built-in roots). CA file path is relative to configuration directory.
+   Throws std::runtime_error if CA file can't be loaded. */
+extern std::shared_ptr<grpc::ChannelCredentials> voicekit_grpc_get_ssl_credentials(const char *ca_file);
+
+/* Returns channel shared by all modules connecting to same endpoint with same
+   TLS and keepalive settings, so their calls are multiplexed over same HTTP/2
+   connection. keepalive_time_ms == 0 leaves gRPC keepalive defaults.
+   Throws std::runtime_error if CA file can't be loaded. */
+extern std::shared_ptr<grpc::Channel> voicekit_grpc_get_channel(const std::string &endpoint, int ssl_grpc, const std::string &ca_file,
+								int keepalive_time_ms);
+
+/* Returns "authorization" metadata value ("Bearer <JWT>") or empty string if
+   any of parameters is empty. Tokens are cached and re-issued once half of
+   their lifetime has passed. */
+extern std::string voicekit_grpc_authorization(const std::string &api_key, const std::string &secret_key,
+					       const std::string &issuer, const std::string &subject, const std::string &audience);
+
+/* Session resource accounting entry: registered while object exists */
+class VoiceKitUsage
+{
+public:
+	VoiceKitUsage(const char *kind, const std::string &channel_name, const std::string &endpoint);
+	~VoiceKitUsage();
+	// Names calling thread (up to 15 characters) and starts accounting its CPU time
+	void ThreadEnter(const char *thread_name);
+	// Adds CPU time of calling thread since ThreadEnter() to the session
+	void ThreadLeave();
+	// Bytes put into (positive) or taken from (negative) session queues
+	void QueueAdd(long long bytes);
+	void Report(struct voicekit_usage_report *report);
+
+private:
+	struct Thread
+	{
+		pthread_t thread;
+		clockid_t clock;
+		double cpu_time_at_enter;
+	};
+
+private:
+	std::string kind;
+	std::string channel_name;
+	std::string endpoint;
+	struct timespec created_at;
+	std::mutex mutex;
+	std::vector<Thread> threads;
+	double finished_cpu_time;
+	std::atomic<long long> queued_bytes;
+	std::atomic<long long> peak_queued_bytes;
+};
+
+/* Runs action from shared timer thread once timeout passes unless destroyed (or disarmed) earlier.
+   Action must not block: it is expected to cancel call (e.g. ClientContext::TryCancel()). */
+class VoiceKitDeadline
+{
+public:
+	VoiceKitDeadline(int timeout_ms, std::function<void()> action); // timeout_ms <= 0: never expires
+	~VoiceKitDeadline();
+	// Returns true if action was run; waits for running action to finish
+	bool Disarm();
+	bool Expired();
+
+private:
+	std::function<void()> action;
+	bool armed;
+	std::atomic<bool> expired;
+
+	friend class VoiceKitDeadlineTimer;
+};
+
+/* Breaker call released with given outcome (cancelled by default) at destruction */
+class VoiceKitBreakerCall
+{
+public:
+	VoiceKitBreakerCall(const std::string &endpoint, const struct voicekit_breaker_conf *conf); // NULL conf: breaker disabled
+	~VoiceKitBreakerCall();
+	bool Rejected() const { return ticket == VOICEKIT_BREAKER_REJECTED; }
+	void SetOutcome(enum voicekit_breaker_outcome outcome) { this->outcome = outcome; }
+	void Release(enum voicekit_breaker_outcome outcome); // at once, so that probe ticket is not held for rest of call
+
+private:
+	std::string endpoint;
+	struct voicekit_breaker_conf conf;
+	bool enabled;
+	int ticket;
+	enum voicekit_breaker_outcome outcome;
+};
+
+/* Keeps calling thread entered into session usage for the scope */
+class VoiceKitUsageThreadScope
+{
+public:
+	VoiceKitUsageThreadScope(const std::shared_ptr<VoiceKitUsage> &usage, const char *thread_name)
+		: usage(usage)
+		{
+			if (usage)
+				usage->ThreadEnter(thread_name);
+		}
+	~VoiceKitUsageThreadScope()
+		{
+			if (usage)
+				usage->ThreadLeave();
+		}
+
+private:
+	std::shared_ptr<VoiceKitUsage> usage;
+};
+
+extern "C" {
+#endif
+
+/* Calls callback for every registered session under registry lock */
+extern void voicekit_usage_foreach(voicekit_usage_callback_t callback, void *arg);
+
+/* Returns VOICEKIT_BREAKER_REJECTED while breaker of endpoint is open; otherwise
+   ticket which must be passed to voicekit_breaker_release() once setup outcome is known */
+extern int voicekit_breaker_acquire(const char *endpoint, const struct voicekit_breaker_conf *conf);
+extern void voicekit_breaker_release(const char *endpoint, const struct voicekit_breaker_conf *conf, int ticket,
+				     enum voicekit_breaker_outcome outcome);
+
+/* Calls callback for every endpoint breaker under registry lock */
+extern void voicekit_breaker_foreach(voicekit_breaker_callback_t callback, void *arg);
+
+/* Returns non-zero if endpoint is "host:port" (port 1..65535) or "unix:" socket path
+   fitting sockaddr_un; "shm:" (shared memory transport of STT mock) is accepted
+   alike "unix:" only if allow_shm is non-zero */
+extern int voicekit_grpc_endpoint_is_valid(const char *endpoint, int allow_shm);
+
+/* Loads CA file into cache unless already cached and unchanged on disk.
+   Returns 0 on success, -1 (with error logged) on failure. */
+extern int voicekit_grpc_credentials_check(const char *ca_file);
+
+/* Writes lowercase hex SHA-256 digest of data (64 characters and terminator) to hex */
+extern void voicekit_sha256_hex(const void *data, size_t len, char hex[65]);
+
+typedef void (*voicekit_bench_op_t)(void *arg);
+
+/* Calls op repeatedly for at least min_time_ms (op must leave its state ready for next call) and
+   prints time and allocations per call to CLI fd as JSON line */
+extern void voicekit_bench_run(int fd, const char *name, int min_time_ms, voicekit_bench_op_t op, void *arg);
+
+#ifdef __cplusplus
+};
+
+/* voicekit_bench_run() of callable object */
+template <typename Op>
+static inline void voicekit_bench_run(int fd, const char *name, int min_time_ms, Op op)
+{
+	voicekit_bench_run(fd, name, min_time_ms, [](void *arg) { (*(Op *) arg)(); }, &op);
+}
+#endif
+
+#endif
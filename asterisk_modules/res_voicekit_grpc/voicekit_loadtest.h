@@ -0,0 +1,217 @@
+/*
+ * Asterisk VoiceKit modules
+ *
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Helpers shared by load-test tools of application modules: fault injection
+ * of mock servers (stt_mock_server, tts_mock_server) and report of load
+ * generators (stt_load program, "voicekit load tts" CLI command).
+ *
+ * Header-only and intentionally free of Asterisk dependencies: standalone
+ * programs are not linked with res_voicekit_grpc.
+ */
+
+#ifndef VOICEKIT_LOADTEST_H
+#define VOICEKIT_LOADTEST_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+
+// Latency, jitter and error injection of mock server: deterministic for given seed and call order
+class VoiceKitMockFaults
+{
+public:
+	VoiceKitMockFaults()
+		: latency_ms(0), jitter_ms(0), setup_error_rate(0.0), stream_error_rate(0.0), random(1) {}
+
+	void Seed(unsigned int seed) { std::lock_guard<std::mutex> lock(mutex); random.seed(seed); }
+	// Sleeps for latency with uniform jitter (+/- jitter_ms)
+	void Delay(int latency_ms)
+	{
+		int delay_ms = latency_ms;
+		if (jitter_ms > 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			delay_ms += std::uniform_int_distribution<int>(-jitter_ms, jitter_ms)(random);
+		}
+		if (delay_ms > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+	}
+	void DelaySetup() { Delay(latency_ms); }
+	bool FailSetup() { return Draw(setup_error_rate); }
+	bool FailStream() { return Draw(stream_error_rate); }
+
+	// Parses common option: returns false if opt is not a fault option
+	bool ParseOption(int opt, const char *arg)
+	{
+		switch (opt) {
+		case 's':
+			latency_ms = atoi(arg);
+			return true;
+		case 'j':
+			jitter_ms = atoi(arg);
+			return true;
+		case 'e':
+			setup_error_rate = atof(arg);
+			return true;
+		case 'E':
+			stream_error_rate = atof(arg);
+			return true;
+		case 'S':
+			Seed(strtoul(arg, NULL, 10));
+			return true;
+		}
+		return false;
+	}
+	static const char *Options() { return "s:j:e:E:S:"; }
+	static const char *Usage() { return "[-s SETUP_MS] [-j JITTER_MS] [-e SETUP_ERROR_RATE] [-E STREAM_ERROR_RATE] [-S SEED]"; }
+
+private:
+	bool Draw(double rate)
+	{
+		if (rate <= 0.0)
+			return false;
+		std::lock_guard<std::mutex> lock(mutex);
+		return std::uniform_real_distribution<double>(0.0, 1.0)(random) < rate;
+	}
+
+public:
+	int latency_ms;
+	int jitter_ms;
+	double setup_error_rate;
+	double stream_error_rate;
+
+private:
+	std::mutex mutex;
+	std::mt19937 random;
+};
+
+
+// Session outcomes, latency percentiles and process resource usage of load generator
+class VoiceKitLoadReport
+{
+public:
+	VoiceKitLoadReport()
+		: sessions(0), failures(0), audio_seconds(0.0), peak_rss_kb(0), peak_threads(0)
+	{
+		baseline_threads = ProcessThreads();
+	}
+
+	void AddSession(bool success, double session_audio_seconds)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		sessions++;
+		if (!success)
+			failures++;
+		audio_seconds += session_audio_seconds;
+	}
+	void AddLatency(const std::string &name, double msec)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		latencies[name].push_back(msec);
+	}
+	void AddError(const std::string &message)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		errors[message]++;
+	}
+	// Called periodically while channels run
+	void SampleProcess()
+	{
+		long rss_kb = ProcessStatusValue("VmRSS:");
+		long threads = ProcessThreads();
+		std::lock_guard<std::mutex> lock(mutex);
+		peak_rss_kb = std::max(peak_rss_kb, rss_kb);
+		peak_threads = std::max(peak_threads, threads);
+	}
+	void Print(FILE *out, int channels, double wall_seconds)
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		double cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec/1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec/1e6;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		fprintf(out, "channels=%d\n", channels);
+		fprintf(out, "wall_sec=%.3f\n", wall_seconds);
+		fprintf(out, "sessions=%llu\n", (unsigned long long) sessions);
+		fprintf(out, "failures=%llu\n", (unsigned long long) failures);
+		fprintf(out, "sessions_per_sec=%.3f\n", wall_seconds > 0.0 ? sessions/wall_seconds : 0.0);
+		fprintf(out, "audio_sec_per_sec=%.3f\n", wall_seconds > 0.0 ? audio_seconds/wall_seconds : 0.0);
+		fprintf(out, "cpu_sec=%.3f\n", cpu_seconds);
+		fprintf(out, "cpu_ms_per_session=%.3f\n", sessions ? cpu_seconds*1000.0/sessions : 0.0);
+		fprintf(out, "cpu_ms_per_audio_sec=%.3f\n", audio_seconds > 0.0 ? cpu_seconds*1000.0/audio_seconds : 0.0);
+		fprintf(out, "peak_rss_kb=%ld\n", peak_rss_kb);
+		fprintf(out, "peak_threads=%ld\n", peak_threads);
+		fprintf(out, "threads_per_channel=%.2f\n", channels ? (double) (peak_threads - baseline_threads)/channels : 0.0);
+		for (auto &entry: latencies) {
+			std::vector<double> &values = entry.second;
+			std::sort(values.begin(), values.end());
+			fprintf(out, "%s_ms count=%zu p50=%.1f p90=%.1f p99=%.1f max=%.1f\n", entry.first.c_str(), values.size(),
+				Percentile(values, 0.50), Percentile(values, 0.90), Percentile(values, 0.99), values.size() ? values.back() : 0.0);
+		}
+		for (auto &entry: errors)
+			fprintf(out, "error count=%llu: %s\n", (unsigned long long) entry.second, entry.first.c_str());
+	}
+
+	static long ProcessThreads() { return ProcessStatusValue("Threads:"); }
+
+private:
+	static double Percentile(const std::vector<double> &sorted, double fraction)
+	{
+		if (sorted.empty())
+			return 0.0;
+		size_t index = std::min(sorted.size() - 1, (size_t) (fraction*sorted.size()));
+		return sorted[index];
+	}
+	static long ProcessStatusValue(const char *key)
+	{
+		FILE *file = fopen("/proc/self/status", "r");
+		if (!file)
+			return 0;
+		char line[256];
+		long value = 0;
+		size_t key_len = strlen(key);
+		while (fgets(line, sizeof(line), file)) {
+			if (!strncmp(line, key, key_len)) {
+				value = atol(line + key_len);
+				break;
+			}
+		}
+		fclose(file);
+		return value;
+	}
+
+private:
+	std::mutex mutex;
+	uint64_t sessions;
+	uint64_t failures;
+	double audio_seconds;
+	long baseline_threads;
+	long peak_rss_kb;
+	long peak_threads;
+	std::map<std::string, std::vector<double>> latencies;
+	std::map<std::string, uint64_t> errors;
+};
+
+#endif